@@ -0,0 +1,145 @@
+//
+// AnalogSampler
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "AnalogSampler.h"
+
+
+#include "EventQueue.h"
+#include "PowerManager.h"
+
+#include <avr/interrupt.h>
+
+
+namespace lr {
+
+
+/// The global instance of the analog sampler.
+///
+AnalogSampler analogSampler;
+
+
+AnalogSampler::AnalogSampler()
+	: _conversionHandler(0), _channelCount(0), _channelIndex(0)
+{
+	for (uint8_t i = 0; i < channelCount; ++i) {
+		_channels[i] = 0;
+		_average[i] = 0;
+		_zeroCount[i] = 0;
+	}
+}
+
+
+void AnalogSampler::begin(uint8_t channelMask)
+{
+	end();
+	// Disable the digital inputs of the pins, to save power.
+	DIDR0 |= channelMask;
+	_channelCount = 0;
+	for (uint8_t channel = 0; channel < channelCount; ++channel) {
+		if ((channelMask & _BV(channel)) == 0) {
+			continue;
+		}
+		_channels[_channelCount++] = channel;
+		// Do one synchronous conversion with the pre-scaler 128.
+		// AVcc reference, right adjusted 10 bit result.
+		ADMUX = _BV(REFS0)|channel;
+		ADCSRA = _BV(ADEN)|_BV(ADSC)|_BV(ADIF)|_BV(ADPS2)|_BV(ADPS1)|_BV(ADPS0);
+		while ((ADCSRA & _BV(ADSC)) != 0) {
+		}
+		_average[channel] = ADC << averageShift;
+		_zeroCount[channel] = 0;
+	}
+	if (_channelCount == 0) {
+		return;
+	}
+	uint8_t oldSREG = SREG;
+	cli();
+	_channelIndex = 0;
+	selectChannel();
+	// Start the conversions with the overflow of timer 0, and read them in the interrupt.
+	ADCSRB = _BV(ADTS2);
+	ADCSRA = _BV(ADEN)|_BV(ADATE)|_BV(ADIE)|_BV(ADIF)|_BV(ADPS2)|_BV(ADPS1)|_BV(ADPS0);
+	SREG = oldSREG;
+}
+
+
+void AnalogSampler::end()
+{
+	ADCSRA &= ~(_BV(ADIE)|_BV(ADATE));
+	_channelCount = 0;
+}
+
+
+uint16_t AnalogSampler::value(uint8_t channel) const
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	const uint16_t average = _average[channel];
+	SREG = oldSREG;
+	return average >> averageShift;
+}
+
+
+void AnalogSampler::setConversionHandler(ConversionHandler handler)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	_conversionHandler = handler;
+	if (handler == 0 && _channelCount > 0) {
+		startConversion();
+	}
+	SREG = oldSREG;
+}
+
+
+void AnalogSampler::addConversion()
+{
+	const uint16_t sample = ADC;
+	const uint8_t channel = _channels[_channelIndex];
+	const uint16_t average = _average[channel];
+	_average[channel] = average - (average >> averageShift) + sample;
+	// Report an input which stays at 0, this is called with disabled interrupts.
+	if (sample == 0) {
+		if (_zeroCount[channel] < faultSampleCount && ++_zeroCount[channel] == faultSampleCount) {
+			eventQueue.push(EventQueue::InputFault, channel, 1, millis());
+		}
+	} else if (_zeroCount[channel] != 0) {
+		if (_zeroCount[channel] == faultSampleCount) {
+			eventQueue.push(EventQueue::InputFault, channel, 0, millis());
+		}
+		_zeroCount[channel] = 0;
+	}
+	if (++_channelIndex >= _channelCount) {
+		_channelIndex = 0;
+	}
+	selectChannel();
+}
+
+
+void AnalogSampler::selectChannel()
+{
+	ADMUX = _BV(REFS0)|_channels[_channelIndex];
+}
+
+
+void AnalogSampler::startConversion()
+{
+	selectChannel();
+	ADCSRA |= _BV(ADSC);
+}
+
+
+}
+
+
+/// The interrupt at the end of each conversion.
+///
+ISR(ADC_vect)
+{
+	lr::powerManager.onInterrupt();
+	lr::analogSampler.onConversion();
+}
+
+
@@ -0,0 +1,142 @@
+#pragma once
+//
+// AnalogSampler
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// Samples analog inputs in the background.
+///
+/// The conversions are started by the overflow of timer 0, which already
+/// wakes the MCU for millis() about 976 times per second. The ADC interrupt
+/// reads each conversion and selects the next input for the next overflow,
+/// so the inputs are sampled in turns without blocking, and the sampling
+/// does not wake the MCU more often than the timer. The samples are shared
+/// by all inputs. Each input is filtered with a running average over about
+/// eight samples, so reading the value never blocks.
+///
+/// An input which reads 0 for faultSampleCount samples in a row, e.g. a
+/// sensor without supply, is reported with an InputFault event from the
+/// interrupt. A second event is pushed as soon as it reads a value again.
+///
+/// While interrupts are disabled, e.g. in AudioPlayer::play(), the overflow
+/// flag of timer 0 is not cleared and triggers no conversions. Call poll()
+/// to keep the sampling running, it starts each conversion directly.
+///
+/// The sampler owns the ADC interrupt. Another class can take over the ADC
+/// for a while with setConversionHandler(), it has to restore the ADC
+/// registers afterwards.
+///
+class AnalogSampler
+{
+public:
+	/// A handler which is called from the ADC interrupt instead of the sampler.
+	///
+	typedef void (*ConversionHandler)();
+
+	/// The number of analog inputs.
+	///
+	static const uint8_t channelCount = 8;
+
+	/// The weight of the running average is 1/2^averageShift.
+	///
+	static const uint8_t averageShift = 3;
+
+	/// The number of samples in a row at 0, after which an input is reported as fault.
+	///
+	static const uint8_t faultSampleCount = 64;
+
+public:
+	/// ctor
+	///
+	AnalogSampler();
+
+public:
+	/// Start the sampling of the given analog inputs.
+	///
+	/// The first conversion of each input is done synchronous, to start
+	/// the average with a valid value.
+	///
+	/// @param channelMask A bit mask with the analog inputs to sample, bit 0 is input 0.
+	///
+	void begin(uint8_t channelMask);
+
+	/// Stop the sampling.
+	///
+	void end();
+
+	/// Get the average of the last samples of an input.
+	///
+	/// @param channel The analog input, from 0 to 7.
+	/// @return The 10 bit value of the ADC.
+	///
+	uint16_t value(uint8_t channel) const;
+
+	/// Process a finished conversion, while interrupts are disabled.
+	///
+	inline void poll() {
+		if ((ADCSRA & _BV(ADIF)) != 0) {
+			ADCSRA |= _BV(ADIF); // Reset the interrupt flag.
+			addConversion();
+			ADCSRA |= _BV(ADSC);
+		}
+	}
+
+	/// Set a handler which processes the conversions instead of the sampler.
+	///
+	/// If the handler is removed, the sampler starts the next conversion.
+	///
+	/// @param handler The handler, or 0 to process the conversions in the sampler again.
+	///
+	void setConversionHandler(ConversionHandler handler);
+
+	/// Process the last conversion.
+	///
+	/// This is called from the ADC interrupt.
+	///
+	inline void onConversion() {
+		if (_conversionHandler != 0) {
+			_conversionHandler();
+		} else {
+			addConversion();
+		}
+	}
+
+private:
+	/// Add the last conversion to the average and select the next input.
+	///
+	void addConversion();
+
+	/// Select the current input for the next conversion.
+	///
+	void selectChannel();
+
+	/// Start the conversion of the current input.
+	///
+	void startConversion();
+
+private:
+	volatile ConversionHandler _conversionHandler; ///< The handler which replaces the sampler, or 0.
+	uint8_t _channels[channelCount]; ///< The sampled inputs.
+	uint8_t _channelCount; ///< The number of sampled inputs.
+	uint8_t _channelIndex; ///< The index of the input in conversion.
+	volatile uint16_t _average[channelCount]; ///< The averages, multiplied by 2^averageShift.
+	uint8_t _zeroCount[channelCount]; ///< The samples in a row at 0, up to faultSampleCount.
+};
+
+
+/// The global instance of the analog sampler.
+///
+extern AnalogSampler analogSampler;
+
+
+}
+
+
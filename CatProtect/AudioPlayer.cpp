@@ -7,8 +7,11 @@
 #include "AudioPlayer.h"
 
 
+#include "AnalogSampler.h"
 #include "SDCard.h"
 #include "DacPort.h"
+#include "LEDController.h"
+#include "SPIBus.h"
 
 
 namespace lr {
@@ -19,8 +22,39 @@ namespace lr {
 AudioPlayer audioPlayer;
 
 
+/// Scale a 12 bit DAC value around the center of the output.
+///
+/// @param value The DAC value.
+/// @param gain The gain in 1/16 steps.
+/// @return The scaled value, limited to the range of the DAC.
+///
+static inline uint16_t applyGain(uint16_t value, uint8_t gain)
+{
+	const int32_t scaled = 0x800 + ((static_cast<int32_t>(value) - 0x800) * gain >> 4);
+	if (scaled < 0) {
+		return 0;
+	} else if (scaled > 0x0fff) {
+		return 0x0fff;
+	}
+	return static_cast<uint16_t>(scaled);
+}
+
+
+AudioPlayer::AudioPlayer()
+	: _preparedBlock(0), _isPrepared(false), _usedPrepareCount(0), _cancelledPrepareCount(0),
+	_prepareTime(0), _wastedPrepareTime(0)
+{
+	_startLatency[0] = 0;
+	_startLatency[1] = 0;
+	resetProfile();
+}
+
+
 bool AudioPlayer::initialize()
 {
+	// A prepared read has to be stopped before the card is accessed.
+	cancel();
+
 	// Initialize the DAC
 	dacPort.initialize();
 	
@@ -38,50 +72,70 @@ bool AudioPlayer::initialize()
 	}
 
 #ifdef AUDIOPLAYER_DEBUG
-	Serial.println(String(F("SD Card Init Success.")));
+	Serial.println(String(F("SD Card Init Success, clock="))+String(sdCard.clockSpeed())+
+		String(F(" high speed="))+String(sdCard.isHighSpeed()));
 	Serial.flush();
 #endif
 
-	// Maximum speed
-	SPI.beginTransaction(SPISettings(32000000, MSBFIRST, SPI_MODE0));
-
-	// Read the directory.
-	status = sdCard.readDirectory();
-	if (status != SDCard::StatusReady) {
-#ifdef AUDIOPLAYER_DEBUG
-		Serial.println(String(F("SD Card read directory failure, error="))+String(sdCard.error()));
-		Serial.flush();
-#endif
-		return false;
-	}
-
-	SPI.endTransaction();
-
+	// The directory is read on the first access.
 	return true;
 }
 
 
 bool AudioPlayer::play(const char *fileName)
 {
+	// The lookup reads the hash index from the card for version 2 images,
+	// so a prepared read has to be stopped first.
+	cancel();
 	const SDCard::DirectoryEntry *entry = sdCard.findFile(fileName);
-	if (entry != 0) {
-		return play(entry->startBlock, entry->fileSize/2);
+	if (entry != 0 && entry->format == SDCard::FormatUnsigned16 && entry->sampleRate > 0) {
+		if (entry->extentCount > 0) {
+			return play(entry->extents, entry->extentCount, entry->fileSize/2, entry->sampleRate, entry->gain);
+		}
+		return play(entry->startBlock, entry->fileSize/2, entry->sampleRate, entry->gain);
 	} else {
 		return false;
 	}
 }
 
 
-bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
+bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount, uint16_t sampleRate, uint8_t gain)
+{
+	// A contiguous file is a single extent.
+	SDCard::Extent extent;
+	extent.startBlock = startBlock;
+	extent.blockCount = (sampleCount * 2 + 511) / 512;
+	return play(&extent, 1, sampleCount, sampleRate, gain);
+}
+
+
+bool AudioPlayer::play(const SDCard::Extent *extents, uint16_t extentCount, uint32_t sampleCount, uint16_t sampleRate,
+	uint8_t gain)
 {
 	SDCard::Status status;
 
-	// Maximum speed
-	SPI.beginTransaction(SPISettings(32000000, MSBFIRST, SPI_MODE0));
-	
-	// Wait until we can start a read.
-	while((status = sdCard.startMultiRead(startBlock)) == SDCard::StatusWait) {
-		delayMicroseconds(1);
+	// The timer can not produce other rates, and the loop is too slow for higher ones.
+	if (sampleRate < minimumSampleRate || sampleRate > maximumSampleRate) {
+		return false;
+	}
+
+	// Keep the SPI bus for the SD-Card while playing, the DAC shares its session.
+	SPISession session(SPIBus::SDCardDevice);
+
+	// Measure the time until the first samples are read, with and without a prepared read.
+	const unsigned long startTime = micros();
+	const bool isPreparedPlay = _isPrepared && extentCount == 1 && extents->startBlock == _preparedBlock;
+	if (isPreparedPlay) {
+		// The read was started in prepare().
+		_isPrepared = false;
+		++_usedPrepareCount;
+		status = SDCard::StatusReady;
+	} else {
+		cancel();
+		// Wait until we can start a read.
+		while((status = sdCard.startMultiRead(extents, extentCount)) == SDCard::StatusWait) {
+			delayMicroseconds(1);
+		}
 	}
 	
 	// Check for any errors.
@@ -90,7 +144,6 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 		Serial.println(String(F("Start Read Failure, error="))+String(sdCard.error()));
 		Serial.flush();
 #endif
-		SPI.endTransaction();
 		return false;
 	}
 
@@ -107,22 +160,29 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 		if (status == SDCard::StatusReady) {
 			sampleIndex += 2;
 		} else if (status == SDCard::StatusError) {
-			SPI.endTransaction();
+#ifdef AUDIOPLAYER_DEBUG
+			Serial.println(String(F("Read Failure, error="))+String(sdCard.error()));
+			Serial.flush();
+#endif
+			sdCard.stopRead();
 			return false;
 		}
 	}
+	_startLatency[isPreparedPlay ? 1 : 0] = micros() - startTime;
+
+	// Disable all interrupts while playing, to keep the exact timing of the samples.
+	// The analog sampler and the LED controller are polled in the loop instead.
+	const uint8_t oldSREG = SREG;
+	cli();
 
 	// Initialize the Timer
-	uint8_t oldSREG = SREG;				
-  	cli();
 	TCCR1A = 0;
 	// no pre-scaling, use ICR1 as TOP
 	TCCR1B = _BV(CS10)|_BV(WGM13);
 	// Set the TOP value.
-	uint16_t timerTop = (F_CPU / 2 / 22050); // number of clocks for 22.5 kHz
+	uint16_t timerTop = (F_CPU / 2 / sampleRate); // number of clocks for the sample rate
 	ICR1 = timerTop;
 	TIMSK1 = 0; // no interrupts from timer
-	SREG = oldSREG;
 
 	// Variables to play the sound.
 	uint32_t currentSample = 0; // The absolute sample position
@@ -132,10 +192,17 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 	uint16_t bufferedSamples = 0x100;
 	// The DAC value, used for fade out.
 	uint16_t dacValue;
+#ifdef AUDIOPLAYER_PROFILE
+	// The timer counts up to the top and down again for each sample.
+	const uint16_t budgetCycles = timerTop * 2;
+	uint16_t worstCycles = 0;
+	uint32_t cycleSum = 0;
+	uint32_t overruns = 0;
+#endif
 		
 	// Fade in
 	for (uint16_t v = 0; v < 0x0800; v += 0x10) {
-		dacPort.setValue(v);
+		dacPort.setValueShared(v);
 		dacPort.pushValue();
 		delayMicroseconds(100);
 	}
@@ -150,12 +217,18 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 		}
 		dacPort.pushValue(); // Set the DAC output.
 		TIFR1 |= _BV(TOV1); // reset the timer flag.
+#ifdef AUDIOPLAYER_PROFILE
+		TIFR1 |= _BV(ICF1); // reset the flag for the top of the counter.
+#endif
 
 		// 2. Read the next sample and write it to the DAC.
 		if (bufferedSamples > 0) { // Check if we have buffered samples.
 			const uint16_t sample = sampleBuffer[(currentSample & sampleBufferMask)];
 			dacValue = (sample >> 4);
-			dacPort.setValue(dacValue);
+			if (gain != unityGain) {
+				dacValue = applyGain(dacValue, gain);
+			}
+			dacPort.setValueShared(dacValue);
 			// Move the current sample pointer.
 			--bufferedSamples;
 			// 3. Increase the sample counter and check for the end.
@@ -179,17 +252,51 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 				bufferedSamples += 2; // (4 bytes)
 			}
 		}
+
+		// 5. Keep sampling the analog input and the LED pattern, the interrupts are disabled.
+		analogSampler.poll();
+		ledController.poll();
+
+#ifdef AUDIOPLAYER_PROFILE
+		// 6. Measure the cycles since the timer overflow.
+		// Read the counter first, the flags tell the direction of the counter.
+		const uint16_t counter = TCNT1;
+		const uint8_t flags = TIFR1;
+		uint16_t cycles;
+		if ((flags & _BV(TOV1)) != 0) {
+			cycles = budgetCycles; // The next sample is already late.
+			++overruns;
+		} else if ((flags & _BV(ICF1)) != 0) {
+			cycles = budgetCycles - counter; // Counting down after the top.
+		} else {
+			cycles = counter;
+		}
+		if (cycles > worstCycles) {
+			worstCycles = cycles;
+		}
+		cycleSum += cycles;
+#endif
 	}
 
+#ifdef AUDIOPLAYER_PROFILE
+	if (worstCycles > _worstSampleCycles) {
+		_worstSampleCycles = worstCycles;
+	}
+	_averageSampleCycles = cycleSum / currentSample;
+	_sampleBudgetCycles = budgetCycles;
+	_overrunCount += overruns;
+#endif
+
 	// Fade out
 	for (uint16_t v = 0x800; v > 0; v -= 0x10) {
-		dacPort.setValue(v);
+		dacPort.setValueShared(v);
 		dacPort.pushValue();
 		delayMicroseconds(100);
 	}
 	
 	// Stop the timer.
 	TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12));          
+	SREG = oldSREG;
 
 	// Stop reading from the SD Card.
 	sdCard.stopRead();
@@ -197,24 +304,151 @@ bool AudioPlayer::play(uint32_t startBlock, uint32_t sampleCount)
 	// Shutdown the output
 	dacPort.shutdown();
 
-	// End SPI transaction.
-	SPI.endTransaction();
-
 	return true; // success
 
 readError:
 	// Stop the timer.
 	TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12));          
+	SREG = oldSREG;
+
+	// Stop reading from the SD Card, the card is still in multi block read mode.
+	sdCard.stopRead();
 
 	// Shutdown the output
 	dacPort.shutdown();
 
-	// End SPI transaction.
-	SPI.endTransaction();
+#ifdef AUDIOPLAYER_DEBUG
+	Serial.println(String(F("Read Failure, error="))+String(sdCard.error())+
+		String(F(" crc errors="))+String(sdCard.crcErrorCount()));
+	Serial.flush();
+#endif
 
 	return false; // error
 }
 
 
+bool AudioPlayer::prepare(uint32_t startBlock)
+{
+	if (_isPrepared) {
+		if (_preparedBlock == startBlock) {
+			return true;
+		}
+		cancel();
+	}
+	SPISession session(SPIBus::SDCardDevice);
+	_preparedBlock = startBlock;
+	const unsigned long startTime = micros();
+	SDCard::Status status;
+	while((status = sdCard.startMultiRead(startBlock)) == SDCard::StatusWait) {
+		delayMicroseconds(1);
+	}
+	_prepareTime = micros() - startTime;
+	_isPrepared = (status == SDCard::StatusReady);
+	return _isPrepared;
+}
+
+
+void AudioPlayer::cancel()
+{
+	if (_isPrepared) {
+		_isPrepared = false;
+		++_cancelledPrepareCount;
+		const unsigned long startTime = micros();
+		sdCard.stopRead();
+		// The time to start and to stop the read was wasted.
+		_wastedPrepareTime += _prepareTime + (micros() - startTime);
+	}
+}
+
+
+uint32_t AudioPlayer::startLatency(bool isPrepared) const
+{
+	return _startLatency[isPrepared ? 1 : 0];
+}
+
+
+uint16_t AudioPlayer::worstSampleCycles() const
+{
+#ifdef AUDIOPLAYER_PROFILE
+	return _worstSampleCycles;
+#else
+	return 0;
+#endif
+}
+
+
+uint16_t AudioPlayer::averageSampleCycles() const
+{
+#ifdef AUDIOPLAYER_PROFILE
+	return _averageSampleCycles;
+#else
+	return 0;
+#endif
+}
+
+
+uint16_t AudioPlayer::sampleBudgetCycles() const
+{
+#ifdef AUDIOPLAYER_PROFILE
+	return _sampleBudgetCycles;
+#else
+	return 0;
+#endif
+}
+
+
+uint32_t AudioPlayer::overrunCount() const
+{
+#ifdef AUDIOPLAYER_PROFILE
+	return _overrunCount;
+#else
+	return 0;
+#endif
+}
+
+
+void AudioPlayer::resetProfile()
+{
+#ifdef AUDIOPLAYER_PROFILE
+	_worstSampleCycles = 0;
+	_averageSampleCycles = 0;
+	_sampleBudgetCycles = 0;
+	_overrunCount = 0;
+#endif
+}
+
+
+void AudioPlayer::printProfile(Print &output)
+{
+	output.print(F("prepared playbacks: used="));
+	output.print(_usedPrepareCount);
+	output.print(F(" cancelled="));
+	output.print(_cancelledPrepareCount);
+	output.print(F(" wasted="));
+	output.print(_wastedPrepareTime);
+	output.println(F("us"));
+	output.print(F("start latency: prepared="));
+	output.print(_startLatency[1]);
+	output.print(F("us not prepared="));
+	output.print(_startLatency[0]);
+	output.println(F("us"));
+#ifdef AUDIOPLAYER_PROFILE
+	output.print(F("cycles per sample: worst="));
+	output.print(_worstSampleCycles);
+	output.print(F(" average="));
+	output.print(_averageSampleCycles);
+	output.print(F(" budget="));
+	output.print(_sampleBudgetCycles);
+	output.print(F(" overruns="));
+	output.println(_overrunCount);
+	if (_overrunCount > 0 || _worstSampleCycles > _sampleBudgetCycles) {
+		output.println(F("Over budget!"));
+	}
+#else
+	output.println(F("No profile."));
+#endif
+}
+
+
 
 }
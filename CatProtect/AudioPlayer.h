@@ -6,11 +6,21 @@
 //
 
 
+#include "SDCard.h"
+
+#include <Arduino.h>
 #include <stdint.h>
 
 
 //#define AUDIOPLAYER_DEBUG
 
+/// Measure the CPU cycles of each sample in the play loop.
+/// The cycles from the timer overflow until the sample is processed are read
+/// from timer 1 and compared with the sample period. This adds about 20 cycles
+/// to each sample and needs 10 bytes of RAM.
+///
+//#define AUDIOPLAYER_PROFILE
+
 
 namespace lr {
 
@@ -23,6 +33,27 @@ namespace lr {
 ///
 class AudioPlayer
 {
+public:
+	/// The lowest sample rate.
+	///
+	/// Timer 1 counts up and down for each sample, so one sample period of
+	/// F_CPU/sampleRate cycles has to fit into 16 bits.
+	///
+	static const uint16_t minimumSampleRate = F_CPU / 0xffffUL + 1;
+
+	/// The highest sample rate, limited by the cycles of the play loop.
+	///
+	static const uint16_t maximumSampleRate = 22050;
+
+	/// The gain for an unchanged output, in 1/16 steps.
+	///
+	static const uint8_t unityGain = 16;
+
+public:
+	/// ctor
+	///
+	AudioPlayer();
+
 public:
 	/// Initialize the Audio Player
 	///
@@ -30,11 +61,122 @@ public:
 
 	/// Play samples from the given start block.
 	///
-	bool play(uint32_t startBlock, uint32_t sampleCount);
+	/// @param startBlock The first block of the samples.
+	/// @param sampleCount The number of samples to play.
+	/// @param sampleRate The sample rate in Hz, from minimumSampleRate to maximumSampleRate.
+	/// @param gain The gain in 1/16 steps, applied around the center of the output.
+	/// @return true on success, false on any error or an unsupported sample rate.
+	///
+	bool play(uint32_t startBlock, uint32_t sampleCount, uint16_t sampleRate = 22050, uint8_t gain = unityGain);
+
+	/// Play samples from a list of extents.
+	///
+	/// The read command is only sent again at the end of each extent,
+	/// without interrupting the playback.
+	///
+	/// @param extents The extents with the samples.
+	/// @param extentCount The number of extents, at least 1.
+	/// @param sampleCount The number of samples to play.
+	/// @param sampleRate The sample rate in Hz, from minimumSampleRate to maximumSampleRate.
+	/// @param gain The gain in 1/16 steps, applied around the center of the output.
+	///
+	bool play(const SDCard::Extent *extents, uint16_t extentCount, uint32_t sampleCount, uint16_t sampleRate = 22050,
+		uint8_t gain = unityGain);
 	
-	/// Play a sample with a given name.
+	/// Play a sample with a given name, with the sample rate and gain of its directory entry.
 	///
 	bool play(const char *fileName);
+
+	/// Prepare the playback of samples from the given start block.
+	///
+	/// This starts the read on the card, so the card can fetch the first
+	/// block while the application waits for the alarm. A following
+	/// play() of a single extent with the same start block continues with
+	/// this read. initialize() and the other calls of play() cancel the
+	/// prepared read first, any other access to the card has to call
+	/// cancel() first.
+	///
+	/// @param startBlock The first block of the samples.
+	/// @return true on success.
+	///
+	bool prepare(uint32_t startBlock);
+
+	/// Cancel a prepared playback.
+	///
+	void cancel();
+
+	/// Check if a playback is prepared.
+	///
+	inline bool isPrepared() const { return _isPrepared; }
+
+	/// Get the number of prepared playbacks which were played.
+	///
+	inline uint16_t usedPrepareCount() const { return _usedPrepareCount; }
+
+	/// Get the number of prepared playbacks which were cancelled.
+	///
+	inline uint16_t cancelledPrepareCount() const { return _cancelledPrepareCount; }
+
+	/// Get the time in us spent to start and stop the cancelled prepared reads.
+	///
+	inline uint32_t wastedPrepareTime() const { return _wastedPrepareTime; }
+
+	/// Get the time in us from the start of the last playback until its first samples were read.
+	///
+	/// @param isPrepared True for the last prepared playback, false for the last other one.
+	///
+	uint32_t startLatency(bool isPrepared) const;
+
+	/// Get the most cycles used for a sample since the last reset.
+	///
+	/// This is always 0 if AUDIOPLAYER_PROFILE is not defined.
+	///
+	uint16_t worstSampleCycles() const;
+
+	/// Get the average cycles used for a sample in the last play.
+	///
+	/// This is always 0 if AUDIOPLAYER_PROFILE is not defined.
+	///
+	uint16_t averageSampleCycles() const;
+
+	/// Get the number of cycles available for each sample in the last play.
+	///
+	/// This is always 0 if AUDIOPLAYER_PROFILE is not defined.
+	///
+	uint16_t sampleBudgetCycles() const;
+
+	/// Get the number of samples which missed the timer since the last reset.
+	///
+	/// This is always 0 if AUDIOPLAYER_PROFILE is not defined.
+	///
+	uint32_t overrunCount() const;
+
+	/// Reset the measured cycles.
+	///
+	void resetProfile();
+
+	/// Print the measured cycles and the budget.
+	///
+	/// Also prints how many prepared playbacks were used and cancelled, the
+	/// wasted time of the cancelled ones, and the start latencies.
+	///
+	void printProfile(Print &output);
+
+private:
+	uint32_t _preparedBlock; ///< The start block of the prepared playback.
+	bool _isPrepared; ///< If a playback is prepared.
+	uint16_t _usedPrepareCount; ///< The number of prepared playbacks which were played.
+	uint16_t _cancelledPrepareCount; ///< The number of prepared playbacks which were cancelled.
+	uint32_t _prepareTime; ///< The time in us to start the prepared read.
+	uint32_t _wastedPrepareTime; ///< The time in us to start and stop the cancelled prepared reads.
+	uint32_t _startLatency[2]; ///< The start latency in us of the last playback, not prepared and prepared.
+
+#ifdef AUDIOPLAYER_PROFILE
+	uint16_t _worstSampleCycles; ///< The most cycles used for one sample.
+	uint16_t _averageSampleCycles; ///< The average cycles of the last play.
+	uint16_t _sampleBudgetCycles; ///< The cycles between two samples of the last play.
+	uint32_t _overrunCount; ///< The number of samples which missed the timer.
+#endif
 };
 
 /// The global instance of the audio player.
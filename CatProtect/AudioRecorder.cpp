@@ -0,0 +1,253 @@
+//
+// AudioRecorder
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "AudioRecorder.h"
+
+
+#include "AnalogSampler.h"
+#include "SDCard.h"
+#include "SPIBus.h"
+
+#include <Arduino.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+
+namespace lr {
+
+
+/// The global instance of the audio recorder.
+///
+AudioRecorder audioRecorder;
+
+
+/// The size of a block.
+///
+static const uint16_t blockSize = 512;
+
+/// The size of the sample buffer.
+///
+static const uint16_t bufferSize = AudioRecorder::bufferSize;
+
+/// The size of a chunk.
+///
+static const uint8_t chunkSize = AudioRecorder::chunkSize;
+
+/// The number of chunks in the buffer.
+///
+static const uint8_t bufferChunkCount = bufferSize / chunkSize;
+
+/// The number of chunks in a block.
+///
+static const uint8_t blockChunkCount = blockSize / chunkSize;
+
+/// The timeout for a busy card in ms.
+///
+static const uint16_t busyTimeout = 600;
+
+/// The magic of the capture header.
+///
+static const char captureMagic[4] = {'L', 'R', 'C', 'P'};
+
+/// The sample buffer, on the stack of record().
+///
+static uint8_t *recordBuffer = 0;
+
+/// The write position of the interrupt in the buffer.
+///
+static uint16_t recordPosition = 0;
+
+/// The number of full chunks in the buffer.
+///
+static volatile uint8_t recordFilledChunks = 0;
+
+/// The number of dropped samples.
+///
+static volatile uint32_t recordDroppedSamples = 0;
+
+
+/// Write the last conversion into the buffer.
+///
+/// This is called from the ADC interrupt while recording.
+///
+static void recordConversion()
+{
+	// Clear the compare flag, so the next compare match starts a conversion.
+	TIFR1 = _BV(OCF1B);
+	const uint8_t sample = ADCH;
+	if (recordFilledChunks >= bufferChunkCount) {
+		++recordDroppedSamples; // The card is busy for too long.
+		return;
+	}
+	recordBuffer[recordPosition] = sample;
+	if (((++recordPosition) & (chunkSize - 1)) == 0) {
+		++recordFilledChunks;
+		if (recordPosition >= bufferSize) {
+			recordPosition = 0;
+		}
+	}
+}
+
+
+AudioRecorder::AudioRecorder()
+	: _recordedSampleCount(0), _droppedSampleCount(0), _longestBusyTime(0),
+	_oldADCSRA(0), _oldADCSRB(0), _oldADMUX(0)
+{
+}
+
+
+bool AudioRecorder::record(uint8_t channel, uint16_t sampleRate, uint32_t sampleCount)
+{
+	_recordedSampleCount = 0;
+	_droppedSampleCount = 0;
+	_longestBusyTime = 0;
+
+	// Check the parameters and the capture region.
+	const SDCard::Extent region = sdCard.captureRegion();
+	if (region.blockCount < 2 || channel > 7 || sampleRate < minimumSampleRate || sampleRate > maximumSampleRate) {
+		return false;
+	}
+	uint32_t blockCount = (sampleCount + blockSize - 1) / blockSize;
+	if (blockCount > region.blockCount - 1) {
+		blockCount = region.blockCount - 1;
+	}
+
+	// Keep the SPI bus for the SD-Card while recording.
+	SPISession session(SPIBus::SDCardDevice);
+
+	// Let the card erase the blocks for the samples.
+	if (sdCard.startMultiWrite(region.startBlock + 1, blockCount) != SDCard::StatusReady) {
+		return false;
+	}
+
+	// Create the buffer for the samples (on the stack).
+	uint8_t sampleBuffer[bufferSize];
+	recordBuffer = sampleBuffer;
+	recordPosition = 0;
+	recordFilledChunks = 0;
+	recordDroppedSamples = 0;
+	startSampling(channel, sampleRate);
+
+	// Stream the full chunks to the card, until all blocks are written.
+	bool success = true;
+	uint16_t readPosition = 0;
+	const uint32_t chunkCount = blockCount * blockChunkCount;
+	uint32_t writtenChunks = 0;
+	bool isBusy = false;
+	unsigned long busyStartTime = 0;
+	while (writtenChunks < chunkCount) {
+		if (recordFilledChunks == 0) {
+			// Wait in the idle mode until the interrupt of the next conversion.
+			cli();
+			if (recordFilledChunks == 0) {
+				sleep_enable();
+				sei();
+				sleep_cpu();
+				sleep_disable();
+			}
+			sei();
+			continue;
+		}
+		const SDCard::Status status = sdCard.writeNextData(sampleBuffer + readPosition, chunkSize);
+		if (status == SDCard::StatusWait) {
+			// Measure how long the card is busy.
+			if (!isBusy) {
+				isBusy = true;
+				busyStartTime = millis();
+			} else if ((millis() - busyStartTime) > busyTimeout) {
+				success = false;
+				break;
+			}
+			continue;
+		}
+		if (isBusy) {
+			isBusy = false;
+			const uint16_t busyTime = millis() - busyStartTime;
+			if (busyTime > _longestBusyTime) {
+				_longestBusyTime = busyTime;
+			}
+		}
+		if (status == SDCard::StatusError) {
+			success = false;
+			break;
+		}
+		// Pass the chunk back to the interrupt.
+		uint8_t oldSREG = SREG;
+		cli();
+		--recordFilledChunks;
+		SREG = oldSREG;
+		readPosition += chunkSize;
+		if (readPosition >= bufferSize) {
+			readPosition = 0;
+		}
+		++writtenChunks;
+	}
+
+	stopSampling();
+	if (sdCard.stopMultiWrite() != SDCard::StatusReady) {
+		success = false;
+	}
+	_recordedSampleCount = writtenChunks * chunkSize;
+	_droppedSampleCount = recordDroppedSamples;
+	recordBuffer = 0;
+
+	// Write the header of the recording.
+	if (success) {
+		CaptureHeader header;
+		memcpy(header.magic, captureMagic, 4);
+		header.sampleCount = _recordedSampleCount;
+		header.droppedSampleCount = _droppedSampleCount;
+		header.sampleRate = sampleRate;
+		header.channel = channel;
+		header.sampleBits = 8;
+		success = (sdCard.writeBlock(region.startBlock, reinterpret_cast<const uint8_t*>(&header),
+			sizeof(CaptureHeader)) == SDCard::StatusReady);
+	}
+	return success;
+}
+
+
+void AudioRecorder::startSampling(uint8_t channel, uint16_t sampleRate)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	_oldADCSRA = ADCSRA;
+	_oldADCSRB = ADCSRB;
+	_oldADMUX = ADMUX;
+	// Timer 1 in CTC mode with OCR1A as TOP, no pre-scaling.
+	TCCR1A = 0;
+	TCCR1B = _BV(WGM12)|_BV(CS10);
+	OCR1A = (F_CPU / sampleRate) - 1;
+	OCR1B = 0; // The compare match B starts each conversion.
+	TCNT1 = 0;
+	TIMSK1 = 0; // no interrupts from timer
+	TIFR1 = _BV(OCF1B);
+	analogSampler.setConversionHandler(&recordConversion);
+	// AVcc reference, left adjusted result to read 8 bits from ADCH.
+	ADMUX = _BV(REFS0)|_BV(ADLAR)|channel;
+	// Start the conversions with the timer 1 compare match B.
+	ADCSRB = _BV(ADTS2)|_BV(ADTS0);
+	// Pre-scaler 32, the conversion takes 26us at 16MHz.
+	ADCSRA = _BV(ADEN)|_BV(ADATE)|_BV(ADIE)|_BV(ADIF)|_BV(ADPS2)|_BV(ADPS0);
+	SREG = oldSREG;
+}
+
+
+void AudioRecorder::stopSampling()
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	TCCR1B &= ~(_BV(CS10)|_BV(CS11)|_BV(CS12));
+	ADCSRA = _oldADCSRA | _BV(ADIF); // Drop the last recorded conversion.
+	ADCSRB = _oldADCSRB;
+	ADMUX = _oldADMUX;
+	analogSampler.setConversionHandler(0);
+	SREG = oldSREG;
+}
+
+
+}
+
+
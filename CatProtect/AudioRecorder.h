@@ -0,0 +1,123 @@
+#pragma once
+//
+// AudioRecorder
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <stdint.h>
+
+
+namespace lr {
+
+
+/// This is the audio recorder.
+///
+/// It samples one analog input with 8 bits and streams the samples into
+/// the capture region of the SD-Card. The conversions are started by
+/// timer 1, and the ADC interrupt writes the samples into a ring buffer.
+/// The recorder takes over the ADC from the analog sampler while recording.
+/// Meanwhile, the recorder streams each full chunk of the buffer into the
+/// current block of a multi block write, without waiting while the card is
+/// busy. The card is told the number of blocks in advance, so it can erase
+/// them before the recording starts.
+///
+/// The card is only busy after each completed block, so the buffer has to
+/// bridge the busy time, but never holds a whole block while it is sent.
+/// If the card stays busy longer than the buffer lasts, samples are dropped
+/// and counted. The buffer lasts 64ms at 8kHz and 23ms at 22.05kHz.
+///
+/// The first block of the capture region contains a header with the
+/// details of the last recording, followed by the samples. The capture
+/// region is only available on cards created with the --capture-blocks
+/// option of CreateDiskImage.pl.
+///
+class AudioRecorder
+{
+public:
+	/// The size of the sample buffer in bytes.
+	///
+	static const uint16_t bufferSize = 512;
+
+	/// The number of samples which are written to the card at once.
+	///
+	static const uint8_t chunkSize = 32;
+
+	/// The lowest supported sample rate.
+	///
+	static const uint16_t minimumSampleRate = 8000;
+
+	/// The highest supported sample rate.
+	///
+	static const uint16_t maximumSampleRate = 22050;
+
+	/// The header in the first block of the capture region.
+	///
+	struct CaptureHeader {
+		char magic[4]; ///< The magic "LRCP".
+		uint32_t sampleCount; ///< The number of recorded samples.
+		uint32_t droppedSampleCount; ///< The number of samples dropped while the card was busy.
+		uint16_t sampleRate; ///< The sample rate in Hz.
+		uint8_t channel; ///< The analog channel.
+		uint8_t sampleBits; ///< The number of bits per sample, always 8.
+	};
+
+public:
+	/// ctor
+	///
+	AudioRecorder();
+
+public:
+	/// Record samples into the capture region.
+	///
+	/// This is a blocking call, which returns after the given number of
+	/// samples, rounded up to whole blocks, was recorded. The recording is
+	/// shortened if the capture region is too small. The recorder uses
+	/// bufferSize bytes of the stack while recording.
+	///
+	/// @param channel The analog channel, from 0 to 7.
+	/// @param sampleRate The sample rate in Hz.
+	/// @param sampleCount The number of samples to record.
+	/// @return true on success, false on any error.
+	///
+	bool record(uint8_t channel, uint16_t sampleRate, uint32_t sampleCount);
+
+	/// Get the number of samples of the last recording.
+	///
+	inline uint32_t recordedSampleCount() const { return _recordedSampleCount; }
+
+	/// Get the number of samples dropped in the last recording.
+	///
+	inline uint32_t droppedSampleCount() const { return _droppedSampleCount; }
+
+	/// Get the longest time in ms the card was busy in the last recording.
+	///
+	inline uint16_t longestBusyTime() const { return _longestBusyTime; }
+
+private:
+	/// Start the timer and the ADC.
+	///
+	void startSampling(uint8_t channel, uint16_t sampleRate);
+
+	/// Stop the timer and the ADC.
+	///
+	void stopSampling();
+
+private:
+	uint32_t _recordedSampleCount; ///< The number of recorded samples.
+	uint32_t _droppedSampleCount; ///< The number of dropped samples.
+	uint16_t _longestBusyTime; ///< The longest busy time of the card.
+	uint8_t _oldADCSRA; ///< The ADC control register before the recording.
+	uint8_t _oldADCSRB; ///< The second ADC control register before the recording.
+	uint8_t _oldADMUX; ///< The ADC multiplexer register before the recording.
+};
+
+
+/// The global instance of the audio recorder.
+///
+extern AudioRecorder audioRecorder;
+
+
+}
+
@@ -9,17 +9,24 @@
 #include <SPI.h>
 
 #include "AudioPlayer.h"
+#include "AudioRecorder.h"
+#include "EventLog.h"
+#include "EventQueue.h"
 #include "SDCard.h"
-#include "Timer.h"
+#include "VoiceTable.h"
 #include "LEDController.h"
 #include "MotionSensor.h"
+#include "PowerManager.h"
+#include "Protothread.h"
+#include "Recovery.h"
+#include "Scheduler.h"
 
 
 using namespace lr;
 
 
-// Motion callback.
-void onMotion(const unsigned long currentTime, MotionSensor::Status status);
+// Motion event handler.
+void onMotion(const unsigned long currentTime, MotionSensor::Status status, uint8_t zone);
 
 /// The logic state.
 enum LogicState : uint8_t {
@@ -31,17 +38,28 @@ enum LogicState : uint8_t {
 	ErrorState,
 	/// If the board is in alarm state, the voice is played.
 	AlarmState,
+	/// If the board tries to recover the SD-Card after an error.
+	RecoveryState,
 } logicState;
 
 
-/// The controller for the LED
-LEDController ledController; 
-
-/// The motion sensor.
+/// The motion sensors.
 MotionSensor motionSensor;
 
+/// The analog input of the motion sensor.
+const uint8_t motionSensorChannel = 0;
+
+/// The threshold of the motion sensor, above the baseline.
+const uint16_t motionSensorThreshold = 200;
+
+/// The interval in ms to check the motion sensors.
+const uint16_t motionSensorInterval = 10;
+
+/// The interval in ms to write the collected events to the card, if required.
+const uint16_t eventLogInterval = 1000;
 
-/// A list of voice sample file names
+
+/// A list of voice sample file names, if there is no playlist on the card.
 const char* const voiceSampleList[] = {
 	"v0.snd",
 	"v1.snd",
@@ -53,14 +71,57 @@ const char* const voiceSampleList[] = {
 /// The number of voice samples
 const int voiceSampleCount = 6;
 
-/// The next voice sample to play.
+/// A bank of voices, which are played for the alarms in one zone.
+struct VoiceBank {
+	uint8_t firstIndex; ///< The index of the first voice in the voice table.
+	uint8_t count; ///< The number of voices in the bank.
+};
+
+/// The number of zones.
+const uint8_t zoneCount = 1;
+
+/// The configured voice bank for each zone of the motion sensors.
+const VoiceBank voiceBankList[zoneCount] = {
+	{0, 6} };
+
+/// The voice bank for each zone, limited to the voices of the playlist.
+VoiceBank voiceBanks[zoneCount];
+
+/// The analog channel of the microphone for recordings.
+const uint8_t microphoneChannel = 1;
+
+/// The sample rate for recordings.
+const uint16_t recordSampleRate = 8000;
+
+/// The length of a recording in seconds.
+const uint8_t recordSeconds = 5;
+
+/// The next voice sample to play in each zone.
 /// They play in a loop.
-int nextVoiceSampleIndex = 0;
+uint8_t nextVoiceInZone[zoneCount];
+
+/// The zone of the last alarm.
+uint8_t alarmZone = 0;
 
 /// Flag if we had an alarm.
 /// The LED will flash red, after an alarm was played.
 bool alarmPlayed = false;
 
+/// The time when the last alarm started.
+unsigned long alarmStartTime = 0;
+
+/// The time in ms after a voice, until another voice is played if there is still motion.
+const uint16_t alarmRepeatDelay = 5000;
+
+/// The maximum number of voices played for one alarm.
+const uint8_t alarmVoiceLimit = 3;
+
+/// The state of the alarm task.
+Protothread alarmThread;
+
+/// The number of voices played for the current alarm.
+uint8_t alarmVoiceCount = 0;
+
 
 /// Arduino setup method.
 ///
@@ -68,12 +129,15 @@ void setup() {
 	// Set the initial state.
 	logicState = WaitForSensor;
 
+	// Disable the unused modules.
+	powerManager.setup();
+
 	// setup the LED controller
 	ledController.setup();
 
-	// setup the motion sensor.
+	// setup the motion sensors, add more sensors with the zone of their voice bank.
+	motionSensor.addSensor(motionSensorChannel, motionSensorThreshold, 0);
 	motionSensor.setup();
-	motionSensor.setCallback(&onMotion);
 
 	// Initialize the serial interface
 	Serial.begin(115200);
@@ -86,54 +150,316 @@ void setup() {
 		signalError();
 		return;
 	}
+
+	// Resolve the voice samples, from the cache if the card did not change.
+	if (!initializeVoices()) {
+		Serial.println(F("Error on reading the voices."));
+		Serial.flush();
+		signalError();
+		return;
+	}
+
+	// Initialize the event log.
+	if (eventLog.initialize()) {
+		eventLog.add(EventLog::Boot, 0, millis());
+	}
 		
+	// Check the motion sensors periodically.
+	scheduler.start(&checkMotionSensor, &motionSensor, 0, motionSensorInterval, millis());
+	// Write the collected events periodically.
+	scheduler.start(&writeEventLog, 0, eventLogInterval, eventLogInterval, millis());
+
 	Serial.println(F("Success!"));
 	Serial.flush();
 }
 
 
+/// Resolve the voices of the card, and limit the voice banks to them.
+///
+/// @return true on success, false if the card could not be read.
+///
+bool initializeVoices()
+{
+	if (!voiceTable.initialize(voiceSampleList, voiceSampleCount)) {
+		return false;
+	}
+	if (voiceTable.isFromCache()) {
+		Serial.println(F("Voices from cache."));
+	}
+	for (uint8_t zone = 0; zone < zoneCount; ++zone) {
+		voiceBanks[zone] = voiceBankList[zone];
+		nextVoiceInZone[zone] = 0;
+	}
+	if (voiceTable.isFromPlaylist()) {
+		Serial.print(F("Voices from playlist: "));
+		Serial.println(voiceTable.voiceCount());
+		// The first bank plays all voices of the playlist, the other banks are limited to them.
+		voiceBanks[0].count = voiceTable.voiceCount();
+		for (uint8_t zone = 1; zone < zoneCount; ++zone) {
+			VoiceBank &bank = voiceBanks[zone];
+			if (bank.firstIndex + bank.count > voiceTable.voiceCount()) {
+				bank.firstIndex = 0;
+				bank.count = voiceTable.voiceCount();
+			}
+		}
+	}
+	// Report the parts of the playlist which were skipped.
+	const uint8_t playlistIssues = voiceTable.playlistIssues();
+	if ((playlistIssues & VoiceTable::PlaylistNameTooLong) != 0) {
+		Serial.println(F("Playlist: skipped names which are too long."));
+	}
+	if ((playlistIssues & VoiceTable::PlaylistTooManyNames) != 0) {
+		Serial.println(F("Playlist: skipped the names after the maximum number of voices."));
+	}
+	if ((playlistIssues & VoiceTable::PlaylistTooLarge) != 0) {
+		Serial.println(F("Playlist: only the start of the file is read."));
+	}
+	// The alarms skip these voices.
+	voiceTable.printMissingVoices(Serial);
+	return true;
+}
+
+
 /// Arduino loop method.
 ///
 void loop() {
 	// Get the current time for this loop iteration.
 	const unsigned long currentTime = millis();
-	// Control the LED
-	ledController.loop(currentTime);
-	// Deactivate everything if there is an error.
-	if (logicState != ErrorState) {
-		// Check the motion sensor.
-		motionSensor.loop(currentTime);
-		// If the board goes into alarm state, play the sound.
-		// This will block the loop, until the sound finishes.
-		if (logicState == AlarmState) {
-			// Get the filename for the next voice sample.
-			const char *fileName = voiceSampleList[nextVoiceSampleIndex];
-			// Play the sound.
-			if (!audioPlayer.play(fileName)) {
-				// On error go into error state.
-				Serial.println(F("Error on play."));
+	// Serial commands.
+	if (Serial.available() > 0) {
+		// The commands may access the card.
+		audioPlayer.cancel();
+		processCommand(Serial.read());
+	}
+	// Run the due tasks, like the check of the motion sensor and the alarm.
+	scheduler.dispatch(currentTime);
+	// Handle the events of the tasks.
+	processEvents();
+	// Sleep until the next task is due, or a command or event is received.
+	while (Serial.available() == 0 && eventQueue.depth() == 0 && !scheduler.isDue(millis())) {
+		powerManager.sleep();
+	}
+}
+
+
+/// The alarm task, which plays the voices of an alarm.
+///
+/// It plays a voice, and another one after a while if there is still motion.
+/// This will block the loop, until the sound finishes.
+///
+void playAlarm(void*, const unsigned long currentTime)
+{
+	PT_BEGIN(alarmThread);
+	alarmVoiceCount = 0;
+	do {
+		if (!playVoice(currentTime)) {
+			PT_EXIT(alarmThread);
+		}
+		// Go back into idle state after the sound.
+		// The sensor might stay in alarm state for a while.
+		logicState = IdleState;
+		scheduler.start(&playAlarm, 0, alarmRepeatDelay, 0, millis());
+		PT_YIELD(alarmThread);
+	} while (logicState == IdleState && motionSensor.hasMotion() && ++alarmVoiceCount < alarmVoiceLimit);
+	PT_END(alarmThread);
+}
+
+
+/// Play the next voice of the alarm zone.
+///
+/// @return true on success, false on an error.
+///
+bool playVoice(const unsigned long currentTime)
+{
+	const VoiceBank &voiceBank = voiceBanks[alarmZone];
+	// Use the next voice of the zone which is on the card.
+	uint8_t voiceIndex = 0;
+	bool isAvailable = false;
+	for (uint8_t i = 0; i < voiceBank.count && !isAvailable; ++i) {
+		voiceIndex = voiceBank.firstIndex + nextVoiceInZone[alarmZone];
+		isAvailable = voiceTable.isAvailable(voiceIndex);
+		// Increase the next voice sample index of the zone, also if the voice fails.
+		if (++nextVoiceInZone[alarmZone] >= voiceBank.count) {
+			nextVoiceInZone[alarmZone] = 0;
+		}
+	}
+	if (!isAvailable) {
+		Serial.println(F("No voice for the alarm."));
+		logicState = IdleState;
+		return false;
+	}
+	eventLog.add(EventLog::Alarm, voiceIndex, currentTime);
+	// Play the sound.
+	if (!voiceTable.play(voiceIndex)) {
+		// Only an error of the card is recovered, a voice which can not be played is skipped.
+		if (sdCard.error() != SDCard::NoError) {
+			eventQueue.pushFromLoop(EventQueue::CardError, sdCard.error(), 0, millis());
+		} else {
+			Serial.println(F("Voice skipped."));
+			logicState = IdleState;
+		}
+		return false;
+	}
+	eventQueue.pushFromLoop(EventQueue::PlaybackDone, voiceIndex, alarmZone, millis());
+	return true;
+}
+
+
+/// Handle all events in the queue.
+///
+void processEvents()
+{
+	EventQueue::Event event;
+	for (uint8_t i = 0; i < EventQueue::size && eventQueue.pop(event); ++i) {
+		if (event.type == EventQueue::SensorStatus) {
+			onMotion(event.time, static_cast<MotionSensor::Status>(event.value), event.parameter);
+		} else if (event.type == EventQueue::PlaybackDone) {
+			// Remember an alarm was played, the LED will flash red.
+			alarmPlayed = true;
+		} else if (event.type == EventQueue::CardError) {
+			onCardError(event.time, static_cast<SDCard::Error>(event.value));
+		} else if (event.type == EventQueue::InputFault) {
+			onInputFault(event.value, event.parameter != 0);
+		}
+	}
+}
+
+
+/// Go into the recovery or error state after an error of the card.
+///
+void onCardError(const unsigned long currentTime, SDCard::Error error)
+{
+	Serial.println(F("Error on play."));
+	Serial.flush();
+	eventLog.add(EventLog::Error, error, currentTime);
+	if (recovery.start(error, currentTime)) {
+		ledController.setState(LEDController::Orange, LEDController::DoubleFlash);
+		logicState = RecoveryState;
+		scheduler.start(&recoverFromError, 0, 0, 0, currentTime);
+	} else {
+		signalError();
+	}
+}
+
+
+/// Report an analog input which reads 0, or works again.
+///
+void onInputFault(uint8_t channel, bool isFault)
+{
+	Serial.print(F("Sensor input "));
+	Serial.print(channel);
+	if (isFault) {
+		Serial.println(F(" reads 0, check the sensor."));
+	} else {
+		Serial.println(F(" works again."));
+	}
+	Serial.flush();
+}
+
+
+/// The task to check the motion sensor.
+///
+void checkMotionSensor(void *context, const unsigned long currentTime)
+{
+	// The sensor is not checked while the card is recovered.
+	if (logicState != RecoveryState && logicState != ErrorState) {
+		static_cast<MotionSensor*>(context)->loop(currentTime);
+	}
+}
+
+
+/// The task to write the collected events to the card.
+///
+/// The write of a block blocks the loop for a few ms. It is done only
+/// between the alarms, and never while a voice is prepared, because the
+/// write would end the prepared read.
+///
+void writeEventLog(void*, const unsigned long)
+{
+	if (logicState == IdleState && eventLog.isFlushPending() && !audioPlayer.isPrepared()) {
+		if (!eventLog.flush()) {
+			Serial.println(F("Error on writing the event log."));
+		}
+	}
+}
+
+
+/// The task to recover the SD-Card after an error while playing a sound.
+///
+void recoverFromError(void*, const unsigned long currentTime)
+{
+	const Recovery::Status status = recovery.loop(currentTime);
+	if (status == Recovery::StatusRecovered) {
+		if (sdCard.isCardChanged()) {
+			// Everything read from the previous card is read again from the new one.
+			Serial.println(F("Another card was inserted."));
+			if (!initializeVoices()) {
+				Serial.println(F("Error on reading the voices."));
 				Serial.flush();
 				signalError();
-			} else {
-				// Increase the next voice sample index
-				++nextVoiceSampleIndex;
-				if (nextVoiceSampleIndex >= voiceSampleCount) {
-					nextVoiceSampleIndex = 0;
-				}
-				// Go back into idle state after the sound.
-				// The sensor might stay in alarm state for a while.
-				logicState = IdleState;
-				// Remember an alarm was played, the LED will flash red.
-				alarmPlayed = true;
+				return;
 			}
+			eventLog.initialize();
 		}
+		Serial.println(F("Recovered from the error."));
+		Serial.flush();
+		eventLog.add(EventLog::Recovered, recovery.attemptCount(), currentTime);
+		ledController.setState(LEDController::Red, LEDController::FlashVerySlow);
+		logicState = IdleState;
+	} else if (status == Recovery::StatusFailed) {
+		Serial.println(F("Recovery failed."));
+		Serial.flush();
+		signalError();
+	} else {
+		// Wait for the next attempt.
+		scheduler.start(&recoverFromError, 0, recovery.nextAttemptDelay(), 0, millis());
+	}
+}
+
+
+/// Process a command received over the serial interface.
+///
+void processCommand(char command)
+{
+	if (command == 'l') {
+		eventLog.printEvents(Serial);
+	} else if (command == 's') {
+		sdCard.printLatencyStats(Serial);
+	} else if (command == 'r') {
+		sdCard.resetLatencyStats();
+		audioPlayer.resetProfile();
+		powerManager.resetStatistics();
+		eventQueue.resetStatistics();
+	} else if (command == 'p') {
+		audioPlayer.printProfile(Serial);
+	} else if (command == 'w') {
+		powerManager.printStatistics(Serial);
+	} else if (command == 'q') {
+		eventQueue.printStatistics(Serial);
+	} else if (command == 't') {
+		motionSensor.printTrace(Serial);
+	} else if (command == 'e') {
+		recovery.printStatistics(Serial);
+	} else if (command == 'c' && logicState == IdleState) {
+		// Record from the microphone into the capture region of the card.
+		Serial.println(F("Recording..."));
+		Serial.flush();
+		const bool success = audioRecorder.record(microphoneChannel, recordSampleRate,
+			static_cast<uint32_t>(recordSampleRate) * recordSeconds);
+		Serial.print(success ? F("Recorded samples: ") : F("Error on recording, samples: "));
+		Serial.print(audioRecorder.recordedSampleCount());
+		Serial.print(F(" dropped: "));
+		Serial.print(audioRecorder.droppedSampleCount());
+		Serial.print(F(" longest busy: "));
+		Serial.print(audioRecorder.longestBusyTime());
+		Serial.println(F("ms"));
 	}
 }
 
 
-/// The motion callback which is called every time when the sensor state changes.
+/// Handle the events of the motion sensor, for each change of the status.
 ///
-void onMotion(const unsigned long currentTime, MotionSensor::Status status)
+void onMotion(const unsigned long currentTime, MotionSensor::Status status, uint8_t zone)
 {
 	if (status == MotionSensor::WaitStablilize) {
 		Serial.println(F("Wait until the sensor is ready."));
@@ -142,6 +468,11 @@ void onMotion(const unsigned long currentTime, MotionSensor::Status status)
 	} else if (status == MotionSensor::Idle) {
 		Serial.println(F("Sensor is in idle state."));
 		Serial.flush();
+		// Log the end of an alarm, with the duration in seconds.
+		if (logicState == IdleState && alarmPlayed) {
+			eventLog.add(EventLog::AlarmEnd, (currentTime - alarmStartTime) / 1000, currentTime);
+			eventLog.requestFlush();
+		}
 		// If an alarm was played, let the LED flash red.
 		if (alarmPlayed) {
 			ledController.setState(LEDController::Red, LEDController::FlashVerySlow);
@@ -149,11 +480,36 @@ void onMotion(const unsigned long currentTime, MotionSensor::Status status)
 			ledController.setState(LEDController::Green, LEDController::FlashVerySlow);
 		}
 		logicState = IdleState; // Ready to observe.
-	} else if (status == MotionSensor::Alarm) {
-		Serial.println(F("Sensor alarm."));
+	} else if (status == MotionSensor::Alarm || status == MotionSensor::ClassifiedAlarm) {
+		Serial.print(F("Sensor alarm in zone "));
+		Serial.println(zone);
+		// Alarms of other sensors during a classification are not classified.
+		if (status == MotionSensor::ClassifiedAlarm) {
+			motionSensor.printLastClassification(Serial);
+		}
 		Serial.flush();
 		ledController.setState(LEDController::Red, LEDController::On);
+		alarmStartTime = currentTime;
+		alarmZone = (zone < zoneCount) ? zone : 0;
 		logicState = AlarmState; // Activate the alarm and play a sound.
+		alarmThread.restart();
+		scheduler.start(&playAlarm, 0, 0, 0, currentTime);
+	} else if (status == MotionSensor::PreAlarm) {
+		// Start reading the next voice of the zone, the alarm will probably follow.
+		if (logicState == IdleState && zone < zoneCount) {
+			voiceTable.prepare(voiceBanks[zone].firstIndex + nextVoiceInZone[zone]);
+		}
+	} else if (status == MotionSensor::PreAlarmCancel) {
+		audioPlayer.cancel();
+	} else if (status == MotionSensor::AlarmSuppressed) {
+		// Probably not a cat, drop the prepared voice.
+		audioPlayer.cancel();
+		Serial.print(F("Suppressed alarm in zone "));
+		Serial.println(zone);
+		motionSensor.printLastClassification(Serial);
+		Serial.flush();
+		eventLog.add(EventLog::AlarmSuppressed, zone, currentTime);
+		eventLog.requestFlush();
 	}
 }
 
@@ -0,0 +1,31 @@
+#pragma once
+//
+// ClassifierWeights
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+
+namespace lr {
+
+
+/// The weights of the alarm classifier in MotionSensor.
+///
+/// The first value is the bias, followed by one weight for each feature,
+/// in the order of MotionSensor::Features. An alarm is reported if the bias
+/// plus the weighted sum of the features is not negative.
+///
+/// Create this file from recorded "class" lines with TrainClassifier.pl.
+/// These default weights accept every alarm.
+///
+const int16_t classifierWeights[5] PROGMEM = {
+	0, 0, 0, 0, 0 };
+
+
+}
+
+
@@ -0,0 +1,38 @@
+#pragma once
+//
+// CRC16
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+
+namespace lr {
+
+
+/// The lookup table for the CRC16-CCITT (polynomial 0x1021) in flash memory.
+///
+extern const uint16_t crc16Table[256] PROGMEM;
+
+
+/// Update a CRC16-CCITT with one byte.
+///
+/// This is the CRC used by the SD-Card for the data blocks, starting with 0x0000.
+///
+inline uint16_t crc16Update(uint16_t crc, uint8_t value)
+{
+	return (crc << 8) ^ pgm_read_word(&crc16Table[(crc >> 8) ^ value]);
+}
+
+
+/// Update a CRC16-CCITT with a number of bytes.
+///
+uint16_t crc16Update(uint16_t crc, const uint8_t *data, uint16_t length);
+
+
+}
+
@@ -8,6 +8,8 @@
 #include "DacPort.h"
 
 
+#include "SPIBus.h"
+
 #include <SPI.h>
 
 #include <avr/io.h>
@@ -51,6 +53,9 @@
 // This will send one bit to the chip.
 #define dacSendBit(bit) if (value & bit) { dacDataUp() } else { dacDataDown() }; dacClockPulse();
 
+// The command bits for the chip: write to the DAC register, 2x gain, enabled.
+#define DAC_COMMAND_WRITE 0x1000
+
 
 namespace lr {
 
@@ -60,6 +65,76 @@ namespace lr {
 DacPort dacPort;
 
 
+#ifdef DACPORT_USE_SPI
+
+
+/// Send a 16bit command to the chip over the SPI bus.
+///
+static inline void dacSendCommand(uint16_t command)
+{
+  SPISession session(SPIBus::DacDevice);
+  dacSelect(); // select the chip
+  SPI.transfer(command >> 8);
+  SPI.transfer(command);
+  dacUnselect(); // unselect the chip.
+}
+
+
+void DacPort::initialize()
+{
+  // Set the chip select and latch to output, the SPI pins are set by the SPI library.
+  pinMode(2, OUTPUT); 
+  pinMode(5, OUTPUT);
+  SPI.begin();
+
+  // Set the outputs to the initial states
+  dacUnselect();
+  dacLatchUp();
+
+  // The chip supports up to 20MHz.
+  spiBus.setSettings(SPIBus::DacDevice, SPISettings(20000000, MSBFIRST, SPI_MODE0));
+  spiBus.setChipSelect(SPIBus::DacDevice, &DAC_CS_PORT, _BV(DAC_CS));
+}
+
+
+void DacPort::setValue(uint16_t value)
+{
+  dacSendCommand(DAC_COMMAND_WRITE | (value & 0x0fff));
+}
+
+
+void DacPort::setValueShared(uint16_t value)
+{
+  const uint16_t command = DAC_COMMAND_WRITE | (value & 0x0fff);
+  spiBus.suspendOwner();
+  dacSelect(); // select the chip
+  SPI.transfer(command >> 8);
+  SPI.transfer(command);
+  dacUnselect(); // unselect the chip.
+  spiBus.resumeOwner();
+}
+
+
+void DacPort::pushValue()
+{
+  // Push the value into the DAC
+  dacLatchDown();
+  dacLatchUp();
+}
+
+
+void DacPort::shutdown()
+{
+  dacSendCommand(0x0000); // bit 12, 0 = Disabled.
+  // Push the value into the DAC
+  dacLatchDown();
+  dacLatchUp();
+}
+
+
+#else
+
+
 void DacPort::initialize()
 {
   // Set all ports to output
@@ -144,6 +219,9 @@ void DacPort::shutdown()
 }
 
 
+#endif
+
+
 }
 
 
@@ -15,11 +15,28 @@
 //   Pin 4   <-----> Pin 4
 //   Pin 5   <-----> Pin 5
 //
+// If DACPORT_USE_SPI is defined, the chip shares the SPI bus with the
+// SD-Card, and is connected to this pins:
+//   Arduino <=====> MCP4821
+//   Pin 2   <-----> Pin 2 (CS)
+//   Pin 13  <-----> Pin 3 (SCK)
+//   Pin 11  <-----> Pin 4 (SDI)
+//   Pin 5   <-----> Pin 5 (LDAC)
+//
 
 
 #include <stdint.h>
 
 
+/// Send the values to the DAC using the hardware SPI bus.
+/// Each value is sent in a short session on the SPI bus, which can be
+/// opened in the middle of a multi block read from the SD-Card. While
+/// the SD-Card owns the bus, setValueShared() sends the value with the
+/// settings of the card and only switches the chip selects.
+///
+//#define DACPORT_USE_SPI
+
+
 namespace lr {
 
 
@@ -35,6 +52,17 @@ public:
   /// Set a value to the DAC
   ///
   void setValue(uint16_t value);
+
+  /// Set a value to the DAC inside an open session of the SD-Card.
+  ///
+  /// The SPI settings of the SD-Card also work for the DAC, so the transaction
+  /// is kept open. Without DACPORT_USE_SPI, this is the same as setValue().
+  ///
+#ifdef DACPORT_USE_SPI
+  void setValueShared(uint16_t value);
+#else
+  inline void setValueShared(uint16_t value) { setValue(value); }
+#endif
   
   /// Push the value to the output
   ///
@@ -0,0 +1,209 @@
+//
+// EventLog
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "EventLog.h"
+
+
+#include "Crc16.h"
+#include "SPIBus.h"
+
+
+namespace lr {
+
+
+/// The global instance of the event log.
+///
+EventLog eventLog;
+
+
+/// The magic at the start of each block.
+///
+static const char blockMagic[4] = {'L', 'R', 'L', 'G'};
+
+
+EventLog::EventLog()
+	: _nextBlockIndex(0), _flushRequested(false), _droppedEvents(0)
+{
+	_block.header.eventCount = 0;
+	_region.startBlock = 0;
+	_region.blockCount = 0;
+}
+
+
+EventLog::~EventLog()
+{
+}
+
+
+bool EventLog::initialize()
+{
+	_region = sdCard.eventLogRegion();
+	if (!isAvailable()) {
+		return false;
+	}
+
+	// Search the block with the highest sequence number.
+	uint32_t lastSequence = 0;
+	uint32_t lastBlockIndex = _region.blockCount - 1;
+	BlockHeader header;
+	{
+		SPISession session(SPIBus::SDCardDevice);
+		for (uint32_t i = 0; i < _region.blockCount; ++i) {
+			if (readBlock(i, &header, 0) && header.sequence > lastSequence) {
+				lastSequence = header.sequence;
+				lastBlockIndex = i;
+			}
+		}
+	}
+
+	// Continue after the last valid block.
+	_nextBlockIndex = lastBlockIndex + 1;
+	if (_nextBlockIndex >= _region.blockCount) {
+		_nextBlockIndex = 0;
+	}
+	_block.header.sequence = lastSequence + 1;
+	return true;
+}
+
+
+void EventLog::add(Type type, uint16_t value, unsigned long currentTime)
+{
+	if (!isAvailable()) {
+		return;
+	}
+	if (_block.header.eventCount >= bufferEventCount) {
+		++_droppedEvents;
+		return;
+	}
+	Event &event = _block.events[_block.header.eventCount++];
+	event.time = currentTime;
+	event.type = type;
+	event.reserved = 0;
+	event.value = value;
+}
+
+
+void EventLog::requestFlush()
+{
+	_flushRequested = true;
+}
+
+
+bool EventLog::isFlushPending() const
+{
+	return _block.header.eventCount > 0 &&
+		(_flushRequested || _block.header.eventCount >= bufferEventCount);
+}
+
+
+bool EventLog::flush()
+{
+	if (!isAvailable() || _block.header.eventCount == 0) {
+		return true;
+	}
+	const uint16_t eventsSize = _block.header.eventCount * sizeof(Event);
+	memcpy(_block.header.magic, blockMagic, 4);
+	_block.header.reserved = 0;
+	_block.header.crc = crc16Update(0, reinterpret_cast<const uint8_t*>(_block.events), eventsSize);
+	const SDCard::Status status = sdCard.writeBlock(_region.startBlock + _nextBlockIndex,
+		reinterpret_cast<const uint8_t*>(&_block), sizeof(BlockHeader) + eventsSize);
+	if (status != SDCard::StatusReady) {
+		return false; // Keep the events and try again later.
+	}
+	if (++_nextBlockIndex >= _region.blockCount) {
+		_nextBlockIndex = 0;
+	}
+	++_block.header.sequence;
+	_block.header.eventCount = 0;
+	_flushRequested = false;
+	return true;
+}
+
+
+void EventLog::printEvents(Print &output)
+{
+	if (!isAvailable()) {
+		output.println(F("No event log."));
+		return;
+	}
+	// The oldest block is the next block to write.
+	BlockHeader header;
+	Event events[bufferEventCount];
+	uint32_t blockIndex = _nextBlockIndex;
+	{
+		SPISession session(SPIBus::SDCardDevice);
+		for (uint32_t i = 0; i < _region.blockCount; ++i) {
+			// Only print blocks with a valid CRC.
+			if (readBlock(blockIndex, &header, events)) {
+				for (uint8_t j = 0; j < header.eventCount; ++j) {
+					printEvent(output, events[j]);
+				}
+			}
+			if (++blockIndex >= _region.blockCount) {
+				blockIndex = 0;
+			}
+		}
+	}
+	for (uint8_t i = 0; i < _block.header.eventCount; ++i) {
+		printEvent(output, _block.events[i]);
+	}
+	output.print(F("Dropped events: "));
+	output.println(_droppedEvents);
+}
+
+
+bool EventLog::readBlock(uint32_t blockIndex, BlockHeader *header, Event *events)
+{
+	SDCard::Status status;
+	while ((status = sdCard.startRead(_region.startBlock + blockIndex)) == SDCard::StatusWait) {
+	}
+	if (status != SDCard::StatusReady) {
+		return false;
+	}
+	bool valid = false;
+	if (sdCard.readBytes(reinterpret_cast<uint8_t*>(header), sizeof(BlockHeader)) == SDCard::StatusReady &&
+		memcmp(header->magic, blockMagic, 4) == 0 && header->eventCount <= bufferEventCount) {
+		// Read the events and check the CRC.
+		uint16_t crc = 0;
+		Event event;
+		valid = true;
+		for (uint8_t i = 0; i < header->eventCount; ++i) {
+			if (sdCard.readBytes(reinterpret_cast<uint8_t*>(&event), sizeof(Event)) != SDCard::StatusReady) {
+				valid = false;
+				break;
+			}
+			crc = crc16Update(crc, reinterpret_cast<const uint8_t*>(&event), sizeof(Event));
+			if (events != 0) {
+				events[i] = event;
+			}
+		}
+		if (crc != header->crc) {
+			valid = false;
+		}
+	}
+	// Skip the rest of the block.
+	sdCard.stopRead();
+	return valid;
+}
+
+
+void EventLog::printEvent(Print &output, const Event &event)
+{
+	output.print(event.time);
+	switch (event.type) {
+	case Boot: output.print(F(" Boot ")); break;
+	case Alarm: output.print(F(" Alarm ")); break;
+	case AlarmEnd: output.print(F(" AlarmEnd ")); break;
+	case Error: output.print(F(" Error ")); break;
+	case Recovered: output.print(F(" Recovered ")); break;
+	case AlarmSuppressed: output.print(F(" AlarmSuppressed ")); break;
+	default: output.print(F(" Unknown ")); break;
+	}
+	output.println(event.value);
+}
+
+
+}
+
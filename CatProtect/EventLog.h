@@ -0,0 +1,157 @@
+#pragma once
+//
+// EventLog
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include "SDCard.h"
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// An append-only event log on the SD-Card.
+///
+/// Events are collected in RAM and written as a whole block into the event
+/// log region of the card. The region is used as ring buffer, each block
+/// has a sequence number and a CRC. After a reset, the log continues after
+/// the last valid block, a block which was not completely written because
+/// of a power loss is ignored and overwritten.
+///
+/// The event log is only available on cards with an event log region,
+/// created with the --log-blocks option of CreateDiskImage.pl.
+///
+class EventLog
+{
+public:
+	/// The type of an event.
+	///
+	enum Type : uint8_t {
+		Boot = 1, ///< The device was started.
+		Alarm = 2, ///< An alarm, the value is the index of the played voice.
+		AlarmEnd = 3, ///< The end of an alarm, the value is the duration in seconds.
+		Error = 4, ///< An error, the value is the SD-Card error.
+		Recovered = 5, ///< Recovered from an error, the value is the number of attempts.
+		AlarmSuppressed = 6, ///< The classifier rejected an alarm, the value is the zone.
+	};
+
+	/// A single event.
+	///
+	struct Event {
+		uint32_t time; ///< The time of the event in ms since the start.
+		Type type; ///< The type of the event.
+		uint8_t reserved; ///< Always 0.
+		uint16_t value; ///< A value which depends on the type.
+	};
+
+	/// The number of events collected in RAM before a flush is required.
+	///
+	static const uint8_t bufferEventCount = 16;
+
+public:
+	/// ctor
+	///
+	EventLog();
+
+	/// dtor
+	///
+	~EventLog();
+
+public:
+	/// Initialize the event log.
+	///
+	/// Call this after the SD-Card was initialized. Only the header in
+	/// block 0 is read for the region, not the directory. This scans the
+	/// event log region for the last valid block.
+	///
+	/// @return true if the event log is available.
+	///
+	bool initialize();
+
+	/// Check if the event log is available.
+	///
+	inline bool isAvailable() const { return _region.blockCount > 0; }
+
+	/// Add an event to the RAM buffer.
+	///
+	/// If the buffer is full, the event is dropped.
+	///
+	void add(Type type, uint16_t value, unsigned long currentTime);
+
+	/// Request a flush of the collected events at the next opportunity.
+	///
+	void requestFlush();
+
+	/// Check if the events should be written to the card.
+	///
+	/// This is the case if the buffer is full, or a flush was requested.
+	///
+	bool isFlushPending() const;
+
+	/// Write all collected events as one block to the card.
+	///
+	/// Each flush writes a single block with CMD24. Only one block is
+	/// collected in RAM, a multi block write with pre-erase would need
+	/// more blocks in RAM to save anything.
+	///
+	/// This is a blocking call, never call it while playing audio.
+	///
+	/// @return true on success.
+	///
+	bool flush();
+
+	/// Print all events from the card and the RAM buffer.
+	///
+	void printEvents(Print &output);
+
+private:
+	/// The header of a block in the event log.
+	///
+	struct BlockHeader {
+		char magic[4]; ///< The magic "LRLG".
+		uint32_t sequence; ///< The sequence number of the block, starting with 1.
+		uint8_t eventCount; ///< The number of events in this block.
+		uint8_t reserved; ///< Always 0.
+		uint16_t crc; ///< The CRC16-CCITT of the events.
+	};
+
+	/// The data of a block in the event log.
+	///
+	struct Block {
+		BlockHeader header; ///< The header.
+		Event events[bufferEventCount]; ///< The events.
+	};
+
+	/// Read the block header and check the CRC of the events.
+	///
+	/// @param blockIndex The index of the block in the region.
+	/// @param header The header which is read.
+	/// @param events If not 0, the events are read into this array of bufferEventCount events.
+	/// @return true if the block is valid.
+	///
+	bool readBlock(uint32_t blockIndex, BlockHeader *header, Event *events);
+
+	/// Print a single event.
+	///
+	static void printEvent(Print &output, const Event &event);
+
+private:
+	Block _block; ///< The next block with the collected events.
+	uint32_t _nextBlockIndex; ///< The index of the next block to write in the region.
+	bool _flushRequested; ///< If a flush was requested.
+	uint16_t _droppedEvents; ///< The number of dropped events.
+	SDCard::Extent _region; ///< The event log region on the card.
+};
+
+
+/// The global instance of the event log.
+///
+extern EventLog eventLog;
+
+
+}
+
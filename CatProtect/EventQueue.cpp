@@ -0,0 +1,106 @@
+//
+// EventQueue
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "EventQueue.h"
+
+
+#include <avr/interrupt.h>
+
+
+namespace lr {
+
+
+/// The global instance of the event queue.
+///
+EventQueue eventQueue;
+
+
+/// The mask for the index in the ring buffer.
+///
+static const uint8_t indexMask = EventQueue::size - 1;
+
+/// Keep the compiler from moving the access to the events across the index update.
+///
+#define memoryBarrier() __asm__ __volatile__ ("" ::: "memory")
+
+
+EventQueue::EventQueue()
+	: _head(0), _tail(0), _maximumDepth(0), _overflowCount(0)
+{
+}
+
+
+bool EventQueue::push(Type type, uint8_t value, uint8_t parameter, const unsigned long time)
+{
+	const uint8_t head = _head;
+	const uint8_t depth = head - _tail;
+	if (depth >= size) {
+		++_overflowCount;
+		return false;
+	}
+	Event &event = _events[head & indexMask];
+	event.time = time;
+	event.type = type;
+	event.value = value;
+	event.parameter = parameter;
+	memoryBarrier();
+	_head = head + 1;
+	if (depth >= _maximumDepth) {
+		_maximumDepth = depth + 1;
+	}
+	return true;
+}
+
+
+bool EventQueue::pushFromLoop(Type type, uint8_t value, uint8_t parameter, const unsigned long time)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	const bool success = push(type, value, parameter, time);
+	SREG = oldSREG;
+	return success;
+}
+
+
+bool EventQueue::pop(Event &event)
+{
+	const uint8_t tail = _tail;
+	if (tail == _head) {
+		return false;
+	}
+	memoryBarrier();
+	event = _events[tail & indexMask];
+	memoryBarrier();
+	_tail = tail + 1;
+	return true;
+}
+
+
+void EventQueue::resetStatistics()
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	_maximumDepth = depth();
+	_overflowCount = 0;
+	SREG = oldSREG;
+}
+
+
+void EventQueue::printStatistics(Print &output)
+{
+	output.print(F("Event queue depth: "));
+	output.print(depth());
+	output.print(F(" maximum: "));
+	output.print(_maximumDepth);
+	output.print(F(" of "));
+	output.print(size);
+	output.print(F(" overflows: "));
+	output.println(_overflowCount);
+}
+
+
+}
+
+
@@ -0,0 +1,121 @@
+#pragma once
+//
+// EventQueue
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// A queue of events, from the interrupts and the modules to the loop.
+///
+/// The queue is a ring buffer for one producer and one consumer. The
+/// producer only writes the head index, the consumer only writes the tail
+/// index. Both indexes are single bytes, which are read and written
+/// atomically on the AVR. So push() is safe in an interrupt, and pop() is
+/// safe in the loop, without disabling the interrupts.
+///
+/// Interrupts do not interrupt each other, so all interrupts together are
+/// one producer. The ADC interrupt pushes the InputFault events this way.
+/// Code in the loop has to use pushFromLoop(), which disables the
+/// interrupts for the few instructions of the push.
+///
+/// The loop drains the queue with pop(). If the queue is full, the new
+/// event is dropped and counted as overflow.
+///
+class EventQueue
+{
+public:
+	/// The type of an event.
+	///
+	enum Type : uint8_t {
+		SensorStatus, ///< The status of the motion sensors, the value is the status, the parameter the zone.
+		PlaybackDone, ///< A voice was played, the value is the voice index, the parameter the zone.
+		CardError, ///< An error of the SD-Card, the value is the error.
+		InputFault, ///< From the ADC interrupt, the value is the analog input, the parameter 1 if it reads 0, and 0 if it works again.
+	};
+
+	/// A single event.
+	///
+	struct Event {
+		unsigned long time; ///< The time of the event in ms.
+		Type type; ///< The type of the event.
+		uint8_t value; ///< A value which depends on the type.
+		uint8_t parameter; ///< A parameter which depends on the type.
+	};
+
+	/// The number of events in the queue, a power of two.
+	///
+	static const uint8_t size = 8;
+
+public:
+	/// ctor
+	///
+	EventQueue();
+
+public:
+	/// Add an event to the queue.
+	///
+	/// Call this from an interrupt, or with disabled interrupts.
+	///
+	/// @return true if the event was added, false if the queue is full.
+	///
+	bool push(Type type, uint8_t value, uint8_t parameter, const unsigned long time);
+
+	/// Add an event to the queue from the loop.
+	///
+	/// @return true if the event was added, false if the queue is full.
+	///
+	bool pushFromLoop(Type type, uint8_t value, uint8_t parameter, const unsigned long time);
+
+	/// Get the oldest event from the queue.
+	///
+	/// Call this from the loop.
+	///
+	/// @param event The event is copied into this variable.
+	/// @return true if there was an event, false if the queue is empty.
+	///
+	bool pop(Event &event);
+
+	/// Get the number of events in the queue.
+	///
+	inline uint8_t depth() const { return static_cast<uint8_t>(_head - _tail); }
+
+	/// Get the maximum number of events in the queue since the last reset.
+	///
+	inline uint8_t maximumDepth() const { return _maximumDepth; }
+
+	/// Get the number of dropped events since the last reset.
+	///
+	inline uint16_t overflowCount() const { return _overflowCount; }
+
+	/// Reset the maximum depth and the overflow counter.
+	///
+	void resetStatistics();
+
+	/// Print the depth and the overflow counter.
+	///
+	void printStatistics(Print &output);
+
+private:
+	Event _events[size]; ///< The ring buffer with the events.
+	volatile uint8_t _head; ///< The number of pushed events, written by the producer.
+	volatile uint8_t _tail; ///< The number of popped events, written by the consumer.
+	uint8_t _maximumDepth; ///< The maximum depth since the last reset.
+	uint16_t _overflowCount; ///< The number of dropped events since the last reset.
+};
+
+
+/// The global instance of the event queue.
+///
+extern EventQueue eventQueue;
+
+
+}
+
+
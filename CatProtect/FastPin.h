@@ -0,0 +1,68 @@
+#pragma once
+//
+// FastPin
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// A digital pin of the ATmega328, resolved at compile time.
+///
+/// The port and the bit of the pin are constants, so each access is a
+/// single instruction (sbi/cbi) instead of the table lookups of
+/// digitalWrite(). Pins 0-7 are on port D, pins 8-13 on port B and the
+/// pins 14-19 (A0-A5) on port C.
+///
+template<uint8_t pin>
+class FastPin
+{
+	static_assert(pin < 20, "The ATmega328 has only the pins 0-19.");
+
+public:
+	/// The bit mask of the pin in its port.
+	///
+	static const uint8_t mask = _BV(pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14));
+
+public:
+	/// Make the pin an output.
+	///
+	static inline void setOutput() {
+		ddr() |= mask;
+	}
+
+	/// Set the pin to high.
+	///
+	static inline void setHigh() {
+		port() |= mask;
+	}
+
+	/// Set the pin to low.
+	///
+	static inline void setLow() {
+		port() &= ~mask;
+	}
+
+private:
+	/// The output register of the pin.
+	///
+	static inline volatile uint8_t& port() {
+		return (pin < 8) ? PORTD : ((pin < 14) ? PORTB : PORTC);
+	}
+
+	/// The data direction register of the pin.
+	///
+	static inline volatile uint8_t& ddr() {
+		return (pin < 8) ? DDRD : ((pin < 14) ? DDRB : DDRC);
+	}
+};
+
+
+}
+
+
@@ -6,11 +6,74 @@
 #include "LEDController.h"
 
 
+#include "PowerManager.h"
+
+#include <avr/interrupt.h>
+
+
 namespace lr {
 
 
+/// The global instance of the LED controller.
+///
+LEDController ledController;
+
+
+/// The level of the green part for orange.
+///
+static const uint8_t orangeGreenLevel = 0x50;
+
+/// The masks to decode the steps of a pattern.
+///
+static const uint8_t stepMask = 0xc0;
+static const uint8_t showCode = 0x00;
+static const uint8_t repeatCountMask = 0x3f;
+
+/// The maximum number of steps without a color, before a pattern is stopped.
+///
+static const uint8_t maximumJumpCount = 4;
+
+/// The patterns for the states.
+///
+static const uint8_t offPattern[] PROGMEM = {
+	LED_SHOW(Off, 100),
+	LED_END };
+static const uint8_t onPattern[] PROGMEM = {
+	LED_SHOW(Selected, 100),
+	LED_END };
+static const uint8_t blinkSlowPattern[] PROGMEM = {
+	LED_SHOW(Selected, 500),
+	LED_SHOW(Off, 500),
+	LED_REPEAT(0, 2) };
+static const uint8_t blinkFastPattern[] PROGMEM = {
+	LED_SHOW(Selected, 250),
+	LED_SHOW(Off, 250),
+	LED_REPEAT(0, 2) };
+static const uint8_t flashVerySlowPattern[] PROGMEM = {
+	LED_SHOW(Off, 10000),
+	LED_SHOW(Selected, 25),
+	LED_REPEAT(0, 2) };
+static const uint8_t doubleFlashPattern[] PROGMEM = {
+	LED_SHOW(Selected, 100),
+	LED_SHOW(Off, 150),
+	LED_REPEAT(1, 2),
+	LED_SHOW(Off, 1500),
+	LED_REPEAT(0, 4) };
+
+/// The pattern for each state.
+///
+static const uint8_t* const statePatterns[] PROGMEM = {
+	offPattern,
+	onPattern,
+	blinkSlowPattern,
+	blinkFastPattern,
+	flashVerySlowPattern,
+	doubleFlashPattern };
+
+
 LEDController::LEDController()
-	: _blinkTimer(), _enabled(false), _color(Red), _state(Off)
+	: _color(Red), _brightness(0xff), _pattern(offPattern), _position(0), _repeatLeft(0),
+	_shownColor(PatternOff), _greenLevel(0), _ticksLeft(1)
 {
 }
 
@@ -23,114 +86,161 @@ LEDController::~LEDController()
 void LEDController::setup()
 {
 	// Set the status LED outputs
-	pinMode(RED_STATUS_PIN, OUTPUT);
-	pinMode(GREEN_STATUS_PIN, OUTPUT);
-	digitalWrite(RED_STATUS_PIN, LOW);
-	digitalWrite(GREEN_STATUS_PIN, LOW);
+	RedPin::setLow();
+	GreenPin::setLow();
+	RedPin::setOutput();
+	GreenPin::setOutput();
+	// Timer 0 already runs in fast PWM mode for millis(), connect the
+	// output compare A to pin 6 only if the red part is dimmed.
+	TCCR0A &= ~(_BV(COM0A1)|_BV(COM0A0));
+	// Timer 2 in fast PWM mode without outputs, with the pre-scaler 256.
+	uint8_t oldSREG = SREG;
+	cli();
+	TCCR2A = _BV(WGM21)|_BV(WGM20);
+	TCCR2B = _BV(CS22)|_BV(CS21);
+	OCR2B = 0;
+	TIFR2 = _BV(TOV2)|_BV(OCF2B);
+	TIMSK2 = _BV(TOIE2);
+	SREG = oldSREG;
 }
 
 
-void LEDController::loop(unsigned long currentTime)
+void LEDController::setState(Color color, State state)
 {
-	if (_blinkTimer.check(currentTime)) {
-		onTimer();
-	}
-	if (_color == Orange && _enabled) {
-		if ((currentTime & 0x07) < 4) {
-			digitalWrite(RED_STATUS_PIN, HIGH);
-			digitalWrite(GREEN_STATUS_PIN, LOW);
-		} else {
-			digitalWrite(RED_STATUS_PIN, LOW);
-			digitalWrite(GREEN_STATUS_PIN, HIGH);
-		}
+	setPattern(reinterpret_cast<const uint8_t*>(pgm_read_word(&statePatterns[state])), color);
+}
+
+
+void LEDController::setPattern(const uint8_t *pattern, Color color)
+{
+	if (_pattern == pattern && _color == color) {
+		return;
 	}
+	uint8_t oldSREG = SREG;
+	cli();
+	_pattern = pattern;
+	_color = color;
+	_position = 0;
+	_repeatLeft = 0;
+	nextStep();
+	SREG = oldSREG;
 }
 
 
-void LEDController::setState(Color color, State state)
+void LEDController::setBrightness(uint8_t brightness)
 {
-	if (_color != color || _state != state) {
-		_color = color;
-		_state = state;
-		switch(state) {
-		case Off:
-			disable();
-			_blinkTimer.stop();
-			break;
-		case On:
-			enable();
-			_blinkTimer.stop();
-			break;
-		case BlinkSlow:
-			enable();
-			_blinkTimer.start(500, millis());				
-			break;
-		case BlinkFast:
-			enable();
-			_blinkTimer.start(250, millis());				
-			break;
-		case FlashVerySlow:
-			disable();
-			_blinkTimer.start(10000, millis());
-		}
-	}		
+	uint8_t oldSREG = SREG;
+	cli();
+	_brightness = brightness;
+	updateLevels();
+	SREG = oldSREG;
 }
 
 
-/// This method is called if the timer "fires".
-///
-void LEDController::onTimer()
+void LEDController::nextStep()
 {
-	if (_state != FlashVerySlow) {
-		if (_enabled) {
-			disable();
+	for (uint8_t jumpCount = 0; jumpCount < maximumJumpCount; ++jumpCount) {
+		const uint8_t code = pgm_read_byte(_pattern + _position);
+		const uint8_t operand = pgm_read_byte(_pattern + _position + 1);
+		if ((code & stepMask) == showCode) {
+			_position += 2;
+			_shownColor = (code >> 3);
+			_ticksLeft = ((static_cast<uint16_t>(code & 0x03) << 8) | operand) * patternUnit;
+			updateLevels();
+			return;
+		} else if ((code & stepMask) == patternRepeat) {
+			const uint8_t count = (code & repeatCountMask);
+			if (count == 0) {
+				_position -= operand;
+			} else if (_repeatLeft == 0) {
+				_repeatLeft = count;
+				_position -= operand;
+			} else if (--_repeatLeft > 0) {
+				_position -= operand;
+			} else {
+				_position += 2;
+			}
 		} else {
-			enable();
-		}
-	} else {
-		if (_enabled) {
-			disable();
-			_blinkTimer.start(10000, millis());
-		} else {
-			enable();
-			_blinkTimer.start(25, millis());
+			break;
 		}
 	}
+	// The end of the pattern, keep the shown color.
+	_ticksLeft = 0xffff;
 }
 
 
-/// Enable the LED with the selected color
-///
-void LEDController::enable()
+void LEDController::updateLevels()
 {
-	_enabled = true;
-	switch (_color) {
-	case Red:
-		digitalWrite(RED_STATUS_PIN, HIGH);
-		digitalWrite(GREEN_STATUS_PIN, LOW);
+	uint8_t color = _shownColor;
+	if (color == PatternSelected) {
+		color = PatternRed + _color;
+	}
+	uint8_t red = 0;
+	uint8_t green = 0;
+	switch (color) {
+	case PatternRed:
+		red = 0xff;
 		break;
-	case Green:
-		digitalWrite(RED_STATUS_PIN, LOW);
-		digitalWrite(GREEN_STATUS_PIN, HIGH);
+	case PatternGreen:
+		green = 0xff;
 		break;
-	case Orange:
-		// This is controlled in the Loop
+	case PatternOrange:
+		red = 0xff;
+		green = orangeGreenLevel;
 		break;
 	default:
 		break;
 	}
+	red = (static_cast<uint16_t>(red) * (_brightness + 1)) >> 8;
+	green = (static_cast<uint16_t>(green) * (_brightness + 1)) >> 8;
+	// The red part. Fast PWM always creates a short pulse, so use the
+	// port for the levels 0 and 255, like analogWrite().
+	if (red == 0 || red == 0xff) {
+		TCCR0A &= ~_BV(COM0A1);
+		if (red == 0) {
+			RedPin::setLow();
+		} else {
+			RedPin::setHigh();
+		}
+	} else {
+		OCR0A = red;
+		TCCR0A |= _BV(COM0A1);
+	}
+	// The green part. The compare match interrupt is only required to dim it.
+	_greenLevel = green;
+	OCR2B = green;
+	if (green == 0 || green == 0xff) {
+		TIMSK2 &= ~_BV(OCIE2B);
+		if (green == 0) {
+			GreenPin::setLow();
+		} else {
+			GreenPin::setHigh();
+		}
+	} else {
+		TIFR2 = _BV(OCF2B);
+		TIMSK2 |= _BV(OCIE2B);
+	}
 }
 
-	
-/// Diable the LED
+
+}
+
+
+/// The overflow interrupt of timer 2, at the start of each PWM period.
 ///
-void LEDController::disable()
+ISR(TIMER2_OVF_vect)
 {
-	_enabled = false;
-	digitalWrite(RED_STATUS_PIN, LOW);
-	digitalWrite(GREEN_STATUS_PIN, LOW);
+	lr::powerManager.onInterrupt();
+	lr::ledController.onTick();
 }
 
 
+/// The compare match B interrupt of timer 2, to dim the green part.
+///
+ISR(TIMER2_COMPB_vect)
+{
+	lr::powerManager.onInterrupt();
+	lr::ledController.onGreenOff();
 }
 
+
@@ -6,9 +6,32 @@
 //
 
 
-#include "Timer.h"
+#include "FastPin.h"
 
 #include <Arduino.h>
+#include <avr/pgmspace.h>
+
+
+/// Show a color in a LED pattern for the given time in ms (16ms to 16s).
+///
+/// The color is one of Off, Selected, Red, Green or Orange.
+///
+#define LED_SHOW(color, milliseconds) \
+	static_cast<uint8_t>(((lr::LEDController::Pattern##color) << 3) | ((lr::LEDController::patternDuration(milliseconds)) >> 8)), \
+	static_cast<uint8_t>(lr::LEDController::patternDuration(milliseconds))
+
+/// Repeat the previous steps of a LED pattern.
+///
+/// @param count The number of repetitions (1-63), or 0 to repeat forever.
+/// @param steps The number of steps to go back.
+///
+#define LED_REPEAT(count, steps) \
+	static_cast<uint8_t>(lr::LEDController::patternRepeat | (count)), static_cast<uint8_t>((steps) * 2)
+
+/// End a LED pattern, the last color is kept.
+///
+#define LED_END \
+	static_cast<uint8_t>(lr::LEDController::patternEnd), 0
 
 
 namespace lr {
@@ -16,17 +39,48 @@ namespace lr {
 
 /// This class controls the Signal LED
 ///
+/// The LED is driven by the timers, so the patterns keep running without
+/// the loop. The red part on pin 6 uses the hardware PWM of timer 0 (OC0A),
+/// which also runs millis(). Pin 7 has no PWM output, so the green part is
+/// switched by the interrupts of timer 2: The overflow sets the pin, and
+/// the compare match B clears it. The overflow also runs the pattern
+/// sequencer, every tickTime microseconds.
+///
+/// Orange is a real mix of both colors, with less green than red.
+///
+/// Each pattern is a small program in PROGMEM, written with the LED_SHOW,
+/// LED_REPEAT and LED_END macros. Every step has two bytes:
+/// - 00ccc0hh llllllll: Show color c for hhllllllll units of patternUnit ticks.
+/// - 01nnnnnn bbbbbbbb: Go back b bytes, n times or forever if n is 0.
+/// - 11000000 00000000: End the pattern, keep the last color.
+///
+/// Repeats with a count can not be nested, repeats forever can enclose one.
+/// A new pattern only costs the bytes of its table.
+///
+/// The class owns the timer 2 interrupts. While interrupts are disabled,
+/// e.g. in AudioPlayer::play(), call poll() to keep the patterns running.
+///
 class LEDController
 {
-private:
-	/// The pin where the red part of the LED is connected.
+public:
+	/// The time of one tick in microseconds.
 	///
-	const int RED_STATUS_PIN = 6;
-	
-	/// The pin where the green part of the LED is connected.
+	/// Timer 2 runs in fast PWM mode with the pre-scaler 256.
 	///
-	const int GREEN_STATUS_PIN = 7;
-	
+	static const uint16_t tickTime = 4096;
+
+	/// The number of ticks for one unit of a pattern duration.
+	///
+	static const uint8_t patternUnit = 4;
+
+	/// The code of a repeat step in a pattern.
+	///
+	static const uint8_t patternRepeat = 0x40;
+
+	/// The code of the end step of a pattern.
+	///
+	static const uint8_t patternEnd = 0xc0;
+
 public:
 	/// The color for the LED
 	///
@@ -35,7 +89,7 @@ public:
 		Green, ///< Green
 		Orange ///< Orange (both)
 	};
-	
+
 	/// The states for the LED
 	///
 	enum State : uint8_t {
@@ -44,27 +98,34 @@ public:
 		BlinkSlow, ///< Blink with 500ms
 		BlinkFast, ///< Blink with 250ms
 		FlashVerySlow, ///< Short flash to indicate the device is running.
+		DoubleFlash, ///< Two short flashes every two seconds, e.g. while the card is recovered.
+	};
+
+	/// The colors in a pattern.
+	///
+	enum PatternColor : uint8_t {
+		PatternOff, ///< The LED is off.
+		PatternSelected, ///< The color selected with setState() or setPattern().
+		PatternRed, ///< Red
+		PatternGreen, ///< Green
+		PatternOrange, ///< Orange
 	};
-	
+
 public:
 	/// ctor
 	///
 	LEDController();
-	
+
 	/// dtor
 	///
 	~LEDController();
-	
+
 public:
 	/// Call this method in the setup() method.
 	///
-	void setup();
-
-	/// Call this method in each loop.
-	///
-	/// @param The current time to the loop.
+	/// This starts timer 2 and connects the PWM output of timer 0.
 	///
-	void loop(unsigned long currentTime);
+	void setup();
 
 	/// Set the LED state.
 	///
@@ -72,19 +133,103 @@ public:
 	/// @param state The state for the LED
 	///
 	void setState(Color color, State state);
-	
+
+	/// Run a pattern.
+	///
+	/// The pattern is only restarted if the pattern or the color changed.
+	///
+	/// @param pattern The pattern in PROGMEM.
+	/// @param color The color for the selected color in the pattern.
+	///
+	void setPattern(const uint8_t *pattern, Color color);
+
+	/// Set the brightness of the LED.
+	///
+	/// @param brightness The brightness from 0 (off) to 255 (full).
+	///
+	void setBrightness(uint8_t brightness);
+
+	/// Process the timer 2 events, while interrupts are disabled.
+	///
+	inline void poll() {
+		const uint8_t flags = TIFR2;
+		if ((flags & _BV(TOV2)) != 0) {
+			TIFR2 = _BV(TOV2); // Reset the interrupt flag.
+			onTick();
+		}
+		if ((flags & _BV(OCF2B)) != 0 && (TIMSK2 & _BV(OCIE2B)) != 0) {
+			TIFR2 = _BV(OCF2B); // Reset the interrupt flag.
+			onGreenOff();
+		}
+	}
+
+	/// Set the green pin at the start of a PWM period and step the pattern.
+	///
+	/// This is called from the interrupt.
+	///
+	inline void onTick() {
+		if (_greenLevel != 0) {
+			GreenPin::setHigh();
+		}
+		if (--_ticksLeft == 0) {
+			nextStep();
+		}
+	}
+
+	/// Clear the green pin at the compare match.
+	///
+	/// This is called from the interrupt.
+	///
+	inline void onGreenOff() {
+		GreenPin::setLow();
+	}
+
+	/// Get the duration in units for a time in ms.
+	///
+	static constexpr uint16_t patternDuration(uint32_t milliseconds) {
+		return limitDuration(milliseconds * 1000 / (static_cast<uint32_t>(tickTime) * patternUnit));
+	}
+
 private:
-	void onTimer();
-	void enable();
-	void disable();
-	
+	/// The pin of the red part, it has to be the output of OC0A.
+	///
+	typedef FastPin<6> RedPin;
+
+	/// The pin of the green part.
+	///
+	typedef FastPin<7> GreenPin;
+
+	/// Limit a duration to the range of a pattern step.
+	///
+	static constexpr uint16_t limitDuration(uint32_t units) {
+		return (units > 0x3ff) ? 0x3ff : ((units == 0) ? 1 : units);
+	}
+
+	/// Run the steps of the pattern, until the next color is shown.
+	///
+	void nextStep();
+
+	/// Calculate the levels for the shown color and the brightness.
+	///
+	void updateLevels();
+
 private:
-	State _state; ///< The current selected state.
 	Color _color; ///< The current selected color.
-	Timer _blinkTimer; ///< The timer used to create the blink state.
-	bool _enabled; ///< The state variable to let the LED blink.
+	uint8_t _brightness; ///< The brightness of the LED.
+	const uint8_t *_pattern; ///< The current pattern.
+	volatile uint8_t _position; ///< The position of the next step in the pattern.
+	volatile uint8_t _repeatLeft; ///< The repetitions left for the current repeat step, or 0.
+	volatile uint8_t _shownColor; ///< The color shown by the pattern.
+	volatile uint8_t _greenLevel; ///< The current PWM level of the green part.
+	volatile uint16_t _ticksLeft; ///< The ticks until the next step of the pattern.
 };
 
 
+/// The global instance of the LED controller.
+///
+extern LEDController ledController;
+
+
 }
 
+
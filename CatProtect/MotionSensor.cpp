@@ -6,12 +6,25 @@
 #include "MotionSensor.h"
 
 
+#include "AnalogSampler.h"
+#ifdef MOTIONSENSOR_CLASSIFIER
+#include "ClassifierWeights.h"
+#endif
+
+
 namespace lr {
 
 
 MotionSensor::MotionSensor()
-	: _lastState(false), _status(Uninitialized), _callback(0)
+	: _status(Uninitialized), _sensorCount(0), _sensorMask(0), _lastStates(0), _readyMask(0),
+	_activeStates(0), _pendingStates(0), _baselineTime(0), _slopeTime(0), _preAlarmSensor(noSensor),
+	_preAlarmTime(0)
 {
+#ifdef MOTIONSENSOR_CLASSIFIER
+	_classifySensor = noSensor;
+	_lastScore = 0;
+	memset(&_lastFeatures, 0, sizeof(Features));
+#endif
 }
 
 
@@ -20,73 +33,281 @@ MotionSensor::~MotionSensor()
 }
 
 
+bool MotionSensor::addSensor(uint8_t channel, uint16_t threshold, uint8_t zone)
+{
+	if (_sensorCount >= maxSensorCount) {
+		return false;
+	}
+	_channel[_sensorCount] = channel;
+	_threshold[_sensorCount] = threshold;
+	_zone[_sensorCount] = zone;
+	_baseline[_sensorCount] = 0;
+	_slopeValue[_sensorCount] = 0;
+	_lastEvent[_sensorCount] = 0;
+	_pendingSince[_sensorCount] = 0;
+	_sensorMask |= _BV(_sensorCount);
+	++_sensorCount;
+	return true;
+}
+
+
 void MotionSensor::setup()
 {
+	uint8_t channelMask = 0;
+	for (uint8_t i = 0; i < _sensorCount; ++i) {
+		channelMask |= _BV(_channel[i]);
+	}
+	analogSampler.begin(channelMask);
 }
 
 
 void MotionSensor::loop(const unsigned long currentTime)
 {
 	if (_status == Uninitialized) {
-		_lastState = currentSensorState();
-		setStatus(WaitStablilize, currentTime);
-	} else if (_status == WaitStablilize) {
-		// Check the sensor state.
-		const bool sensorState = currentSensorState();
-		if (sensorState != _lastState) {
-			_lastEvent.start(currentTime);
-			_lastState = sensorState;			
-		} else if (sensorState == false) {
-			if ((_lastEvent.elapsed(currentTime)/1000) >= IDLE_TIME) {
-				// Great, we can process in working state.
-				setStatus(Idle, currentTime);
+		// Start the baselines with the current values.
+		for (uint8_t i = 0; i < _sensorCount; ++i) {
+			_slopeValue[i] = analogSampler.value(_channel[i]);
+			_baseline[i] = _slopeValue[i] << baselineFraction;
+			_lastEvent[i] = currentTime;
+		}
+		_baselineTime = currentTime;
+		_slopeTime = currentTime;
+		_lastStates = updateSensorStates(currentTime);
+		setStatus(WaitStablilize, currentTime, 0);
+		return;
+	}
+
+#ifdef MOTIONSENSOR_TRACE
+	if (_sensorCount > 0) {
+		_trace.add(currentTime, analogSampler.value(_channel[0]));
+	}
+#endif
+
+	// Check the sensor states.
+	const uint8_t states = updateSensorStates(currentTime);
+	const uint8_t changedStates = states ^ _lastStates;
+	if (changedStates != 0) {
+		_lastStates = states;
+		for (uint8_t i = 0; i < _sensorCount; ++i) {
+			if ((changedStates & _BV(i)) != 0) {
+				_lastEvent[i] = currentTime;
+			}
+		}
+		// Ready sensors which register motion raise an alarm.
+		const uint8_t alarms = changedStates & states & _readyMask;
+		_readyMask &= ~alarms;
+		if (alarms != 0 && _status != WaitStablilize) {
+			for (uint8_t i = 0; i < _sensorCount; ++i) {
+				if ((alarms & _BV(i)) != 0) {
+#ifdef MOTIONSENSOR_CLASSIFIER
+					if (_classifySensor == noSensor) {
+						startClassification(i, currentTime);
+						continue;
+					}
+#endif
+					setStatus(Alarm, currentTime, _zone[i]);
+				}
 			}
 		}
-	} else if (_status == Idle) {
-		const bool sensorState = currentSensorState();
-		if (sensorState) { // Alarm!
-			_lastState = true;
-			_lastEvent.start(currentTime);
-			setStatus(Alarm, currentTime);
-		}		
-	} else if (_status == Alarm) {
-		// Wait until the sensor goes back to idle state.
-		const bool sensorState = currentSensorState();
-		if (sensorState != _lastState) {
-			_lastEvent.start(currentTime);
-			_lastState = sensorState;			
-		} else if (sensorState == false) {
-			if ((_lastEvent.elapsed(currentTime)/1000) >= IDLE_TIME) {
-				// Great, we can process in working state.
-				setStatus(Idle, currentTime);
+	}
+
+	updatePreAlarm(currentTime, states);
+#ifdef MOTIONSENSOR_CLASSIFIER
+	updateClassification(currentTime, states);
+#endif
+
+	// Sensors in LOW state, which are not ready, wait for the idle time.
+	const uint8_t waitingSensors = _sensorMask & ~(states | _readyMask);
+	if (waitingSensors != 0) {
+		for (uint8_t i = 0; i < _sensorCount; ++i) {
+			if ((waitingSensors & _BV(i)) != 0 && ((currentTime - _lastEvent[i])/1000) >= static_cast<unsigned long>(IDLE_TIME)) {
+				_readyMask |= _BV(i);
 			}
 		}
+		if (_readyMask == _sensorMask) {
+			// Great, all sensors are in working state.
+			setStatus(Idle, currentTime, 0);
+		}
 	}
 }
 
 
-bool MotionSensor::currentSensorState() const
+uint8_t MotionSensor::updateSensorStates(const unsigned long currentTime)
 {
-	const int sensorValue = analogRead(MOTION_SENSOR);
-	const bool sensorState = (sensorValue > 200);
-	return sensorState;
+	// In the warm-up, the baselines follow at each call. A sensor which is HIGH at the
+	// start would otherwise keep a high baseline for a long time, and miss motion.
+	const bool updateBaseline = _status == WaitStablilize || (currentTime - _baselineTime) >= baselineInterval;
+	if (updateBaseline) {
+		_baselineTime = currentTime;
+	}
+	for (uint8_t i = 0; i < _sensorCount; ++i) {
+		const uint8_t sensorBit = _BV(i);
+		const uint16_t value = analogSampler.value(_channel[i]);
+		const uint16_t baseline = _baseline[i] >> baselineFraction;
+		if ((_activeStates & sensorBit) != 0) {
+			// Keep the sensor active, until the value falls below 3/4 of the threshold.
+			if (value < baseline + _threshold[i] - (_threshold[i] >> 2)) {
+				_activeStates &= ~sensorBit;
+			}
+		} else if (value > baseline + _threshold[i]) {
+			// Ignore short spikes above the threshold.
+			if ((_pendingStates & sensorBit) == 0) {
+				_pendingStates |= sensorBit;
+				_pendingSince[i] = currentTime;
+			} else if ((currentTime - _pendingSince[i]) >= minimumActiveTime) {
+				_pendingStates &= ~sensorBit;
+				_activeStates |= sensorBit;
+			}
+		} else {
+			_pendingStates &= ~sensorBit;
+			// Follow slow changes of the idle sensor.
+			if (updateBaseline) {
+				const int16_t delta = static_cast<int16_t>(value << baselineFraction) - static_cast<int16_t>(_baseline[i]);
+				// Round to the nearest step, a plain shift of a negative delta would round down.
+				_baseline[i] += (delta + (1 << (baselineShift - 1))) >> baselineShift;
+			}
+		}
+	}
+	return _activeStates;
 }
 
 
-void MotionSensor::setStatus(Status status, const unsigned long currentTime)
+void MotionSensor::updatePreAlarm(const unsigned long currentTime, uint8_t states)
 {
-	if (_status != status) {
-		_status = status;
-		if (_callback != 0) {
-			_callback(currentTime, status);
+	// The pre-alarm ends with the alarm of the sensor.
+	if (_preAlarmSensor != noSensor && (states & _BV(_preAlarmSensor)) != 0) {
+		_preAlarmSensor = noSensor;
+	}
+	if ((currentTime - _slopeTime) < slopeInterval) {
+		return;
+	}
+	_slopeTime = currentTime;
+	for (uint8_t i = 0; i < _sensorCount; ++i) {
+		const uint16_t value = analogSampler.value(_channel[i]);
+		const int16_t slope = static_cast<int16_t>(value - _slopeValue[i]);
+		_slopeValue[i] = value;
+		const uint16_t baseline = _baseline[i] >> baselineFraction;
+		if (i == _preAlarmSensor) {
+			if (value < baseline + (_threshold[i] >> 2) || (currentTime - _preAlarmTime) >= preAlarmTimeout) {
+				_preAlarmSensor = noSensor;
+				notify(PreAlarmCancel, currentTime, _zone[i]);
+			}
+		} else if (_preAlarmSensor == noSensor && _status != WaitStablilize &&
+			(_readyMask & ~states & _BV(i)) != 0 &&
+			value > baseline + (_threshold[i] >> 1) && slope >= static_cast<int16_t>(_threshold[i] >> 3)) {
+			_preAlarmSensor = i;
+			_preAlarmTime = currentTime;
+			notify(PreAlarm, currentTime, _zone[i]);
+		}
+	}
+}
+
+
+#ifdef MOTIONSENSOR_CLASSIFIER
+void MotionSensor::startClassification(uint8_t sensor, const unsigned long currentTime)
+{
+	_classifySensor = sensor;
+	_classifyWasActive = true;
+	_classifyOscillations = 0;
+	_classifyPeak = 0;
+	_classifyActiveTime = 0;
+	_classifyStartTime = currentTime;
+	_classifyPeakTime = currentTime;
+	_classifyLastTime = currentTime;
+}
+
+
+void MotionSensor::updateClassification(const unsigned long currentTime, uint8_t states)
+{
+	if (_classifySensor == noSensor) {
+		return;
+	}
+	const uint8_t i = _classifySensor;
+	const uint16_t value = analogSampler.value(_channel[i]);
+	const uint16_t baseline = _baseline[i] >> baselineFraction;
+	const uint16_t amplitude = (value > baseline) ? (value - baseline) : 0;
+	if (amplitude > _classifyPeak) {
+		_classifyPeak = amplitude;
+		_classifyPeakTime = currentTime;
+	}
+	const bool isActive = (states & _BV(i)) != 0;
+	if (_classifyWasActive) {
+		_classifyActiveTime += currentTime - _classifyLastTime;
+	}
+	if (isActive != _classifyWasActive) {
+		_classifyWasActive = isActive;
+		if (_classifyOscillations < 0xff) {
+			++_classifyOscillations;
 		}
 	}
+	_classifyLastTime = currentTime;
+	if ((currentTime - _classifyStartTime) < classificationWindow) {
+		return;
+	}
+
+	// Scale the features to bytes and weight them.
+	_lastFeatures.amplitude = min(_classifyPeak >> 2, 0xff);
+	_lastFeatures.riseTime = min((_classifyPeakTime - _classifyStartTime) >> 2, 0xffUL);
+	_lastFeatures.duration = min(_classifyActiveTime >> 2, 0xff);
+	_lastFeatures.oscillations = _classifyOscillations;
+	const uint8_t *features = reinterpret_cast<const uint8_t*>(&_lastFeatures);
+	int32_t score = static_cast<int16_t>(pgm_read_word(&classifierWeights[0]));
+	for (uint8_t f = 0; f < featureCount; ++f) {
+		score += static_cast<int32_t>(static_cast<int16_t>(pgm_read_word(&classifierWeights[f + 1]))) * features[f];
+	}
+	_lastScore = score;
+	_classifySensor = noSensor;
+	if (score >= 0) {
+		// Only the event tells the sketch that the alarm was classified.
+		_status = Alarm;
+		notify(ClassifiedAlarm, currentTime, _zone[i]);
+	} else {
+		notify(AlarmSuppressed, currentTime, _zone[i]);
+	}
+}
+#endif
+
+
+void MotionSensor::setStatus(Status status, const unsigned long currentTime, uint8_t zone)
+{
+	// Each alarm is reported, even if another sensor is still in alarm state.
+	if (_status != status || status == Alarm) {
+		_status = status;
+		notify(status, currentTime, zone);
+	}
+}
+
+
+void MotionSensor::notify(Status status, const unsigned long currentTime, uint8_t zone)
+{
+	eventQueue.pushFromLoop(EventQueue::SensorStatus, status, zone, currentTime);
+}
+
+
+void MotionSensor::printLastClassification(Print &output)
+{
+#ifdef MOTIONSENSOR_CLASSIFIER
+	output.print(F("class "));
+	output.print(_lastFeatures.amplitude);
+	output.print(' ');
+	output.print(_lastFeatures.riseTime);
+	output.print(' ');
+	output.print(_lastFeatures.duration);
+	output.print(' ');
+	output.print(_lastFeatures.oscillations);
+	output.print(' ');
+	output.println(_lastScore);
+#endif
 }
 
 
-void MotionSensor::setCallback(Callback callback)
+void MotionSensor::printTrace(Print &output)
 {
-	_callback = callback;
+#ifdef MOTIONSENSOR_TRACE
+	_trace.print(output);
+#else
+	output.println(F("No trace."));
+#endif
 }
 
 
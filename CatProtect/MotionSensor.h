@@ -6,39 +6,135 @@
 //
 
 
-#include "TimeDelta.h"
+#include "EventQueue.h"
+#include "SensorTrace.h"
 
 #include <Arduino.h>
 
 
+/// Record a compressed trace of the value of the first sensor in RAM.
+/// The trace is printed with printTrace(). This needs about 200 bytes of RAM.
+///
+//#define MOTIONSENSOR_TRACE
+
+/// Classify each alarm before it is reported, to suppress alarms which are
+/// probably not caused by a cat. The weights are in ClassifierWeights.h.
+///
+//#define MOTIONSENSOR_CLASSIFIER
+
+
 namespace lr {
 
 
-/// The class which handles the motion sensor.
+/// The class which handles the motion sensors.
+///
+/// Up to maxSensorCount sensors are connected to the analog inputs. Each
+/// sensor has its own threshold and belongs to a zone, which selects the
+/// voices played for an alarm of the sensor.
+///
+/// The threshold is relative to a baseline, which follows slow changes of
+/// the idle sensor output, e.g. on warm days. The baseline is an
+/// exponential moving average in fixed point, updated every
+/// baselineInterval while the sensor is inactive. While the sensors
+/// stabilize, the baselines are updated at each loop, so they settle in a
+/// few seconds, even if a sensor is HIGH at the start. A sensor gets active if
+/// its value stays above the baseline plus the threshold for
+/// minimumActiveTime, short spikes are ignored. It gets inactive again if
+/// the value falls below the baseline plus 3/4 of the threshold.
+///
+/// A ready sensor with a value rising quickly above half of the threshold
+/// raises a pre-alarm. This gives the application time to prepare the
+/// playback before the alarm. The pre-alarm is cancelled if the value
+/// falls below a quarter of the threshold, or after preAlarmTimeout.
+///
+/// With MOTIONSENSOR_CLASSIFIER defined, an alarm is only reported after
+/// a classification window. In this window, features of the signal are
+/// collected and weighted with a linear classifier. Alarms with a negative
+/// score are suppressed, the others are reported as ClassifiedAlarm event.
+/// This holds each classified alarm back for classificationWindow, which
+/// adds to the start latency of the playback, and is longer than the time
+/// the prepared read of the pre-alarm saves. DetectorBenchClassifier
+/// measures the delay. Only one alarm is classified at a time, alarms of
+/// other sensors in the window are reported as Alarm event without
+/// classification.
+///
+/// Each change of the status is pushed as SensorStatus event to the
+/// event queue.
+///
+/// The state of all sensors is kept in arrays and bit masks, with one bit
+/// for each sensor. A loop iteration compares each value with the threshold
+/// of the sensor, everything else is done with the masks. Only sensors with
+/// a changed state, or sensors waiting for the idle time, take more work.
 ///
 class MotionSensor
 {
 public:
-	/// The status of the motion sensor.
+	/// The status of the motion sensors.
 	enum Status : uint8_t {
 		Uninitialized, ///< Loop was never called before.
-		WaitStablilize, ///< Wait for the sensor to stabilize.
-		Idle, ///< The motion sensor is working.
-		Alarm, ///< The motion sensor registered motion.
+		WaitStablilize, ///< Wait for the sensors to stabilize.
+		Idle, ///< The motion sensors are working.
+		Alarm, ///< A motion sensor registered motion.
+		PreAlarm, ///< Only as event, a sensor value rises towards the threshold.
+		PreAlarmCancel, ///< Only as event, the pre-alarm ended without an alarm.
+		AlarmSuppressed, ///< Only as event, the classifier rejected an alarm.
+		ClassifiedAlarm, ///< Only as event, the classifier accepted an alarm. The combined status is Alarm.
+	};
+
+	/// The features of an alarm for the classifier.
+	///
+	struct Features {
+		uint8_t amplitude; ///< The peak above the baseline, in 4 ADC steps.
+		uint8_t riseTime; ///< The time from the alarm to the peak in 4ms.
+		uint8_t duration; ///< The time the sensor was active in the window in 4ms.
+		uint8_t oscillations; ///< The number of changes of the active state in the window.
 	};
 
-	/// The callback.
+	/// The number of features.
 	///
-	/// The first parameter is the current time, and the
-	/// The second parameter is the new status.
+	static const uint8_t featureCount = 4;
+
+	/// The maximum number of sensors.
 	///
-	typedef void (*Callback)(const unsigned long, Status);
+	static const uint8_t maxSensorCount = 4;
 
-private:
-	/// The analog pin of the motion sensor.
+	/// The time in ms a value has to stay above the threshold, until the sensor is active.
 	///
-	const int MOTION_SENSOR = 0;
+	static const uint16_t minimumActiveTime = 150;
 
+	/// The interval in ms to update the baselines.
+	///
+	static const uint16_t baselineInterval = 500;
+
+	/// The weight of a new value for the baseline is 1/2^baselineShift.
+	///
+	/// This is a time constant of about 16 seconds.
+	///
+	static const uint8_t baselineShift = 5;
+
+	/// The number of fraction bits of the baselines.
+	///
+	static const uint8_t baselineFraction = 5;
+
+	/// The interval in ms to measure the slope for the pre-alarm.
+	///
+	static const uint8_t slopeInterval = 50;
+
+	/// The time in ms after a pre-alarm is cancelled if there was no alarm.
+	///
+	static const uint16_t preAlarmTimeout = 2000;
+
+	/// The value if no sensor is in pre-alarm.
+	///
+	static const uint8_t noSensor = 0xff;
+
+	/// The time in ms to collect the features of an alarm.
+	///
+	/// A classified alarm is reported this much later than without the classifier.
+	///
+	static const uint16_t classificationWindow = 600;
+
+private:
 	/// The idle time in seconds.
 	/// This is the time which the sensor has to be in LOW state, before another event
 	/// is triggered. It is also the initialization time which is required until
@@ -50,42 +146,130 @@ public:
 	/// ctor
 	///
 	MotionSensor();
-	
+
 	/// dtor
 	///
 	~MotionSensor();
 
 public:
+	/// Add a sensor.
+	///
+	/// Call this before setup().
+	///
+	/// @param channel The analog input of the sensor.
+	/// @param threshold The sensor registers motion if the value is this much above the baseline.
+	/// @param zone The zone of the sensor.
+	/// @return true if the sensor was added, false if there are too many sensors.
+	///
+	bool addSensor(uint8_t channel, uint16_t threshold, uint8_t zone);
+
 	/// Call this method in setup()
 	///
 	void setup();
-	
-	/// Set a callback if the status changes.
-	///
-	void setCallback(Callback callback);
-	
+
 	/// Call this method in loop();
 	///
 	void loop(const unsigned long currentTime);
-	
-	/// Get the current status of the motion sensor.
+
+	/// Get the combined status of all motion sensors.
 	///
 	inline Status status() const { return _status; }
-	
+
+	/// Check if any sensor registers motion right now.
+	///
+	inline bool hasMotion() const { return _activeStates != 0; }
+
+	/// Get the baseline of a sensor, with baselineFraction bits.
+	///
+	inline uint16_t baseline(uint8_t sensor) const { return _baseline[sensor]; }
+
+	/// Print the features and the score of the last classified alarm.
+	///
+	/// The line starts with "class", followed by the features in the order
+	/// of the Features struct and the score. Call this only for the
+	/// ClassifiedAlarm and AlarmSuppressed events, an Alarm event was not
+	/// classified. This prints nothing if MOTIONSENSOR_CLASSIFIER is not
+	/// defined.
+	///
+	void printLastClassification(Print &output);
+
+	/// Print the trace of the first sensor.
+	///
+	/// This prints "No trace." if MOTIONSENSOR_TRACE is not defined.
+	///
+	void printTrace(Print &output);
+
 private:
-	/// Set the status and call the callback
+	/// Set the combined status and push the event.
+	///
+	void setStatus(Status status, const unsigned long currentTime, uint8_t zone);
+
+	/// Push a SensorStatus event to the event queue, without changing the combined status.
+	///
+	/// The parameter of the event is the zone of the sensor for an alarm or pre-alarm, otherwise 0.
+	///
+	void notify(Status status, const unsigned long currentTime, uint8_t zone);
+
+	/// Detect and cancel pre-alarms.
+	///
+	/// @param currentTime The current time in ms.
+	/// @param states The mask with the active sensors.
 	///
-	void setStatus(Status status, const unsigned long currentTime);
-	
-	/// Get the current sensor state.
+	void updatePreAlarm(const unsigned long currentTime, uint8_t states);
+
+#ifdef MOTIONSENSOR_CLASSIFIER
+	/// Start the classification of an alarm.
+	///
+	void startClassification(uint8_t sensor, const unsigned long currentTime);
+
+	/// Collect the features and report the alarm at the end of the window.
+	///
+	void updateClassification(const unsigned long currentTime, uint8_t states);
+#endif
+
+	/// Update the current state of all sensors.
+	///
+	/// This reads the average values of the analog sampler and never blocks.
 	///
-	bool currentSensorState() const;
-	
+	/// @param currentTime The current time in ms.
+	/// @return A mask with the bits of all sensors which register motion.
+	///
+	uint8_t updateSensorStates(const unsigned long currentTime);
+
 private:
-	Status _status; ///< The status of the sensor.
-	TimeDelta _lastEvent; ///< The last event of the sensor.
-	bool _lastState; ///< The last state to detect a change.
-	Callback _callback; ///< The callback to call if the sensor state changes.
+	Status _status; ///< The combined status of the sensors.
+	uint8_t _sensorCount; ///< The number of sensors.
+	uint8_t _sensorMask; ///< A mask with the bits of all sensors.
+	uint8_t _lastStates; ///< The last state of each sensor, to detect a change.
+	uint8_t _readyMask; ///< The sensors which are low for the idle time and ready for an alarm.
+	uint8_t _activeStates; ///< The sensors which register motion.
+	uint8_t _pendingStates; ///< The sensors above the threshold, waiting for the minimum active time.
+	unsigned long _baselineTime; ///< The time of the last baseline update.
+	unsigned long _slopeTime; ///< The time of the last slope measurement.
+	uint8_t _preAlarmSensor; ///< The sensor in pre-alarm, or noSensor.
+	unsigned long _preAlarmTime; ///< The time of the pre-alarm.
+	uint8_t _channel[maxSensorCount]; ///< The analog input of each sensor.
+	uint8_t _zone[maxSensorCount]; ///< The zone of each sensor.
+	uint16_t _threshold[maxSensorCount]; ///< The threshold of each sensor.
+	uint16_t _baseline[maxSensorCount]; ///< The baseline of each sensor, with baselineFraction bits.
+	uint16_t _slopeValue[maxSensorCount]; ///< The value of each sensor at the last slope measurement.
+	unsigned long _pendingSince[maxSensorCount]; ///< The time each sensor went above the threshold.
+	unsigned long _lastEvent[maxSensorCount]; ///< The time of the last change of each sensor.
+#ifdef MOTIONSENSOR_TRACE
+	SensorTrace _trace; ///< The trace of the first sensor.
+#endif
+#ifdef MOTIONSENSOR_CLASSIFIER
+	uint8_t _classifySensor; ///< The sensor with the classified alarm, or noSensor.
+	bool _classifyWasActive; ///< The last active state of the classified sensor.
+	uint8_t _classifyOscillations; ///< The changes of the active state.
+	uint16_t _classifyPeak; ///< The peak above the baseline.
+	uint16_t _classifyActiveTime; ///< The time the sensor was active in ms.
+	unsigned long _classifyStartTime; ///< The time of the alarm.
+	unsigned long _classifyPeakTime; ///< The time of the peak.
+	unsigned long _classifyLastTime; ///< The time of the last update.
+	Features _lastFeatures; ///< The features of the last classified alarm.
+	int32_t _lastScore; ///< The score of the last classified alarm.
+#endif
 };
 
 
@@ -0,0 +1,111 @@
+//
+// PowerManager
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "PowerManager.h"
+
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
+
+
+namespace lr {
+
+
+/// The global instance of the power manager.
+///
+PowerManager powerManager;
+
+
+PowerManager::PowerManager()
+	: _startTime(0), _sleepMillis(0), _sleepMicros(0), _isSleeping(false), _wakeTime(0)
+{
+}
+
+
+void PowerManager::setup()
+{
+	// The two wire interface is not used.
+	power_twi_disable();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	resetStatistics();
+}
+
+
+void PowerManager::sleep()
+{
+	const unsigned long sleepStart = micros();
+	// Enable the interrupts with the sleep instruction, so an interrupt
+	// after the check in the loop can not be missed until the next one.
+	cli();
+	_isSleeping = true;
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	// The interrupt which woke the MCU already ran, its time is not spent sleeping.
+	cli();
+	unsigned long sleepEnd;
+	if (_isSleeping) {
+		// Woken by the timer 0 interrupt of the core.
+		_isSleeping = false;
+		sleepEnd = micros() - timerInterruptMicros;
+	} else {
+		sleepEnd = _wakeTime;
+	}
+	sei();
+	if (static_cast<long>(sleepEnd - sleepStart) > 0) {
+		_sleepMicros += sleepEnd - sleepStart;
+	}
+	while (_sleepMicros >= 1000) {
+		_sleepMicros -= 1000;
+		++_sleepMillis;
+	}
+}
+
+
+uint16_t PowerManager::dutyCycle() const
+{
+	const unsigned long seconds = (millis() - _startTime) / 1000;
+	if (seconds == 0 || _sleepMillis / seconds > 1000) {
+		return 1000;
+	}
+	return 1000 - (_sleepMillis / seconds);
+}
+
+
+uint16_t PowerManager::averageCurrent() const
+{
+	const uint16_t duty = dutyCycle();
+	return (static_cast<uint32_t>(activeCurrent) * duty +
+		static_cast<uint32_t>(idleCurrent) * (1000 - duty)) / 1000;
+}
+
+
+void PowerManager::resetStatistics()
+{
+	_startTime = millis();
+	_sleepMillis = 0;
+	_sleepMicros = 0;
+}
+
+
+void PowerManager::printStatistics(Print &output)
+{
+	const uint16_t current = averageCurrent();
+	output.print(F("duty cycle: "));
+	output.print(dutyCycle());
+	output.print(F("/1000 average current: "));
+	output.print(current);
+	output.print(F("uA, per day: "));
+	// 24h * uA / 1000 = mAh
+	output.print(static_cast<uint32_t>(current) * 24 / 1000);
+	output.println(F("mAh"));
+}
+
+
+}
+
+
@@ -0,0 +1,107 @@
+#pragma once
+//
+// PowerManager
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// Puts the MCU to sleep between the iterations of the loop.
+///
+/// The MCU sleeps in idle mode until the next interrupt. This is the
+/// timer 0 interrupt for millis() every millisecond, the ADC interrupt of
+/// the analog sampler, the LED timer and the serial interface. The loop
+/// sleeps again after each interrupt, until the next task of the scheduler
+/// is due, so the CPU clock is stopped most of the time.
+///
+/// The time spent sleeping is measured, to estimate the current of the
+/// MCU from the duty cycle. The interrupts of the application call
+/// onInterrupt() first, so the sleep ends when the interrupt starts, and
+/// the time of the interrupt is counted as active time. The timer 0
+/// interrupt of the Arduino core is counted with its typical duration.
+///
+class PowerManager
+{
+public:
+	/// The typical current of the MCU while active at 16MHz and 5V in uA.
+	///
+	static const uint16_t activeCurrent = 9500;
+
+	/// The typical current of the MCU in idle mode at 16MHz and 5V in uA.
+	///
+	static const uint16_t idleCurrent = 2700;
+
+	/// The typical time of the timer 0 interrupt of the Arduino core in us.
+	///
+	static const uint8_t timerInterruptMicros = 5;
+
+public:
+	/// ctor
+	///
+	PowerManager();
+
+public:
+	/// Call this method in setup().
+	///
+	/// Disables the unused modules of the MCU.
+	///
+	void setup();
+
+	/// Sleep until the next interrupt.
+	///
+	void sleep();
+
+	/// Mark the end of the sleep at the start of an interrupt.
+	///
+	/// Call this first in each interrupt of the application.
+	///
+	inline void onInterrupt() {
+		if (_isSleeping) {
+			_isSleeping = false;
+			_wakeTime = micros();
+		}
+	}
+
+	/// Get the part of the time the MCU was awake since the last reset.
+	///
+	/// @return The duty cycle in 1/1000.
+	///
+	uint16_t dutyCycle() const;
+
+	/// Get the estimated average current of the MCU.
+	///
+	/// @return The current in uA.
+	///
+	uint16_t averageCurrent() const;
+
+	/// Reset the measured sleep time.
+	///
+	void resetStatistics();
+
+	/// Print the duty cycle and the estimated current.
+	///
+	void printStatistics(Print &output);
+
+private:
+	unsigned long _startTime; ///< The time of the last reset in ms.
+	unsigned long _sleepMillis; ///< The time spent sleeping since the last reset in ms.
+	uint16_t _sleepMicros; ///< The remaining time spent sleeping in us, less than 1ms.
+	volatile bool _isSleeping; ///< If the MCU sleeps, until the first interrupt.
+	volatile unsigned long _wakeTime; ///< The time at the start of the interrupt which ended the sleep in us.
+};
+
+
+/// The global instance of the power manager.
+///
+extern PowerManager powerManager;
+
+
+}
+
+
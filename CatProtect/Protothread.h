@@ -0,0 +1,91 @@
+#pragma once
+//
+// Protothread
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <stdint.h>
+
+
+/// Start the body of a protothread.
+///
+/// This resumes the function at the last yield point.
+///
+#define PT_BEGIN(pt) \
+	switch ((pt).line) { case 0:
+
+/// Return from the function, and resume after this point at the next call.
+///
+#define PT_YIELD(pt) \
+	do { (pt).line = __LINE__; return; case __LINE__:; } while (0)
+
+/// Return from the function until the condition is true.
+///
+/// The condition is checked again at each call.
+///
+#define PT_WAIT_UNTIL(pt, condition) \
+	do { (pt).line = __LINE__; case __LINE__: if (!(condition)) { return; } } while (0)
+
+/// End the protothread early, the next call starts it again.
+///
+#define PT_EXIT(pt) \
+	do { (pt).line = 0; return; } while (0)
+
+/// End the body of a protothread, the next call starts it again.
+///
+#define PT_END(pt) \
+	} (pt).line = 0
+
+
+namespace lr {
+
+
+/// The state of a stackless coroutine (protothread).
+///
+/// A protothread is a function which returns at its yield points, and
+/// continues after the last yield point at the next call. The only state
+/// is the line of this yield point, so each thread needs two bytes of
+/// RAM, and switching costs one function call and one switch.
+///
+/// The function is usually a task of the scheduler. To wait for a time,
+/// start the task with the delay and yield:
+///
+///   void blinkTask(void*, const unsigned long currentTime) {
+///       PT_BEGIN(blinkThread);
+///       for (;;) {
+///           ...
+///           scheduler.start(&blinkTask, 0, 500, 0, currentTime);
+///           PT_YIELD(blinkThread);
+///       }
+///       PT_END(blinkThread);
+///   }
+///
+/// Local variables are lost at each yield point, keep the state which is
+/// required after a yield in global or member variables. The body must not
+/// contain a switch statement, because the thread uses one to resume.
+///
+class Protothread
+{
+public:
+	/// ctor
+	///
+	Protothread() : line(0) {}
+
+	/// Start the thread again at the next call.
+	///
+	inline void restart() { line = 0; }
+
+	/// Check if the thread is waiting at a yield point.
+	///
+	inline bool isWaiting() const { return line != 0; }
+
+public:
+	uint16_t line; ///< The line of the last yield point, or 0 at the start.
+};
+
+
+}
+
+
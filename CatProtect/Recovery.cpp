@@ -0,0 +1,102 @@
+//
+// Recovery
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "Recovery.h"
+
+
+namespace lr {
+
+
+/// The global instance of the recovery.
+///
+Recovery recovery;
+
+
+Recovery::Recovery()
+	: _status(StatusIdle), _startTime(0), _attemptTime(0), _delay(0),
+	_attemptCount(0), _successCount(0), _failedAttemptCount(0), _lastRecoveryTime(0)
+{
+}
+
+
+Recovery::ErrorClass Recovery::classify(SDCard::Error error)
+{
+	switch (error) {
+	case SDCard::Error_TimeOut:
+	case SDCard::Error_ReadSingleBlockFailed:
+	case SDCard::Error_ReadFailed:
+	case SDCard::Error_CrcMismatch:
+	case SDCard::Error_WriteBlockFailed:
+	case SDCard::Error_WriteFailed:
+		return ErrorClassTransient;
+	case SDCard::Error_SendIfCondFailed:
+	case SDCard::Error_ReadOCRFailed:
+	case SDCard::Error_SetBlockLengthFailed:
+	case SDCard::Error_CalibrationFailed:
+		return ErrorClassCard;
+	default:
+		// The card works, but its content can not be used.
+		return ErrorClassPermanent;
+	}
+}
+
+
+bool Recovery::start(SDCard::Error error, unsigned long currentTime)
+{
+	if (classify(error) == ErrorClassPermanent) {
+		_status = StatusFailed;
+		return false;
+	}
+	_status = StatusWaiting;
+	_startTime = currentTime;
+	_attemptTime = currentTime;
+	_delay = 0; // The first attempt is made immediately.
+	_attemptCount = 0;
+	return true;
+}
+
+
+Recovery::Status Recovery::loop(unsigned long currentTime)
+{
+	if (_status != StatusWaiting || (currentTime - _attemptTime) < _delay) {
+		return _status;
+	}
+	++_attemptCount;
+	if (sdCard.reinitialize() == SDCard::StatusReady) {
+		_status = StatusRecovered;
+		_lastRecoveryTime = millis() - _startTime;
+		++_successCount;
+		return _status;
+	}
+	++_failedAttemptCount;
+	if (classify(sdCard.error()) == ErrorClassPermanent) {
+		_status = StatusFailed;
+		return _status;
+	}
+	// Wait longer after each failed attempt.
+	_attemptTime = millis();
+	if (_delay == 0) {
+		_delay = initialDelay;
+	} else if (_delay < maximumDelay) {
+		_delay = min(_delay * 2, maximumDelay);
+	}
+	return _status;
+}
+
+
+void Recovery::printStatistics(Print &output)
+{
+	output.print(F("Recoveries: "));
+	output.print(_successCount);
+	output.print(F(" failed attempts: "));
+	output.print(_failedAttemptCount);
+	output.print(F(" last time: "));
+	output.print(_lastRecoveryTime);
+	output.println(F("ms"));
+}
+
+
+}
+
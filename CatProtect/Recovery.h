@@ -0,0 +1,122 @@
+#pragma once
+//
+// Recovery
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include "SDCard.h"
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// The recovery of the SD-Card after an error.
+///
+/// After an error, the card is brought back into the ready state with
+/// SDCard::reinitialize(). If this fails, the next attempt is made after
+/// a delay, which is doubled after each failed attempt up to a maximum.
+/// Errors which can not be fixed by initializing the card, like an
+/// unknown image format, are not recovered.
+///
+class Recovery
+{
+public:
+	/// The class of an error.
+	///
+	enum ErrorClass : uint8_t {
+		ErrorClassTransient, ///< A read or write failed, the card is probably still initialized.
+		ErrorClassCard, ///< The initialization of the card failed, it has to be initialized from the start.
+		ErrorClassPermanent, ///< The error can not be fixed by initializing the card.
+	};
+
+	/// The status of the recovery.
+	///
+	enum Status : uint8_t {
+		StatusIdle, ///< There is no recovery in progress.
+		StatusWaiting, ///< Waiting for the next attempt.
+		StatusRecovered, ///< The card was recovered successfully.
+		StatusFailed, ///< The recovery failed with a permanent error.
+	};
+
+	/// The delay before the second attempt in ms.
+	///
+	static const uint16_t initialDelay = 250;
+
+	/// The maximum delay between two attempts in ms.
+	///
+	static const uint32_t maximumDelay = 60000;
+
+public:
+	/// ctor
+	///
+	Recovery();
+
+public:
+	/// Get the class of an error.
+	///
+	static ErrorClass classify(SDCard::Error error);
+
+	/// Start a recovery after an error.
+	///
+	/// @param error The error of the card.
+	/// @param currentTime The current time in ms.
+	/// @return true if the recovery was started, false if the error is permanent.
+	///
+	bool start(SDCard::Error error, unsigned long currentTime);
+
+	/// Make the next attempt if it is time.
+	///
+	/// Call this from the loop while the recovery is in progress.
+	///
+	/// @param currentTime The current time in ms.
+	/// @return The status of the recovery.
+	///
+	Status loop(unsigned long currentTime);
+
+	/// Get the number of attempts of the last recovery.
+	///
+	inline uint16_t attemptCount() const { return _attemptCount; }
+
+	/// Get the number of successful recoveries.
+	///
+	inline uint16_t successCount() const { return _successCount; }
+
+	/// Get the number of failed attempts.
+	///
+	inline uint16_t failedAttemptCount() const { return _failedAttemptCount; }
+
+	/// Get the delay from the last attempt to the next one in ms.
+	///
+	inline uint32_t nextAttemptDelay() const { return _delay; }
+
+	/// Get the time of the last successful recovery in ms.
+	///
+	inline uint32_t lastRecoveryTime() const { return _lastRecoveryTime; }
+
+	/// Print the counters of the recovery.
+	///
+	void printStatistics(Print &output);
+
+private:
+	Status _status; ///< The status of the recovery.
+	unsigned long _startTime; ///< The time when the recovery started.
+	unsigned long _attemptTime; ///< The time of the last attempt.
+	uint32_t _delay; ///< The delay until the next attempt.
+	uint16_t _attemptCount; ///< The number of attempts of the current recovery.
+	uint16_t _successCount; ///< The number of successful recoveries.
+	uint16_t _failedAttemptCount; ///< The number of failed attempts.
+	uint32_t _lastRecoveryTime; ///< The duration of the last successful recovery.
+};
+
+
+/// The global instance of the recovery.
+///
+extern Recovery recovery;
+
+
+}
+
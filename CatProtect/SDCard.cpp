@@ -7,6 +7,9 @@
 #include "SDCard.h"
 
 
+#include "Crc16.h"
+
+
 // define macros to send text to serial if debug is activated.
 #ifdef SDCARD_DEBUG
 #define SDC_DEBUG_PRINT(text) Serial.print(text); Serial.flush();
@@ -17,9 +20,16 @@
 #endif
 
 // The pin and port for the chip select of the SD-Card.
+// All other access to the card goes through SPI.transfer(). Together with
+// these definitions, this is everything which has to be replaced to run
+// the library against an emulated card. Replace all three, or none.
+#if !defined(SDCARD_CSPINNUM) && !defined(SDCARD_CSPORT) && !defined(SDCARD_CSPIN)
 #define SDCARD_CSPINNUM 10
-#define SDCARD_CSPORT PORTB 
-#define SDCARD_CSPIN PINB2 
+#define SDCARD_CSPORT PORTB
+#define SDCARD_CSPIN PINB2
+#elif !defined(SDCARD_CSPINNUM) || !defined(SDCARD_CSPORT) || !defined(SDCARD_CSPIN)
+#error "Define SDCARD_CSPINNUM, SDCARD_CSPORT and SDCARD_CSPIN together."
+#endif
 
 
 namespace lr {
@@ -37,6 +47,16 @@ struct SDCardState {
 	///
 	const uint16_t blockSize = 512;
 
+	/// The size of the version 2 header in block 0, before its CRC16.
+	///
+	static const uint8_t versionTwoHeaderSize = 42;
+
+	/// The number of slots in a block of the hash index (version 2).
+	///
+	/// The CRC16 of the slots follows the last slot.
+	///
+	static const uint8_t slotsPerIndexBlock = 63;
+
 	/// The SD Card type
 	///
 	enum CardType : uint8_t {
@@ -58,8 +78,14 @@ struct SDCardState {
 	///
 	enum Command : uint16_t {
 		Cmd_GoIdleState          = 0 | Response1, ///< Go idle state.
+		Cmd_SwitchFunction       = 6 | Response1, ///< Check or switch the card function, like high speed mode.
 		Cmd_SendIfCond           = 8 | Response7, ///< Verify SD Memory Card interface operating condition.
+		Cmd_SendCSD              = 9 | Response1, ///< Read the card specific data register.
+		Cmd_SendCID              = 10 | Response1, ///< Read the card identification register.
 		Cmd_StopTransmission     = 12 | Response1, ///< Stop reading blocks.
+		Cmd_SendStatus           = 13 | Response1, ///< Read the status, the second byte of the R2 response is read separately.
+		Cmd_WriteBlock           = 24 | Response1, ///< Write one block.
+		Cmd_WriteMultiBlock      = 25 | Response1, ///< Write multiple blocks.
 		Cmd_SetBlockLenght       = 16 | Response1, ///< Set the block length
 		Cmd_ReadSingleBlock      = 17 | Response1, ///< Read one block.
 		Cmd_ReadMultiBlock       = 18 | Response1, ///< Read multiple blocks.
@@ -67,6 +93,7 @@ struct SDCardState {
 		Cmd_ReadOCR              = 58 | Response3, ///< Retrieve the OCR register.
 		ACmd_Flag                = 0x100, ///< The flag for app commands.
 		ACmd_SendOpCond          = 41 | ACmd_Flag | Response1, ///< Sends host capacity support information and activates the card's initialization process. 
+		ACmd_SetWriteBlockEraseCount = 23 | ACmd_Flag | Response1, ///< Set the number of blocks to pre-erase for the next multi block write.
 	};
 
 	/// The state of the read command
@@ -76,6 +103,17 @@ struct SDCardState {
 		ReadStateReadData = 1, ///< In the middle of data reading.
 		ReadStateReadCRC = 2, ///< Reached end of block, read CRC bytes.
 		ReadStateEnd = 3, ///< The read process has ended (end of block or error).
+		ReadStateStopResponse = 4, ///< Stopped at the end of an extent, waiting for the response.
+		ReadStateStopWait = 5, ///< Stopped at the end of an extent, waiting until the card is ready.
+	};
+
+	/// The type of the directory on the card.
+	///
+	enum DirectoryType : uint8_t {
+		DirectoryNone = 0, ///< The directory was not read yet.
+		DirectoryHCDI1 = 1, ///< A HCDI version 1 directory, read into memory.
+		DirectoryHCDI2 = 2, ///< A HCDI version 2 directory with a hash index on the card.
+		DirectoryFAT32 = 3, ///< The root directory of a FAT32 file system, read into memory.
 	};
 
 	/// The block read mode
@@ -91,6 +129,27 @@ struct SDCardState {
 	const uint8_t R1_IllegalCommand = 0x04; ///< The flag for an illegal command.
 	const uint8_t R1_ReadyState = 0x00; ///< The ready state.
 	const uint8_t BlockDataStart = 0xfe; ///< Byte to indicate the block data will start.
+	const uint8_t MultiWriteDataStart = 0xfc; ///< Byte to indicate the data of a block in a multi block write.
+	const uint8_t MultiWriteStop = 0xfd; ///< Byte to stop a multi block write.
+	const uint8_t DataResponseMask = 0x1f; ///< The mask for the data response after writing a block.
+	const uint8_t DataResponseAccepted = 0x05; ///< The data response if the data was accepted.
+
+	/// The timeout to write a block in ms.
+	///
+	const uint16_t writeTimeout = 600;
+
+	/// The number of blocks read at each clock speed during the calibration.
+	///
+	const uint8_t calibrationBlockCount = 8;
+
+	/// The number of reads at each clock speed during the calibration, all have to pass.
+	///
+	const uint8_t calibrationReadCount = 3;
+
+	/// The argument for CMD6 to check or switch to the high speed mode.
+	///
+	const uint32_t SwitchHighSpeedCheck = 0x00fffff1;
+	const uint32_t SwitchHighSpeedSet = 0x80fffff1;
 
 	/// The last error
 	///
@@ -99,6 +158,40 @@ struct SDCardState {
 	/// The SPI settings for SD data transfers.
 	///
 	SPISettings spiSettings;
+
+#ifdef SDCARD_LATENCY_STATS
+	/// The latency histograms.
+	///
+	uint16_t latencyHistogram[SDCard::LatencyPhaseCount][SDCard::latencyBucketCount];
+
+	/// The number of polls in the current start or block start phase.
+	///
+	uint16_t latencyPollCount = 0;
+
+	/// The number of polls in the last call of waitUntilReady().
+	///
+	uint16_t readyPollCount = 0;
+#endif
+
+	/// The SPI clock speed in Hz, selected by the calibration.
+	///
+	uint32_t clockSpeed = 0;
+
+	/// If the card was switched into the high speed mode.
+	///
+	bool highSpeed = false;
+
+	/// The CRC16 of the CID register in the high word and of the CSD register in the low word.
+	///
+	uint32_t cardIdentity = 0;
+
+	/// If a different card was found since the last successful reinitialize().
+	///
+	bool isCardChanged = false;
+
+	/// If the directory in memory belongs to a previous card.
+	///
+	bool isDirectoryOutdated = false;
 	
 	/// The card type.
 	///
@@ -116,10 +209,88 @@ struct SDCardState {
 	///
 	ReadMode blockReadMode;
 
+	/// The next extent to read after the current one.
+	///
+	const SDCard::Extent *nextExtent;
+
+	/// The number of extents left after the current one.
+	///
+	uint16_t extentsLeft = 0;
+
+	/// The number of blocks left in the current extent.
+	///
+	uint32_t blocksLeft;
+
+	/// The number of bytes read while waiting for a response.
+	///
+	uint8_t responseWaitCount;
+
+#ifdef SDCARD_VERIFY_CRC
+	/// The CRC of the data read from the current block.
+	///
+	uint16_t blockCrc;
+#endif
+
+	/// The number of read blocks with a wrong CRC.
+	///
+	uint16_t crcErrorCount = 0;
+
+	/// The region for the event log.
+	///
+	SDCard::Extent eventLogRegion = {0, 0};
+
+	/// The region for audio recordings.
+	///
+	SDCard::Extent captureRegion = {0, 0};
+
+	/// If the regions were read from the header, without reading the directory.
+	///
+	bool isRegionRead = false;
+
 	/// The directory.
 	///
 	SDCard::DirectoryEntry *directoryEntry = 0;
 
+	/// The type of the directory.
+	///
+	DirectoryType directoryType = DirectoryNone;
+
+	/// The number of blocks per cluster (FAT32).
+	///
+	uint8_t sectorsPerCluster;
+
+	/// The first block of the file allocation table (FAT32).
+	///
+	uint32_t fatStartBlock;
+
+	/// The first block of the data region (FAT32).
+	///
+	uint32_t dataStartBlock;
+
+	/// The number of hash index blocks (version 2).
+	///
+	uint16_t indexBlockCount;
+
+	/// The first block of the hash index (version 2).
+	///
+	uint32_t indexStartBlock;
+
+	/// The first block of the file records (version 2).
+	///
+	uint32_t recordStartBlock;
+
+	/// The number of file records (version 2).
+	///
+	uint32_t recordCount;
+
+	/// The entry returned by findFile() for version 2 directories.
+	///
+	SDCard::DirectoryEntry foundEntry;
+
+	/// The file name of the entry returned by findFile() for version 2 directories.
+	///
+	char foundFileName[17];
+
 
 	/// Only chip select.
 	///
@@ -139,9 +310,6 @@ struct SDCardState {
 	///
 	inline void chipSelectBegin()
 	{
-#ifdef SDCARD_USE_SPI_TRANSACTIONS
-		SPI.beginTransaction(spiSettings);
-#endif
 		SDCARD_CSPORT &= ~_BV(SDCARD_CSPIN);
 	}
 
@@ -150,9 +318,6 @@ struct SDCardState {
 	inline void chipSelectEnd()
 	{
 		SDCARD_CSPORT |= _BV(SDCARD_CSPIN);
-#ifdef SDCARD_USE_SPI_TRANSACTIONS		
-		SPI.endTransaction();
-#endif
 	}
 
 	/// Send a byte over the SPI bus
@@ -177,6 +342,48 @@ struct SDCardState {
 		}
 	}
 
+	/// Receive a byte from the SPI bus, which is part of the block data.
+	///
+	inline uint8_t spiReceiveData()
+	{
+		const uint8_t value = spiReceive();
+#ifdef SDCARD_VERIFY_CRC
+		blockCrc = crc16Update(blockCrc, value);
+#endif
+		return value;
+	}
+
+	/// Read the CRC at the end of the block.
+	///
+	/// @return true if the CRC matches or the CRC is not verified.
+	///
+	inline bool spiReceiveCrc()
+	{
+#ifdef SDCARD_VERIFY_CRC
+		uint16_t crc = static_cast<uint16_t>(spiReceive()) << 8;
+		crc |= spiReceive();
+		if (crc != blockCrc) {
+			++crcErrorCount;
+			return false;
+		}
+		return true;
+#else
+		spiSkip(2);
+		return true;
+#endif
+	}
+
+	/// Mark the start of the block data.
+	///
+	inline void startBlockData()
+	{
+		recordLatencyPolls(SDCard::LatencyBlockStart);
+		blockReadState = ReadStateReadData;
+#ifdef SDCARD_VERIFY_CRC
+		blockCrc = 0;
+#endif
+	}
+
 	/// Wait while sending clocks on the SPI bus
 	///
 	inline void spiWait(uint8_t count)
@@ -190,15 +397,71 @@ struct SDCardState {
 	///
 	inline bool waitUntilReady(uint16_t timeoutMillis) {
 		uint16_t startTime = millis();
+#ifdef SDCARD_LATENCY_STATS
+		readyPollCount = 0;
+#endif
 		do {
 			const uint8_t result = spiReceive();
 			if (result == 0xff) {
 				return true;
 			}
+#ifdef SDCARD_LATENCY_STATS
+			if (readyPollCount < 0xffff) {
+				++readyPollCount;
+			}
+#endif
 		} while ((static_cast<uint16_t>(millis()) - startTime) < timeoutMillis);
 		return false;
 	}
 
+	/// Count one poll of the current start or block start phase.
+	///
+	inline void countLatencyPoll()
+	{
+#ifdef SDCARD_LATENCY_STATS
+		if (latencyPollCount < 0xffff) {
+			++latencyPollCount;
+		}
+#endif
+	}
+
+	/// Add an operation with the given number of polls to a latency histogram.
+	///
+	inline void recordLatency(SDCard::LatencyPhase phase, uint16_t pollCount)
+	{
+#ifdef SDCARD_LATENCY_STATS
+		// The bucket is the number of significant bits.
+		uint8_t bucket = 0;
+		while (pollCount != 0 && bucket < SDCard::latencyBucketCount - 1) {
+			pollCount >>= 1;
+			++bucket;
+		}
+		uint16_t &count = latencyHistogram[phase][bucket];
+		if (count < 0xffff) {
+			++count;
+		}
+#endif
+	}
+
+	/// Record the polls of the last waitUntilReady() call after a stopped read.
+	///
+	inline void recordStopLatency()
+	{
+#ifdef SDCARD_LATENCY_STATS
+		recordLatency(SDCard::LatencyStopRead, readyPollCount);
+#endif
+	}
+
+	/// Record the polls of the current start or block start phase and start a new phase.
+	///
+	inline void recordLatencyPolls(SDCard::LatencyPhase phase)
+	{
+#ifdef SDCARD_LATENCY_STATS
+		recordLatency(phase, latencyPollCount);
+		latencyPollCount = 0;
+#endif
+	}
+
 	/// Send a command to the SD card synchronous.
 	///
 	/// @param command The command to send.
@@ -253,6 +516,22 @@ struct SDCardState {
 		return result;
 	}
 
+	/// Send the stop command in a special way, while the card is sending data.
+	///
+	/// The byte after the command is skipped, the response has to be read after this call.
+	///
+	inline void sendStopTransmission()
+	{
+		spiSend(Cmd_StopTransmission | 0x40);
+		spiSend(0);
+		spiSend(0);
+		spiSend(0);
+		spiSend(0);
+		spiSend(0xff); // Fake CRC
+		// Skip one byte
+		spiSkip(1);
+	}
+
 	/// Wait until the card is ready, then send the command.
 	///
 	/// Same parameters as sendCommand().
@@ -278,6 +557,7 @@ struct SDCardState {
 		pinMode(SDCARD_CSPINNUM, OUTPUT);
 		onlyChipSelectEnd();
 		SPI.begin();
+		spiBus.setChipSelect(SPIBus::SDCardDevice, &SDCARD_CSPORT, _BV(SDCARD_CSPIN));
 	
 		// Speed should be <400kHz for the initialization.
 		spiSettings = SPISettings(250000, MSBFIRST, SPI_MODE0);
@@ -341,11 +621,24 @@ struct SDCardState {
 			goto initFail;
 		}
 	
+		// Switch into the high speed mode, only supported by version 2 cards.
+		highSpeed = false;
+		if (cardType != CardTypeSD1) {
+			highSpeed = switchHighSpeed();
+		}
+
+		// Read the CID and CSD registers to identify the card.
+		cardIdentity = 0;
+		{
+			uint16_t cidCrc;
+			uint16_t csdCrc;
+			if (readRegisterCrc(Cmd_SendCID, &cidCrc) && readRegisterCrc(Cmd_SendCSD, &csdCrc)) {
+				cardIdentity = (static_cast<uint32_t>(cidCrc) << 16) | csdCrc;
+			}
+		}
+	
 		onlyChipSelectEnd();
 		SPI.endTransaction();
-	
-		// now rise the clock speed to maximum.
-		spiSettings = SPISettings(32000000, MSBFIRST, SPI_MODE0);
 
 		// Debug output
 #ifdef SDCARD_DEBUG
@@ -355,10 +648,16 @@ struct SDCardState {
 			case CardTypeSD2: SDC_DEBUG_PRINTLN(String(F("SD2"))); break;
 			case CardTypeSDHC: SDC_DEBUG_PRINTLN(String(F("SDHC"))); break;
 		}
+		SDC_DEBUG_PRINTLN(String(F("High speed ")) + String(highSpeed));
 #endif
-	
-		// Make sure we can use SPI in the timer interrupt.
-		SPI.usingInterrupt(255); // Using from timer.
+
+		// Select the fastest clock speed which reads reliable.
+		if (calibrateClock() == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+
+		// Use the selected settings for all sessions of the card.
+		spiBus.setSettings(SPIBus::SDCardDevice, spiSettings);
 		return SDCard::StatusReady;
 
 initFail:
@@ -366,6 +665,248 @@ initFail:
 		SPI.endTransaction();
 		return SDCard::StatusError;
 	}
+
+	/// Bring the card back into the ready state after an error.
+	///
+	/// If the card still responds to CMD13 at the calibrated speed, only
+	/// the block length is set again. Otherwise, the card is initialized
+	/// from the start and the clock is calibrated again.
+	///
+	inline SDCard::Status reinitialize()
+	{
+		// Only an active multi block read has to be stopped, a stop command without a read is an illegal command.
+		const bool isMultiBlockRead = (blockReadMode == ReadModeMultipleBlocks &&
+			blockReadState != ReadStateStopResponse && blockReadState != ReadStateStopWait);
+
+		// Reset the read state.
+		blockReadState = ReadStateEnd;
+		blockReadMode = ReadModeSingleBlock;
+		extentsLeft = 0;
+		blockByteCount = 0;
+		// A failed attempt may have found the new card already.
+		isCardChanged = isDirectoryOutdated;
+
+		bool isResponsive = false;
+		{
+			SPISession session(SPIBus::SDCardDevice);
+			onlyChipSelectBegin();
+			if (isMultiBlockRead) {
+				sendStopTransmission();
+				spiSkip(2);
+			}
+			if (waitUntilReady(300) && sendCommand(Cmd_SendStatus, 0) == R1_ReadyState) {
+				spiSkip(1); // The second byte of the status.
+				isResponsive = (sendCommand(Cmd_SetBlockLenght, blockSize) == R1_ReadyState);
+			}
+			onlyChipSelectEnd();
+		}
+		if (isResponsive) {
+			return readOutdatedDirectory();
+		}
+
+		// Initialize the card from the start.
+		const uint32_t previousIdentity = cardIdentity;
+		if (initialize() != SDCard::StatusReady) {
+			return SDCard::StatusError;
+		}
+		// The directory in memory is only valid for the same card.
+		if (previousIdentity != 0 && cardIdentity != previousIdentity) {
+			isCardChanged = true;
+			isDirectoryOutdated = true;
+		}
+		return readOutdatedDirectory();
+	}
+
+	/// Replace the directory of a previous card with the one of the current card.
+	///
+	inline SDCard::Status readOutdatedDirectory()
+	{
+		if (isDirectoryOutdated) {
+			clearDirectory();
+			SPISession session(SPIBus::SDCardDevice);
+			if (readDirectory() != SDCard::StatusReady) {
+				return SDCard::StatusError;
+			}
+			isDirectoryOutdated = false;
+		}
+		error = SDCard::NoError;
+		return SDCard::StatusReady;
+	}
+
+	/// Free the directory in memory and forget the regions.
+	///
+	inline void clearDirectory()
+	{
+		while (directoryEntry != 0) {
+			SDCard::DirectoryEntry *entry = directoryEntry;
+			directoryEntry = entry->next;
+			delete[] entry->fileName;
+			delete[] entry->extents;
+			delete entry;
+		}
+		directoryType = DirectoryNone;
+		isRegionRead = false;
+		eventLogRegion = SDCard::Extent {0, 0};
+		captureRegion = SDCard::Extent {0, 0};
+	}
+
+	/// Read a data block with the given size synchronous, while the chip select is active.
+	///
+	/// Only the bytes at the given position are kept, all other bytes are skipped.
+	///
+	/// @param byteCount The size of the data block.
+	/// @param position The position of the bytes to keep.
+	/// @param buffer The buffer for the kept bytes.
+	/// @param bufferSize The number of bytes to keep.
+	/// @param blockCrc If not 0, the CRC16 of the data is stored in this variable.
+	/// @return true if the block was read and the CRC matches.
+	///
+	inline bool readDataBlockPart(uint16_t byteCount, uint16_t position, uint8_t *buffer, uint8_t bufferSize, uint16_t *blockCrc = 0)
+	{
+		// Wait for the start of the data.
+		const uint16_t startTime = millis();
+		uint8_t result;
+		while ((result = spiReceive()) == 0xff) {
+			if ((static_cast<uint16_t>(millis()) - startTime) > 300) {
+				return false;
+			}
+		}
+		if (result != BlockDataStart) {
+			return false;
+		}
+		uint16_t crc = 0;
+		for (uint16_t i = 0; i < byteCount; ++i) {
+			const uint8_t value = spiReceive();
+			crc = crc16Update(crc, value);
+			if (i >= position && i < position + bufferSize) {
+				buffer[i - position] = value;
+			}
+		}
+		uint16_t cardCrc = static_cast<uint16_t>(spiReceive()) << 8;
+		cardCrc |= spiReceive();
+		if (blockCrc != 0) {
+			*blockCrc = crc;
+		}
+		return cardCrc == crc;
+	}
+
+	/// Read a 16 byte register of the card and calculate its CRC16.
+	///
+	/// Has to be called with an active chip select.
+	///
+	/// @param command The command to read the register.
+	/// @param crc The variable for the CRC.
+	/// @return true on success.
+	///
+	inline bool readRegisterCrc(Command command, uint16_t *crc)
+	{
+		return waitAndSendCommand(command, 0) == R1_ReadyState && readDataBlockPart(16, 0, 0, 0, crc);
+	}
+
+	/// Check and switch into the high speed mode with CMD6.
+	///
+	/// Has to be called with an active chip select at the initialization speed.
+	/// Only byte 13 with the supported functions and byte 16 with the selected
+	/// function of the 64 byte status are used.
+	///
+	/// @return true if the card is in high speed mode.
+	///
+	inline bool switchHighSpeed()
+	{
+		uint8_t status[4];
+		// Check if the function is supported.
+		if (waitAndSendCommand(Cmd_SwitchFunction, SwitchHighSpeedCheck) != R1_ReadyState ||
+			!readDataBlockPart(64, 13, status, 4) || (status[0] & 0x02) == 0) {
+			return false;
+		}
+		// Switch to the high speed function.
+		if (waitAndSendCommand(Cmd_SwitchFunction, SwitchHighSpeedSet) != R1_ReadyState ||
+			!readDataBlockPart(64, 13, status, 4) || (status[3] & 0x0f) != 0x01) {
+			return false;
+		}
+		// The new timing is used after 8 clocks.
+		spiWait(1);
+		return true;
+	}
+
+	/// Read the first blocks of the card with a multi block read and check the data.
+	///
+	/// Each block is verified with its CRC. The CRCs of all blocks are combined
+	/// into a checksum, to compare the data read at different clock speeds.
+	///
+	/// @param checksum The variable for the checksum.
+	/// @return true if all blocks were read successfully.
+	///
+	inline bool calibrationRead(uint16_t *checksum)
+	{
+		onlyChipSelectBegin();
+		bool success = waitUntilReady(300) && sendCommand(Cmd_ReadMultiBlock, 0) == R1_ReadyState;
+		if (success) {
+			*checksum = 0;
+			for (uint8_t i = 0; success && i < calibrationBlockCount; ++i) {
+				uint16_t crc = 0;
+				success = readDataBlockPart(blockSize, 0, 0, 0, &crc);
+				*checksum = crc16Update(*checksum, crc >> 8);
+				*checksum = crc16Update(*checksum, crc);
+			}
+			sendStopTransmission();
+			uint8_t result;
+			for (uint8_t i = 0; ((result = spiReceive()) & 0x80) && i < 0x10; ++i);
+			if (result != R1_ReadyState || !waitUntilReady(300)) {
+				success = false;
+			}
+		}
+		onlyChipSelectEnd();
+		return success;
+	}
+
+	/// Select the fastest SPI clock speed which reads reliable from the card.
+	///
+	/// First a reference checksum is read at the initialization speed. Next,
+	/// the same blocks are read and timed at F_CPU/2, F_CPU/4, F_CPU/8 and
+	/// F_CPU/16, repeated to catch clocks which fail only sometimes. The clock
+	/// with the shortest read time and only matching checksums is selected.
+	/// If no clock passes, the initialization speed is kept.
+	///
+	inline SDCard::Status calibrateClock()
+	{
+		uint16_t referenceChecksum;
+		uint16_t checksum;
+		uint32_t bestTime = 0xffffffff;
+		clockSpeed = 250000;
+		SPI.beginTransaction(spiSettings);
+		const bool referenceRead = calibrationRead(&referenceChecksum);
+		SPI.endTransaction();
+		if (!referenceRead) {
+			error = SDCard::Error_CalibrationFailed;
+			return SDCard::StatusError;
+		}
+		for (uint8_t divider = 2; divider <= 16; divider <<= 1) {
+			const uint32_t candidateSpeed = F_CPU / divider;
+			const SPISettings candidateSettings(candidateSpeed, MSBFIRST, SPI_MODE0);
+			SPI.beginTransaction(candidateSettings);
+			const uint32_t startTime = micros();
+			bool success = true;
+			for (uint8_t i = 0; success && i < calibrationReadCount; ++i) {
+				success = calibrationRead(&checksum) && checksum == referenceChecksum;
+			}
+			const uint32_t readTime = micros() - startTime;
+			SPI.endTransaction();
+#ifdef SDCARD_DEBUG
+			SDC_DEBUG_PRINTLN(String(F("Clock ")) + String(candidateSpeed) + String(F("Hz: ")) +
+				(success ? String(readTime) + String(F("us")) : String(F("failed"))));
+#endif
+			if (success && readTime < bestTime) {
+				bestTime = readTime;
+				clockSpeed = candidateSpeed;
+				spiSettings = candidateSettings;
+			}
+		}
+#ifdef SDCARD_DEBUG
+		SDC_DEBUG_PRINTLN(String(F("Selected clock ")) + String(clockSpeed) + String(F("Hz")));
+#endif
+		return SDCard::StatusReady;
+	}
 	
 	inline SDCard::Status startRead(uint32_t block)
 	{
@@ -374,8 +915,10 @@ initFail:
 		uint8_t result = spiReceive();
 		if (result != 0xff) { // Check if the chip is idle.
 			chipSelectEnd();
+			countLatencyPoll();
 			return SDCard::StatusWait; // The chip isn't ready yet.
 		}
+		recordLatencyPolls(SDCard::LatencyStartRead);
 	
 		// Ok, the chip is ready send the read command.
 		result = sendCommand(Cmd_ReadSingleBlock, block);
@@ -392,6 +935,17 @@ initFail:
 		return SDCard::StatusReady;	
 	}
 	
+	inline SDCard::Status startMultiRead(const SDCard::Extent *extents, uint16_t extentCount)
+	{
+		const SDCard::Status status = startMultiRead(extents->startBlock);
+		if (status == SDCard::StatusReady) {
+			nextExtent = extents + 1;
+			extentsLeft = extentCount - 1;
+			blocksLeft = extents->blockCount;
+		}
+		return status;
+	}
+	
 	inline SDCard::Status startMultiRead(uint32_t startBlock)
 	{
 		// Begin a transaction.
@@ -399,8 +953,10 @@ initFail:
 		uint8_t result = spiReceive();
 		if (result != 0xff) { // Check if the chip is idle.
 			chipSelectEnd();
+			countLatencyPoll();
 			return SDCard::StatusWait; // The chip isn't ready yet.
 		}
+		recordLatencyPolls(SDCard::LatencyStartRead);
 	
 		// Ok, the chip is ready send the read command.
 		result = sendCommand(Cmd_ReadMultiBlock, startBlock);
@@ -413,6 +969,7 @@ initFail:
 		blockByteCount = 0;
 		blockReadState = ReadStateWait;
 		blockReadMode = ReadModeMultipleBlocks;
+		extentsLeft = 0;
 		chipSelectEnd();
 		return SDCard::StatusReady;	
 	}
@@ -430,10 +987,11 @@ initFail:
 		case ReadStateWait:
 			result = spiReceive();
 			if (result == 0xff) {
+				countLatencyPoll();
 				status = SDCard::StatusWait;
 				break;
 			} else if (result == BlockDataStart) {
-				blockReadState = ReadStateReadData;
+				startBlockData();
 				// no break! continue with read data.
 			} else {
 				error = SDCard::Error_ReadFailed;
@@ -443,8 +1001,15 @@ initFail:
 			}
 		case ReadStateReadData:
 			bytesToRead = min(blockSize - blockByteCount, *byteCount);
-			for (uint16_t i = 0; i < bytesToRead; ++i) {
-				buffer[i] = spiReceive();
+			if (buffer != 0) {
+				for (uint16_t i = 0; i < bytesToRead; ++i) {
+					buffer[i] = spiReceiveData();
+				}
+			} else {
+				// No buffer, just skip the bytes.
+				for (uint16_t i = 0; i < bytesToRead; ++i) {
+					spiReceiveData();
+				}
 			}
 			*byteCount = bytesToRead;
 			blockByteCount += bytesToRead;
@@ -453,9 +1018,12 @@ initFail:
 			}
 			blockReadState = ReadStateReadCRC;
 		case ReadStateReadCRC:
-			spiSkip(2);
 			blockByteCount = 0;
-			if (blockReadMode == ReadModeSingleBlock) {
+			if (!spiReceiveCrc()) {
+				error = SDCard::Error_CrcMismatch;
+				blockReadState = ReadStateEnd;
+				status = SDCard::StatusError;
+			} else if (blockReadMode == ReadModeSingleBlock) {
 				blockReadState = ReadStateEnd;
 				status = SDCard::StatusEndOfBlock;
 			} else {
@@ -466,6 +1034,11 @@ initFail:
 		case ReadStateEnd:
 			status = SDCard::StatusEndOfBlock;
 			break;
+		default:
+			// Extents are only supported by readFast4().
+			error = SDCard::Error_ReadFailed;
+			status = SDCard::StatusError;
+			break;
 		}
 		chipSelectEnd();
 #ifdef SDCARD_DEBUG
@@ -484,9 +1057,10 @@ initFail:
 		case ReadStateWait:
 			readByte = spiReceive();
 			if (readByte == 0xff) {
+				countLatencyPoll();
 				return SDCard::StatusWait;
 			} else if (readByte == BlockDataStart) {
-				blockReadState = ReadStateReadData;
+				startBlockData();
 				return SDCard::StatusWait;
 			} else {
 				blockReadState = ReadStateEnd;
@@ -494,45 +1068,106 @@ initFail:
 				return SDCard::StatusError; // Failed.
 			}
 		case ReadStateReadData:
-			buffer[0] = spiReceive();
-			buffer[1] = spiReceive();
-			buffer[2] = spiReceive();
-			buffer[3] = spiReceive();
+			buffer[0] = spiReceiveData();
+			buffer[1] = spiReceiveData();
+			buffer[2] = spiReceiveData();
+			buffer[3] = spiReceiveData();
 			blockByteCount += 4;
 			if (blockByteCount >= blockSize) {
 				blockReadState = ReadStateReadCRC;
 			}
 			return SDCard::StatusReady;
 		case ReadStateReadCRC:
-			spiSkip(2);
 			blockByteCount = 0;
+			if (!spiReceiveCrc()) {
+				error = SDCard::Error_CrcMismatch;
+				blockReadState = ReadStateEnd;
+				return SDCard::StatusError;
+			}
+			if (extentsLeft > 0 && --blocksLeft == 0) {
+				return stopExtent();
+			}
 			blockReadState = ReadStateWait;
 			return SDCard::StatusWait;
 		case ReadStateEnd:
 			return SDCard::StatusError; // Failed.
+		default:
+			return continueNextExtent();
 		}		
 	}
 
-	inline SDCard::Status stopRead()
+	/// Stop the transmission at the end of an extent.
+	///
+	/// Only the command is sent, the response is checked in continueNextExtent().
+	///
+	SDCard::Status stopExtent()
 	{
-		if (blockReadMode == ReadModeSingleBlock) {
-			if (blockReadState != ReadStateEnd) {
-				// Make sure we read the rest of the data.
-				uint16_t byteCount = blockSize;
-				while (readData(0, &byteCount) != SDCard::StatusEndOfBlock) {
+		sendStopTransmission();
+		responseWaitCount = 0;
+		blockReadState = ReadStateStopResponse;
+		return SDCard::StatusWait;
+	}
+
+	/// Check one byte of the response to the stop command and start reading the next extent.
+	///
+	SDCard::Status continueNextExtent()
+	{
+		const uint8_t result = spiReceive();
+		if (blockReadState == ReadStateStopResponse) {
+			if ((result & 0x80) == 0) {
+				if (result != R1_ReadyState) {
+					goto extentFail;
 				}
+				blockReadState = ReadStateStopWait;
+			} else if (++responseWaitCount > 0x10) {
+				goto extentFail;
 			}
-		} else {
-			// Send Command 12 in a special way
-			chipSelectBegin(); // If not already done			
-			spiSend(Cmd_StopTransmission | 0x40);
-			spiSend(0);
-			spiSend(0);
-			spiSend(0);
-			spiSend(0);
-			spiSend(0xff); // Fake CRC
-			// Skip one byte
-			spiSkip(1);
+			return SDCard::StatusWait;
+		} else if (blockReadState == ReadStateStopWait) {
+			if (result == 0xff) {
+				// The card is ready, start reading the next extent.
+				if (sendCommand(Cmd_ReadMultiBlock, nextExtent->startBlock) != R1_ReadyState) {
+					goto extentFail;
+				}
+				blocksLeft = nextExtent->blockCount;
+				++nextExtent;
+				--extentsLeft;
+				blockReadState = ReadStateWait;
+			}
+			return SDCard::StatusWait;
+		}
+extentFail:
+		error = SDCard::Error_ReadFailed;
+		blockReadState = ReadStateEnd;
+		return SDCard::StatusError;
+	}
+
+	inline SDCard::Status stopRead()
+	{
+		if (blockReadMode == ReadModeSingleBlock) {
+			if (blockReadState != ReadStateEnd) {
+				// Make sure we read the rest of the data.
+				uint16_t byteCount = blockSize;
+				while (readData(0, &byteCount) != SDCard::StatusEndOfBlock) {
+				}
+			}
+		} else if (blockReadState == ReadStateStopResponse || blockReadState == ReadStateStopWait) {
+			// The transmission was already stopped at the end of an extent.
+			chipSelectBegin(); // If not already done
+			if (blockReadState == ReadStateStopResponse) {
+				// The card sends 0xff before the response, the busy state follows the response.
+				uint8_t result;
+				for (; ((result = spiReceive()) & 0x80) && responseWaitCount < 0x10; ++responseWaitCount);
+				if (result != R1_ReadyState) {
+					return SDCard::StatusError;
+				}
+			}
+			waitUntilReady(300);
+			recordStopLatency();
+		} else {
+			// Send Command 12 in a special way
+			chipSelectBegin(); // If not already done			
+			sendStopTransmission();
 			uint8_t result;
 			for (uint8_t i = 0; ((result = spiReceive()) & 0x80) && i < 0x10; ++i);
 			if (result != R1_ReadyState) {
@@ -543,10 +1178,157 @@ initFail:
 				return SDCard::StatusError;
 			}
 			waitUntilReady(300);
+			recordStopLatency();
 		}
+		// No multi block read is active anymore.
+		blockReadMode = ReadModeSingleBlock;
+		blockReadState = ReadStateEnd;
+#ifdef SDCARD_LATENCY_STATS
+		latencyPollCount = 0; // Discard the polls of an unfinished phase.
+#endif
 		return SDCard::StatusReady;
 	}
 	
+	/// Send the CRC of a written block, check the response and wait until the card is ready.
+	///
+	inline SDCard::Status finishWriteBlock()
+	{
+		spiWait(2); // The CRC is not checked by the card.
+		if ((spiReceive() & DataResponseMask) != DataResponseAccepted) {
+			error = SDCard::Error_WriteFailed;
+			return SDCard::StatusError;
+		}
+		// Wait until the card has written the block.
+		if (!waitUntilReady(writeTimeout)) {
+			error = SDCard::Error_TimeOut;
+			return SDCard::StatusError;
+		}
+		return SDCard::StatusReady;
+	}
+
+	inline SDCard::Status writeBlock(uint32_t block, const uint8_t *data, uint16_t byteCount)
+	{
+		SDCard::Status status = SDCard::StatusError;
+		chipSelectBegin();
+		if (!waitUntilReady(writeTimeout)) {
+			error = SDCard::Error_TimeOut;
+		} else if (sendCommand(Cmd_WriteBlock, block) != R1_ReadyState) {
+			error = SDCard::Error_WriteBlockFailed;
+		} else {
+			byteCount = min(byteCount, blockSize);
+			spiSend(BlockDataStart);
+			for (uint16_t i = 0; i < byteCount; ++i) {
+				spiSend(data[i]);
+			}
+			for (uint16_t i = byteCount; i < blockSize; ++i) {
+				spiSend(0x00);
+			}
+			status = finishWriteBlock();
+		}
+		chipSelectEnd();
+		return status;
+	}
+
+	inline SDCard::Status startMultiWrite(uint32_t startBlock, uint32_t blockCount)
+	{
+		SDCard::Status status = SDCard::StatusError;
+		chipSelectBegin();
+		if (!waitUntilReady(writeTimeout)) {
+			error = SDCard::Error_TimeOut;
+		} else if (sendCommand(ACmd_SetWriteBlockEraseCount, blockCount) != R1_ReadyState) {
+			error = SDCard::Error_WriteBlockFailed;
+		} else if (sendCommand(Cmd_WriteMultiBlock, startBlock) != R1_ReadyState) {
+			error = SDCard::Error_WriteBlockFailed;
+		} else {
+			blockByteCount = 0;
+			status = SDCard::StatusReady;
+		}
+		chipSelectEnd();
+		return status;
+	}
+
+	inline SDCard::Status writeData(const uint8_t *data, uint16_t byteCount)
+	{
+		SDCard::Status status = SDCard::StatusReady;
+		chipSelectBegin();
+		while (byteCount > 0) {
+			if (blockByteCount == 0) {
+				spiSend(MultiWriteDataStart);
+			}
+			const uint16_t bytesToWrite = min(blockSize - blockByteCount, byteCount);
+			for (uint16_t i = 0; i < bytesToWrite; ++i) {
+				spiSend(data[i]);
+			}
+			data += bytesToWrite;
+			byteCount -= bytesToWrite;
+			blockByteCount += bytesToWrite;
+			if (blockByteCount >= blockSize) {
+				blockByteCount = 0;
+				status = finishWriteBlock();
+				if (status != SDCard::StatusReady) {
+					break;
+				}
+			}
+		}
+		chipSelectEnd();
+		return status;
+	}
+
+	inline SDCard::Status writeNextData(const uint8_t *data, uint16_t byteCount)
+	{
+		chipSelectBegin();
+		if (blockByteCount == 0) {
+			// The card keeps the data line low while it writes the previous block.
+			if (spiReceive() != 0xff) {
+				chipSelectEnd();
+				return SDCard::StatusWait;
+			}
+			spiSend(MultiWriteDataStart);
+		}
+		SDCard::Status status = SDCard::StatusReady;
+		byteCount = min(byteCount, static_cast<uint16_t>(blockSize - blockByteCount));
+		for (uint16_t i = 0; i < byteCount; ++i) {
+			spiSend(data[i]);
+		}
+		blockByteCount += byteCount;
+		if (blockByteCount >= blockSize) {
+			blockByteCount = 0;
+			spiWait(2); // The CRC is not checked by the card.
+			if ((spiReceive() & DataResponseMask) != DataResponseAccepted) {
+				error = SDCard::Error_WriteFailed;
+				status = SDCard::StatusError;
+			}
+		}
+		chipSelectEnd();
+		return status;
+	}
+
+	inline SDCard::Status stopMultiWrite()
+	{
+		SDCard::Status status = SDCard::StatusReady;
+		chipSelectBegin();
+		// Fill the last block.
+		if (blockByteCount > 0) {
+			for (uint16_t i = blockByteCount; i < blockSize; ++i) {
+				spiSend(0x00);
+			}
+			blockByteCount = 0;
+			status = finishWriteBlock();
+		} else if (!waitUntilReady(writeTimeout)) {
+			// The last block from writeNextData() is still written.
+			error = SDCard::Error_TimeOut;
+			status = SDCard::StatusError;
+		}
+		spiSend(MultiWriteStop);
+		spiSkip(1);
+		if (!waitUntilReady(writeTimeout)) {
+			error = SDCard::Error_TimeOut;
+			status = SDCard::StatusError;
+		}
+		chipSelectEnd();
+		return status;
+	}
+
 	inline SDCard::Status synchronousStartRead(uint32_t block)
 	{
 		SDCard::Status localStatus;
@@ -574,72 +1356,623 @@ initFail:
 		return result;		
 	}
 	
+	inline uint16_t getLittleEndianUInt16(const uint8_t *value) {
+		return value[0] | (static_cast<uint16_t>(value[1]) << 8);
+	}
+
+	/// Read a number of bytes from the current single block read.
+	///
+	/// Waits for the start of the block data if necessary.
+	///
+	inline SDCard::Status synchronousReadBytes(uint8_t *buffer, uint16_t byteCount)
+	{
+		while (byteCount > 0) {
+			uint16_t readCount = byteCount;
+			const SDCard::Status status = synchronousReadData(buffer, &readCount);
+			if (status == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			if (buffer != 0) {
+				buffer += readCount;
+			}
+			byteCount -= readCount;
+			if (status == SDCard::StatusEndOfBlock && byteCount > 0) {
+				error = SDCard::Error_ReadFailed;
+				return SDCard::StatusError;
+			}
+		}
+		return SDCard::StatusReady;
+	}
+
+	/// Read the regions from the header of a version 2 image, if this was not done yet.
+	///
+	/// Only block 0 is read, the directory itself is not read or verified.
+	///
+	inline SDCard::Status readRegionsIfRequired()
+	{
+		if (directoryType != DirectoryNone || isRegionRead) {
+			return SDCard::StatusReady;
+		}
+		// The magic, the empty version 1 directory, the version and the version 2 header with its CRC.
+		uint8_t buffer[versionTwoHeaderSize + 2];
+		if (readBlockPart(0, 0, buffer, sizeof(buffer)) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		// The regions are written, so a corrupt header must not be used.
+		if (strncmp("HCDI", reinterpret_cast<char*>(buffer), 4) == 0 &&
+			getLittleEndianUInt32(buffer + 4) == 0 && getLittleEndianUInt16(buffer + 8) == 2 &&
+			crc16Update(0, buffer, versionTwoHeaderSize) == getLittleEndianUInt16(buffer + versionTwoHeaderSize)) {
+			eventLogRegion.startBlock = getLittleEndianUInt32(buffer + 26);
+			eventLogRegion.blockCount = getLittleEndianUInt32(buffer + 30);
+			captureRegion.startBlock = getLittleEndianUInt32(buffer + 34);
+			captureRegion.blockCount = getLittleEndianUInt32(buffer + 38);
+		} else {
+			eventLogRegion = SDCard::Extent {0, 0};
+			captureRegion = SDCard::Extent {0, 0};
+		}
+		isRegionRead = true;
+		return SDCard::StatusReady;
+	}
+
+	/// Read the directory, if this was not done yet.
+	///
+	inline SDCard::Status readDirectoryIfRequired()
+	{
+		if (directoryType != DirectoryNone) {
+			return SDCard::StatusReady;
+		}
+		return readDirectory();
+	}
+
 	inline SDCard::Status readDirectory()
 	{
-		SDCard::Status status;
-		
 		// Wait until the block 0 read command has started.
 		if (synchronousStartRead(0) == SDCard::StatusError) {
 			return SDCard::StatusError;
 		}
 		
 		// The buffer to read the data.
-		uint8_t buffer[9];
-		memset(buffer, 0xaa, 9); 
-		uint16_t byteCount = 4;
-		if (synchronousReadData(buffer, &byteCount) == SDCard::StatusError) {
+		uint8_t buffer[32];
+		if (synchronousReadBytes(buffer, 8) == SDCard::StatusError) {
 			return SDCard::StatusError;
 		}
 		
-		// Check the magic.
+		// Check the magic, without it the card could contain a FAT32 file system.
 		const char *magic = "HCDI";
 		if (strncmp(magic, reinterpret_cast<char*>(buffer), 4) != 0) {
-			error = SDCard::Error_UnknownMagic;
-			return SDCard::StatusError;
+			if (stopRead() == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			return mountFat();
 		}
 		
-		// Read the directory.
-		uint32_t startBlock;
+		// A version 2 image starts with an empty version 1 directory,
+		// followed by the version number and the location of the hash index.
+		uint32_t startBlock = getLittleEndianUInt32(buffer + 4);
+		if (startBlock == 0) {
+			uint16_t headerCrc = crc16Update(0, buffer, 8);
+			if (synchronousReadBytes(buffer, 2) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			const uint16_t version = getLittleEndianUInt16(buffer);
+			if (version == 2) {
+				// Only the header is verified here, each lookup verifies the blocks it reads.
+				headerCrc = crc16Update(headerCrc, buffer, 2);
+				if (synchronousReadBytes(buffer, 32) == SDCard::StatusError) {
+					return SDCard::StatusError;
+				}
+				headerCrc = crc16Update(headerCrc, buffer, 32);
+				indexBlockCount = getLittleEndianUInt16(buffer);
+				indexStartBlock = getLittleEndianUInt32(buffer + 2);
+				recordStartBlock = getLittleEndianUInt32(buffer + 6);
+				recordCount = getLittleEndianUInt32(buffer + 10);
+				eventLogRegion.startBlock = getLittleEndianUInt32(buffer + 16);
+				eventLogRegion.blockCount = getLittleEndianUInt32(buffer + 20);
+				captureRegion.startBlock = getLittleEndianUInt32(buffer + 24);
+				captureRegion.blockCount = getLittleEndianUInt32(buffer + 28);
+				if (synchronousReadBytes(buffer, 2) == SDCard::StatusError) {
+					return SDCard::StatusError;
+				}
+				if (getLittleEndianUInt16(buffer) != headerCrc) {
+					error = SDCard::Error_DirectoryCorrupt;
+					eventLogRegion = SDCard::Extent {0, 0};
+					captureRegion = SDCard::Extent {0, 0};
+					stopRead();
+					return SDCard::StatusError;
+				}
+			} else if (version != 0) {
+				error = SDCard::Error_UnknownVersion;
+				stopRead();
+				return SDCard::StatusError;
+			}
+			if (stopRead() == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			if (version == 2) {
+				directoryType = DirectoryHCDI2;
+			} else {
+				// An empty version 1 directory.
+				directoryType = DirectoryHCDI1;
+			}
+			return SDCard::StatusReady;
+		}
+		
+		// Read the version 1 directory.
 		uint32_t fileSize;
 		uint8_t stringLength;
 		SDCard::DirectoryEntry *newEntry = 0;
 		SDCard::DirectoryEntry *lastEntry = 0;		
-		do {
-			// Read the initial bytes.
-			byteCount = 9; // 2x 32bit integer + 1 byte string length.
-			if (readData(buffer, &byteCount) == SDCard::StatusError) {
+		while (startBlock > 0) {
+			// Read the file size and the string length.
+			if (synchronousReadBytes(buffer, 5) == SDCard::StatusError) {
 				return SDCard::StatusError;
 			}
 			// Interpret the bytes (not portable).
+			fileSize = getLittleEndianUInt32(buffer);
+			stringLength = buffer[4];
+			newEntry = new SDCard::DirectoryEntry;
+			newEntry->startBlock = startBlock;
+			newEntry->fileSize = fileSize;
+			newEntry->sampleRate = 22050;
+			newEntry->crc = 0;
+			newEntry->format = SDCard::FormatUnsigned16;
+			newEntry->gain = 16;
+			newEntry->fileName = new char[stringLength+1];
+			newEntry->extents = 0;
+			newEntry->extentCount = 0;
+			memset(newEntry->fileName, 0, stringLength+1);
+			if (synchronousReadBytes(reinterpret_cast<uint8_t*>(newEntry->fileName), stringLength) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			newEntry->next = 0;
+			if (lastEntry != 0) {
+				lastEntry->next = newEntry;
+			} else {
+				directoryEntry = newEntry;
+			}
+			lastEntry = newEntry;
+			// Read the start block of the next entry.
+			if (synchronousReadBytes(buffer, 4) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
 			startBlock = getLittleEndianUInt32(buffer);
-			fileSize = getLittleEndianUInt32(buffer + 4);
-			stringLength = buffer[8];
-			if (startBlock > 0) {
-				newEntry = new SDCard::DirectoryEntry;
-				newEntry->startBlock = startBlock;
-				newEntry->fileSize = fileSize;
-				newEntry->fileName = new char[stringLength+1];
-				memset(newEntry->fileName, 0, stringLength+1);
-				byteCount = stringLength;
-				if (readData(reinterpret_cast<uint8_t*>(newEntry->fileName), &byteCount) == SDCard::StatusError) {
+		}
+		directoryType = DirectoryHCDI1;
+		
+		// Skip the rest of the block.
+		return stopRead();
+	}
+
+	/// Read a part of a single block synchronous.
+	///
+	/// @param block The block to read.
+	/// @param offset The offset of the first byte to read in the block.
+	/// @param buffer The buffer for the bytes.
+	/// @param byteCount The number of bytes to read.
+	///
+	inline SDCard::Status readBlockPart(uint32_t block, uint16_t offset, uint8_t *buffer, uint16_t byteCount)
+	{
+		if (synchronousStartRead(block) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (synchronousReadBytes(0, offset) == SDCard::StatusError ||
+			synchronousReadBytes(buffer, byteCount) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		return stopRead();
+	}
+
+	/// Check if the given block is a FAT32 boot sector.
+	///
+	inline bool isFat32BootSector(uint32_t block)
+	{
+		uint8_t buffer[8];
+		if (readBlockPart(block, 82, buffer, 8) == SDCard::StatusError) {
+			return false;
+		}
+		return strncmp("FAT32   ", reinterpret_cast<char*>(buffer), 8) == 0;
+	}
+
+	/// Get the first block of a cluster.
+	///
+	inline uint32_t clusterBlock(uint32_t cluster)
+	{
+		return dataStartBlock + (cluster - 2) * sectorsPerCluster;
+	}
+
+	/// Check if a cluster number is the end of a cluster chain.
+	///
+	inline bool isEndOfChain(uint32_t cluster)
+	{
+		return cluster < 2 || cluster >= 0x0ffffff7UL; // Free, bad or end of chain.
+	}
+
+	/// Read the entry for a cluster from the file allocation table.
+	///
+	inline SDCard::Status readFatEntry(uint32_t cluster, uint32_t *nextCluster)
+	{
+		uint8_t buffer[4];
+		if (readBlockPart(fatStartBlock + (cluster >> 7), (cluster & 0x7f) * 4, buffer, 4) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		*nextCluster = getLittleEndianUInt32(buffer) & 0x0fffffffUL;
+		return SDCard::StatusReady;
+	}
+
+	/// Resolve the cluster chain of a file into extents.
+	///
+	/// Consecutive entries in the file allocation table are read in one pass,
+	/// so a contiguous file needs only one block read for 128 clusters.
+	///
+	/// @param cluster The first cluster of the file.
+	/// @param clusterCount The number of clusters of the file.
+	/// Counting stops after maximumExtentCount + 1 extents. If the chain ends
+	/// early, the extents cover only the clusters of the chain.
+	///
+	/// @param extents The array for the extents, or 0 to just count them.
+	/// @param extentCount out: The number of extents.
+	///
+	inline SDCard::Status resolveExtents(uint32_t cluster, uint32_t clusterCount, SDCard::Extent *extents, uint16_t *extentCount)
+	{
+		uint16_t count = 0;
+		uint32_t extentStart = cluster;
+		uint32_t extentLength = 0;
+		uint8_t buffer[4];
+		while (clusterCount > 0 && count <= SDCard::maximumExtentCount) {
+			// Start reading the entries from the block with the current cluster.
+			uint8_t entryIndex = (cluster & 0x7f);
+			if (synchronousStartRead(fatStartBlock + (cluster >> 7)) == SDCard::StatusError ||
+				synchronousReadBytes(0, entryIndex * 4) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			for (;;) {
+				++extentLength;
+				if (--clusterCount == 0) {
+					break;
+				}
+				if (synchronousReadBytes(buffer, 4) == SDCard::StatusError) {
 					return SDCard::StatusError;
 				}
-				newEntry->next = 0;
-				if (lastEntry != 0) {
-					lastEntry->next = newEntry;
-				} else {
-					directoryEntry = newEntry;
+				const uint32_t nextCluster = getLittleEndianUInt32(buffer) & 0x0fffffffUL;
+				if (nextCluster != cluster + 1) {
+					// The file is fragmented, or the chain is shorter than expected.
+					if (extents != 0) {
+						extents[count].startBlock = clusterBlock(extentStart);
+						extents[count].blockCount = extentLength * sectorsPerCluster;
+					}
+					++count;
+					extentLength = 0;
+					if (isEndOfChain(nextCluster)) {
+						clusterCount = 0;
+					}
+					extentStart = nextCluster;
+					cluster = nextCluster;
+					break;
+				}
+				cluster = nextCluster;
+				if (++entryIndex >= 128) {
+					break; // The next entry is in the next block.
 				}
-				lastEntry = newEntry;
 			}
-		} while(startBlock > 0);
-		
-		// Success
+			if (stopRead() == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+		}
+		if (extentLength > 0) {
+			if (extents != 0) {
+				extents[count].startBlock = clusterBlock(extentStart);
+				extents[count].blockCount = extentLength * sectorsPerCluster;
+			}
+			++count;
+		}
+		*extentCount = count;
 		return SDCard::StatusReady;
 	}
-	
+
+	/// Create a directory entry from a FAT directory entry.
+	///
+	/// The start block of the new entry is set to the first cluster.
+	///
+	/// @return The new entry, or 0 if this is no sound file.
+	///
+	inline SDCard::DirectoryEntry* createFatEntry(const uint8_t *fatEntry)
+	{
+		const uint8_t attributes = fatEntry[11];
+		if (fatEntry[0] == 0xe5 || (attributes & 0x0f) == 0x0f || (attributes & 0x18) != 0) {
+			return 0; // A deleted file, long file name, directory or volume label.
+		}
+		if (strncmp("SND", reinterpret_cast<const char*>(fatEntry + 8), 3) != 0) {
+			return 0;
+		}
+		const uint32_t firstCluster =
+			(static_cast<uint32_t>(getLittleEndianUInt16(fatEntry + 20)) << 16) |
+			getLittleEndianUInt16(fatEntry + 26);
+		const uint32_t fileSize = getLittleEndianUInt32(fatEntry + 28);
+		if (fileSize == 0 || isEndOfChain(firstCluster)) {
+			return 0;
+		}
+		// Convert the 8.3 name into a lower case name with a dot.
+		char name[13];
+		uint8_t length = 0;
+		for (uint8_t i = 0; i < 11; ++i) {
+			if (i == 8) {
+				name[length++] = '.';
+			}
+			const char c = fatEntry[i];
+			if (c != ' ') {
+				name[length++] = (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
+			}
+		}
+		name[length] = 0;
+		SDCard::DirectoryEntry *newEntry = new SDCard::DirectoryEntry;
+		newEntry->startBlock = firstCluster;
+		newEntry->fileSize = fileSize;
+		newEntry->sampleRate = 22050;
+		newEntry->crc = 0;
+		newEntry->format = SDCard::FormatUnsigned16;
+		newEntry->gain = 16;
+		newEntry->fileName = new char[length+1];
+		memcpy(newEntry->fileName, name, length+1);
+		newEntry->extents = 0;
+		newEntry->extentCount = 0;
+		newEntry->next = 0;
+		return newEntry;
+	}
+
+	/// Mount a FAT32 file system and read the sound files from the root directory.
+	///
+	inline SDCard::Status mountFat()
+	{
+		uint8_t buffer[38];
+		// Check the boot signature.
+		if (readBlockPart(0, 510, buffer, 2) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (buffer[0] != 0x55 || buffer[1] != 0xaa) {
+			error = SDCard::Error_UnknownMagic;
+			return SDCard::StatusError;
+		}
+		// Block 0 is either the boot sector, or a master boot record.
+		uint32_t volumeStartBlock = 0;
+		if (!isFat32BootSector(0)) {
+			// Use the first partition.
+			if (readBlockPart(0, 450, buffer, 8) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			if (buffer[0] != 0x0b && buffer[0] != 0x0c) {
+				error = SDCard::Error_UnknownMagic;
+				return SDCard::StatusError;
+			}
+			volumeStartBlock = getLittleEndianUInt32(buffer + 4);
+			if (!isFat32BootSector(volumeStartBlock)) {
+				error = SDCard::Error_UnsupportedFileSystem;
+				return SDCard::StatusError;
+			}
+		}
+		// Read the BIOS parameter block, starting at offset 11.
+		if (readBlockPart(volumeStartBlock, 11, buffer, 38) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		sectorsPerCluster = buffer[2];
+		if (getLittleEndianUInt16(buffer) != blockSize || sectorsPerCluster == 0) {
+			error = SDCard::Error_UnsupportedFileSystem;
+			return SDCard::StatusError;
+		}
+		fatStartBlock = volumeStartBlock + getLittleEndianUInt16(buffer + 3);
+		dataStartBlock = fatStartBlock + buffer[5] * getLittleEndianUInt32(buffer + 25);
+		uint32_t cluster = getLittleEndianUInt32(buffer + 33);
+
+		// Read the root directory.
+		SDCard::DirectoryEntry *lastEntry = 0;
+		bool endOfDirectory = false;
+		while (!endOfDirectory && !isEndOfChain(cluster)) {
+			for (uint8_t sector = 0; sector < sectorsPerCluster && !endOfDirectory; ++sector) {
+				if (synchronousStartRead(clusterBlock(cluster) + sector) == SDCard::StatusError) {
+					return SDCard::StatusError;
+				}
+				for (uint8_t i = 0; i < 16; ++i) {
+					if (synchronousReadBytes(buffer, 32) == SDCard::StatusError) {
+						return SDCard::StatusError;
+					}
+					if (buffer[0] == 0) {
+						endOfDirectory = true;
+						break;
+					}
+					SDCard::DirectoryEntry *newEntry = createFatEntry(buffer);
+					if (newEntry != 0) {
+						if (lastEntry != 0) {
+							lastEntry->next = newEntry;
+						} else {
+							directoryEntry = newEntry;
+						}
+						lastEntry = newEntry;
+					}
+				}
+				if (stopRead() == SDCard::StatusError) {
+					return SDCard::StatusError;
+				}
+			}
+			if (!endOfDirectory && readFatEntry(cluster, &cluster) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+		}
+
+		// Resolve the cluster chains of all files into extents.
+		const uint32_t clusterSize = static_cast<uint32_t>(sectorsPerCluster) * blockSize;
+		SDCard::DirectoryEntry **link = &directoryEntry;
+		while (*link != 0) {
+			SDCard::DirectoryEntry *entry = *link;
+			const uint32_t firstCluster = entry->startBlock;
+			const uint32_t clusterCount = (entry->fileSize + clusterSize - 1) / clusterSize;
+			uint16_t extentCount;
+			if (resolveExtents(firstCluster, clusterCount, 0, &extentCount) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			if (extentCount == 0 || extentCount > SDCard::maximumExtentCount) {
+				// Remove files which would need too much memory.
+				*link = entry->next;
+				delete[] entry->fileName;
+				delete entry;
+				continue;
+			}
+			SDCard::Extent *extents = new SDCard::Extent[extentCount];
+			if (resolveExtents(firstCluster, clusterCount, extents, &extentCount) == SDCard::StatusError) {
+				delete[] extents;
+				return SDCard::StatusError;
+			}
+			// A chain which ends early limits the file to its clusters.
+			uint32_t chainSize = 0;
+			for (uint16_t i = 0; i < extentCount; ++i) {
+				chainSize += extents[i].blockCount * blockSize;
+			}
+			if (entry->fileSize > chainSize) {
+				entry->fileSize = chainSize;
+			}
+			entry->startBlock = extents[0].startBlock;
+			if (extentCount > 1) {
+				entry->extents = extents;
+				entry->extentCount = extentCount;
+			} else {
+				delete[] extents;
+			}
+			link = &entry->next;
+		}
+		directoryType = DirectoryFAT32;
+		return SDCard::StatusReady;
+	}
+
+	/// Calculate the FNV-1a hash for a file name.
+	///
+	inline uint32_t fileNameHash(const char *fileName)
+	{
+		uint32_t hash = 2166136261UL;
+		while (*fileName != 0) {
+			hash ^= static_cast<uint8_t>(*fileName);
+			hash *= 16777619UL;
+			++fileName;
+		}
+		return hash;
+	}
+
+	/// Search the hash index for a given hash.
+	///
+	/// Each index block contains 63 slots with a 32bit hash and a 32bit
+	/// record number, followed by the CRC16 of the slots. Unused slots have
+	/// the record number 0xffffffff. The whole block is read to verify it.
+	///
+	/// @param hash The hash to search for.
+	/// @param firstSlot The first slot in the block to check.
+	/// @param slot Set to the slot of the found hash.
+	/// @param recordIndex Set to the record number of the found hash.
+	/// @return StatusReady if the hash was found, StatusEndOfBlock if not, StatusError on any error.
+	///
+	inline SDCard::Status findIndexSlot(uint32_t hash, uint8_t firstSlot, uint8_t *slot, uint32_t *recordIndex)
+	{
+		const uint32_t block = indexStartBlock + (hash % indexBlockCount);
+		if (synchronousStartRead(block) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		uint8_t buffer[8];
+		uint16_t crc = 0;
+		SDCard::Status result = SDCard::StatusEndOfBlock;
+		for (uint8_t i = 0; i < slotsPerIndexBlock; ++i) {
+			if (synchronousReadBytes(buffer, 8) == SDCard::StatusError) {
+				return SDCard::StatusError;
+			}
+			crc = crc16Update(crc, buffer, 8);
+			// The rest of the block is empty after the first unused slot.
+			if (result != SDCard::StatusReady && i >= firstSlot &&
+				getLittleEndianUInt32(buffer + 4) != 0xffffffffUL && getLittleEndianUInt32(buffer) == hash) {
+				*slot = i;
+				*recordIndex = getLittleEndianUInt32(buffer + 4);
+				result = SDCard::StatusReady;
+			}
+		}
+		if (synchronousReadBytes(buffer, 2) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (stopRead() == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (getLittleEndianUInt16(buffer) != crc) {
+			error = SDCard::Error_DirectoryCorrupt;
+			return SDCard::StatusError;
+		}
+		return result;
+	}
+
+	/// Read a file record into the found entry.
+	///
+	/// Each record has 32 bytes: 32bit start block, 32bit file size,
+	/// 16bit sample rate, 16bit CRC, 8bit format, 8bit gain, the 16bit CRC
+	/// of the record and 16 bytes for the zero padded file name.
+	///
+	inline SDCard::Status readFileRecord(uint32_t recordIndex)
+	{
+		const uint32_t block = recordStartBlock + (recordIndex >> 4);
+		if (synchronousStartRead(block) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (synchronousReadBytes(0, static_cast<uint16_t>(recordIndex & 0x0f) * 32) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		uint8_t buffer[16];
+		if (synchronousReadBytes(buffer, 16) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		memset(foundFileName, 0, sizeof(foundFileName));
+		if (synchronousReadBytes(reinterpret_cast<uint8_t*>(foundFileName), 16) == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		if (stopRead() == SDCard::StatusError) {
+			return SDCard::StatusError;
+		}
+		uint16_t crc = crc16Update(0, buffer, 14);
+		crc = crc16Update(crc, reinterpret_cast<const uint8_t*>(foundFileName), 16);
+		if (getLittleEndianUInt16(buffer + 14) != crc) {
+			error = SDCard::Error_DirectoryCorrupt;
+			return SDCard::StatusError;
+		}
+		foundEntry.startBlock = getLittleEndianUInt32(buffer);
+		foundEntry.fileSize = getLittleEndianUInt32(buffer + 4);
+		foundEntry.sampleRate = getLittleEndianUInt16(buffer + 8);
+		foundEntry.crc = getLittleEndianUInt16(buffer + 10);
+		foundEntry.format = static_cast<SDCard::Format>(buffer[12]);
+		foundEntry.gain = buffer[13];
+		foundEntry.fileName = foundFileName;
+		foundEntry.extents = 0;
+		foundEntry.extentCount = 0;
+		foundEntry.next = 0;
+		return SDCard::StatusReady;
+	}
+
 	const SDCard::DirectoryEntry* findFile(const char *fileName)
 	{
+		if (directoryType == DirectoryHCDI2) {
+			if (indexBlockCount == 0) {
+				return 0;
+			}
+			const uint32_t hash = fileNameHash(fileName);
+			uint8_t slot = 0;
+			uint32_t recordIndex = 0;
+			// Hash collisions are rare, but possible. Check the name of the
+			// record and continue the search if it does not match.
+			while (slot < slotsPerIndexBlock) {
+				if (findIndexSlot(hash, slot, &slot, &recordIndex) != SDCard::StatusReady) {
+					return 0;
+				}
+				if (recordIndex < recordCount) {
+					if (readFileRecord(recordIndex) != SDCard::StatusReady) {
+						return 0;
+					}
+					if (strcmp(fileName, foundFileName) == 0) {
+						return &foundEntry;
+					}
+				}
+				++slot;
+			}
+			return 0;
+		}
 		SDCard::DirectoryEntry *entry = directoryEntry;
 		while (entry != 0) {
 			if (strcmp(fileName, entry->fileName) == 0) {
@@ -667,14 +2000,25 @@ SDCard::Status SDCard::initialize()
 }
 
 
+SDCard::Status SDCard::reinitialize()
+{
+	return sdCardState.reinitialize();
+}
+
+
 SDCard::Status SDCard::readDirectory()
 {
-	return sdCardState.readDirectory();	
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.readDirectoryIfRequired();
 }
 
 
 const SDCard::DirectoryEntry* SDCard::findFile(const char *fileName)
 {
+	SPISession session(SPIBus::SDCardDevice);
+	if (sdCardState.readDirectoryIfRequired() != StatusReady) {
+		return 0;
+	}
 	return sdCardState.findFile(fileName);
 }
 
@@ -682,22 +2026,39 @@ const SDCard::DirectoryEntry* SDCard::findFile(const char *fileName)
 
 SDCard::Status SDCard::startRead(uint32_t block)
 {
+	SPISession session(SPIBus::SDCardDevice);
 	return sdCardState.startRead(block);
 }
 
 
 SDCard::Status SDCard::startMultiRead(uint32_t startBlock)
 {
+	SPISession session(SPIBus::SDCardDevice);
 	return sdCardState.startMultiRead(startBlock);
 }
 
 
+SDCard::Status SDCard::startMultiRead(const Extent *extents, uint16_t extentCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.startMultiRead(extents, extentCount);
+}
+
+
 SDCard::Status SDCard::readData(uint8_t *buffer, uint16_t *byteCount)
 {
+	SPISession session(SPIBus::SDCardDevice);
 	return sdCardState.readData(buffer, byteCount);	
 }
 
 
+SDCard::Status SDCard::readBytes(uint8_t *buffer, uint16_t byteCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.synchronousReadBytes(buffer, byteCount);
+}
+
+
 void SDCard::startFastRead()
 {
 	// Select the chip and start reading.
@@ -713,6 +2074,7 @@ SDCard::Status SDCard::readFast4(uint8_t *buffer)
 
 SDCard::Status SDCard::stopRead()
 {
+	SPISession session(SPIBus::SDCardDevice);
 	return sdCardState.stopRead();
 }
 
@@ -723,6 +2085,133 @@ SDCard::Error SDCard::error()
 }
 
 
+SDCard::Status SDCard::writeBlock(uint32_t block, const uint8_t *data, uint16_t byteCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.writeBlock(block, data, byteCount);
+}
+
+
+SDCard::Status SDCard::startMultiWrite(uint32_t startBlock, uint32_t blockCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.startMultiWrite(startBlock, blockCount);
+}
+
+
+SDCard::Status SDCard::writeData(const uint8_t *data, uint16_t byteCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.writeData(data, byteCount);
+}
+
+
+SDCard::Status SDCard::writeNextData(const uint8_t *data, uint16_t byteCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.writeNextData(data, byteCount);
+}
+
+
+SDCard::Status SDCard::stopMultiWrite()
+{
+	SPISession session(SPIBus::SDCardDevice);
+	return sdCardState.stopMultiWrite();
+}
+
+
+SDCard::Extent SDCard::eventLogRegion()
+{
+	SPISession session(SPIBus::SDCardDevice);
+	sdCardState.readRegionsIfRequired();
+	return sdCardState.eventLogRegion;
+}
+
+
+SDCard::Extent SDCard::captureRegion()
+{
+	SPISession session(SPIBus::SDCardDevice);
+	sdCardState.readRegionsIfRequired();
+	return sdCardState.captureRegion;
+}
+
+
+uint16_t SDCard::crcErrorCount()
+{
+	return sdCardState.crcErrorCount;
+}
+
+
+SPISettings SDCard::spiSettings()
+{
+	return sdCardState.spiSettings;
+}
+
+
+uint32_t SDCard::clockSpeed()
+{
+	return sdCardState.clockSpeed;
+}
+
+
+bool SDCard::isHighSpeed()
+{
+	return sdCardState.highSpeed;
+}
+
+
+uint32_t SDCard::cardIdentity()
+{
+	return sdCardState.cardIdentity;
+}
+
+
+bool SDCard::isCardChanged()
+{
+	return sdCardState.isCardChanged;
+}
+
+
+uint16_t SDCard::latencyCount(LatencyPhase phase, uint8_t bucket)
+{
+#ifdef SDCARD_LATENCY_STATS
+	if (phase < LatencyPhaseCount && bucket < latencyBucketCount) {
+		return sdCardState.latencyHistogram[phase][bucket];
+	}
+#endif
+	return 0;
+}
+
+
+void SDCard::resetLatencyStats()
+{
+#ifdef SDCARD_LATENCY_STATS
+	memset(sdCardState.latencyHistogram, 0, sizeof(sdCardState.latencyHistogram));
+#endif
+}
+
+
+void SDCard::printLatencyStats(Print &output)
+{
+#ifdef SDCARD_LATENCY_STATS
+	for (uint8_t phase = 0; phase < LatencyPhaseCount; ++phase) {
+		switch (phase) {
+		case LatencyStartRead: output.print(F("start:")); break;
+		case LatencyBlockStart: output.print(F("block:")); break;
+		default: output.print(F("stop:")); break;
+		}
+		for (uint8_t bucket = 0; bucket < latencyBucketCount; ++bucket) {
+			output.print(' ');
+			output.print(sdCardState.latencyHistogram[phase][bucket]);
+		}
+		output.println();
+	}
+#else
+	output.println(F("No latency stats."));
+#endif
+}
+
+
 } // end of namespace
 
 
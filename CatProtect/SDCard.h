@@ -10,11 +10,25 @@
 // requires that the data from the SD card is loaded in small chunks to 
 // create the right timing when playing the samples.
 //
-// This library assumes the chip select for the SD-Card is on Pin 10.
-// The library is tested with the AdaFruit Data Logging Shield.
+// The chip select for the SD-Card is on pin 10 (PORTB, PINB2) by default.
+// To use another pin, define SDCARD_CSPINNUM, SDCARD_CSPORT and SDCARD_CSPIN
+// together in the compiler options, e.g. -DSDCARD_CSPINNUM=9
+// -DSDCARD_CSPORT=PORTB -DSDCARD_CSPIN=PINB1. Defining only some of them is
+// an error. The library is tested with the AdaFruit Data Logging Shield.
+//
+// All calls open a session for the SD-Card on the SPI bus, except
+// startFastRead() and readFast4(). Open one session around the whole
+// read process to keep the SPI bus for the card while reading.
+//
+// The card can either contain an image in the HCDI format, created with
+// the CreateDiskImage.pl script, or a FAT32 file system. From a FAT32 file
+// system, only the files with the extension "SND" in the root directory
+// are accessible, using their short 8.3 names in lower case.
 //
 
 
+#include "SPIBus.h"
+
 #include <SPI.h>
 
 
@@ -22,11 +36,18 @@
 ///
 //#define SDCARD_DEBUG
 
-/// Use the SPI transactions for all read calls.
-/// If not defined, it is assumed one huge SPI.transaction for the whole read process.
-/// Only the CS signal is handled.
+/// Verify the CRC16 of all read data blocks.
+/// The CRC is calculated with a lookup table in flash while the bytes are
+/// read. A block with a wrong CRC ends the read with an error and is counted.
 ///
-//#define SDCARD_USE_SPI_TRANSACTIONS 
+//#define SDCARD_VERIFY_CRC
+
+/// Record the latency of the card in log2 histograms.
+/// The number of polls is counted for the start of reads, for the wait on
+/// the start of each data block and for the wait until the card is ready
+/// after a stopped read. This needs 96 bytes of RAM.
+///
+//#define SDCARD_LATENCY_STATS
 
 
 namespace lr {
@@ -48,6 +69,13 @@ public:
 		Error_ReadSingleBlockFailed = 5,
 		Error_ReadFailed = 6,
 		Error_UnknownMagic = 7,
+		Error_UnknownVersion = 8,
+		Error_CrcMismatch = 9,
+		Error_WriteBlockFailed = 10,
+		Error_WriteFailed = 11,
+		Error_UnsupportedFileSystem = 12,
+		Error_CalibrationFailed = 13,
+		Error_DirectoryCorrupt = 15,
 	};
 	
 	/// The status of a command.
@@ -59,12 +87,55 @@ public:
 		StatusEndOfBlock = 3, ///< Reached the end of the block.
 	};
 
+	/// The phases of a read, for which the latency is recorded.
+	///
+	enum LatencyPhase : uint8_t {
+		LatencyStartRead = 0, ///< The number of StatusWait returns from startRead() and startMultiRead().
+		LatencyBlockStart = 1, ///< The number of polls until the data of a block starts.
+		LatencyStopRead = 2, ///< The number of polls until the card is ready after stopRead().
+		LatencyPhaseCount = 3, ///< The number of phases.
+	};
+
+	/// The number of buckets in each latency histogram.
+	///
+	/// Bucket 0 counts operations without any wait, bucket n counts
+	/// operations with 2^(n-1) to 2^n-1 polls. The last bucket also
+	/// counts all longer operations.
+	///
+	static const uint8_t latencyBucketCount = 16;
+
+	/// The format of the data in a file.
+	///
+	enum Format : uint8_t {
+		FormatUnsigned16 = 0, ///< 16bit unsigned little-endian mono samples.
+	};
+
+	/// A range of consecutive blocks on the card.
+	///
+	struct Extent {
+		uint32_t startBlock; ///< The first block of the range.
+		uint32_t blockCount; ///< The number of blocks, 0 if the range does not exist.
+	};
+
+	/// The maximum number of extents of a file on a FAT32 file system.
+	///
+	/// The extents of all files are kept in memory, files with more
+	/// extents are not listed in the directory.
+	///
+	static const uint16_t maximumExtentCount = 32;
+
 	/// A single directory entry.
 	///
 	struct DirectoryEntry {
 		uint32_t startBlock; ///< The start block of the file in blocks.
 		uint32_t fileSize; ///< The size of the file in bytes.
+		uint16_t sampleRate; ///< The sample rate in Hz.
+		uint16_t crc; ///< The CRC16-CCITT of the file data, 0 if unknown.
+		Format format; ///< The format of the file data.
+		uint8_t gain; ///< The gain in 1/16 steps, 16 = 1.0
 		char *fileName; ///< Null terminated filename ascii.
+		const Extent *extents; ///< The extents of a fragmented file, or 0 if the file is contiguous.
+		uint16_t extentCount; ///< The number of extents, or 0 if the file is contiguous.
 		DirectoryEntry *next; ///< The next entry, or a null pointer at the end.
 	};
 	
@@ -73,11 +144,40 @@ public:
 	/// This call needs some time until the SD-Card is ready for read. It
 	/// should be placed in the setup() method.
 	///
+	/// If supported, the card is switched into the high speed mode. After
+	/// this, the first blocks of the card are read at different clock speeds,
+	/// and the fastest clock which reads the data without errors is selected.
+	/// Use spiSettings() for all transactions with the card.
+	///
 	/// @return StatusReady on succes, StatusError on any error.
 	///
 	Status initialize();
 
-	/// Read the SD Card Directory in HCDI format
+	/// Bring the card back into the ready state after an error.
+	///
+	/// If the card still responds, only a few commands are sent. Otherwise
+	/// the card is initialized again like in initialize(). If a different
+	/// card was inserted meanwhile, the directory in memory belongs to the
+	/// previous card. It is discarded and read from the new card, and
+	/// isCardChanged() reports the change.
+	/// The last error is reset on success.
+	///
+	/// @return StatusReady on success, StatusError on any error.
+	///
+	Status reinitialize();
+
+	/// Read the SD Card Directory in HCDI format or from a FAT32 file system.
+	///
+	/// The directory is only read once. This is done automatically by
+	/// findFile(), if it was not done before.
+	///
+	/// For version 1 images, the whole directory is read into memory. For
+	/// version 2 images, only the header with the location of the hash index
+	/// is read from block 0, and verified with its CRC16. A mismatch fails
+	/// with Error_DirectoryCorrupt. For
+	/// FAT32 file systems, the cluster chain of each file is resolved into
+	/// a list of extents, so no file allocation table access is required
+	/// while reading the file.
 	///
 	/// @return StatusReady on success, StatusError on any error.
 	///
@@ -85,6 +185,12 @@ public:
 
 	/// Find a file with the given name
 	///
+	/// For version 2 images, this reads one block of the hash index and
+	/// one block with the file record from the card. The index block and
+	/// the record are verified with their CRC16, a mismatch returns 0 with
+	/// Error_DirectoryCorrupt. The returned entry is only valid until the
+	/// next call of this method.
+	///
 	/// @return The found directory entry, or 0 if no such file was found.
 	///
 	const DirectoryEntry* findFile(const char *fileName);
@@ -105,6 +211,20 @@ public:
 	///
 	Status startMultiRead(uint32_t startBlock);
 
+	/// Start reading the given extents one after the other until stopRead() is called.
+	///
+	/// Only readFast4() follows the extents. At the end of each extent, it
+	/// stops the transmission and starts a new multi block read without
+	/// blocking, and returns StatusWait meanwhile. After the last extent,
+	/// the following blocks are read.
+	///
+	/// @param extents The extents to read. They have to stay valid until stopRead() is called.
+	/// @param extentCount The number of extents, at least 1.
+	/// @return StatusWait = call again, StatusError = there was an error,
+	///    StatusReady = reading of the block has started, call readFast4().
+	///
+	Status startMultiRead(const Extent *extents, uint16_t extentCount);
+
 	/// Read data if ready.
 	///
 	/// @param buffer The buffer to read the data into.
@@ -114,8 +234,19 @@ public:
 	///
 	Status readData(uint8_t *buffer, uint16_t *byteCount);
 
+	/// Read a number of bytes from the current block, waiting for the data.
+	///
+	/// @param buffer The buffer to read the data into.
+	/// @param byteCount The number of bytes to read.
+	/// @return StatusReady on success, StatusError if there was an error or
+	///     the end of the block was reached before all bytes were read.
+	///
+	Status readBytes(uint8_t *buffer, uint16_t byteCount);
+
 	/// Start the fast reading.
 	///
+	/// This call and readFast4() need an open SPISession for the SD-Card.
+	///
 	void startFastRead();
 
 	/// Super fast data multi read.
@@ -136,9 +267,134 @@ public:
 	/// 
 	Status stopRead();
 
+	/// Write a single block synchronous.
+	///
+	/// This is a blocking call and can take a long time until the card
+	/// has written the data. Never call it while playing audio.
+	///
+	/// @param block The block in (512 byte blocks).
+	/// @param data The data to write.
+	/// @param byteCount The number of bytes to write, the rest of the block is filled with 0x00.
+	/// @return StatusReady on success, StatusError on any error.
+	///
+	Status writeBlock(uint32_t block, const uint8_t *data, uint16_t byteCount);
+
+	/// Start writing multiple blocks until stopMultiWrite() is called.
+	///
+	/// The card is told how many blocks will be written, so it can erase
+	/// them in advance.
+	///
+	/// @param startBlock The first block in (512 byte blocks).
+	/// @param blockCount The number of blocks which will be written.
+	/// @return StatusReady on success, StatusError on any error.
+	///
+	Status startMultiWrite(uint32_t startBlock, uint32_t blockCount);
+
+	/// Write data synchronous after startMultiWrite().
+	///
+	/// The data is written as one stream, a new block is started every 512 bytes.
+	/// This call waits until the card is ready after each completed block.
+	///
+	/// @param data The data to write.
+	/// @param byteCount The number of bytes to write.
+	/// @return StatusReady on success, StatusError on any error.
+	///
+	Status writeData(const uint8_t *data, uint16_t byteCount);
+
+	/// Write the next part of the stream after startMultiWrite() without waiting for the card.
+	///
+	/// Like writeData(), a new block is started every 512 bytes. If the card is
+	/// still busy writing the previous block at the start of a new block, nothing
+	/// is sent. Otherwise the data is sent, and a completed block is written by
+	/// the card in the background. Do not mix this call with writeData().
+	///
+	/// @param data The data to write.
+	/// @param byteCount The number of bytes to write, which must not cross the end of a block.
+	/// @return StatusWait = the card is busy, call again, StatusReady = the data was sent,
+	///    StatusError = the card did not accept the block.
+	///
+	Status writeNextData(const uint8_t *data, uint16_t byteCount);
+
+	/// End writing multiple blocks.
+	///
+	/// An incomplete last block is filled with 0x00 bytes. This is a blocking call.
+	///
+	/// @return StatusReady on success, StatusError on any error.
+	///
+	Status stopMultiWrite();
+
+	/// Get the region for the event log.
+	///
+	/// If the directory was not read yet, only the header in block 0 is read.
+	///
+	/// @return The region, with a block count of 0 if the card has no event log.
+	///
+	Extent eventLogRegion();
+
+	/// Get the region for audio recordings.
+	///
+	/// If the directory was not read yet, only the header in block 0 is read.
+	///
+	/// @return The region, with a block count of 0 if the card has no capture region.
+	///
+	Extent captureRegion();
+
 	/// Get the last error
 	///
 	Error error();
+
+	/// Get the number of read blocks with a wrong CRC.
+	///
+	/// This is always 0 if SDCARD_VERIFY_CRC is not defined.
+	///
+	uint16_t crcErrorCount();
+
+	/// Get the SPI settings selected by the calibration in initialize().
+	///
+	/// The settings are also set for the SD-Card on the SPI bus.
+	///
+	SPISettings spiSettings();
+
+	/// Get the SPI clock speed in Hz selected by the calibration in initialize().
+	///
+	uint32_t clockSpeed();
+
+	/// Check if the card was switched into the high speed mode.
+	///
+	bool isHighSpeed();
+
+	/// Get a value which identifies the card.
+	///
+	/// This is the CRC16 of the CID register in the high word and the CRC16
+	/// of the CSD register in the low word, read in initialize().
+	///
+	/// @return The identity, or 0 if the registers could not be read.
+	///
+	uint32_t cardIdentity();
+
+	/// Check if the last reinitialize() found a different card.
+	///
+	/// Everything read from the previous card, like the voices and the
+	/// position in the event log, has to be read again.
+	///
+	bool isCardChanged();
+
+	/// Get the number of operations in a bucket of a latency histogram.
+	///
+	/// The counts stop at 0xffff. This is always 0 if SDCARD_LATENCY_STATS is not defined.
+	///
+	/// @param phase The phase of the read.
+	/// @param bucket The bucket, from 0 to latencyBucketCount-1.
+	///
+	uint16_t latencyCount(LatencyPhase phase, uint8_t bucket);
+
+	/// Reset all latency histograms.
+	///
+	void resetLatencyStats();
+
+	/// Print all latency histograms, one line for each phase.
+	///
+	void printLatencyStats(Print &output);
 };
 
 /// The global instance to access the SD Card
@@ -0,0 +1,69 @@
+//
+// SPIBus
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "SPIBus.h"
+
+
+namespace lr {
+
+
+/// The global instance of the SPI bus.
+///
+SPIBus spiBus;
+
+
+SPIBus::SPIBus()
+	: _suspendedDevices(0), _isOwnerSuspended(false), _owner(NoDevice)
+{
+	for (uint8_t i = 0; i < DeviceCount; ++i) {
+		_chipSelectPort[i] = 0;
+		_chipSelectMask[i] = 0;
+	}
+}
+
+
+void SPIBus::setSettings(Device device, const SPISettings &settings)
+{
+	_settings[device] = settings;
+}
+
+
+void SPIBus::setChipSelect(Device device, volatile uint8_t *port, uint8_t mask)
+{
+	_chipSelectPort[device] = port;
+	_chipSelectMask[device] = mask;
+}
+
+
+void SPIBus::switchTo(Device device)
+{
+	// End the transaction of the current owner.
+	if (_owner != NoDevice) {
+		volatile uint8_t *port = _chipSelectPort[_owner];
+		// Release a selected chip, so the other device can use the bus.
+		// It is only selected again if the bus is passed to another device.
+		if (port != 0 && (*port & _chipSelectMask[_owner]) == 0) {
+			*port |= _chipSelectMask[_owner];
+			if (device != NoDevice) {
+				_suspendedDevices |= _BV(_owner);
+			}
+		}
+		SPI.endTransaction();
+	}
+	_owner = device;
+	// Start the transaction for the new owner.
+	if (device != NoDevice) {
+		SPI.beginTransaction(_settings[device]);
+		// Select the chip again, if it was released by an earlier switch.
+		if ((_suspendedDevices & _BV(device)) != 0) {
+			*_chipSelectPort[device] &= ~_chipSelectMask[device];
+			_suspendedDevices &= ~_BV(device);
+		}
+	}
+}
+
+
+}
+
@@ -0,0 +1,154 @@
+#pragma once
+//
+// SPIBus
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <SPI.h>
+
+
+namespace lr {
+
+
+/// The owner of the SPI bus.
+///
+/// The bus keeps the SPI settings and the chip select of each device. It
+/// is used with SPISession objects, which open a transaction for a device
+/// on creation and close it when they go out of scope. If a device already
+/// owns the bus, a session for the same device costs just one compare.
+///
+/// A session for another device can be opened inside an open session, for
+/// short transfers like a DAC value in the middle of a multi block read
+/// from the SD-Card. The chip select of the current owner is released for
+/// the transfer and restored at the end of the inner session. At the end
+/// of the outermost session, the chip select of the owner is released.
+///
+/// A device which works with the SPI settings of the owner can also be
+/// used inside the session of the owner, after suspendOwner(). This only
+/// changes the chip selects, without ending the transaction.
+///
+/// No device may use the SPI bus from an interrupt, therefore no transaction
+/// disables the interrupts.
+///
+class SPIBus
+{
+public:
+	/// The devices on the bus.
+	///
+	enum Device : uint8_t {
+		SDCardDevice = 0, ///< The SD-Card.
+		DacDevice = 1, ///< The DAC, if DACPORT_USE_SPI is defined.
+		DeviceCount = 2, ///< The number of devices.
+		NoDevice = 0xff, ///< No device owns the bus.
+	};
+
+public:
+	/// ctor
+	///
+	SPIBus();
+
+public:
+	/// Set the SPI settings for a device.
+	///
+	/// The new settings are used with the next session of the device.
+	///
+	void setSettings(Device device, const SPISettings &settings);
+
+	/// Set the chip select of a device.
+	///
+	/// @param device The device.
+	/// @param port The port of the chip select pin.
+	/// @param mask The bit mask of the chip select pin in the port.
+	///
+	void setChipSelect(Device device, volatile uint8_t *port, uint8_t mask);
+
+	/// Get the device which owns the bus.
+	///
+	inline Device owner() const { return _owner; }
+
+	/// Pass the bus to another device.
+	///
+	/// Use SPISession instead of calling this method directly.
+	///
+	/// @param device The new owner of the bus, or NoDevice to end the transaction.
+	///
+	void switchTo(Device device);
+
+	/// Release the chip select of the owner, for a short transfer to another
+	/// device with the settings of the owner.
+	///
+	/// The transaction stays open. The caller selects the other device, and
+	/// calls resumeOwner() after the transfer.
+	///
+	inline void suspendOwner()
+	{
+		volatile uint8_t *port = _chipSelectPort[_owner];
+		_isOwnerSuspended = (*port & _chipSelectMask[_owner]) == 0;
+		*port |= _chipSelectMask[_owner];
+	}
+
+	/// Select the owner again after suspendOwner(), if it was selected before.
+	///
+	inline void resumeOwner()
+	{
+		if (_isOwnerSuspended) {
+			*_chipSelectPort[_owner] &= ~_chipSelectMask[_owner];
+		}
+	}
+
+private:
+	SPISettings _settings[DeviceCount]; ///< The settings for each device.
+	volatile uint8_t *_chipSelectPort[DeviceCount]; ///< The port of the chip select for each device.
+	uint8_t _chipSelectMask[DeviceCount]; ///< The mask of the chip select for each device.
+	uint8_t _suspendedDevices; ///< A bit for each device with a chip select released by switchTo().
+	bool _isOwnerSuspended; ///< If the chip select of the owner was released by suspendOwner().
+	Device _owner; ///< The current owner of the bus.
+};
+
+
+/// The global instance of the SPI bus.
+///
+extern SPIBus spiBus;
+
+
+/// A session on the SPI bus for one device.
+///
+/// The device owns the bus until the session goes out of scope. After this,
+/// the previous owner gets the bus back.
+///
+class SPISession
+{
+public:
+	/// Start the session.
+	///
+	inline SPISession(SPIBus::Device device)
+		: _previousOwner(spiBus.owner()), _switched(_previousOwner != device)
+	{
+		if (_switched) {
+			spiBus.switchTo(device);
+		}
+	}
+
+	/// End the session.
+	///
+	inline ~SPISession()
+	{
+		if (_switched) {
+			spiBus.switchTo(_previousOwner);
+		}
+	}
+
+private:
+	SPISession(const SPISession&);
+	SPISession& operator=(const SPISession&);
+
+private:
+	const SPIBus::Device _previousOwner; ///< The owner before this session.
+	const bool _switched; ///< If the owner was changed for this session.
+};
+
+
+}
+
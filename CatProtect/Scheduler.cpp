@@ -0,0 +1,175 @@
+//
+// Scheduler
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "Scheduler.h"
+
+
+namespace lr {
+
+
+/// The global instance of the scheduler.
+///
+Scheduler scheduler;
+
+
+Scheduler::Scheduler()
+	: _taskCount(0)
+{
+#ifdef SCHEDULER_PROFILE
+	_moveCount = 0;
+#endif
+}
+
+
+bool Scheduler::start(Callback callback, void *context, unsigned long delay, uint16_t interval, const unsigned long currentTime)
+{
+	uint8_t index = find(callback, context);
+	const bool isNew = (index == maxTaskCount);
+	if (isNew) {
+		if (_taskCount >= maxTaskCount) {
+			return false;
+		}
+		index = _taskCount++;
+		_tasks[index].callback = callback;
+		_tasks[index].context = context;
+		_tasks[index].deadline = currentTime + delay;
+	}
+	Task &task = _tasks[index];
+	// A restarted task can move in both directions.
+	const bool isEarlier = static_cast<long>((currentTime + delay) - task.deadline) < 0;
+	task.deadline = currentTime + delay;
+	task.interval = interval;
+	if (isNew || isEarlier) {
+		siftUp(index);
+	} else {
+		siftDown(index);
+	}
+	return true;
+}
+
+
+void Scheduler::stop(Callback callback, void *context)
+{
+	const uint8_t index = find(callback, context);
+	if (index != maxTaskCount) {
+		removeAt(index);
+	}
+}
+
+
+unsigned long Scheduler::timeUntilNext(const unsigned long currentTime) const
+{
+	if (_taskCount == 0) {
+		return 0xffffffffUL;
+	}
+	const long delta = static_cast<long>(_tasks[0].deadline - currentTime);
+	return (delta > 0) ? static_cast<unsigned long>(delta) : 0;
+}
+
+
+void Scheduler::dispatch(const unsigned long currentTime)
+{
+	// Limit the calls, in case a task restarts itself without a delay.
+	for (uint8_t i = 0; i < maxTaskCount && isDue(currentTime); ++i) {
+		// Update the heap first, the callback may start or stop tasks.
+		const Callback callback = _tasks[0].callback;
+		void * const context = _tasks[0].context;
+		if (_tasks[0].interval > 0) {
+			_tasks[0].deadline += _tasks[0].interval;
+			// Skip the missed intervals, e.g. after playing a sound.
+			if (static_cast<long>(currentTime - _tasks[0].deadline) >= 0) {
+				_tasks[0].deadline = currentTime + _tasks[0].interval;
+			}
+			siftDown(0);
+		} else {
+			removeAt(0);
+		}
+		callback(context, currentTime);
+	}
+}
+
+
+uint32_t Scheduler::moveCount() const
+{
+#ifdef SCHEDULER_PROFILE
+	return _moveCount;
+#else
+	return 0;
+#endif
+}
+
+
+uint8_t Scheduler::find(Callback callback, void *context) const
+{
+	for (uint8_t i = 0; i < _taskCount; ++i) {
+		if (_tasks[i].callback == callback && _tasks[i].context == context) {
+			return i;
+		}
+	}
+	return maxTaskCount;
+}
+
+
+void Scheduler::removeAt(uint8_t index)
+{
+	--_taskCount;
+	if (index == _taskCount) {
+		return;
+	}
+	// Move the last task into the gap, it can go up or down.
+	_tasks[index] = _tasks[_taskCount];
+	if (index > 0 && isBefore(_tasks[index], _tasks[(index - 1) / 2])) {
+		siftUp(index);
+	} else {
+		siftDown(index);
+	}
+}
+
+
+void Scheduler::siftUp(uint8_t index)
+{
+	const Task task = _tasks[index];
+	while (index > 0) {
+		const uint8_t parent = (index - 1) / 2;
+		if (!isBefore(task, _tasks[parent])) {
+			break;
+		}
+		_tasks[index] = _tasks[parent];
+		index = parent;
+#ifdef SCHEDULER_PROFILE
+		++_moveCount;
+#endif
+	}
+	_tasks[index] = task;
+}
+
+
+void Scheduler::siftDown(uint8_t index)
+{
+	const Task task = _tasks[index];
+	for (;;) {
+		uint8_t child = index * 2 + 1;
+		if (child >= _taskCount) {
+			break;
+		}
+		if (child + 1 < _taskCount && isBefore(_tasks[child + 1], _tasks[child])) {
+			++child;
+		}
+		if (!isBefore(_tasks[child], task)) {
+			break;
+		}
+		_tasks[index] = _tasks[child];
+		index = child;
+#ifdef SCHEDULER_PROFILE
+		++_moveCount;
+#endif
+	}
+	_tasks[index] = task;
+}
+
+
+}
+
+
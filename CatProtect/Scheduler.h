@@ -0,0 +1,154 @@
+#pragma once
+//
+// Scheduler
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+/// Count the levels which the tasks move in the heap.
+/// The host benchmark uses the count to model the cycles of the dispatch.
+/// This adds about 8 cycles to each level and needs 4 bytes of RAM.
+///
+//#define SCHEDULER_PROFILE
+
+
+namespace lr {
+
+
+/// Runs tasks at their deadlines.
+///
+/// The tasks are kept in a binary min-heap, ordered by their deadline. The
+/// task with the next deadline is always the first one, so checking if a
+/// task is due takes constant time, independent of the number of tasks.
+/// Only due tasks are dispatched, each with O(log n) work.
+///
+/// Deadlines are compared with the signed difference of the times, so the
+/// order stays correct if millis() wraps around. All deadlines have to be
+/// less than 24 days apart, which is true for the delays used here.
+///
+/// A task is identified by its callback and context. The context is passed
+/// to the callback, e.g. the object which handles the task. A task with an
+/// interval is repeated, otherwise it is removed before it is called.
+///
+class Scheduler
+{
+public:
+	/// The callback of a task.
+	///
+	/// The first parameter is the context of the task.
+	/// The second parameter is the current time in ms.
+	///
+	typedef void (*Callback)(void*, const unsigned long);
+
+	/// The maximum number of tasks.
+	///
+	static const uint8_t maxTaskCount = 8;
+
+public:
+	/// ctor
+	///
+	Scheduler();
+
+public:
+	/// Start a task, or restart it if it already exists.
+	///
+	/// @param callback The function to call.
+	/// @param context The context for the callback.
+	/// @param delay The time until the first call in ms.
+	/// @param interval The interval between the calls in ms, or 0 for a single call.
+	/// @param currentTime The current time in ms.
+	/// @return true if the task was started, false if there are too many tasks.
+	///
+	bool start(Callback callback, void *context, unsigned long delay, uint16_t interval, const unsigned long currentTime);
+
+	/// Stop a task.
+	///
+	/// @param callback The function of the task.
+	/// @param context The context of the task.
+	///
+	void stop(Callback callback, void *context);
+
+	/// Check if a task is due.
+	///
+	inline bool isDue(const unsigned long currentTime) const {
+		return _taskCount > 0 && static_cast<long>(currentTime - _tasks[0].deadline) >= 0;
+	}
+
+	/// Get the time until the next task is due.
+	///
+	/// @return The time in ms, 0 if a task is due, or 0xffffffff if there is no task.
+	///
+	unsigned long timeUntilNext(const unsigned long currentTime) const;
+
+	/// Call all tasks which are due.
+	///
+	/// Call this from the loop. Each task is called at most once, even if
+	/// it missed several intervals.
+	///
+	void dispatch(const unsigned long currentTime);
+
+	/// Get the number of tasks.
+	///
+	inline uint8_t taskCount() const { return _taskCount; }
+
+	/// Get the number of levels which the tasks moved in the heap.
+	///
+	/// This is always 0 if SCHEDULER_PROFILE is not defined.
+	///
+	uint32_t moveCount() const;
+
+private:
+	/// A task.
+	///
+	struct Task {
+		unsigned long deadline; ///< The time of the next call.
+		Callback callback; ///< The function to call.
+		void *context; ///< The context for the callback.
+		uint16_t interval; ///< The interval between the calls, or 0.
+	};
+
+	/// Check if a task is before another task.
+	///
+	static inline bool isBefore(const Task &a, const Task &b) {
+		return static_cast<long>(a.deadline - b.deadline) < 0;
+	}
+
+	/// Find a task.
+	///
+	/// @return The index of the task, or maxTaskCount if there is no such task.
+	///
+	uint8_t find(Callback callback, void *context) const;
+
+	/// Remove the task at the given index.
+	///
+	void removeAt(uint8_t index);
+
+	/// Move the task at the given index up to its place.
+	///
+	void siftUp(uint8_t index);
+
+	/// Move the task at the given index down to its place.
+	///
+	void siftDown(uint8_t index);
+
+private:
+	Task _tasks[maxTaskCount]; ///< The heap with the tasks.
+	uint8_t _taskCount; ///< The number of tasks.
+#ifdef SCHEDULER_PROFILE
+	uint32_t _moveCount; ///< The number of levels the tasks moved in the heap.
+#endif
+};
+
+
+/// The global instance of the scheduler.
+///
+extern Scheduler scheduler;
+
+
+}
+
+
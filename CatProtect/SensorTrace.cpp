@@ -0,0 +1,152 @@
+//
+// SensorTrace
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "SensorTrace.h"
+
+
+namespace lr {
+
+
+/// The mask and code for a delta.
+///
+static const uint8_t deltaMask = 0x80;
+static const uint8_t deltaCode = 0x00;
+
+/// The mask and code for a run of samples.
+///
+static const uint8_t runMask = 0xc0;
+static const uint8_t runCode = 0x80;
+static const uint8_t maximumRunLength = 0x3f;
+
+/// The mask and code for an absolute value.
+///
+static const uint8_t absoluteMask = 0xfc;
+static const uint8_t absoluteCode = 0xc0;
+
+
+SensorTrace::SensorTrace()
+{
+	clear();
+}
+
+
+void SensorTrace::add(const unsigned long currentTime, uint16_t value)
+{
+	if (!_isStarted) {
+		startChunk(currentTime, value);
+		return;
+	}
+	if (static_cast<long>(currentTime - _nextSampleTime) < 0) {
+		return;
+	}
+	// Start a new chunk if samples were missed or the chunk is full.
+	Chunk &chunk = _chunks[_chunkIndex];
+	if ((currentTime - _nextSampleTime) >= sampleInterval || chunk.size >= chunkDataSize) {
+		startChunk(currentTime, value);
+		return;
+	}
+	_nextSampleTime += sampleInterval;
+	const int16_t delta = static_cast<int16_t>(value - _lastValue);
+	if (delta == 0) {
+		if (_isRunOpen && (chunk.data[chunk.size - 1] & ~runMask) < maximumRunLength) {
+			++chunk.data[chunk.size - 1];
+		} else {
+			chunk.data[chunk.size++] = runCode | 1;
+			_isRunOpen = true;
+		}
+	} else if (delta >= -64 && delta <= 63) {
+		chunk.data[chunk.size++] = deltaCode | (static_cast<uint8_t>(delta) & ~deltaMask);
+		_isRunOpen = false;
+	} else {
+		if (chunk.size + 2 > chunkDataSize) {
+			startChunk(currentTime, value);
+			return;
+		}
+		chunk.data[chunk.size++] = absoluteCode | (value >> 8);
+		chunk.data[chunk.size++] = static_cast<uint8_t>(value);
+		_isRunOpen = false;
+	}
+	_lastValue = value;
+}
+
+
+void SensorTrace::clear()
+{
+	for (uint8_t i = 0; i < chunkCount; ++i) {
+		_chunks[i].startTime = 0;
+		_chunks[i].size = 0;
+	}
+	_chunkIndex = 0;
+	_isStarted = false;
+	_isRunOpen = false;
+	_lastValue = 0;
+	_nextSampleTime = 0;
+}
+
+
+void SensorTrace::print(Print &output)
+{
+	// The oldest chunk is the one after the current chunk.
+	uint8_t chunkIndex = _chunkIndex;
+	for (uint8_t i = 0; i < chunkCount; ++i) {
+		if (++chunkIndex >= chunkCount) {
+			chunkIndex = 0;
+		}
+		printChunk(output, _chunks[chunkIndex]);
+	}
+}
+
+
+void SensorTrace::startChunk(const unsigned long currentTime, uint16_t value)
+{
+	if (_isStarted && ++_chunkIndex >= chunkCount) {
+		_chunkIndex = 0;
+	}
+	Chunk &chunk = _chunks[_chunkIndex];
+	chunk.startTime = currentTime;
+	chunk.data[0] = absoluteCode | (value >> 8);
+	chunk.data[1] = static_cast<uint8_t>(value);
+	chunk.size = 2;
+	_isStarted = true;
+	_isRunOpen = false;
+	_lastValue = value;
+	_nextSampleTime = currentTime + sampleInterval;
+}
+
+
+void SensorTrace::printChunk(Print &output, const Chunk &chunk)
+{
+	uint32_t time = chunk.startTime;
+	uint16_t value = 0;
+	for (uint8_t i = 0; i < chunk.size; ++i) {
+		const uint8_t code = chunk.data[i];
+		uint8_t count = 1;
+		if ((code & deltaMask) == deltaCode) {
+			// Sign extend the 7 bit delta.
+			value += static_cast<int8_t>(code << 1) >> 1;
+		} else if ((code & runMask) == runCode) {
+			count = code & ~runMask;
+		} else if ((code & absoluteMask) == absoluteCode && i + 1 < chunk.size) {
+			value = (static_cast<uint16_t>(code & ~absoluteMask) << 8) | chunk.data[++i];
+		}
+		printLine(output, time, value, count);
+		time += static_cast<uint32_t>(count) * sampleInterval;
+	}
+}
+
+
+void SensorTrace::printLine(Print &output, uint32_t time, uint16_t value, uint8_t count)
+{
+	output.print(time);
+	output.print(' ');
+	output.print(value);
+	output.print(' ');
+	output.println(count);
+}
+
+
+}
+
+
@@ -0,0 +1,103 @@
+#pragma once
+//
+// SensorTrace
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+
+namespace lr {
+
+
+/// A compressed trace of a sensor value in RAM.
+///
+/// The value is sampled every sampleInterval and written as compressed
+/// codes into a ring of chunks. If all chunks are full, the oldest chunk
+/// is overwritten. Each chunk starts with the time and the absolute value
+/// of the first sample, so every chunk can be decoded on its own.
+///
+/// The codes in a chunk are:
+/// - 0ddddddd: The value changed by the signed 7 bit delta d (never 0).
+/// - 10nnnnnn: The value did not change for n samples (1-63).
+/// - 110000hh llllllll: The absolute 10 bit value hhllllllll.
+///
+/// If the loop was blocked and samples were missed, a new chunk is started.
+///
+class SensorTrace
+{
+public:
+	/// The interval between two samples in ms.
+	///
+	static const uint8_t sampleInterval = 50;
+
+	/// The number of chunks in the ring.
+	///
+	static const uint8_t chunkCount = 4;
+
+	/// The number of code bytes in each chunk.
+	///
+	static const uint8_t chunkDataSize = 43;
+
+public:
+	/// ctor
+	///
+	SensorTrace();
+
+public:
+	/// Add a sample if the sample interval elapsed.
+	///
+	/// Call this from the loop.
+	///
+	/// @param currentTime The current time in ms.
+	/// @param value The current value of the sensor.
+	///
+	void add(const unsigned long currentTime, uint16_t value);
+
+	/// Remove all samples.
+	///
+	void clear();
+
+	/// Print the trace, starting with the oldest sample.
+	///
+	/// Each line contains the time, the value and the number of samples
+	/// with this value.
+	///
+	void print(Print &output);
+
+private:
+	/// A chunk of the trace.
+	///
+	struct Chunk {
+		uint32_t startTime; ///< The time of the first sample in ms.
+		uint8_t size; ///< The number of used bytes in data.
+		uint8_t data[chunkDataSize]; ///< The codes.
+	};
+
+	/// Start a new chunk with the given sample.
+	///
+	void startChunk(const unsigned long currentTime, uint16_t value);
+
+	/// Print a chunk.
+	///
+	static void printChunk(Print &output, const Chunk &chunk);
+
+	/// Print a line with a value.
+	///
+	static void printLine(Print &output, uint32_t time, uint16_t value, uint8_t count);
+
+private:
+	Chunk _chunks[chunkCount]; ///< The chunks of the ring.
+	uint8_t _chunkIndex; ///< The index of the current chunk.
+	bool _isStarted; ///< If the first sample was added.
+	bool _isRunOpen; ///< If the last code is a run, which can be extended.
+	uint16_t _lastValue; ///< The value of the last sample.
+	unsigned long _nextSampleTime; ///< The time of the next sample.
+};
+
+
+}
+
+
@@ -0,0 +1,460 @@
+//
+// VoiceTable
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "VoiceTable.h"
+
+
+#include "AudioPlayer.h"
+#include "Crc16.h"
+#include "SDCard.h"
+#include "SPIBus.h"
+
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+
+// The address of the cache in the EEPROM.
+#ifndef VOICETABLE_EEPROM_ADDRESS
+#define VOICETABLE_EEPROM_ADDRESS 0
+#endif
+
+
+namespace lr {
+
+
+/// The global instance of the voice table.
+///
+VoiceTable voiceTable;
+
+
+/// The magic at the start of the cache.
+///
+static const char cacheMagic[4] = {'L', 'R', 'V', '3'};
+
+/// The name of the playlist file.
+///
+static const char playlistFileName[] = "voices.txt";
+
+
+/// Read a block of the card and calculate its CRC16.
+///
+/// @param block The block to read.
+/// @param checksum The variable for the checksum.
+/// @param isImage Set to true if the block starts with the HCDI magic. Can be 0.
+/// @return true on success.
+///
+static bool readBlockChecksum(uint32_t block, uint16_t *checksum, bool *isImage)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	SDCard::Status status;
+	while ((status = sdCard.startRead(block)) == SDCard::StatusWait) {
+	}
+	if (status != SDCard::StatusReady) {
+		return false;
+	}
+	uint8_t buffer[32];
+	uint16_t crc = 0;
+	if (isImage != 0) {
+		*isImage = false;
+	}
+	for (uint16_t position = 0; position < 512; ) {
+		uint16_t readCount = sizeof(buffer);
+		status = sdCard.readData(buffer, &readCount);
+		if (status == SDCard::StatusError) {
+			return false;
+		} else if (status != SDCard::StatusWait) {
+			if (position == 0 && isImage != 0) {
+				*isImage = (memcmp(buffer, "HCDI", 4) == 0);
+			}
+			crc = crc16Update(crc, buffer, readCount);
+			position += readCount;
+		}
+	}
+	sdCard.stopRead();
+	*checksum = crc;
+	return true;
+}
+
+
+/// Collects the file names of the playlist.
+///
+/// Blanks inside of a name are kept, and names which are too long are
+/// skipped, so no name is changed into the name of another file.
+///
+struct PlaylistParser {
+	char names[VoiceTable::maximumVoiceCount][VoiceTable::maximumFileNameLength + 1]; ///< The names.
+	char line[VoiceTable::maximumFileNameLength]; ///< The name in the current line.
+	uint8_t nameCount; ///< The number of names.
+	uint8_t length; ///< The characters of the line, without the blanks at the start.
+	uint8_t nameLength; ///< The characters of the line, up to the last one which is no blank.
+	bool isComment; ///< If the line is a comment.
+	uint8_t issues; ///< The PlaylistIssue bits.
+
+	PlaylistParser() : nameCount(0), length(0), nameLength(0), isComment(false), issues(0) {}
+
+	/// Add the next character of the playlist.
+	///
+	void add(const char c) {
+		const bool isBlank = (c == ' ' || c == '\t');
+		if (c == '\n' || c == '\r') {
+			if (nameLength > 0 && !isComment) {
+				if (nameLength > VoiceTable::maximumFileNameLength) {
+					issues |= VoiceTable::PlaylistNameTooLong;
+				} else if (nameCount >= VoiceTable::maximumVoiceCount) {
+					issues |= VoiceTable::PlaylistTooManyNames;
+				} else {
+					memcpy(names[nameCount], line, nameLength);
+					names[nameCount++][nameLength] = '\0';
+				}
+			}
+			length = 0;
+			nameLength = 0;
+			isComment = false;
+		} else if (length == 0 && c == '#') {
+			isComment = true;
+		} else if (!isComment && (length > 0 || !isBlank)) {
+			// The length stops after the maximum, to mark the name as too long.
+			if (length < VoiceTable::maximumFileNameLength) {
+				line[length] = c;
+			}
+			if (length <= VoiceTable::maximumFileNameLength) {
+				++length;
+			}
+			if (!isBlank) {
+				nameLength = length;
+			}
+		}
+	}
+};
+
+
+/// Get a block of a file.
+///
+/// @param entry The entry of the file.
+/// @param index The index of the block in the file.
+/// @return The block on the card.
+///
+static uint32_t fileBlock(const SDCard::DirectoryEntry *entry, uint32_t index)
+{
+	for (uint16_t i = 0; i < entry->extentCount; ++i) {
+		if (index < entry->extents[i].blockCount) {
+			return entry->extents[i].startBlock + index;
+		}
+		index -= entry->extents[i].blockCount;
+	}
+	return entry->startBlock + index;
+}
+
+
+/// Read the playlist, and pass its characters to the parser.
+///
+/// At most maximumPlaylistSize bytes are read.
+///
+/// @param parser The parser for the names, or 0 to calculate the checksum only.
+/// @param checksum The variable for the CRC16 of the read bytes.
+/// @return true if the playlist was read, false if there is no playlist or on an error.
+///
+static bool readPlaylist(PlaylistParser *parser, uint16_t *checksum)
+{
+	const SDCard::DirectoryEntry *entry = sdCard.findFile(playlistFileName);
+	if (entry == 0 || entry->fileSize == 0) {
+		return false;
+	}
+	uint32_t fileSize = entry->fileSize;
+	if (fileSize > VoiceTable::maximumPlaylistSize) {
+		if (parser != 0) {
+			parser->issues |= VoiceTable::PlaylistTooLarge;
+		}
+		fileSize = VoiceTable::maximumPlaylistSize;
+	}
+	uint16_t crc = 0;
+	{
+		SPISession session(SPIBus::SDCardDevice);
+		for (uint16_t offset = 0; offset < fileSize; offset += 512) {
+			SDCard::Status status;
+			while ((status = sdCard.startRead(fileBlock(entry, offset / 512))) == SDCard::StatusWait) {
+			}
+			if (status != SDCard::StatusReady) {
+				return false;
+			}
+			uint8_t buffer[32];
+			for (uint16_t position = offset; position < offset + 512; ) {
+				uint16_t readCount = sizeof(buffer);
+				status = sdCard.readData(buffer, &readCount);
+				if (status == SDCard::StatusError) {
+					return false;
+				} else if (status != SDCard::StatusWait) {
+					// Only the bytes of the file are used, not the rest of the last block.
+					uint16_t fileCount = 0;
+					if (position < fileSize) {
+						fileCount = (fileSize - position < readCount) ? (fileSize - position) : readCount;
+					}
+					crc = crc16Update(crc, buffer, fileCount);
+					for (uint16_t i = 0; parser != 0 && i < fileCount; ++i) {
+						parser->add(buffer[i]);
+					}
+					position += readCount;
+				}
+			}
+			sdCard.stopRead();
+		}
+	}
+	// The last line may end without a line break.
+	if (parser != 0) {
+		parser->add('\n');
+	}
+	*checksum = crc;
+	return true;
+}
+
+
+/// Check if a file of the directory can be played as a voice.
+///
+/// @param entry The entry of the file, or 0 if the file was not found.
+///
+static bool isPlayable(const SDCard::DirectoryEntry *entry)
+{
+	// Fragmented files are played by name, which checks the format.
+	return entry != 0 && entry->fileSize >= 2 && (entry->extentCount > 0 ||
+		(entry->format == SDCard::FormatUnsigned16 && entry->sampleRate > 0));
+}
+
+
+VoiceTable::VoiceTable()
+	: _defaultFileNames(0), _voiceCount(0), _fromCache(false), _fromPlaylist(false), _playlistIssues(0)
+{
+	for (uint8_t i = 0; i < maximumVoiceCount; ++i) {
+		_fileNames[i] = 0;
+	}
+}
+
+
+bool VoiceTable::initialize(const char* const *fileNames, uint8_t voiceCount)
+{
+	voiceCount = min(voiceCount, maximumVoiceCount);
+	_defaultFileNames = fileNames;
+	_voiceCount = 0;
+	_fromCache = false;
+	_fromPlaylist = false;
+	_playlistIssues = 0;
+	// The directory is read from the card, a prepared read has to be stopped first.
+	audioPlayer.cancel();
+
+	// Identify the card and the directory.
+	CacheHeader header;
+	bool isImage;
+	if (!readBlockChecksum(0, &header.directoryChecksum, &isImage)) {
+		return false;
+	}
+	memcpy(header.magic, cacheMagic, 4);
+	header.cardIdentity = sdCard.cardIdentity();
+	header.voiceCount = 0;
+	header.isPlaylist = 0;
+	header.playlistIssues = 0;
+	header.playlistChecksum = 0;
+	const bool isCacheable = isImage && header.cardIdentity != 0;
+
+	// Use the cache if it was written for this card and directory.
+	if (isCacheable && loadCache(header, voiceCount)) {
+		_fromCache = true;
+		_fromPlaylist = (header.isPlaylist != 0);
+		_voiceCount = header.voiceCount;
+		_playlistIssues = header.playlistIssues;
+		// Images have no fragmented files, all voices on the card are in the table.
+		for (uint8_t i = 0; i < _voiceCount; ++i) {
+			_fileNames[i] = 0;
+		}
+		return true;
+	}
+
+	// Resolve all voices from the directory.
+	if (sdCard.readDirectory() != SDCard::StatusReady) {
+		return false;
+	}
+	if (loadPlaylist(&header.playlistChecksum)) {
+		_fromPlaylist = true;
+	} else {
+		header.playlistChecksum = 0;
+		_voiceCount = voiceCount;
+		resolveVoices(fileNames);
+	}
+	if (isCacheable) {
+		header.voiceCount = _voiceCount;
+		header.isPlaylist = _fromPlaylist ? 1 : 0;
+		header.playlistIssues = _playlistIssues;
+		writeCache(header);
+	}
+	return true;
+}
+
+
+bool VoiceTable::play(uint8_t index)
+{
+	if (index >= _voiceCount) {
+		return false;
+	}
+	const Voice &voice = _voices[index];
+	if (voice.sampleCount > 0) {
+		return audioPlayer.play(voice.startBlock, voice.sampleCount, voice.sampleRate, voice.gain);
+	}
+	// Fragmented or missing files.
+	if (_fileNames[index] == 0) {
+		return false;
+	}
+	return audioPlayer.play(_fileNames[index]);
+}
+
+
+bool VoiceTable::isAvailable(uint8_t index) const
+{
+	return index < _voiceCount && (_voices[index].sampleCount > 0 || _fileNames[index] != 0);
+}
+
+
+void VoiceTable::printMissingVoices(Print &output)
+{
+	if (!_fromPlaylist) {
+		for (uint8_t i = 0; i < _voiceCount; ++i) {
+			if (!isAvailable(i)) {
+				output.print(F("Voice not found: "));
+				output.println(_defaultFileNames[i]);
+			}
+		}
+		return;
+	}
+	// The missing names were removed from the table, they are only in the playlist.
+	if ((_playlistIssues & PlaylistNameNotFound) == 0) {
+		return;
+	}
+	PlaylistParser parser;
+	uint16_t checksum;
+	if (!readPlaylist(&parser, &checksum)) {
+		return;
+	}
+	for (uint8_t i = 0; i < parser.nameCount; ++i) {
+		if (!isPlayable(sdCard.findFile(parser.names[i]))) {
+			output.print(F("Voice not found: "));
+			output.println(parser.names[i]);
+		}
+	}
+}
+
+
+bool VoiceTable::prepare(uint8_t index)
+{
+	if (index >= _voiceCount || _voices[index].sampleCount == 0) {
+		return false;
+	}
+	return audioPlayer.prepare(_voices[index].startBlock);
+}
+
+
+bool VoiceTable::loadCache(CacheHeader &header, uint8_t defaultVoiceCount)
+{
+	const uint8_t *address = reinterpret_cast<const uint8_t*>(VOICETABLE_EEPROM_ADDRESS);
+	CacheHeader cachedHeader;
+	eeprom_read_block(&cachedHeader, address, sizeof(CacheHeader));
+	// The voice count is only known from the cache, and the CRC after reading the voices.
+	if (memcmp(&cachedHeader, &header, offsetof(CacheHeader, voiceCount)) != 0 ||
+		cachedHeader.voiceCount > maximumVoiceCount) {
+		return false;
+	}
+	// The default voices of another version of the application do not match.
+	if (cachedHeader.isPlaylist == 0 && cachedHeader.voiceCount != defaultVoiceCount) {
+		return false;
+	}
+	// Editing the playlist does not change block 0, as long as its size stays the same.
+	if (cachedHeader.isPlaylist != 0) {
+		if (!readPlaylist(0, &header.playlistChecksum) ||
+			header.playlistChecksum != cachedHeader.playlistChecksum) {
+			return false;
+		}
+	}
+	const uint16_t voicesSize = cachedHeader.voiceCount * sizeof(Voice);
+	eeprom_read_block(_voices, address + sizeof(CacheHeader), voicesSize);
+	if (crc16Update(0, reinterpret_cast<const uint8_t*>(_voices), voicesSize) != cachedHeader.crc) {
+		return false;
+	}
+	header.voiceCount = cachedHeader.voiceCount;
+	header.isPlaylist = cachedHeader.isPlaylist;
+	header.playlistIssues = cachedHeader.playlistIssues;
+	return true;
+}
+
+
+void VoiceTable::writeCache(CacheHeader &header)
+{
+	uint8_t *address = reinterpret_cast<uint8_t*>(VOICETABLE_EEPROM_ADDRESS);
+	const uint16_t voicesSize = _voiceCount * sizeof(Voice);
+	header.crc = crc16Update(0, reinterpret_cast<const uint8_t*>(_voices), voicesSize);
+	// Only changed bytes are written, to save EEPROM write cycles.
+	eeprom_update_block(_voices, address + sizeof(CacheHeader), voicesSize);
+	eeprom_update_block(&header, address, sizeof(CacheHeader));
+}
+
+
+bool VoiceTable::loadPlaylist(uint16_t *checksum)
+{
+	// Collect the names first, they can only be resolved after the read.
+	PlaylistParser parser;
+	if (!readPlaylist(&parser, checksum)) {
+		return false;
+	}
+	_playlistIssues |= parser.issues;
+	if (parser.nameCount == 0) {
+		return false;
+	}
+
+	const char *fileNames[maximumVoiceCount];
+	for (uint8_t i = 0; i < parser.nameCount; ++i) {
+		fileNames[i] = parser.names[i];
+	}
+	_voiceCount = parser.nameCount;
+	resolveVoices(fileNames);
+
+	// Remove the voices which are not on the card, so each voice of the playlist can be played.
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < _voiceCount; ++i) {
+		if (isAvailable(i)) {
+			_voices[count] = _voices[i];
+			_fileNames[count] = _fileNames[i];
+			++count;
+		}
+	}
+	if (count < _voiceCount) {
+		_playlistIssues |= PlaylistNameNotFound;
+		_voiceCount = count;
+	}
+	return true;
+}
+
+
+void VoiceTable::resolveVoices(const char* const *fileNames)
+{
+	for (uint8_t i = 0; i < _voiceCount; ++i) {
+		Voice &voice = _voices[i];
+		const SDCard::DirectoryEntry *entry = sdCard.findFile(fileNames[i]);
+		_fileNames[i] = 0;
+		if (isPlayable(entry) && entry->extentCount == 0) {
+			voice.startBlock = entry->startBlock;
+			voice.sampleCount = entry->fileSize / 2;
+			voice.sampleRate = entry->sampleRate;
+			voice.gain = entry->gain;
+		} else {
+			voice.startBlock = 0;
+			voice.sampleCount = 0;
+			voice.sampleRate = 0;
+			voice.gain = 0;
+			// Fragmented files only exist on FAT32, where the entries stay in memory.
+			if (entry != 0 && entry->extentCount > 0) {
+				_fileNames[i] = entry->fileName;
+			}
+		}
+	}
+}
+
+
+}
+
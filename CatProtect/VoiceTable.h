@@ -0,0 +1,211 @@
+#pragma once
+//
+// VoiceTable
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+
+#include <stdint.h>
+
+
+namespace lr {
+
+
+/// The resolved locations of the voice samples.
+///
+/// The voices are listed in the playlist file on the card, one file name
+/// per line. Empty lines and lines starting with '#' are ignored, blanks
+/// at the start and the end of a line too. Only the first
+/// maximumPlaylistSize bytes of the playlist are read. Names which are too
+/// long, the names after the maximum number of voices and the names of
+/// missing files are skipped, and reported by playlistIssues().
+/// If there is no playlist, the default file names of the application are
+/// used.
+///
+/// At the start, each voice file name is resolved into its start block,
+/// sample count, sample rate and gain. The resolved table is cached in the EEPROM,
+/// together with the identity of the card and a checksum of the directory.
+/// If both match at the next start, the table is loaded from the EEPROM and
+/// the directory of the card is not read at all.
+///
+/// The checksum is the CRC16 of block 0, which contains the whole directory
+/// of version 1 images and the header with the checksum of the hash index
+/// of version 2 images. For FAT32 file systems, block 0 does not change with
+/// the files, so the table is resolved at each start and never cached.
+/// Block 0 does not change if the playlist is edited without changing its
+/// size, so a table from the playlist is cached with the CRC16 of all read
+/// bytes of the playlist. To check it, the directory and the playlist are read at each
+/// start, only the voices are not resolved again.
+///
+/// Fragmented files on FAT32 file systems can not be stored in the table,
+/// they are played using their file name.
+///
+/// On the alarm path, a voice is only an index into the table.
+///
+class VoiceTable
+{
+public:
+	/// The resolved location of a voice.
+	///
+	struct Voice {
+		uint32_t startBlock; ///< The first block of the samples.
+		uint32_t sampleCount; ///< The number of samples, 0 if the voice is played by name.
+		uint16_t sampleRate; ///< The sample rate in Hz.
+		uint8_t gain; ///< The gain in 1/16 steps.
+	};
+
+	/// The maximum number of voices in the table.
+	///
+	static const uint8_t maximumVoiceCount = 8;
+
+	/// The maximum length of a file name in the playlist.
+	///
+	static const uint8_t maximumFileNameLength = 16;
+
+	/// The maximum number of bytes read from the playlist.
+	///
+	static const uint16_t maximumPlaylistSize = 2048;
+
+	/// The problems found in the playlist, one bit each.
+	///
+	enum PlaylistIssue : uint8_t {
+		PlaylistNameTooLong = 0x01, ///< A name is longer than maximumFileNameLength, it was skipped.
+		PlaylistTooManyNames = 0x02, ///< There are more than maximumVoiceCount names, the others were skipped.
+		PlaylistTooLarge = 0x04, ///< The playlist is larger than maximumPlaylistSize, the rest was ignored.
+		PlaylistNameNotFound = 0x08, ///< A file of the playlist is not on the card, it was removed from the table.
+	};
+
+public:
+	/// ctor
+	///
+	VoiceTable();
+
+public:
+	/// Initialize the voice table.
+	///
+	/// Call this after the SD-Card was initialized. The voices are read from
+	/// the playlist, or the given default file names are used. Names of the
+	/// playlist which are not found on the card are removed from the table.
+	/// Default voices which are not found are kept, so the indexes do not
+	/// change, but they are not available.
+	///
+	/// @param fileNames The default file names of the voices. The list has to stay valid.
+	/// @param voiceCount The number of default voices, at most maximumVoiceCount.
+	/// @return true on success, false if the card could not be read.
+	///
+	bool initialize(const char* const *fileNames, uint8_t voiceCount);
+
+	/// Check if the table was loaded from the cache.
+	///
+	inline bool isFromCache() const { return _fromCache; }
+
+	/// Check if the voices were read from the playlist.
+	///
+	inline bool isFromPlaylist() const { return _fromPlaylist; }
+
+	/// Get the problems found in the playlist.
+	///
+	/// @return A combination of the PlaylistIssue bits, 0 if there is no problem.
+	///
+	inline uint8_t playlistIssues() const { return _playlistIssues; }
+
+	/// Get the number of voices.
+	///
+	inline uint8_t voiceCount() const { return _voiceCount; }
+
+	/// Check if a voice was found on the card.
+	///
+	/// @param index The index of the voice.
+	/// @return true if the voice can be played.
+	///
+	bool isAvailable(uint8_t index) const;
+
+	/// Print a line for each voice which was not found on the card.
+	///
+	/// For a playlist, this reads the playlist again, but only if names
+	/// were removed.
+	///
+	void printMissingVoices(Print &output);
+
+	/// Play a voice.
+	///
+	/// @param index The index of the voice.
+	/// @return true on success, false on any error.
+	///
+	bool play(uint8_t index);
+
+	/// Prepare the playback of a voice.
+	///
+	/// Only contiguous voices are prepared, see AudioPlayer::prepare().
+	///
+	/// @param index The index of the voice.
+	/// @return true if the playback was prepared.
+	///
+	bool prepare(uint8_t index);
+
+private:
+	/// The header of the cache in the EEPROM.
+	///
+	struct CacheHeader {
+		char magic[4]; ///< The magic "LRV3".
+		uint32_t cardIdentity; ///< The identity of the card.
+		uint16_t directoryChecksum; ///< The CRC16 of block 0 of the card.
+		uint8_t voiceCount; ///< The number of voices.
+		uint8_t isPlaylist; ///< 1 if the voices were read from the playlist, otherwise 0.
+		uint8_t playlistIssues; ///< The problems found in the playlist.
+		uint16_t playlistChecksum; ///< The CRC16 of the read bytes of the playlist, 0 without playlist.
+		uint16_t crc; ///< The CRC16-CCITT of the voices.
+	};
+
+	/// Load the table from the cache.
+	///
+	/// The voice count and the source of the voices are taken from the cache.
+	/// For a table from the playlist, the playlist is read to compare its
+	/// checksum.
+	///
+	/// @param header The header with the identity of the card and the directory.
+	/// @param defaultVoiceCount The number of default voices.
+	/// @return true if the cache matches the given header.
+	///
+	bool loadCache(CacheHeader &header, uint8_t defaultVoiceCount);
+
+	/// Write the table into the cache.
+	///
+	void writeCache(CacheHeader &header);
+
+	/// Read the file names from the playlist and resolve them.
+	///
+	/// @param checksum The variable for the CRC16 of the read bytes of the playlist.
+	/// @return true if the playlist was read, false if there is no playlist.
+	///
+	bool loadPlaylist(uint16_t *checksum);
+
+	/// Resolve the table from the directory of the card.
+	///
+	/// Voices which are not on the card are kept in the table, but are not available.
+	///
+	/// @param fileNames The file names of the voices.
+	///
+	void resolveVoices(const char* const *fileNames);
+
+private:
+	const char* const *_defaultFileNames; ///< The default file names, to report the missing ones.
+	const char *_fileNames[maximumVoiceCount]; ///< The file names to play voices which are not in the table, or 0.
+	uint8_t _voiceCount; ///< The number of voices.
+	bool _fromCache; ///< If the table was loaded from the cache.
+	bool _fromPlaylist; ///< If the voices were read from the playlist.
+	uint8_t _playlistIssues; ///< The problems found in the playlist.
+	Voice _voices[maximumVoiceCount]; ///< The resolved voices.
+};
+
+
+/// The global instance of the voice table.
+///
+extern VoiceTable voiceTable;
+
+
+}
+
@@ -0,0 +1,71 @@
+//
+// CrcBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Measures the cycles of streamed block reads with readFast4(). The
+// benchmark is built with SDCARD_VERIFY_CRC as CrcBench, and without it as
+// CrcBenchPlain, the difference is the cost of the verification.
+//
+#include "Bench.h"
+#include "SDCardEmulator.h"
+
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+int main()
+{
+#ifdef SDCARD_VERIFY_CRC
+	section("Streamed read with CRC verification");
+#else
+	section("Streamed read without CRC verification");
+#endif
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v2.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		const uint32_t blockCount = entry->fileSize / 512;
+		SPISession session(SPIBus::SDCardDevice);
+		SDCard::Status status;
+		while ((status = sdCard.startMultiRead(entry->startBlock)) == SDCard::StatusWait) {
+		}
+		sdCard.startFastRead();
+		uint8_t buffer[4];
+		// Wait for the first block, the access time of the card is not measured.
+		while ((status = sdCard.readFast4(buffer)) == SDCard::StatusWait) {
+		}
+		CycleMeter meter;
+		uint32_t readCount = 1;
+		while (readCount < blockCount * 128 && status != SDCard::StatusError) {
+			status = sdCard.readFast4(buffer);
+			if (status == SDCard::StatusReady) {
+				++readCount;
+			}
+		}
+		double cycles = static_cast<double>(meter.elapsed());
+		sdCard.stopRead();
+		CHECK(status != SDCard::StatusError);
+		CHECK_EQUAL(sdCard.crcErrorCount(), 0);
+#ifdef SDCARD_VERIFY_CRC
+		// Each byte is added to the CRC with two lpm, charged by the emulation, and the register work.
+		const double crcCycles = 512.0 * (2 * 3 + avrCycles::crc16Byte);
+		cycles += (blockCount - 1) * 512.0 * avrCycles::crc16Byte;
+		report("CRC cycles per block", crcCycles, "cycles");
+		// The verification has to leave the play loop most of its 22050Hz sample period.
+		reportBudget("CRC cycles per sample", crcCycles / 256, F_CPU / 22050 / 10, "cycles");
+#endif
+		report("Read cycles per block", cycles / (blockCount - 1), "cycles");
+		report("Read cycles per sample", cycles / (blockCount - 1) / 256, "cycles");
+	});
+	return testResult();
+}
+
+
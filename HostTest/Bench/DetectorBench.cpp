@@ -0,0 +1,335 @@
+//
+// DetectorBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Runs generated traces of a motion sensor through the motion sensor of the
+// sketch, and through the fixed threshold of 200 it replaced. The traces
+// have noise, short spikes, a drifting output on warm days, and periods of
+// motion at random times. Each alarm within a period of motion is a hit,
+// each other alarm a false alarm. The benchmark reports the false alarms
+// per hour, the missed periods of motion, the time from the start of a
+// motion to its alarm, and the cycles per sample of both detectors. The
+// cycles between the register accesses are added from the model in Bench.h.
+// DetectorBenchClassifier runs the same traces with MOTIONSENSOR_CLASSIFIER,
+// to measure how long the classifier holds the alarms back.
+//
+#include "Bench.h"
+
+#include "AnalogSampler.h"
+#include "EventQueue.h"
+#include "MotionSensor.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The length of each trace in seconds.
+///
+const uint32_t traceSeconds = 600;
+
+/// The interval of the loop calls in ms, like in the sketch.
+///
+const uint16_t loopInterval = 10;
+
+/// The threshold of the sensor, like in the sketch.
+///
+const uint16_t threshold = 200;
+
+/// The time in ms after a period of motion, in which an alarm still counts as hit.
+///
+const uint32_t hitMargin = 1000;
+
+/// The budget for the mean time in ms from the start of a motion to its alarm.
+///
+/// The motion rises above the threshold in less than 120ms, and has to stay
+/// there for the minimum active time. The classifier adds its window.
+///
+const double latencyBudget = 120 + MotionSensor::minimumActiveTime + 2 * loopInterval
+#ifdef MOTIONSENSOR_CLASSIFIER
+	+ MotionSensor::classificationWindow
+#endif
+	;
+
+
+/// The parameters of a generated trace.
+///
+struct TraceParameters {
+	const char *name; ///< The name of the trace.
+	uint16_t idleLevel; ///< The average output of the idle sensor.
+	uint16_t drift; ///< The amplitude of the slow drift of the idle output.
+	double noise; ///< The standard deviation of the noise.
+	uint8_t spikesPerMinute; ///< The number of short spikes per minute.
+	bool isHighAtStart; ///< If the sensor is HIGH for the first 15 seconds of the warm-up.
+};
+
+/// The traces.
+///
+const TraceParameters traceParameters[] = {
+	{"Quiet night", 80, 0, 8.0, 0, false},
+	{"Noisy sensor", 100, 0, 30.0, 6, false},
+	{"Warm day", 160, 90, 15.0, 1, false},
+	{"HIGH at the start", 100, 0, 15.0, 1, true},
+};
+
+/// A period of motion in a trace.
+///
+struct Motion {
+	uint32_t start; ///< The start in ms.
+	uint32_t end; ///< The end in ms.
+};
+
+/// The value of the generated trace for each ms.
+///
+std::vector<uint16_t> traceValues;
+
+/// The periods of motion of the trace.
+///
+std::vector<Motion> motions;
+
+
+/// The results of a detector for one trace.
+///
+struct Result {
+	uint32_t falseAlarmCount; ///< The alarms outside of the periods of motion.
+	uint32_t missCount; ///< The periods of motion without an alarm.
+	uint32_t latencySum; ///< The sum of the times in ms from the start of each hit period to its first alarm.
+};
+
+
+/// Generate a trace with random motion.
+///
+void generateTrace(const TraceParameters &parameters, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	std::normal_distribution<double> noise(0.0, parameters.noise);
+	std::uniform_int_distribution<uint32_t> gap(45000, 75000);
+	std::uniform_int_distribution<uint32_t> duration(1000, 3000);
+	std::uniform_int_distribution<uint32_t> amplitude(350, 450);
+	const uint32_t traceLength = traceSeconds * 1000;
+	std::vector<double> values(traceLength);
+	for (uint32_t ms = 0; ms < traceLength; ++ms) {
+		// The drift has a period of 4 minutes.
+		values[ms] = parameters.idleLevel + parameters.drift * std::sin(ms * 2.0 * M_PI / 240000.0);
+	}
+	if (parameters.isHighAtStart) {
+		for (uint32_t ms = 0; ms < 15000; ++ms) {
+			values[ms] += 800;
+		}
+	}
+	// Short spikes of 30ms.
+	std::uniform_int_distribution<uint32_t> spikeTime(0, traceLength - 30);
+	for (uint32_t i = 0; i < parameters.spikesPerMinute * traceSeconds / 60; ++i) {
+		const uint32_t start = spikeTime(random);
+		for (uint32_t ms = start; ms < start + 30; ++ms) {
+			values[ms] += 400;
+		}
+	}
+	// The motion starts soon after the sensors are ready, and rises in 200ms.
+	motions.clear();
+	for (uint32_t start = 21000 + gap(random) / 20; start + 5000 < traceLength; start += gap(random)) {
+		const Motion motion = {start, start + duration(random)};
+		const double level = amplitude(random);
+		for (uint32_t ms = motion.start; ms < motion.end; ++ms) {
+			values[ms] += level * std::min(1.0, (ms - motion.start) / 200.0);
+		}
+		motions.push_back(motion);
+	}
+	traceValues.resize(traceLength);
+	for (uint32_t ms = 0; ms < traceLength; ++ms) {
+		traceValues[ms] = static_cast<uint16_t>(std::max(0.0, std::min(1023.0, values[ms] + noise(random))));
+	}
+}
+
+
+/// Count the false alarms and the missed periods of motion.
+///
+Result evaluate(const std::vector<uint32_t> &alarmTimes)
+{
+	Result result = {0, 0, 0};
+	std::vector<bool> isHit(motions.size(), false);
+	for (uint32_t alarmTime : alarmTimes) {
+		bool isFalseAlarm = true;
+		for (size_t i = 0; i < motions.size(); ++i) {
+			if (alarmTime >= motions[i].start && alarmTime <= motions[i].end + hitMargin) {
+				if (!isHit[i]) {
+					result.latencySum += alarmTime - motions[i].start;
+				}
+				isHit[i] = true;
+				isFalseAlarm = false;
+			}
+		}
+		if (isFalseAlarm) {
+			++result.falseAlarmCount;
+		}
+	}
+	for (bool hit : isHit) {
+		if (!hit) {
+			++result.missCount;
+		}
+	}
+	return result;
+}
+
+
+/// The fixed threshold, which was used before the baseline.
+///
+/// Like the old motion sensor, an alarm is raised if the value rises above
+/// the threshold, after the sensor was below it for the idle time.
+///
+class FixedThresholdDetector
+{
+public:
+	FixedThresholdDetector() : _isActive(false), _isReady(false), _lastEvent(0) {}
+
+	/// Check the value, and return true for an alarm.
+	///
+	bool update(uint16_t value, unsigned long currentTime) {
+		const bool isActive = value > threshold;
+		bool isAlarm = false;
+		if (isActive != _isActive) {
+			_isActive = isActive;
+			_lastEvent = currentTime;
+			isAlarm = isActive && _isReady;
+			_isReady = false;
+		}
+		if (!_isActive && !_isReady && currentTime - _lastEvent >= 20000) {
+			_isReady = true;
+		}
+		return isAlarm;
+	}
+
+private:
+	bool _isActive;
+	bool _isReady;
+	unsigned long _lastEvent;
+};
+
+
+/// The results of all traces, in shared memory for the forked runs.
+///
+struct Totals {
+	Result results[2]; ///< The results of the baseline and the fixed threshold.
+	uint32_t motionCount; ///< The periods of motion.
+};
+
+/// The totals of all traces.
+///
+Totals *totals = 0;
+
+
+/// Get the mean time from the start of a motion to its alarm in ms.
+///
+double meanLatency(const Result &result, uint32_t motionCount)
+{
+	const uint32_t hitCount = motionCount - result.missCount;
+	return (hitCount > 0) ? static_cast<double>(result.latencySum) / hitCount : 0.0;
+}
+
+
+/// Run the current trace through both detectors.
+///
+void runTrace()
+{
+	MotionSensor motionSensor;
+	motionSensor.addSensor(0, threshold, 0);
+	motionSensor.setup();
+	FixedThresholdDetector fixedDetector;
+	std::vector<uint32_t> alarmTimes[2];
+	uint64_t sensorCycles = 0;
+	uint64_t fixedCycles = 0;
+	uint32_t loopCount = 0;
+	while (millis() < traceSeconds * 1000UL - loopInterval) {
+		wait(static_cast<uint64_t>(loopInterval) * F_CPU / 1000);
+		const unsigned long currentTime = millis();
+		// Measure the calls without the interrupts in between.
+		uint64_t interruptCycles = statistics().interruptCycles;
+		CycleMeter meter;
+		motionSensor.loop(currentTime);
+		sensorCycles += meter.elapsed() - (statistics().interruptCycles - interruptCycles);
+		interruptCycles = statistics().interruptCycles;
+		meter.restart();
+		const uint16_t value = analogSampler.value(0);
+		fixedCycles += meter.elapsed() - (statistics().interruptCycles - interruptCycles);
+		if (fixedDetector.update(value, currentTime)) {
+			alarmTimes[1].push_back(currentTime);
+		}
+		++loopCount;
+		EventQueue::Event event;
+		while (eventQueue.pop(event)) {
+			if (event.type == EventQueue::SensorStatus &&
+				(event.value == MotionSensor::Alarm || event.value == MotionSensor::ClassifiedAlarm)) {
+				alarmTimes[0].push_back(event.time);
+			}
+		}
+	}
+	const double hours = traceSeconds / 3600.0;
+	const Result results[2] = {evaluate(alarmTimes[0]), evaluate(alarmTimes[1])};
+	report("Periods of motion", motions.size(), "");
+	report("Baseline, false alarms per hour", results[0].falseAlarmCount / hours, "");
+	report("Baseline, missed periods of motion", results[0].missCount, "");
+	report("Baseline, alarm latency", meanLatency(results[0], motions.size()), "ms");
+	report("Fixed threshold, false alarms per hour", results[1].falseAlarmCount / hours, "");
+	report("Fixed threshold, missed periods of motion", results[1].missCount, "");
+	report("Fixed threshold, alarm latency", meanLatency(results[1], motions.size()), "ms");
+	for (uint8_t i = 0; i < 2; ++i) {
+		totals->results[i].falseAlarmCount += results[i].falseAlarmCount;
+		totals->results[i].missCount += results[i].missCount;
+		totals->results[i].latencySum += results[i].latencySum;
+	}
+	totals->motionCount += motions.size();
+	// The cycles of one sample of one sensor, with the rest of the loop.
+	const double slopeCallsPerLoop = static_cast<double>(loopInterval) / MotionSensor::slopeInterval;
+	report("Baseline, cycles per sample", static_cast<double>(sensorCycles) / loopCount +
+		avrCycles::motionSensorLoop + avrCycles::motionSensorState + slopeCallsPerLoop * avrCycles::motionSensorSlope,
+		"cycles");
+	report("Fixed threshold, cycles per sample", static_cast<double>(fixedCycles) / loopCount +
+		avrCycles::motionSensorLoop + avrCycles::fixedThreshold, "cycles");
+}
+
+
+}
+
+
+int main()
+{
+	setAnalogInput(0, [](uint64_t cycle) -> uint16_t {
+		const uint64_t ms = cycle / (F_CPU / 1000);
+		return (ms < traceValues.size()) ? traceValues[ms] : traceValues.back();
+	});
+
+	totals = static_cast<Totals*>(allocateShared(sizeof(Totals)));
+	memset(totals, 0, sizeof(Totals));
+	uint32_t seed = 1;
+	for (const TraceParameters &parameters : traceParameters) {
+		section(parameters.name);
+		generateTrace(parameters, seed++);
+		runBoot([]{
+			runTrace();
+		});
+	}
+
+	section("All traces");
+	const double hours = traceSeconds * (sizeof(traceParameters) / sizeof(TraceParameters)) / 3600.0;
+	report("Periods of motion", totals->motionCount, "");
+	reportBudget("Baseline, false alarms per hour", totals->results[0].falseAlarmCount / hours, 1, "");
+	reportBudget("Baseline, missed periods of motion", totals->results[0].missCount * 100.0 / totals->motionCount, 0, "%");
+	reportBudget("Baseline, alarm latency", meanLatency(totals->results[0], totals->motionCount), latencyBudget, "ms");
+	report("Fixed threshold, false alarms per hour", totals->results[1].falseAlarmCount / hours, "");
+	report("Fixed threshold, missed periods of motion", totals->results[1].missCount * 100.0 / totals->motionCount, "%");
+	report("Fixed threshold, alarm latency", meanLatency(totals->results[1], totals->motionCount), "ms");
+	return testResult();
+}
+
+
+
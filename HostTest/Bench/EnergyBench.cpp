@@ -0,0 +1,89 @@
+//
+// EnergyBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Runs the sketch without motion on the virtual clock, and estimates the
+// energy of an idle day from the active and the sleeping cycles of the
+// emulated MCU. The duty cycle which the sketch measures itself is compared
+// with the duty cycle of the emulation.
+//
+#include "Bench.h"
+#include "SDCardEmulator.h"
+
+#include "PowerManager.h"
+
+#include <cmath>
+
+
+using namespace host;
+using namespace lr;
+
+
+void setup();
+void loop();
+
+
+namespace {
+
+
+/// The simulated time of the measurement in seconds.
+///
+const uint32_t measureSeconds = 20;
+
+
+/// Get the average current in uA for a duty cycle, with the currents of the power manager.
+///
+double averageCurrent(double dutyCycle)
+{
+	return PowerManager::activeCurrent * dutyCycle + PowerManager::idleCurrent * (1.0 - dutyCycle);
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	// The sensor output stays low, there is no motion.
+	setAnalogInput(0, [](uint64_t) -> uint16_t { return 100; });
+
+	section("Idle day without motion");
+	runBoot([]{
+		setup();
+		// Let the sketch settle after the start, then measure.
+		const uint64_t settleEnd = cycle() + F_CPU;
+		while (cycle() < settleEnd) {
+			loop();
+		}
+		powerManager.resetStatistics();
+		const Statistics start = statistics();
+		const uint64_t startCycle = cycle();
+		const uint64_t startActive = activeCycles();
+		const uint64_t endCycle = startCycle + static_cast<uint64_t>(measureSeconds) * F_CPU;
+		while (cycle() < endCycle) {
+			loop();
+		}
+		const double elapsed = static_cast<double>(cycle() - startCycle);
+		const double dutyCycle = (activeCycles() - startActive) / elapsed;
+		const double estimatedDutyCycle = powerManager.dutyCycle() / 1000.0;
+		const double current = averageCurrent(dutyCycle);
+		report("Wake-ups per second", (statistics().wakeUpCount - start.wakeUpCount) / double(measureSeconds), "");
+		reportBudget("ADC conversions per second",
+			(statistics().interruptCount[VectorAdc] - start.interruptCount[VectorAdc]) / double(measureSeconds),
+			1000, "");
+		report("Interrupt cycles per second",
+			(statistics().interruptCycles - start.interruptCycles) / double(measureSeconds), "cycles");
+		report("Duty cycle", dutyCycle * 1000, "/1000");
+		report("Duty cycle measured by the sketch", estimatedDutyCycle * 1000, "/1000");
+		// The sketch counts the interrupts as active time, so its estimate is close to the emulation.
+		reportBudget("Error of the measured duty cycle", std::fabs(estimatedDutyCycle - dutyCycle) * 1000, 2, "/1000");
+		report("Average current", current, "uA");
+		report("Charge per day", current * 24 / 1000, "mAh");
+	});
+	return testResult();
+}
+
+
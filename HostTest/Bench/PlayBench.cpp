@@ -0,0 +1,175 @@
+//
+// PlayBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Measures the cycles of the playback path: the reads from the card, the
+// directory, the DAC and one iteration of the play loop. The benchmark is
+// built with AUDIOPLAYER_PROFILE, the player measures its own iterations
+// with timer 1. The cycles of the code without register accesses are added
+// from the model in Bench.h. The play loop has to fit into the budget of
+// a 22050Hz sample, or the benchmark fails.
+//
+#include "Bench.h"
+#include "SDCardEmulator.h"
+
+#include "AudioPlayer.h"
+#include "DacPort.h"
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// Get a little endian value from the image.
+///
+uint32_t imageUInt(size_t offset, uint8_t size)
+{
+	const uint8_t *data = sdCardEmulator.image() + offset;
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < size; ++i) {
+		value |= static_cast<uint32_t>(data[i]) << (i * 8);
+	}
+	return value;
+}
+
+
+/// Start a read of the given block and wait for the data.
+///
+void startBlockRead(uint32_t block, bool isMultiRead)
+{
+	SDCard::Status status;
+	if (isMultiRead) {
+		while ((status = sdCard.startMultiRead(block)) == SDCard::StatusWait) {
+		}
+	} else {
+		while ((status = sdCard.startRead(block)) == SDCard::StatusWait) {
+		}
+	}
+	CHECK_EQUAL(status, SDCard::StatusReady);
+}
+
+
+/// Measure the directory of an image, from the first access to the card.
+///
+/// @param modelCycles The modelled cycles to add to the measurement.
+///
+void benchDirectory(const char *name, uint64_t modelCycles)
+{
+	if (!CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady)) {
+		return;
+	}
+	CycleMeter meter;
+	CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+	CHECK(sdCard.findFile("v5.snd") != 0);
+	report(name, (meter.elapsed() + modelCycles) / (F_CPU / 1000.0), "ms");
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+
+	section("Reads from the card");
+	runBoot([]{
+		if (!CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady)) {
+			return;
+		}
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v2.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		SPISession session(SPIBus::SDCardDevice);
+		uint8_t buffer[32];
+
+		// The data calls of readFast4() in one block, without the start and the end of the block.
+		startBlockRead(entry->startBlock, true);
+		sdCard.startFastRead();
+		SDCard::Status status;
+		while ((status = sdCard.readFast4(buffer)) == SDCard::StatusWait) {
+		}
+		CycleMeter meter;
+		for (uint8_t i = 0; i < 100; ++i) {
+			CHECK_EQUAL(sdCard.readFast4(buffer), SDCard::StatusReady);
+		}
+		report("readFast4() cycles per call", meter.elapsed() / 100.0 + avrCycles::readFast4Data, "cycles");
+		sdCard.stopRead();
+
+		// The calls of readData() with 32 bytes, for a whole block.
+		startBlockRead(entry->startBlock, false);
+		uint16_t byteCount = sizeof(buffer);
+		while ((status = sdCard.readData(buffer, &byteCount)) == SDCard::StatusWait) {
+			byteCount = sizeof(buffer);
+		}
+		meter.restart();
+		uint16_t callCount = 1;
+		do {
+			byteCount = sizeof(buffer);
+			status = sdCard.readData(buffer, &byteCount);
+			++callCount;
+		} while (status == SDCard::StatusReady);
+		CHECK_EQUAL(status, SDCard::StatusEndOfBlock);
+		const double readDataCycles = meter.elapsed() +
+			callCount * static_cast<double>(avrCycles::readDataCall) + 512.0 * avrCycles::readDataByte;
+		report("readData() cycles per 32 bytes", readDataCycles / callCount, "cycles");
+		report("readData() cycles per byte", readDataCycles / 512, "cycles");
+		sdCard.stopRead();
+	});
+
+	section("Directory");
+	runBoot([]{
+		benchDirectory("Version 1 directory", 0);
+	});
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	// The version 2 directory verifies the CRC of the index and the records.
+	const uint32_t crcBlockCount = imageUInt(10, 2) + (imageUInt(20, 4) + 15) / 16;
+	runBoot([crcBlockCount]{
+		benchDirectory("Version 2 directory", crcBlockCount * 512ULL * avrCycles::crc16Byte);
+	});
+	sdCardEmulator.loadImage(dataPath("fat.img"));
+	runBoot([]{
+		benchDirectory("FAT32 directory", 0);
+	});
+
+	section("DAC");
+	runBoot([]{
+		dacPort.initialize();
+		CycleMeter meter;
+		for (uint16_t value = 0; value < 100; ++value) {
+			dacPort.setValue(value * 40);
+		}
+		report("DacPort::setValue() cycles", meter.elapsed() / 100.0 + avrCycles::dacSetValue, "cycles");
+	});
+
+	section("Play loop at 22050Hz");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	runBoot([]{
+		if (!CHECK(audioPlayer.initialize())) {
+			return;
+		}
+		CHECK(audioPlayer.play("v5.snd"));
+		// The timer counts up to F_CPU/2/22050 and down again for each sample.
+		CHECK_EQUAL(audioPlayer.sampleBudgetCycles(), 2 * (F_CPU / 2 / 22050));
+		// The player measures the registers and the SPI bus, the model adds the code in between.
+		const uint32_t modelCycles = avrCycles::playLoop + avrCycles::readFast4Data + avrCycles::dacSetValue;
+		const double averageCycles = audioPlayer.averageSampleCycles() + modelCycles;
+		const double worstCycles = audioPlayer.worstSampleCycles() + modelCycles;
+		report("Modelled cycles per sample", modelCycles, "cycles");
+		// The average has to leave half of the period, as margin for the slower iterations
+		// at the block boundaries.
+		reportBudget("Play cycles per sample, average", averageCycles, F_CPU / 2 / 22050, "cycles");
+		reportBudget("Play cycles per sample, worst", worstCycles, audioPlayer.sampleBudgetCycles(), "cycles");
+		CHECK_EQUAL(audioPlayer.overrunCount(), 0);
+	});
+	return testResult();
+}
+
+
@@ -0,0 +1,117 @@
+//
+// PrepareBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Replays a trace with motion and with movements which only raise a
+// pre-alarm through the sketch, with a fast and a slow card. The sketch
+// prepares the read of the voice at each pre-alarm. The benchmark reports
+// the start latency of the prepared playbacks and of the others, which the
+// audio player measures itself, and the time wasted by the cancelled reads.
+//
+#include "Bench.h"
+#include "SDCardEmulator.h"
+#include "SensorReplay.h"
+
+#include "AudioPlayer.h"
+#include "SensorTrace.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+void setup();
+void loop();
+
+
+namespace {
+
+
+/// The length of the trace in seconds.
+///
+const uint32_t traceSeconds = 1200;
+
+/// The time between two movements in seconds.
+///
+const uint32_t movementInterval = 60;
+
+
+/// Create the trace, with motion and small movements in turn.
+///
+/// The motion lasts 8 seconds, so the sketch plays a second voice without a
+/// prepared read. The small movements rise to 3/4 of the threshold and
+/// only raise a pre-alarm.
+///
+SensorReplay createTrace()
+{
+	SensorReplay replay;
+	for (uint32_t time = 0; time < traceSeconds * 1000; time += SensorTrace::sampleInterval) {
+		const uint32_t movement = time / (movementInterval * 1000);
+		const uint32_t movementTime = time % (movementInterval * 1000);
+		const bool isMotion = (movement % 2) == 0;
+		uint16_t value = 100;
+		if (movement > 0 && movementTime < (isMotion ? 8000 : 1000)) {
+			const uint16_t level = isMotion ? 400 : 150;
+			value += (movementTime < 200) ? level * movementTime / 200 : level;
+		}
+		replay.add(time, value);
+	}
+	return replay;
+}
+
+
+/// Replay the trace through the sketch, and report the measurements of the audio player.
+///
+void replayTrace()
+{
+	const SensorReplay replay = createTrace();
+	replay.connect(0, cycle());
+	setup();
+	while (millis() < replay.endTime()) {
+		loop();
+	}
+	const uint32_t movementCount = traceSeconds / movementInterval - 1;
+	// The first movement is a small one.
+	CHECK_EQUAL(audioPlayer.usedPrepareCount(), movementCount / 2);
+	CHECK_EQUAL(audioPlayer.cancelledPrepareCount(), (movementCount + 1) / 2);
+	report("Prepared playbacks", audioPlayer.usedPrepareCount(), "");
+	report("Cancelled prepared reads", audioPlayer.cancelledPrepareCount(), "");
+	const double preparedLatency = audioPlayer.startLatency(true);
+	const double latency = audioPlayer.startLatency(false);
+	report("Start latency without a prepared read", latency, "us");
+	reportBudget("Start latency with a prepared read", preparedLatency, latency, "us");
+	report("Saved latency", latency - preparedLatency, "us");
+	if (audioPlayer.cancelledPrepareCount() > 0) {
+		// A cancelled read may cost at most the latency it saves.
+		reportBudget("Wasted time per cancelled read",
+			static_cast<double>(audioPlayer.wastedPrepareTime()) / audioPlayer.cancelledPrepareCount(),
+			latency - preparedLatency, "us");
+	}
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+
+	section("Fast card");
+	runBoot([]{
+		replayTrace();
+	});
+
+	section("Slow card");
+	sdCardEmulator.setLatency(SDCardEmulator::slowCard);
+	runBoot([]{
+		replayTrace();
+	});
+	sdCardEmulator.setLatency(SDCardEmulator::fastCard);
+	return testResult();
+}
+
+
+
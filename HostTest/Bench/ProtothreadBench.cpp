@@ -0,0 +1,132 @@
+//
+// ProtothreadBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Measures the RAM of a protothread task and the cycles of a switch to a
+// task, with eight protothreads run by the scheduler. Like in the
+// scheduler benchmark, the scheduler counts the moves in its heap and the
+// cycles are modelled with the constants in Bench.h. The RAM is counted
+// with the sizes of the AVR, the pointers of the host are larger.
+//
+#include "Bench.h"
+
+#include "Protothread.h"
+#include "Scheduler.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The number of measured ticks of 1ms.
+///
+const uint32_t tickCount = 100000;
+
+/// The number of yield points in each thread.
+///
+const uint8_t yieldPointCount = 4;
+
+/// The size of a task in the scheduler on the AVR: the deadline, two pointers and the interval.
+///
+const uint8_t avrTaskSize = 4 + 2 + 2 + 2;
+
+
+/// The state of a thread, which is kept over the yield points.
+///
+struct Thread {
+	Protothread thread; ///< The state of the protothread.
+	uint8_t step; ///< The next expected yield point.
+	uint32_t switchCount; ///< The number of switches to the thread.
+	uint32_t orderErrorCount; ///< The number of switches to an unexpected yield point.
+};
+
+/// The threads.
+///
+Thread threads[Scheduler::maxTaskCount];
+
+
+/// Check that the thread continues at the expected yield point.
+///
+void checkStep(Thread &thread, uint8_t step)
+{
+	if (thread.step != step) {
+		++thread.orderErrorCount;
+	}
+	thread.step = (step + 1) % yieldPointCount;
+}
+
+
+/// The task of a thread, which passes its yield points in a loop.
+///
+void threadTask(void *context, const unsigned long)
+{
+	Thread &thread = *static_cast<Thread*>(context);
+	++thread.switchCount;
+	PT_BEGIN(thread.thread);
+	for (;;) {
+		checkStep(thread, 0);
+		PT_YIELD(thread.thread);
+		checkStep(thread, 1);
+		PT_YIELD(thread.thread);
+		checkStep(thread, 2);
+		PT_YIELD(thread.thread);
+		checkStep(thread, 3);
+		PT_YIELD(thread.thread);
+	}
+	PT_END(thread.thread);
+}
+
+
+}
+
+
+int main()
+{
+	section("RAM of a task");
+	CHECK_EQUAL(sizeof(Protothread), 2);
+	report("Protothread state", sizeof(Protothread), "bytes");
+	report("Scheduler task on the AVR", avrTaskSize, "bytes");
+	reportBudget("RAM per protothread task", sizeof(Protothread) + avrTaskSize, 16, "bytes");
+
+	section("Switches between eight threads");
+	runBoot([]{
+		Scheduler taskScheduler;
+		for (uint8_t i = 0; i < Scheduler::maxTaskCount; ++i) {
+			CHECK(taskScheduler.start(&threadTask, &threads[i], i + 1, 3 + i, 0));
+		}
+		uint32_t dueTickCount = 0;
+		for (uint32_t tick = 1; tick <= tickCount; ++tick) {
+			if (taskScheduler.isDue(tick)) {
+				++dueTickCount;
+				taskScheduler.dispatch(tick);
+			}
+		}
+		uint32_t switchCount = 0;
+		for (uint8_t i = 0; i < Scheduler::maxTaskCount; ++i) {
+			CHECK(threads[i].switchCount > tickCount / (3 + i) - 2);
+			CHECK_EQUAL(threads[i].orderErrorCount, 0);
+			switchCount += threads[i].switchCount;
+		}
+		// A resume compares the line with the yield points before it jumps, the model counts all of them.
+		const double resumeCycles = avrCycles::protothreadSwitch + yieldPointCount * avrCycles::protothreadCase;
+		report("Cycles of a resume and yield", resumeCycles, "cycles");
+		// The checks of the heap, one per tick, one after each task and one after each due tick.
+		const double schedulerCycles = (static_cast<double>(switchCount) + dueTickCount) * avrCycles::schedulerIsDue +
+			switchCount * static_cast<double>(avrCycles::schedulerDispatch) +
+			taskScheduler.moveCount() * static_cast<double>(avrCycles::schedulerMove);
+		const double switchCycles = schedulerCycles / switchCount + resumeCycles;
+		report("Switches per second", switchCount / (tickCount / 1000.0), "");
+		// The switch to a thread may take as long as one sample of the play loop at 22050Hz.
+		reportBudget("Cycles per switch to a thread", switchCycles, F_CPU / 22050, "cycles");
+		report("Load of the switches", switchCycles * switchCount / (tickCount * (F_CPU / 1000.0)) * 100, "%");
+	});
+	return testResult();
+}
+
+
+
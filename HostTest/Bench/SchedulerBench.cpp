@@ -0,0 +1,107 @@
+//
+// SchedulerBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Measures the cycles of the scheduler for each tick of millis(), with one
+// to eight repeating tasks. The scheduler only works in CPU registers, so
+// the benchmark is built with SCHEDULER_PROFILE, the scheduler counts the
+// levels its tasks move in the heap. The cycles are modelled from these
+// counts with the constants in Bench.h. A tick without a due task has to
+// cost the same with any number of tasks, and a dispatched task at most
+// the levels of the heap.
+//
+#include "Bench.h"
+
+#include "Scheduler.h"
+
+#include <cmath>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The number of measured ticks of 1ms.
+///
+const uint32_t tickCount = 100000;
+
+/// The intervals of the tasks in ms.
+///
+const uint16_t taskIntervals[Scheduler::maxTaskCount] = {10, 13, 17, 23, 29, 31, 37, 41};
+
+/// The calls of each task.
+///
+uint32_t callCounts[Scheduler::maxTaskCount];
+
+
+/// The task, which counts its calls.
+///
+void countCall(void *context, const unsigned long)
+{
+	++*static_cast<uint32_t*>(context);
+}
+
+
+/// Measure the ticks with the given number of tasks.
+///
+void benchTasks(uint8_t taskCount)
+{
+	Scheduler taskScheduler;
+	for (uint8_t i = 0; i < taskCount; ++i) {
+		callCounts[i] = 0;
+		CHECK(taskScheduler.start(&countCall, &callCounts[i], taskIntervals[i], taskIntervals[i], 0));
+	}
+	// Like the loop of the sketch, which only wakes up for due tasks.
+	uint32_t dueTickCount = 0;
+	const uint32_t startMoveCount = taskScheduler.moveCount();
+	for (uint32_t tick = 1; tick <= tickCount; ++tick) {
+		if (taskScheduler.isDue(tick)) {
+			++dueTickCount;
+			taskScheduler.dispatch(tick);
+		}
+	}
+	const uint32_t moveCount = taskScheduler.moveCount() - startMoveCount;
+	uint32_t dispatchCount = 0;
+	for (uint8_t i = 0; i < taskCount; ++i) {
+		CHECK_EQUAL(callCounts[i], tickCount / taskIntervals[i]);
+		dispatchCount += callCounts[i];
+	}
+	// Each due tick checks the heap again after its last task.
+	const double checkCount = tickCount + dueTickCount + dispatchCount;
+	const double cycles = checkCount * avrCycles::schedulerIsDue +
+		dispatchCount * static_cast<double>(avrCycles::schedulerDispatch) +
+		moveCount * static_cast<double>(avrCycles::schedulerMove);
+	const double dispatchCycles = (cycles - tickCount * static_cast<double>(avrCycles::schedulerIsDue)) / dispatchCount;
+	char name[48];
+	snprintf(name, sizeof(name), "%d task%s, cycles per tick", taskCount, (taskCount > 1) ? "s" : "");
+	report(name, cycles / tickCount, "cycles");
+	snprintf(name, sizeof(name), "%d task%s, cycles per dispatched task", taskCount, (taskCount > 1) ? "s" : "");
+	// A task moves down at most to the last level of the heap.
+	const uint8_t heapDepth = static_cast<uint8_t>(std::floor(std::log2(taskCount)));
+	reportBudget(name, dispatchCycles, 2 * avrCycles::schedulerIsDue + avrCycles::schedulerDispatch +
+		heapDepth * avrCycles::schedulerMove, "cycles");
+}
+
+
+}
+
+
+int main()
+{
+	section("Ticks with repeating tasks");
+	runBoot([]{
+		report("Cycles per tick without a due task", avrCycles::schedulerIsDue, "cycles");
+		for (uint8_t taskCount = 1; taskCount <= Scheduler::maxTaskCount; taskCount *= 2) {
+			benchTasks(taskCount);
+		}
+	});
+	return testResult();
+}
+
+
+
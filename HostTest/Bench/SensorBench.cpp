@@ -0,0 +1,103 @@
+//
+// SensorBench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Measures the cycles of one MotionSensor::loop() with one to four idle
+// sensors, called at the interval of the sketch. The reads of the sampled
+// values are charged by the emulation, the code in between is added from
+// the model in Bench.h. Each added sensor must only add the work of its
+// threshold comparison, the rest of the loop works on the bit masks.
+//
+#include "Bench.h"
+
+#include "AnalogSampler.h"
+#include "MotionSensor.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The interval of the loop calls in ms, like in the sketch.
+///
+const uint16_t loopInterval = 10;
+
+/// The number of measured loop calls.
+///
+const uint16_t loopCount = 1000;
+
+/// The cycles of one loop with each number of sensors.
+///
+double loopCycles[MotionSensor::maxSensorCount + 1];
+
+
+/// Measure the loop with the given number of sensors.
+///
+void benchSensors(uint8_t sensorCount)
+{
+	MotionSensor motionSensor;
+	for (uint8_t i = 0; i < sensorCount; ++i) {
+		CHECK(motionSensor.addSensor(i, 200, i));
+	}
+	motionSensor.setup();
+	// Wait until all sensors are ready, without measuring.
+	const unsigned long startTime = millis();
+	while (motionSensor.status() != MotionSensor::Idle && millis() - startTime < 30000) {
+		wait(static_cast<uint64_t>(loopInterval) * F_CPU / 1000);
+		motionSensor.loop(millis());
+	}
+	if (!CHECK_EQUAL(motionSensor.status(), MotionSensor::Idle)) {
+		return;
+	}
+	// Measure only the loop calls, without the interrupts in between.
+	uint64_t measuredCycles = 0;
+	for (uint16_t i = 0; i < loopCount; ++i) {
+		wait(static_cast<uint64_t>(loopInterval) * F_CPU / 1000);
+		const uint64_t interruptCycles = statistics().interruptCycles;
+		CycleMeter meter;
+		motionSensor.loop(millis());
+		measuredCycles += meter.elapsed() - (statistics().interruptCycles - interruptCycles);
+	}
+	CHECK_EQUAL(motionSensor.status(), MotionSensor::Idle);
+	// The slopes of the sensors are measured at every slopeInterval.
+	const double slopeCallsPerLoop = static_cast<double>(loopInterval) / MotionSensor::slopeInterval;
+	const double modelCycles = avrCycles::motionSensorLoop +
+		sensorCount * (avrCycles::motionSensorState + slopeCallsPerLoop * avrCycles::motionSensorSlope);
+	loopCycles[sensorCount] = static_cast<double>(measuredCycles) / loopCount + modelCycles;
+	char name[48];
+	snprintf(name, sizeof(name), "Loop cycles with %d sensor%s", sensorCount, (sensorCount > 1) ? "s" : "");
+	// The loop may use 1% of its interval.
+	reportBudget(name, loopCycles[sensorCount], F_CPU / 1000 * loopInterval / 100, "cycles");
+}
+
+
+}
+
+
+int main()
+{
+	for (uint8_t channel = 0; channel < MotionSensor::maxSensorCount; ++channel) {
+		setAnalogInput(channel, [](uint64_t) -> uint16_t { return 100; });
+	}
+
+	section("Loop with idle sensors");
+	runBoot([]{
+		for (uint8_t sensorCount = 1; sensorCount <= MotionSensor::maxSensorCount; ++sensorCount) {
+			benchSensors(sensorCount);
+		}
+		const double sensorCycles = (loopCycles[MotionSensor::maxSensorCount] - loopCycles[1]) /
+			(MotionSensor::maxSensorCount - 1);
+		report("Fixed cycles of the loop", loopCycles[1] - sensorCycles, "cycles");
+		// A sensor adds its comparison and its share of the slopes, nothing which depends on the other sensors.
+		reportBudget("Cycles per added sensor", sensorCycles, 2 * avrCycles::motionSensorState, "cycles");
+	});
+	return testResult();
+}
+
+
+
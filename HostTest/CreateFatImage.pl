@@ -0,0 +1,179 @@
+#!/usr/bin/perl
+#
+# FAT32 Test Image Creator
+# ===========================================================================
+# (c)2014 by Lucky Resistor. http://luckyresistor.me
+# Licensed under the MIT license. See file LICENSE for details.
+#
+
+use v5.16.0;
+use strict;
+use warnings;
+use IO::Dir;
+use IO::File;
+use Getopt::Long;
+use File::Spec;
+
+# This script creates a small FAT32 disk image from the files in a directory,
+# for the host tests of the FAT32 support in SDCard.cpp. It is no general
+# purpose formatter: a cluster is one block, and the image is just large
+# enough for the files.
+#
+# The files are stored in the root directory with their 8.3 names in upper
+# case, in the sorted order of the names. The root directory always spans
+# several clusters, and contains a long file name entry, a deleted entry and
+# a subdirectory entry, which have to be skipped by the reader.
+#
+#   CreateFatImage.pl -i sounds -o fat_image.bin
+#
+# Options:
+#   --mbr             Put the volume into a partition, behind a master boot record.
+#   --fragment NAME   Store the clusters of the file NAME with a gap after each cluster.
+#   --truncate NAME   End the cluster chain of the file NAME after the half of the clusters.
+#   --fillers COUNT   Add COUNT small text files in front of the other files (default 20).
+#
+
+# Configuration
+# ---------------------------------------------------------------------------
+my $confBlockSize = 512;
+my $confReservedBlocks = 32;
+my $confFatCount = 2;
+my $confPartitionStart = 2048;
+my $confEndOfChain = 0x0fffffff;
+
+# Options
+# ---------------------------------------------------------------------------
+my $optInputDirectory;
+my $optOutput;
+my $optMbr = 0;
+my @optFragment = ();
+my @optTruncate = ();
+my $optFillers = 20;
+
+GetOptions( "input|i=s" => \$optInputDirectory,
+			"output|o=s" => \$optOutput,
+			"mbr" => \$optMbr,
+			"fragment=s" => \@optFragment,
+			"truncate=s" => \@optTruncate,
+			"fillers=i" => \$optFillers,)
+	or die("Error reading commands line parameters.");
+
+# Functions
+# ---------------------------------------------------------------------------
+
+# Create a 32 byte directory entry.
+sub directoryEntry {
+	my ($name, $extension, $attributes, $cluster, $size) = @_;
+	return pack("A8A3CCCvvvvvvvV", uc($name), uc($extension), $attributes, 0, 0, 0, 0, 0,
+		$cluster >> 16, 0, 0, $cluster & 0xffff, $size);
+}
+
+# Main
+# ---------------------------------------------------------------------------
+my @files = ();
+for my $i (0..($optFillers - 1)) {
+	push(@files, {"name"=>"F$i", "extension"=>"TXT", "data"=>"x" x 10});
+}
+my $inputDirectory = IO::Dir->new($optInputDirectory)
+	or die("Could not open input directory.");
+my @fileNames = sort(grep { !/^\.{1,2}$/ } $inputDirectory->read);
+undef $inputDirectory;
+foreach my $fileName (@fileNames) {
+	my ($name, $extension) = ($fileName =~ /^([^.]{1,8})(?:\.([^.]{0,3}))?$/)
+		or die("The file name \"$fileName\" is no 8.3 name.");
+	my $inFile = IO::File->new(File::Spec->catfile($optInputDirectory, $fileName), "<:raw")
+		or die("Could not open input file $fileName for reading.");
+	local $/;
+	my $data = <$inFile> // "";
+	$inFile->close();
+	push(@files, {"name"=>$name, "extension"=>($extension // ""), "data"=>$data,
+		"fragment"=>(grep { $_ eq $fileName } @optFragment) ? 1 : 0,
+		"truncate"=>(grep { $_ eq $fileName } @optTruncate) ? 1 : 0});
+}
+
+# Allocate the clusters, starting after the first root directory cluster.
+my $directoryEntryCount = @files + 3;
+my $directoryClusterCount = int(($directoryEntryCount * 32 + $confBlockSize - 1) / $confBlockSize);
+my $nextCluster = 3;
+my @fat = (0x0ffffff8, $confEndOfChain, $confEndOfChain);
+my %clusterData = ();
+my $allocate = sub {
+	my ($count, $gap) = @_;
+	my @clusters = ();
+	for (1..$count) {
+		push(@clusters, $nextCluster);
+		$nextCluster += $gap ? 2 : 1;
+	}
+	for my $i (0..$#clusters) {
+		$fat[$clusters[$i]] = ($i < $#clusters) ? $clusters[$i + 1] : $confEndOfChain;
+	}
+	return @clusters;
+};
+foreach my $file (@files) {
+	my $size = length($file->{"data"});
+	my $clusterCount = int(($size + $confBlockSize - 1) / $confBlockSize);
+	$file->{"cluster"} = 0;
+	next if $clusterCount == 0;
+	my @clusters = $allocate->($clusterCount, $file->{"fragment"});
+	if ($file->{"truncate"}) {
+		my $keep = int(($clusterCount + 1) / 2);
+		$fat[$clusters[$keep - 1]] = $confEndOfChain;
+	}
+	for my $i (0..$#clusters) {
+		$clusterData{$clusters[$i]} = substr($file->{"data"}, $i * $confBlockSize, $confBlockSize);
+	}
+	$file->{"cluster"} = $clusters[0];
+	++$nextCluster; # Leave a gap between the files.
+}
+my @directoryClusters = (2, $allocate->($directoryClusterCount - 1, 0));
+$fat[2] = (@directoryClusters > 1) ? $directoryClusters[1] : $confEndOfChain;
+
+# Create the root directory.
+my $directory = pack("C", 0x41) . ("\0" x 10) . pack("C", 0x0f) . ("\0" x 20);
+foreach my $file (@files) {
+	$directory .= directoryEntry($file->{"name"}, $file->{"extension"}, 0x20,
+		$file->{"cluster"}, length($file->{"data"}));
+	$directory .= pack("C", 0xe5) . ("\0" x 7) . "SND" . ("\0" x 21) if $file->{"name"} eq "F0";
+}
+$directory .= directoryEntry("SUB", "", 0x10, 0, 0);
+for my $i (0..$#directoryClusters) {
+	$clusterData{$directoryClusters[$i]} = substr($directory, $i * $confBlockSize, $confBlockSize)
+		if $i * $confBlockSize < length($directory);
+}
+
+# Write the image.
+my $fatBlockCount = int(($nextCluster + 127) / 128) + 1;
+my $dataStartBlock = $confReservedBlocks + $confFatCount * $fatBlockCount;
+my $totalBlockCount = $dataStartBlock + $nextCluster;
+my $volumeStart = $optMbr ? $confPartitionStart : 0;
+my $image = "\0" x (($volumeStart + $totalBlockCount) * $confBlockSize);
+if ($optMbr) {
+	substr($image, 446 + 4, 1) = pack("C", 0x0c);
+	substr($image, 454, 8) = pack("VV", $volumeStart, $totalBlockCount);
+	substr($image, 510, 2) = pack("CC", 0x55, 0xaa);
+}
+my $bootSector = pack("C3a8vCvCvvCvvvVV", 0xeb, 0x58, 0x90, "MSWIN4.1", $confBlockSize, 1,
+	$confReservedBlocks, $confFatCount, 0, 0, 0xf8, 0, 63, 255, $volumeStart, $totalBlockCount);
+$bootSector .= pack("VvvVvv", $fatBlockCount, 0, 0, 2, 1, 6);
+$bootSector .= "\0" x (82 - length($bootSector)) . "FAT32   ";
+$bootSector .= "\0" x (510 - length($bootSector)) . pack("CC", 0x55, 0xaa);
+substr($image, $volumeStart * $confBlockSize, $confBlockSize) = $bootSector;
+my $fatData = pack("V*", map { $_ // 0 } @fat[0..($fatBlockCount * 128 - 1)]);
+for my $i (0..($confFatCount - 1)) {
+	substr($image, ($volumeStart + $confReservedBlocks + $i * $fatBlockCount) * $confBlockSize,
+		length($fatData)) = $fatData;
+}
+foreach my $cluster (keys(%clusterData)) {
+	my $data = $clusterData{$cluster};
+	substr($image, ($volumeStart + $dataStartBlock + $cluster - 2) * $confBlockSize, length($data)) = $data;
+}
+my $outFile = IO::File->new($optOutput, ">:raw")
+	or die("Could not open output file \"$optOutput\" for write.");
+$outFile->print($image);
+$outFile->close();
+
+print "FAT32 image with " . scalar(@fileNames) . " files and $totalBlockCount blocks written.\n";
+
+# ===========================================================================
+# END
+#
@@ -0,0 +1,30 @@
+//
+// Bench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "Bench.h"
+
+
+#include <cstdio>
+
+
+namespace host {
+
+
+void report(const char *name, double value, const char *unit)
+{
+	printf("   %-44s %12.1f %s\n", name, value, unit);
+}
+
+
+bool reportBudget(const char *name, double value, double budget, const char *unit)
+{
+	printf("   %-44s %12.1f %s (budget %.1f)\n", name, value, unit, budget);
+	return check(value <= budget, name, __FILE__, __LINE__);
+}
+
+
+}
+
+
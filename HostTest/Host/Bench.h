@@ -0,0 +1,133 @@
+#pragma once
+//
+// Bench
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The measurements for the host benchmarks. The emulated MCU charges the
+// cycles of register, flash and EEPROM accesses, but code which only works
+// in CPU registers is free on the host. The benchmarks add the cycles of
+// this code from the model below, which are counted by hand from the AVR
+// instruction timings for the instructions avr-gcc uses.
+//
+
+
+#include "Test.h"
+
+
+namespace host {
+
+
+/// The modelled cycles of the AVR instructions which are not charged by the emulation.
+///
+namespace avrCycles {
+
+/// One crc16Update() step: the table index, the shift and the xor, without the two lpm.
+///
+const uint32_t crc16Byte = 10;
+
+/// One readFast4() call which returns data: the call, the state switch, four st and the byte count.
+///
+const uint32_t readFast4Data = 34;
+
+/// One readData() call: the call, the state switch and the limits of the byte count.
+///
+const uint32_t readDataCall = 40;
+
+/// One byte in the loop of readData(): the st, the counter and the branch.
+///
+const uint32_t readDataByte = 6;
+
+/// One DacPort::setValue(): the call, and the test and jump for each of the 12 data bits.
+///
+const uint32_t dacSetValue = 46;
+
+/// One iteration of the play loop without its calls: the buffer positions, the
+/// shift of the sample, the 32 bit sample counter and the branches.
+///
+const uint32_t playLoop = 72;
+
+/// One MotionSensor::loop() without the work for each sensor: the call, the status,
+/// the interval checks with 32 bit times and the masks of the changed and waiting sensors.
+///
+const uint32_t motionSensorLoop = 96;
+
+/// One idle sensor in updateSensorStates(): the call of value(), the shift of the
+/// baseline, the threshold comparison and the bit of the sensor.
+///
+const uint32_t motionSensorState = 52;
+
+/// One idle sensor in updatePreAlarm(): the call of value(), the slope and the
+/// conditions for the pre-alarm.
+///
+const uint32_t motionSensorSlope = 64;
+
+/// One sensor with the fixed threshold, which was used before the baseline: the call
+/// of value(), the comparison and the bit of the sensor.
+///
+const uint32_t fixedThreshold = 24;
+
+/// One Scheduler::isDue(): the task count, and the sign of the 32 bit difference to the deadline.
+///
+const uint32_t schedulerIsDue = 16;
+
+/// One task in Scheduler::dispatch() without the moves in the heap: the loads of the
+/// callback, the next deadline, the copies of the task in siftDown(), the last
+/// comparison and the indirect call.
+///
+const uint32_t schedulerDispatch = 96;
+
+/// One level a task moves in the heap: the index of the child, the comparisons of
+/// the deadlines and the copy of the 10 byte task.
+///
+const uint32_t schedulerMove = 64;
+
+/// One resume and yield of a protothread, without the call: the load of the line,
+/// the jump to the yield point, and the store of the next line.
+///
+const uint32_t protothreadSwitch = 14;
+
+/// One yield point the switch of a protothread compares with the line: cpi, cpc and brne.
+///
+const uint32_t protothreadCase = 4;
+
+}
+
+
+/// Measure the cycles of the emulated MCU.
+///
+class CycleMeter
+{
+public:
+	/// Start the measurement.
+	///
+	CycleMeter() : _start(cycle()) {}
+
+	/// Get the cycles since the start.
+	///
+	uint64_t elapsed() const { return cycle() - _start; }
+
+	/// Restart the measurement.
+	///
+	void restart() { _start = cycle(); }
+
+private:
+	uint64_t _start;
+};
+
+
+/// Print a measured value.
+///
+void report(const char *name, double value, const char *unit);
+
+/// Print a measured value with its budget, and check it.
+///
+/// @return True if the value is within the budget.
+///
+bool reportBudget(const char *name, double value, double budget, const char *unit);
+
+
+}
+
+
@@ -0,0 +1,101 @@
+//
+// DacEmulator
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "DacEmulator.h"
+
+
+namespace host {
+
+
+DacEmulator dacEmulator;
+
+
+namespace {
+
+// The pins of the DAC on port D.
+const uint8_t chipSelectMask = _BV(PIND2);
+const uint8_t clockMask = _BV(PIND3);
+const uint8_t dataMask = _BV(PIND4);
+const uint8_t latchMask = _BV(PIND5);
+
+/// The bit of a command which enables the output.
+///
+const uint16_t enableBit = 0x1000;
+
+}
+
+
+DacEmulator::DacEmulator()
+	: _commandCount(0), _errorCount(0), _shift(0), _bitCount(0), _inputRegister(0)
+{
+	addSpiDevice(this);
+	addPortListener([this](RegisterId port, uint8_t oldValue, uint8_t newValue) {
+		portChanged(port, oldValue, newValue);
+	});
+}
+
+
+void DacEmulator::clear()
+{
+	_samples.clear();
+	_commandCount = 0;
+	_errorCount = 0;
+}
+
+
+bool DacEmulator::isSelected()
+{
+	return (PORTD.value & chipSelectMask) == 0;
+}
+
+
+uint8_t DacEmulator::transfer(uint8_t data, uint32_t)
+{
+	_shift = (_shift << 8) | data;
+	_bitCount += 8;
+	return 0xff; // The chip has no data output.
+}
+
+
+void DacEmulator::portChanged(RegisterId port, uint8_t oldValue, uint8_t newValue)
+{
+	if (port != RegPORTD) {
+		return;
+	}
+	const uint8_t falling = oldValue & ~newValue;
+	const uint8_t rising = ~oldValue & newValue;
+	if ((falling & chipSelectMask) != 0) {
+		_shift = 0;
+		_bitCount = 0;
+	}
+	if ((rising & clockMask) != 0 && (newValue & chipSelectMask) == 0) {
+		_shift = (_shift << 1) | (((newValue & dataMask) != 0) ? 1 : 0);
+		++_bitCount;
+	}
+	if ((rising & chipSelectMask) != 0) {
+		finishCommand();
+	}
+	if ((falling & latchMask) != 0) {
+		_samples.push_back({cycle(), static_cast<uint16_t>(_inputRegister & 0x0fff), (_inputRegister & enableBit) != 0});
+	}
+}
+
+
+void DacEmulator::finishCommand()
+{
+	if (_bitCount == 16) {
+		_inputRegister = static_cast<uint16_t>(_shift);
+		++_commandCount;
+	} else if (_bitCount > 0) {
+		++_errorCount;
+	}
+	_shift = 0;
+	_bitCount = 0;
+}
+
+
+}
+
+
@@ -0,0 +1,83 @@
+#pragma once
+//
+// DacEmulator
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// An emulated MCP4821 DAC, connected to the pins 2 to 5 like in DacPort.
+// The DAC decodes the bit-banged commands from the port writes, and the
+// commands on the SPI bus if DACPORT_USE_SPI is defined. Each falling edge
+// of the latch records the value of the input register as one sample.
+//
+
+
+#include "Mcu.h"
+
+#include <vector>
+
+
+namespace host {
+
+
+/// The emulated DAC.
+///
+class DacEmulator : public SpiDevice
+{
+public:
+	/// One sample at the output of the DAC.
+	///
+	struct Sample {
+		uint64_t cycle; ///< The cycle of the latch.
+		uint16_t value; ///< The 12 bit value.
+		bool enabled; ///< If the output was enabled.
+	};
+
+public:
+	/// Create the DAC and connect it to the port and the SPI bus.
+	///
+	DacEmulator();
+
+public:
+	/// Get the recorded samples.
+	///
+	const std::vector<Sample>& samples() const { return _samples; }
+
+	/// Remove all recorded samples and reset the counters.
+	///
+	void clear();
+
+	/// Get the number of complete 16 bit commands.
+	///
+	uint32_t commandCount() const { return _commandCount; }
+
+	/// Get the number of commands with a wrong number of bits.
+	///
+	uint32_t errorCount() const { return _errorCount; }
+
+public: // SpiDevice
+	bool isSelected() override;
+	uint8_t transfer(uint8_t data, uint32_t clock) override;
+
+private:
+	void portChanged(RegisterId port, uint8_t oldValue, uint8_t newValue);
+	void finishCommand();
+
+private:
+	std::vector<Sample> _samples;
+	uint32_t _commandCount;
+	uint32_t _errorCount;
+	uint32_t _shift;
+	uint8_t _bitCount;
+	uint16_t _inputRegister;
+};
+
+
+/// The global instance of the DAC.
+///
+extern DacEmulator dacEmulator;
+
+
+}
+
+
@@ -0,0 +1,1165 @@
+//
+// Mcu
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "Mcu.h"
+
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#define HOST_REGISTER8(name, space) host::Register8 name(host::Reg##name, space);
+#define HOST_REGISTER16(name) host::Register16 name(host::Reg##name);
+#include "Registers.h"
+#undef HOST_REGISTER8
+#undef HOST_REGISTER16
+
+
+// The interrupt handlers of the code under test, if they are linked.
+extern "C" {
+void ADC_vect(void) __attribute__((weak));
+void TIMER2_OVF_vect(void) __attribute__((weak));
+void TIMER2_COMPB_vect(void) __attribute__((weak));
+}
+
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+
+namespace host {
+
+
+namespace {
+
+
+/// A cycle which never comes.
+///
+const uint64_t never = UINT64_MAX;
+
+/// The cycles of the timer 0 overflow interrupt of the Arduino core.
+///
+const uint32_t timer0InterruptCycles = 80;
+
+/// The cycles of the serial interrupts of the Arduino core.
+///
+const uint32_t serialInterruptCycles = 40;
+
+/// The cycles until a written EEPROM byte is programmed (3.4ms).
+///
+const uint32_t eepromWriteCycles = 54400;
+
+/// The size of the serial buffers in the Arduino core.
+///
+const uint8_t serialBufferSize = 64;
+
+
+/// A compare event of a timer.
+///
+struct TimerEvent {
+	uint32_t phase; ///< The phase of the counter for the event.
+	Register8 *flagRegister; ///< The register with the flag.
+	uint8_t flag; ///< The flag which is set.
+};
+
+
+/// The state of a timer.
+///
+/// The counter runs through the phases 0 to period-1. For the phase and
+/// frequency correct PWM mode, the phases after TOP count down again.
+///
+struct Timer {
+	uint32_t prescale; ///< The pre-scaler, or 0 if the timer is stopped.
+	uint32_t period; ///< The number of phases.
+	uint32_t top; ///< The top of the counter for the dual slope mode, or 0.
+	uint64_t startCycle; ///< The cycle at startPhase.
+	uint64_t startPhase; ///< The phase at startCycle.
+	std::vector<TimerEvent> events; ///< The events of one period.
+	uint64_t nextCycle; ///< The cycle of the next event.
+};
+
+
+/// The state of the emulated MCU.
+///
+struct State {
+	uint64_t cycle;
+	uint64_t nextEventCycle;
+	bool inInterrupt;
+	Timer timer0;
+	Timer timer1;
+	Timer timer2;
+	bool adcConverting;
+	bool adcFirstConversion;
+	uint8_t adcChannel;
+	uint64_t adcCompletionCycle;
+	uint32_t timer0Millis;
+	uint8_t timer0Fract;
+	uint32_t timer0OverflowCount;
+	uint32_t serialCyclesPerByte;
+	uint8_t serialQueued;
+	uint64_t serialTransmitCycle;
+	bool serialTransmitInterrupt;
+	std::deque<std::pair<uint64_t, char>> serialInput;
+	std::deque<char> serialReceived;
+	bool serialReceiveInterrupt;
+	uint64_t eepromReadyCycle;
+	Statistics statistics;
+};
+
+State state;
+
+/// The port listeners, created on first use for the static devices.
+///
+std::vector<PortListener>& portListeners()
+{
+	static std::vector<PortListener> listeners;
+	return listeners;
+}
+
+/// The SPI devices, created on first use for the static devices.
+///
+std::vector<SpiDevice*>& spiDevices()
+{
+	static std::vector<SpiDevice*> devices;
+	return devices;
+}
+
+AnalogInput analogInputs[8];
+std::string serialText;
+bool serialEcho = false;
+
+
+uint8_t* allocateEeprom()
+{
+	uint8_t *memory = static_cast<uint8_t*>(allocateShared(E2END + 1));
+	memset(memory, 0xff, E2END + 1);
+	return memory;
+}
+
+uint8_t *eepromMemory = allocateEeprom();
+
+
+void setFlag(Register8 &reg, uint8_t flag);
+void startAdcConversion();
+
+
+uint32_t timerPrescale(uint8_t clockSelect, bool isTimer2)
+{
+	static const uint32_t prescales[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	static const uint32_t prescales2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	return isTimer2 ? prescales2[clockSelect & 7] : prescales[clockSelect & 7];
+}
+
+
+uint64_t timerPhase(const Timer &timer)
+{
+	if (timer.prescale == 0 || timer.period == 0) {
+		return timer.startPhase;
+	}
+	return (timer.startPhase + (state.cycle - timer.startCycle) / timer.prescale) % timer.period;
+}
+
+
+uint16_t timerCount(const Timer &timer)
+{
+	const uint64_t phase = timerPhase(timer);
+	if (timer.top > 0 && phase > timer.top) {
+		return static_cast<uint16_t>(2 * timer.top - phase);
+	}
+	return static_cast<uint16_t>(phase);
+}
+
+
+void scheduleTimer(Timer &timer)
+{
+	timer.nextCycle = never;
+	if (timer.prescale == 0 || timer.period == 0) {
+		return;
+	}
+	const uint64_t tick = timer.startPhase + (state.cycle - timer.startCycle) / timer.prescale;
+	for (const TimerEvent &event : timer.events) {
+		uint64_t delta = (event.phase + timer.period - tick % timer.period) % timer.period;
+		if (delta == 0) {
+			delta = timer.period;
+		}
+		const uint64_t eventCycle = timer.startCycle + (tick + delta - timer.startPhase) * timer.prescale;
+		if (eventCycle < timer.nextCycle) {
+			timer.nextCycle = eventCycle;
+		}
+	}
+}
+
+
+void restartTimer(Timer &timer, uint64_t phase, uint32_t prescale, uint32_t period)
+{
+	timer.prescale = prescale;
+	timer.period = period;
+	timer.startCycle = state.cycle;
+	timer.startPhase = (period > 0) ? (phase % period) : 0;
+}
+
+
+void updateNextEventCycle()
+{
+	uint64_t next = never;
+	next = std::min(next, state.timer0.nextCycle);
+	next = std::min(next, state.timer1.nextCycle);
+	next = std::min(next, state.timer2.nextCycle);
+	if (state.adcConverting) {
+		next = std::min(next, state.adcCompletionCycle);
+	}
+	if (state.serialQueued > 0) {
+		next = std::min(next, state.serialTransmitCycle);
+	}
+	if (!state.serialInput.empty()) {
+		next = std::min(next, std::max(state.serialInput.front().first, state.cycle + 1));
+	}
+	state.nextEventCycle = next;
+}
+
+
+void configureTimer0()
+{
+	Timer &timer = state.timer0;
+	const uint64_t phase = timerPhase(timer);
+	restartTimer(timer, phase, timerPrescale(TCCR0B.value, false), 256);
+	timer.top = 0;
+	timer.events.clear();
+	timer.events.push_back({0, std::addressof(TIFR0), _BV(TOV0)});
+	scheduleTimer(timer);
+	updateNextEventCycle();
+}
+
+
+void configureTimer1(bool keepPhase = true, uint16_t phase = 0)
+{
+	Timer &timer = state.timer1;
+	const uint64_t currentPhase = keepPhase ? timerPhase(timer) : phase;
+	const uint8_t mode = ((TCCR1B.value >> WGM12) & 3) << 2 | (TCCR1A.value & 3);
+	timer.events.clear();
+	timer.top = 0;
+	uint32_t period = 0x10000;
+	switch (mode) {
+	case 4: // CTC with OCR1A as TOP
+		period = OCR1A.value + 1;
+		timer.events.push_back({OCR1A.value, std::addressof(TIFR1), _BV(OCF1A)});
+		if (OCR1B.value <= OCR1A.value) {
+			timer.events.push_back({OCR1B.value, std::addressof(TIFR1), _BV(OCF1B)});
+		}
+		break;
+	case 8: // Phase and frequency correct PWM with ICR1 as TOP
+		timer.top = ICR1.value;
+		period = 2 * timer.top;
+		timer.events.push_back({0, std::addressof(TIFR1), _BV(TOV1)});
+		timer.events.push_back({timer.top, std::addressof(TIFR1), _BV(ICF1)});
+		if (OCR1B.value < timer.top) {
+			timer.events.push_back({OCR1B.value, std::addressof(TIFR1), _BV(OCF1B)});
+			timer.events.push_back({period - OCR1B.value, std::addressof(TIFR1), _BV(OCF1B)});
+		}
+		break;
+	case 0: // Normal
+		timer.events.push_back({0, std::addressof(TIFR1), _BV(TOV1)});
+		timer.events.push_back({OCR1A.value, std::addressof(TIFR1), _BV(OCF1A)});
+		timer.events.push_back({OCR1B.value, std::addressof(TIFR1), _BV(OCF1B)});
+		break;
+	default:
+		fatal("Unsupported timer 1 mode.");
+	}
+	restartTimer(timer, currentPhase, timerPrescale(TCCR1B.value, false), period);
+	scheduleTimer(timer);
+	updateNextEventCycle();
+}
+
+
+void configureTimer2()
+{
+	Timer &timer = state.timer2;
+	const uint64_t phase = timerPhase(timer);
+	restartTimer(timer, phase, timerPrescale(TCCR2B.value, true), 256);
+	timer.top = 0;
+	timer.events.clear();
+	timer.events.push_back({0, std::addressof(TIFR2), _BV(TOV2)});
+	timer.events.push_back({OCR2B.value, std::addressof(TIFR2), _BV(OCF2B)});
+	scheduleTimer(timer);
+	updateNextEventCycle();
+}
+
+
+void handleTimerEvents(Timer &timer)
+{
+	if (timer.nextCycle != state.cycle) {
+		return;
+	}
+	const uint64_t tick = timer.startPhase + (state.cycle - timer.startCycle) / timer.prescale;
+	for (const TimerEvent &event : timer.events) {
+		if (tick % timer.period == event.phase) {
+			setFlag(*event.flagRegister, event.flag);
+		}
+	}
+	scheduleTimer(timer);
+}
+
+
+void completeAdcConversion()
+{
+	state.adcConverting = false;
+	uint16_t value = 0;
+	if (analogInputs[state.adcChannel]) {
+		value = std::min<uint16_t>(analogInputs[state.adcChannel](state.cycle), 1023);
+	}
+	ADC.value = ((ADMUX.value & _BV(ADLAR)) != 0) ? static_cast<uint16_t>(value << 6) : value;
+	ADCSRA.value &= ~_BV(ADSC);
+	setFlag(ADCSRA, _BV(ADIF));
+}
+
+
+void processEvents(uint64_t targetCycle)
+{
+	while (state.nextEventCycle <= targetCycle) {
+		state.cycle = state.nextEventCycle;
+		handleTimerEvents(state.timer0);
+		handleTimerEvents(state.timer1);
+		handleTimerEvents(state.timer2);
+		if (state.adcConverting && state.adcCompletionCycle == state.cycle) {
+			completeAdcConversion();
+		}
+		if (state.serialQueued > 0 && state.serialTransmitCycle == state.cycle) {
+			--state.serialQueued;
+			state.serialTransmitInterrupt = true;
+			state.serialTransmitCycle = state.cycle + state.serialCyclesPerByte;
+		}
+		while (!state.serialInput.empty() && state.serialInput.front().first <= state.cycle) {
+			state.serialReceived.push_back(state.serialInput.front().second);
+			state.serialInput.pop_front();
+			state.serialReceiveInterrupt = true;
+		}
+		updateNextEventCycle();
+	}
+	state.cycle = targetCycle;
+}
+
+
+void setFlag(Register8 &reg, uint8_t flag)
+{
+	const bool rising = (reg.value & flag) == 0;
+	reg.value |= flag;
+	if (!rising || (ADCSRA.value & (_BV(ADEN)|_BV(ADATE))) != (_BV(ADEN)|_BV(ADATE))) {
+		return;
+	}
+	// The rising edge of the selected flag triggers a conversion.
+	const uint8_t triggerSource = ADCSRB.value & 7;
+	if ((triggerSource == 0 && &reg == &ADCSRA && flag == _BV(ADIF)) ||
+		(triggerSource == 4 && &reg == &TIFR0 && flag == _BV(TOV0)) ||
+		(triggerSource == 5 && &reg == &TIFR1 && flag == _BV(OCF1B)) ||
+		(triggerSource == 6 && &reg == &TIFR1 && flag == _BV(TOV1))) {
+		startAdcConversion();
+	}
+}
+
+
+void startAdcConversion()
+{
+	if (state.adcConverting || (ADCSRA.value & _BV(ADEN)) == 0) {
+		return;
+	}
+	const uint8_t prescaleBits = ADCSRA.value & 7;
+	const uint32_t prescale = (prescaleBits == 0) ? 2 : (1u << prescaleBits);
+	state.adcConverting = true;
+	state.adcChannel = ADMUX.value & 0x07;
+	state.adcCompletionCycle = state.cycle + (state.adcFirstConversion ? 25 : 13) * prescale;
+	state.adcFirstConversion = false;
+	ADCSRA.value |= _BV(ADSC);
+	updateNextEventCycle();
+}
+
+
+/// Get the pending interrupt with the highest priority.
+///
+Vector pendingVector()
+{
+	if ((TIFR2.value & _BV(OCF2B)) != 0 && (TIMSK2.value & _BV(OCIE2B)) != 0) {
+		return VectorTimer2CompareB;
+	}
+	if ((TIFR2.value & _BV(TOV2)) != 0 && (TIMSK2.value & _BV(TOIE2)) != 0) {
+		return VectorTimer2Overflow;
+	}
+	if ((TIFR0.value & _BV(TOV0)) != 0 && (TIMSK0.value & _BV(TOIE0)) != 0) {
+		return VectorTimer0Overflow;
+	}
+	if (state.serialReceiveInterrupt) {
+		return VectorSerialReceive;
+	}
+	if (state.serialTransmitInterrupt) {
+		return VectorSerialEmpty;
+	}
+	if ((ADCSRA.value & _BV(ADIF)) != 0 && (ADCSRA.value & _BV(ADIE)) != 0) {
+		return VectorAdc;
+	}
+	return VectorCount;
+}
+
+
+void advanceTo(uint64_t targetCycle);
+
+
+/// The timer 0 overflow interrupt of the Arduino core.
+///
+void timer0Overflow()
+{
+	uint32_t m = state.timer0Millis;
+	uint8_t f = state.timer0Fract;
+	m += 1;
+	f += 3;
+	if (f >= 125) {
+		f -= 125;
+		m += 1;
+	}
+	state.timer0Fract = f;
+	state.timer0Millis = m;
+	state.timer0OverflowCount++;
+}
+
+
+void deliverInterrupts()
+{
+	if (state.inInterrupt) {
+		return;
+	}
+	while ((SREG.value & 0x80) != 0) {
+		const Vector vector = pendingVector();
+		if (vector == VectorCount) {
+			break;
+		}
+		const uint64_t startCycle = state.cycle;
+		state.inInterrupt = true;
+		SREG.value &= ~0x80;
+		state.statistics.interruptCount[vector]++;
+		switch (vector) {
+		case VectorTimer2CompareB:
+			TIFR2.value &= ~_BV(OCF2B);
+			advanceTo(state.cycle + interruptOverheadCycles);
+			if (TIMER2_COMPB_vect) {
+				TIMER2_COMPB_vect();
+			}
+			break;
+		case VectorTimer2Overflow:
+			TIFR2.value &= ~_BV(TOV2);
+			advanceTo(state.cycle + interruptOverheadCycles);
+			if (TIMER2_OVF_vect) {
+				TIMER2_OVF_vect();
+			}
+			break;
+		case VectorTimer0Overflow:
+			TIFR0.value &= ~_BV(TOV0);
+			advanceTo(state.cycle + timer0InterruptCycles);
+			timer0Overflow();
+			break;
+		case VectorSerialReceive:
+			state.serialReceiveInterrupt = false;
+			advanceTo(state.cycle + serialInterruptCycles);
+			break;
+		case VectorSerialEmpty:
+			state.serialTransmitInterrupt = false;
+			advanceTo(state.cycle + serialInterruptCycles);
+			break;
+		case VectorAdc:
+			ADCSRA.value &= ~_BV(ADIF);
+			advanceTo(state.cycle + interruptOverheadCycles);
+			if (ADC_vect) {
+				ADC_vect();
+			}
+			break;
+		default:
+			break;
+		}
+		SREG.value |= 0x80;
+		state.inInterrupt = false;
+		state.statistics.interruptCycles += state.cycle - startCycle;
+	}
+}
+
+
+void advanceTo(uint64_t targetCycle)
+{
+	while (state.nextEventCycle <= targetCycle) {
+		processEvents(state.nextEventCycle);
+		deliverInterrupts();
+	}
+	if (targetCycle > state.cycle) {
+		state.cycle = targetCycle;
+	}
+}
+
+
+}
+
+
+void charge(uint32_t cycleCount)
+{
+	advanceTo(state.cycle + cycleCount);
+	deliverInterrupts();
+}
+
+
+void onRead(Register8 &reg)
+{
+	switch (reg.id) {
+	case RegTCNT0:
+		reg.value = static_cast<uint8_t>(timerCount(state.timer0));
+		break;
+	case RegTCNT2:
+		reg.value = static_cast<uint8_t>(timerCount(state.timer2));
+		break;
+	case RegADCL:
+		reg.value = static_cast<uint8_t>(ADC.value);
+		break;
+	case RegADCH:
+		reg.value = static_cast<uint8_t>(ADC.value >> 8);
+		break;
+	case RegPINB:
+		reg.value = PORTB.value;
+		break;
+	case RegPINC:
+		reg.value = PORTC.value;
+		break;
+	case RegPIND:
+		reg.value = PORTD.value;
+		break;
+	default:
+		break;
+	}
+}
+
+
+void onWrite(Register8 &reg, uint8_t value, uint8_t mask)
+{
+	const uint8_t oldValue = reg.value;
+	switch (reg.id) {
+	case RegTIFR0:
+	case RegTIFR1:
+	case RegTIFR2:
+	case RegEIFR:
+		// Writing a one clears the flag.
+		reg.value = oldValue & ~(value & mask);
+		break;
+	case RegPINB:
+	case RegPINC:
+	case RegPIND: {
+		// Writing a one toggles the port bit.
+		Register8 &port = (reg.id == RegPINB) ? PORTB : ((reg.id == RegPINC) ? PORTC : PORTD);
+		const uint8_t oldPort = port.value;
+		port.value = oldPort ^ (value & mask);
+		for (PortListener &listener : portListeners()) {
+			listener(port.id, oldPort, port.value);
+		}
+		break;
+	}
+	case RegADCSRA: {
+		const uint8_t written = value & mask;
+		uint8_t newValue = ((oldValue & ~mask) | written) & ~(_BV(ADIF)|_BV(ADSC));
+		if ((oldValue & _BV(ADIF)) != 0 && (written & _BV(ADIF)) == 0) {
+			newValue |= _BV(ADIF);
+		}
+		if ((oldValue & _BV(ADEN)) == 0 && (newValue & _BV(ADEN)) != 0) {
+			state.adcFirstConversion = true;
+		}
+		if ((newValue & _BV(ADEN)) == 0) {
+			state.adcConverting = false;
+		}
+		if (state.adcConverting) {
+			newValue |= _BV(ADSC);
+		}
+		reg.value = newValue;
+		if ((written & _BV(ADSC)) != 0) {
+			startAdcConversion();
+		}
+		updateNextEventCycle();
+		break;
+	}
+	default:
+		reg.value = (oldValue & ~mask) | (value & mask);
+		break;
+	}
+	switch (reg.id) {
+	case RegPORTB:
+	case RegPORTC:
+	case RegPORTD:
+		for (PortListener &listener : portListeners()) {
+			listener(reg.id, oldValue, reg.value);
+		}
+		break;
+	case RegTCCR0A:
+	case RegTCCR0B:
+		configureTimer0();
+		break;
+	case RegTCCR1A:
+	case RegTCCR1B:
+		configureTimer1();
+		break;
+	case RegTCCR2A:
+	case RegTCCR2B:
+	case RegOCR2B:
+		configureTimer2();
+		break;
+	case RegTCNT2:
+		restartTimer(state.timer2, reg.value, state.timer2.prescale, state.timer2.period);
+		scheduleTimer(state.timer2);
+		updateNextEventCycle();
+		break;
+	default:
+		break;
+	}
+	deliverInterrupts();
+}
+
+
+void onRead(Register16 &reg)
+{
+	if (reg.id == RegTCNT1) {
+		reg.value = timerCount(state.timer1);
+	}
+}
+
+
+void onWrite(Register16 &reg, uint16_t value)
+{
+	reg.value = value;
+	switch (reg.id) {
+	case RegTCNT1:
+		configureTimer1(false, value);
+		break;
+	case RegICR1:
+	case RegOCR1A:
+	case RegOCR1B:
+		configureTimer1();
+		break;
+	default:
+		break;
+	}
+	deliverInterrupts();
+}
+
+
+void reset()
+{
+#define HOST_REGISTER8(name, space) name.value = 0;
+#define HOST_REGISTER16(name) name.value = 0;
+#include "Registers.h"
+#undef HOST_REGISTER8
+#undef HOST_REGISTER16
+	state = State();
+	state.timer0.nextCycle = never;
+	state.timer1.nextCycle = never;
+	state.timer2.nextCycle = never;
+	state.nextEventCycle = never;
+	state.serialCyclesPerByte = F_CPU * 10 / 115200;
+	serialText.clear();
+}
+
+
+void initArduino()
+{
+	TCCR0A = _BV(WGM01)|_BV(WGM00);
+	TCCR0B = _BV(CS01)|_BV(CS00);
+	TIMSK0 = _BV(TOIE0);
+	ADCSRA = _BV(ADPS2)|_BV(ADPS1)|_BV(ADPS0)|_BV(ADEN);
+	sei();
+}
+
+
+uint64_t cycle()
+{
+	return state.cycle;
+}
+
+
+void wait(uint64_t cycleCount)
+{
+	advanceTo(state.cycle + cycleCount);
+	deliverInterrupts();
+}
+
+
+void waitUntil(uint64_t targetCycle)
+{
+	if (targetCycle > state.cycle) {
+		wait(targetCycle - state.cycle);
+	}
+}
+
+
+Statistics& statistics()
+{
+	return state.statistics;
+}
+
+
+uint64_t activeCycles()
+{
+	return state.cycle - state.statistics.sleepCycles;
+}
+
+
+void addPortListener(PortListener listener)
+{
+	portListeners().push_back(listener);
+}
+
+
+void addSpiDevice(SpiDevice *device)
+{
+	spiDevices().push_back(device);
+}
+
+
+void setAnalogInput(uint8_t channel, AnalogInput input)
+{
+	analogInputs[channel & 7] = input;
+}
+
+
+std::string& serialOutput()
+{
+	return serialText;
+}
+
+
+void setSerialEcho(bool enabled)
+{
+	serialEcho = enabled;
+}
+
+
+void sendSerial(const std::string &text, uint64_t startCycle)
+{
+	uint64_t arrival = std::max(startCycle, state.cycle);
+	if (!state.serialInput.empty()) {
+		arrival = std::max(arrival, state.serialInput.back().first);
+	}
+	for (char c : text) {
+		arrival += state.serialCyclesPerByte;
+		state.serialInput.push_back(std::make_pair(arrival, c));
+	}
+	updateNextEventCycle();
+}
+
+
+uint8_t* eeprom()
+{
+	return eepromMemory;
+}
+
+
+void* allocateShared(size_t size)
+{
+	void *memory = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		fatal("Could not allocate shared memory.");
+	}
+	return memory;
+}
+
+
+void fatal(const char *message)
+{
+	fflush(stdout);
+	fprintf(stderr, "FATAL at cycle %llu: %s\n", static_cast<unsigned long long>(state.cycle), message);
+	_exit(2);
+}
+
+
+}
+
+
+// ---------------------------------------------------------------------------
+// Arduino Core
+// ---------------------------------------------------------------------------
+
+
+unsigned long millis()
+{
+	const uint8_t oldSREG = SREG;
+	cli();
+	const unsigned long m = host::state.timer0Millis;
+	host::charge(8);
+	SREG = oldSREG;
+	return m;
+}
+
+
+unsigned long micros()
+{
+	const uint8_t oldSREG = SREG;
+	cli();
+	unsigned long m = host::state.timer0OverflowCount;
+	host::charge(8);
+	const uint8_t t = TCNT0;
+	if ((TIFR0 & _BV(TOV0)) && (t < 255)) {
+		m++;
+	}
+	SREG = oldSREG;
+	return static_cast<uint32_t>(((m << 8) + t) * (64 / (F_CPU / 1000000L)));
+}
+
+
+void delay(unsigned long ms)
+{
+	if ((SREG.value & 0x80) == 0) {
+		host::fatal("delay() with disabled interrupts never returns.");
+	}
+	uint32_t start = micros();
+	while (ms > 0) {
+		while (ms > 0 && (micros() - start) >= 1000) {
+			ms--;
+			start += 1000;
+		}
+	}
+}
+
+
+void delayMicroseconds(unsigned int us)
+{
+	if (us > 1) {
+		host::charge(us * host::cyclesPerMicrosecond - 6);
+	}
+}
+
+
+namespace {
+
+host::Register8& pinPort(uint8_t pin)
+{
+	return (pin < 8) ? PORTD : ((pin < 14) ? PORTB : PORTC);
+}
+
+host::Register8& pinDirection(uint8_t pin)
+{
+	return (pin < 8) ? DDRD : ((pin < 14) ? DDRB : DDRC);
+}
+
+uint8_t pinMask(uint8_t pin)
+{
+	return _BV(pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14));
+}
+
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	host::charge(40);
+	if (mode == OUTPUT) {
+		pinDirection(pin) |= pinMask(pin);
+	} else {
+		pinDirection(pin) &= ~pinMask(pin);
+		if (mode == INPUT_PULLUP) {
+			pinPort(pin) |= pinMask(pin);
+		}
+	}
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	host::charge(45);
+	if (value == LOW) {
+		pinPort(pin) &= ~pinMask(pin);
+	} else {
+		pinPort(pin) |= pinMask(pin);
+	}
+}
+
+
+int digitalRead(uint8_t pin)
+{
+	host::charge(40);
+	return (pinPort(pin).value & pinMask(pin)) != 0 ? HIGH : LOW;
+}
+
+
+int analogRead(uint8_t pin)
+{
+	ADMUX = _BV(REFS0)|((pin >= 14) ? (pin - 14) : pin);
+	ADCSRA |= _BV(ADSC);
+	while ((ADCSRA & _BV(ADSC)) != 0) {
+	}
+	return ADC;
+}
+
+
+std::string String::format(long long value, unsigned char base)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	const bool negative = value < 0;
+	unsigned long long magnitude = negative ? -value : value;
+	std::string text;
+	do {
+		text.insert(text.begin(), digits[magnitude % base]);
+		magnitude /= base;
+	} while (magnitude > 0);
+	if (negative) {
+		text.insert(text.begin(), '-');
+	}
+	return text;
+}
+
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t count = 0;
+	while (size-- > 0) {
+		count += write(*buffer++);
+	}
+	return count;
+}
+
+
+size_t Print::print(double value, int digits)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%.*f", digits, value);
+	return write(text);
+}
+
+
+size_t Print::printSigned(long value, int base)
+{
+	if (base == DEC && value < 0) {
+		return print('-') + printNumber(static_cast<unsigned long>(-value), base);
+	}
+	return printNumber(static_cast<unsigned long>(value), base);
+}
+
+
+size_t Print::printNumber(unsigned long value, int base)
+{
+	// The values are printed as 32 bit values, like on the AVR.
+	value &= 0xffffffffUL;
+	static const char digits[] = "0123456789ABCDEF";
+	char text[40];
+	char *p = &text[sizeof(text) - 1];
+	*p = '\0';
+	if (base < 2) {
+		base = 10;
+	}
+	do {
+		*--p = digits[value % base];
+		value /= base;
+	} while (value > 0);
+	return write(p);
+}
+
+
+void HardwareSerial::begin(unsigned long baudRate)
+{
+	host::state.serialCyclesPerByte = F_CPU * 10 / baudRate;
+}
+
+
+int HardwareSerial::available()
+{
+	host::charge(12);
+	return static_cast<int>(host::state.serialReceived.size());
+}
+
+
+int HardwareSerial::read()
+{
+	host::charge(20);
+	if (host::state.serialReceived.empty()) {
+		return -1;
+	}
+	const char c = host::state.serialReceived.front();
+	host::state.serialReceived.pop_front();
+	return static_cast<uint8_t>(c);
+}
+
+
+int HardwareSerial::peek()
+{
+	host::charge(12);
+	if (host::state.serialReceived.empty()) {
+		return -1;
+	}
+	return static_cast<uint8_t>(host::state.serialReceived.front());
+}
+
+
+void HardwareSerial::flush()
+{
+	while (host::state.serialQueued > 0) {
+		host::waitUntil(host::state.serialTransmitCycle);
+	}
+}
+
+
+size_t HardwareSerial::write(uint8_t value)
+{
+	host::charge(30);
+	while (host::state.serialQueued > host::serialBufferSize) {
+		host::waitUntil(host::state.serialTransmitCycle);
+	}
+	if (host::state.serialQueued == 0) {
+		host::state.serialTransmitCycle = host::state.cycle + host::state.serialCyclesPerByte;
+	}
+	host::state.serialQueued++;
+	host::updateNextEventCycle();
+	host::serialText.push_back(static_cast<char>(value));
+	if (host::serialEcho) {
+		putchar(value);
+	}
+	return 1;
+}
+
+
+// ---------------------------------------------------------------------------
+// SPI
+// ---------------------------------------------------------------------------
+
+
+void SPIClass::begin()
+{
+	host::charge(20);
+	if ((DDRB.value & _BV(PINB2)) == 0) {
+		PORTB |= _BV(PINB2);
+	}
+	DDRB |= _BV(PINB2);
+	SPCR |= _BV(MSTR);
+	SPCR |= _BV(SPE);
+	DDRB |= _BV(PINB5);
+	DDRB |= _BV(PINB3);
+}
+
+
+void SPIClass::end()
+{
+	SPCR &= ~_BV(SPE);
+}
+
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+	host::charge(6);
+	host::state.statistics.spiTransactionCount++;
+	SPCR = settings.spcr;
+	SPSR = settings.spsr;
+}
+
+
+void SPIClass::endTransaction()
+{
+	host::charge(4);
+}
+
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	static const uint8_t dividers[4] = {4, 16, 64, 128};
+	uint32_t divider = dividers[SPCR.value & SPI_CLOCK_MASK];
+	if ((SPSR.value & _BV(SPI2X)) != 0) {
+		divider /= 2;
+	}
+	SPDR = data;
+	host::charge(1 + 8 * divider);
+	uint8_t result = 0xff;
+	uint8_t selectedCount = 0;
+	for (host::SpiDevice *device : host::spiDevices()) {
+		if (device->isSelected()) {
+			result &= device->transfer(data, F_CPU / divider);
+			++selectedCount;
+		}
+	}
+	host::state.statistics.spiTransferCount++;
+	if (selectedCount > 1) {
+		host::state.statistics.spiContentionCount++;
+	}
+	SPDR.value = result;
+	(void)static_cast<uint8_t>(SPSR);
+	return SPDR;
+}
+
+
+// ---------------------------------------------------------------------------
+// EEPROM and Sleep
+// ---------------------------------------------------------------------------
+
+
+void eeprom_read_block(void *destination, const void *source, size_t size)
+{
+	host::waitUntil(host::state.eepromReadyCycle);
+	const size_t address = reinterpret_cast<size_t>(source);
+	if (address + size > E2END + 1) {
+		host::fatal("EEPROM read out of range.");
+	}
+	host::charge(8 * size);
+	memcpy(destination, host::eepromMemory + address, size);
+}
+
+
+void eeprom_update_block(const void *source, void *destination, size_t size)
+{
+	const size_t address = reinterpret_cast<size_t>(destination);
+	if (address + size > E2END + 1) {
+		host::fatal("EEPROM write out of range.");
+	}
+	const uint8_t *data = static_cast<const uint8_t*>(source);
+	for (size_t i = 0; i < size; ++i) {
+		host::waitUntil(host::state.eepromReadyCycle);
+		host::charge(12);
+		if (host::eepromMemory[address + i] != data[i]) {
+			host::eepromMemory[address + i] = data[i];
+			host::state.eepromReadyCycle = host::state.cycle + host::eepromWriteCycles;
+			host::state.statistics.eepromWriteCount++;
+		}
+	}
+}
+
+
+uint8_t eeprom_read_byte(const uint8_t *address)
+{
+	uint8_t value;
+	eeprom_read_block(&value, address, 1);
+	return value;
+}
+
+
+void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+	eeprom_update_block(&value, address, 1);
+}
+
+
+void sleep_cpu()
+{
+	host::charge(1);
+	if ((SMCR.value & _BV(SE)) == 0) {
+		return;
+	}
+	if ((SREG.value & 0x80) == 0) {
+		host::fatal("sleep_cpu() with disabled interrupts never returns.");
+	}
+	const uint64_t startCycle = host::state.cycle;
+	while (host::pendingVector() == host::VectorCount) {
+		if (host::state.nextEventCycle == host::never) {
+			host::fatal("sleep_cpu() without any wake-up source.");
+		}
+		host::processEvents(host::state.nextEventCycle);
+	}
+	host::state.statistics.sleepCycles += host::state.cycle - startCycle;
+	host::state.statistics.wakeUpCount++;
+	host::charge(4); // wake-up from idle
+}
+
+
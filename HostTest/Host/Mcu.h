@@ -0,0 +1,165 @@
+#pragma once
+//
+// Mcu
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// An emulated ATmega328 at 16MHz, for running the CatProtect code on the
+// host. There is no instruction set emulation: the code runs natively,
+// and only the accesses to the registers, the SPI bus, the flash and the
+// EEPROM are charged with the cycles of the AVR instructions. All timers,
+// the ADC and the interrupts run on this virtual clock. Sleeping skips
+// the time to the next interrupt.
+//
+
+
+#include <avr/io.h>
+
+#include <functional>
+#include <string>
+
+
+namespace host {
+
+
+/// The number of cycles per microsecond.
+///
+const uint32_t cyclesPerMicrosecond = 16;
+
+/// The interrupt vectors of the emulated MCU, in priority order.
+///
+enum Vector : uint8_t {
+	VectorTimer2CompareB = 8,
+	VectorTimer2Overflow = 9,
+	VectorTimer0Overflow = 16,
+	VectorSerialReceive = 18,
+	VectorSerialEmpty = 19,
+	VectorAdc = 21,
+	VectorCount = 26
+};
+
+/// The cycles of an interrupt entry and exit, including the vector jump,
+/// the register saves of an ISR which calls functions, and reti.
+///
+const uint32_t interruptOverheadCycles = 50;
+
+/// Statistics of the emulated MCU.
+///
+struct Statistics {
+	uint64_t sleepCycles; ///< The cycles spent in sleep_cpu().
+	uint64_t interruptCycles; ///< The cycles spent in interrupts, including the overhead.
+	uint32_t wakeUpCount; ///< The number of wake-ups from sleep_cpu().
+	uint32_t interruptCount[VectorCount]; ///< The number of calls for each vector.
+	uint32_t spiTransferCount; ///< The number of SPI transfers.
+	uint32_t spiContentionCount; ///< The number of transfers with more than one selected device.
+	uint32_t spiTransactionCount; ///< The number of SPI.beginTransaction() calls.
+	uint32_t eepromWriteCount; ///< The number of written EEPROM bytes.
+};
+
+
+/// A device on the SPI bus.
+///
+class SpiDevice
+{
+public:
+	virtual ~SpiDevice() {}
+
+	/// Check if the chip select of the device is low.
+	///
+	virtual bool isSelected() = 0;
+
+	/// Exchange one byte with the device.
+	///
+	/// @param data The byte sent by the MCU.
+	/// @param clock The SPI clock in Hz.
+	/// @return The byte sent by the device.
+	///
+	virtual uint8_t transfer(uint8_t data, uint32_t clock) = 0;
+};
+
+/// A function which is called after each write to a port register.
+///
+typedef std::function<void(RegisterId port, uint8_t oldValue, uint8_t newValue)> PortListener;
+
+/// A function which returns the voltage on an analog input at the given cycle, from 0 to 1023.
+///
+typedef std::function<uint16_t(uint64_t cycle)> AnalogInput;
+
+
+/// Reset the MCU with all registers, timers and statistics.
+///
+/// The listeners, SPI devices and analog inputs are kept.
+///
+void reset();
+
+/// Initialize the MCU like the Arduino main() before setup().
+///
+/// Timer 0 runs with a pre-scaler of 64 for millis() and the interrupts are enabled.
+///
+void initArduino();
+
+/// Get the current cycle.
+///
+uint64_t cycle();
+
+/// Let the given number of cycles pass, like in a busy loop.
+///
+/// Interrupts are delivered, if they are enabled.
+///
+void wait(uint64_t cycleCount);
+
+/// Let the time pass until the given cycle.
+///
+void waitUntil(uint64_t cycle);
+
+/// Get the statistics of the MCU.
+///
+Statistics& statistics();
+
+/// Get the active cycles, which are all cycles outside of sleep_cpu().
+///
+uint64_t activeCycles();
+
+/// Add a listener for the writes to the port registers.
+///
+void addPortListener(PortListener listener);
+
+/// Add a device to the SPI bus.
+///
+void addSpiDevice(SpiDevice *device);
+
+/// Set the function for the voltage on an analog input channel.
+///
+void setAnalogInput(uint8_t channel, AnalogInput input);
+
+/// Get the text written to the serial port.
+///
+std::string& serialOutput();
+
+/// Echo the serial output to stdout.
+///
+void setSerialEcho(bool enabled);
+
+/// Send text to the serial port of the MCU, starting at the given cycle.
+///
+/// The characters arrive one after the other at the speed of the port.
+///
+void sendSerial(const std::string &text, uint64_t cycle);
+
+/// Get the EEPROM memory, which is shared with all boots.
+///
+uint8_t* eeprom();
+
+/// Allocate memory which is shared with all boots.
+///
+void* allocateShared(size_t size);
+
+/// Stop with a message about an impossible state of the emulation.
+///
+[[noreturn]] void fatal(const char *message);
+
+
+}
+
+
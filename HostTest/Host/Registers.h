@@ -0,0 +1,57 @@
+//
+// Registers
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The list of the emulated registers. Define HOST_REGISTER8(name, space)
+// and HOST_REGISTER16(name) before including this file.
+//
+
+HOST_REGISTER8(PINB, host::SpaceBit)
+HOST_REGISTER8(DDRB, host::SpaceBit)
+HOST_REGISTER8(PORTB, host::SpaceBit)
+HOST_REGISTER8(PINC, host::SpaceBit)
+HOST_REGISTER8(DDRC, host::SpaceBit)
+HOST_REGISTER8(PORTC, host::SpaceBit)
+HOST_REGISTER8(PIND, host::SpaceBit)
+HOST_REGISTER8(DDRD, host::SpaceBit)
+HOST_REGISTER8(PORTD, host::SpaceBit)
+HOST_REGISTER8(TIFR0, host::SpaceBit)
+HOST_REGISTER8(TIFR1, host::SpaceBit)
+HOST_REGISTER8(TIFR2, host::SpaceBit)
+HOST_REGISTER8(EIFR, host::SpaceBit)
+HOST_REGISTER8(GPIOR0, host::SpaceBit)
+HOST_REGISTER8(TCCR0A, host::SpaceIo)
+HOST_REGISTER8(TCCR0B, host::SpaceIo)
+HOST_REGISTER8(TCNT0, host::SpaceIo)
+HOST_REGISTER8(OCR0A, host::SpaceIo)
+HOST_REGISTER8(OCR0B, host::SpaceIo)
+HOST_REGISTER8(SPCR, host::SpaceIo)
+HOST_REGISTER8(SPSR, host::SpaceIo)
+HOST_REGISTER8(SPDR, host::SpaceIo)
+HOST_REGISTER8(SMCR, host::SpaceIo)
+HOST_REGISTER8(MCUCR, host::SpaceIo)
+HOST_REGISTER8(SREG, host::SpaceIo)
+HOST_REGISTER8(PRR, host::SpaceMemory)
+HOST_REGISTER8(TIMSK0, host::SpaceMemory)
+HOST_REGISTER8(TIMSK1, host::SpaceMemory)
+HOST_REGISTER8(TIMSK2, host::SpaceMemory)
+HOST_REGISTER8(ADCL, host::SpaceMemory)
+HOST_REGISTER8(ADCH, host::SpaceMemory)
+HOST_REGISTER8(ADCSRA, host::SpaceMemory)
+HOST_REGISTER8(ADCSRB, host::SpaceMemory)
+HOST_REGISTER8(ADMUX, host::SpaceMemory)
+HOST_REGISTER8(DIDR0, host::SpaceMemory)
+HOST_REGISTER8(TCCR1A, host::SpaceMemory)
+HOST_REGISTER8(TCCR1B, host::SpaceMemory)
+HOST_REGISTER8(TCCR2A, host::SpaceMemory)
+HOST_REGISTER8(TCCR2B, host::SpaceMemory)
+HOST_REGISTER8(TCNT2, host::SpaceMemory)
+HOST_REGISTER8(OCR2A, host::SpaceMemory)
+HOST_REGISTER8(OCR2B, host::SpaceMemory)
+HOST_REGISTER16(TCNT1)
+HOST_REGISTER16(ICR1)
+HOST_REGISTER16(OCR1A)
+HOST_REGISTER16(OCR1B)
+HOST_REGISTER16(ADC)
@@ -0,0 +1,493 @@
+//
+// SDCardEmulator
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "SDCardEmulator.h"
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+
+namespace host {
+
+
+const SDCardEmulator::Latency SDCardEmulator::fastCard = {200, 20, 20, 0, 500, 0, 0};
+const SDCardEmulator::Latency SDCardEmulator::slowCard = {2000, 400, 1000, 4, 2000, 32, 150000};
+
+SDCardEmulator sdCardEmulator;
+
+
+namespace {
+
+/// The position for no data block in the output.
+///
+const size_t noDataBlock = std::string::npos;
+
+/// The number of ACMD41 commands until the card is ready.
+///
+const uint8_t initRoundCount = 3;
+
+/// The probability of a flipped bit above the maximum clock, 1/n per byte.
+///
+const uint32_t bitErrorRate = 512;
+
+uint16_t crc16(const uint8_t *data, size_t size)
+{
+	uint16_t crc = 0;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= static_cast<uint16_t>(data[i]) << 8;
+		for (uint8_t bit = 0; bit < 8; ++bit) {
+			crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+		}
+	}
+	return crc;
+}
+
+struct Registration {
+	Registration() { addSpiDevice(&sdCardEmulator); }
+} registration;
+
+}
+
+
+SDCardEmulator::SDCardEmulator()
+	: _image(nullptr), _imageSize(0), _chipSelectPort(std::addressof(PORTB)), _chipSelectMask(_BV(PINB2)),
+	_latency(fastCard), _maximumClock(0), _highSpeedSupport(true), _random(1), _corruptBlock(-1),
+	_failBlockCount(-1), _failDurationMicros(0), _powerCutBlockCount(-1), _powerCutByteCount(0),
+	_isResponding(true), _respondAgainCycle(0)
+{
+	static const uint8_t cid[16] = {0x03, 'S', 'D', 'H', 'C', '3', '2', 'G', 0x80, 0x12, 0x34, 0x56, 0x78, 0x01, 0x4a, 0x01};
+	static const uint8_t csd[16] = {0x40, 0x0e, 0x00, 0x32, 0x5b, 0x59, 0x00, 0x00, 0xed, 0xc8, 0x7f, 0x80, 0x0a, 0x40, 0x40, 0x01};
+	memcpy(_cid, cid, sizeof(_cid));
+	memcpy(_csd, csd, sizeof(_csd));
+	resetCounters();
+	resetState();
+}
+
+
+bool SDCardEmulator::loadImage(const std::string &path, size_t size)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	const size_t fileSize = static_cast<size_t>(ftell(file));
+	fseek(file, 0, SEEK_SET);
+	_imageSize = ((std::max(size, fileSize) + 511) / 512) * 512;
+	_image = static_cast<uint8_t*>(allocateShared(_imageSize));
+	memset(_image, 0, _imageSize);
+	const bool success = fread(_image, 1, fileSize, file) == fileSize;
+	fclose(file);
+	return success;
+}
+
+
+void SDCardEmulator::setChipSelect(Register8 &port, uint8_t bit)
+{
+	_chipSelectPort = std::addressof(port);
+	_chipSelectMask = _BV(bit);
+}
+
+
+void SDCardEmulator::setLatency(const Latency &latency)
+{
+	_latency = latency;
+}
+
+
+void SDCardEmulator::setSerialNumber(uint32_t serialNumber)
+{
+	_cid[9] = static_cast<uint8_t>(serialNumber >> 24);
+	_cid[10] = static_cast<uint8_t>(serialNumber >> 16);
+	_cid[11] = static_cast<uint8_t>(serialNumber >> 8);
+	_cid[12] = static_cast<uint8_t>(serialNumber);
+}
+
+
+void SDCardEmulator::setMaximumClock(uint32_t clock)
+{
+	_maximumClock = clock;
+}
+
+
+void SDCardEmulator::setHighSpeedSupport(bool supported)
+{
+	_highSpeedSupport = supported;
+}
+
+
+void SDCardEmulator::corruptBlockCrc(uint32_t block)
+{
+	_corruptBlock = block;
+}
+
+
+void SDCardEmulator::failAfterBlocks(uint32_t blockCount, uint32_t durationMicros)
+{
+	_failBlockCount = blockCount;
+	_failDurationMicros = durationMicros;
+}
+
+
+void SDCardEmulator::cutPowerWhileWriting(uint32_t blockCount, uint16_t byteCount)
+{
+	_powerCutBlockCount = blockCount;
+	_powerCutByteCount = byteCount;
+}
+
+
+void SDCardEmulator::powerCycle()
+{
+	_isResponding = true;
+	resetState();
+}
+
+
+void SDCardEmulator::resetCounters()
+{
+	memset(&_counters, 0, sizeof(_counters));
+}
+
+
+bool SDCardEmulator::isSelected()
+{
+	return (_chipSelectPort->value & _chipSelectMask) == 0;
+}
+
+
+uint8_t SDCardEmulator::transfer(uint8_t data, uint32_t clock)
+{
+	const uint64_t now = cycle();
+	if (!_isResponding) {
+		if (_respondAgainCycle == 0 || now < _respondAgainCycle) {
+			return 0xff;
+		}
+		_isResponding = true;
+		resetState();
+	}
+	uint8_t result = nextOutput(now);
+	receive(data, now);
+	if (_maximumClock != 0 && clock > _maximumClock) {
+		_random = _random * 1103515245u + 12345u;
+		if (((_random >> 16) % bitErrorRate) == 0) {
+			result ^= static_cast<uint8_t>(1 << ((_random >> 8) & 7));
+			++_counters.bitErrors;
+		}
+	}
+	return result;
+}
+
+
+uint8_t SDCardEmulator::nextOutput(uint64_t now)
+{
+	if (_outputPosition < _output.size()) {
+		const uint8_t value = static_cast<uint8_t>(_output[_outputPosition++]);
+		if (_outputPosition == _dataBlockEnd) {
+			_dataBlockEnd = noDataBlock;
+			++_counters.blocksRead;
+			_nextBlockCycle = now + _latency.blockGapMicros * cyclesPerMicrosecond;
+			blockTransferred(now);
+		}
+		if (_outputPosition >= _output.size()) {
+			_output.clear();
+			_outputPosition = 0;
+		}
+		return value;
+	}
+	if (_readBlocksLeft > 0) {
+		if (now < _nextBlockCycle) {
+			return 0xff;
+		}
+		if (!_isMultiRead) {
+			--_readBlocksLeft;
+		}
+		queueBlock(_readBlock++);
+		return nextOutput(now);
+	}
+	if (now < _busyUntilCycle) {
+		return 0x00;
+	}
+	return 0xff;
+}
+
+
+void SDCardEmulator::receive(uint8_t data, uint64_t now)
+{
+	if (!_isResponding) {
+		return;
+	}
+	if (_writeState == WriteData) {
+		if (_powerCutBlockCount == 0 && _writeCount == _powerCutByteCount) {
+			// The power is cut, only the received bytes reach the flash.
+			if (static_cast<size_t>(_writeBlock + 1) * 512 <= _imageSize) {
+				memcpy(_image + static_cast<size_t>(_writeBlock) * 512, _writeBuffer, std::min<uint16_t>(_writeCount, 512));
+			}
+			_powerCutBlockCount = -1;
+			stopResponding(now, 0);
+			return;
+		}
+		_writeBuffer[_writeCount++] = data;
+		if (_writeCount == sizeof(_writeBuffer)) {
+			finishWrittenBlock(now);
+		}
+		return;
+	}
+	if (_commandLength == 0) {
+		if (_writeState == WriteWaitToken) {
+			if ((data == 0xfe && !_isMultiWrite) || (data == 0xfc && _isMultiWrite)) {
+				_writeState = WriteData;
+				_writeCount = 0;
+				return;
+			}
+			if (data == 0xfd && _isMultiWrite) {
+				_writeState = WriteNone;
+				_output.assign(1, static_cast<char>(0xff));
+				_outputPosition = 0;
+				_busyUntilCycle = now + _latency.writeBusyMicros * cyclesPerMicrosecond;
+				return;
+			}
+			if (data == 0xff) {
+				return;
+			}
+			_writeState = WriteNone;
+		}
+		if ((data & 0xc0) != 0x40) {
+			return;
+		}
+	}
+	_command[_commandLength++] = data;
+	if (_commandLength == sizeof(_command)) {
+		_commandLength = 0;
+		executeCommand(now);
+	}
+}
+
+
+void SDCardEmulator::executeCommand(uint64_t now)
+{
+	const uint8_t index = _command[0] & 0x3f;
+	const uint32_t argument = (static_cast<uint32_t>(_command[1]) << 24) | (static_cast<uint32_t>(_command[2]) << 16) |
+		(static_cast<uint32_t>(_command[3]) << 8) | _command[4];
+	++_counters.commands[index];
+	if (now < _busyUntilCycle) {
+		++_counters.busyCommands;
+	}
+	const bool isApplicationCommand = _isApplicationCommand;
+	_isApplicationCommand = false;
+	_output.clear();
+	_outputPosition = 0;
+	_dataBlockEnd = noDataBlock;
+	// The card sends one byte before each response.
+	_output.push_back(static_cast<char>(0xff));
+	if (index == 12) {
+		if (!_isMultiRead) {
+			++_counters.unexpectedStops;
+			_output.push_back(static_cast<char>(r1() | 0x04));
+			return;
+		}
+		_readBlocksLeft = 0;
+		_isMultiRead = false;
+		_output.append(_latency.stopResponseDelay, static_cast<char>(0xff));
+		_output.push_back(0x00);
+		_busyUntilCycle = now + _latency.stopBusyMicros * cyclesPerMicrosecond;
+		return;
+	}
+	_readBlocksLeft = 0;
+	_isMultiRead = false;
+	switch (index) {
+	case 0:
+		resetState();
+		_output.assign(1, static_cast<char>(0xff));
+		_output.push_back(0x01);
+		return;
+	case 8:
+		_output.push_back(static_cast<char>(r1()));
+		_output.push_back(0x00);
+		_output.push_back(0x00);
+		_output.push_back(0x01);
+		_output.push_back(static_cast<char>(argument & 0xff));
+		return;
+	case 55:
+		_isApplicationCommand = true;
+		_output.push_back(static_cast<char>(r1()));
+		return;
+	case 41:
+		if (!isApplicationCommand) {
+			_output.push_back(static_cast<char>(r1() | 0x04));
+			return;
+		}
+		if (++_initRounds >= initRoundCount) {
+			_isIdle = false;
+		}
+		_output.push_back(static_cast<char>(r1()));
+		return;
+	case 58:
+		_output.push_back(static_cast<char>(r1()));
+		_output.push_back(static_cast<char>(0xc0));
+		_output.push_back(static_cast<char>(0xff));
+		_output.push_back(static_cast<char>(0x80));
+		_output.push_back(0x00);
+		return;
+	case 16:
+		_output.push_back(static_cast<char>(r1() | (argument == 512 ? 0 : 0x40)));
+		return;
+	case 13:
+		_output.push_back(static_cast<char>(r1()));
+		_output.push_back(0x00);
+		return;
+	default:
+		break;
+	}
+	if (_isIdle) {
+		_output.push_back(static_cast<char>(r1() | 0x04));
+		return;
+	}
+	switch (index) {
+	case 6: {
+		uint8_t status[64];
+		memset(status, 0, sizeof(status));
+		status[13] = _highSpeedSupport ? 0x03 : 0x01;
+		status[16] = _highSpeedSupport ? 0x01 : 0x0f;
+		_output.push_back(0x00);
+		queueData(status, sizeof(status));
+		break;
+	}
+	case 9:
+		_output.push_back(0x00);
+		queueData(_csd, sizeof(_csd));
+		break;
+	case 10:
+		_output.push_back(0x00);
+		queueData(_cid, sizeof(_cid));
+		break;
+	case 17:
+	case 18:
+		_output.push_back(0x00);
+		_readBlock = argument;
+		_isMultiRead = (index == 18);
+		_readBlocksLeft = 1;
+		_nextBlockCycle = now + _latency.readMicros * cyclesPerMicrosecond;
+		break;
+	case 23:
+		_output.push_back(static_cast<char>(isApplicationCommand ? 0x00 : 0x04));
+		break;
+	case 24:
+	case 25:
+		_output.push_back(0x00);
+		_writeState = WriteWaitToken;
+		_isMultiWrite = (index == 25);
+		_writeBlock = argument;
+		break;
+	default:
+		_output.push_back(0x04);
+		break;
+	}
+}
+
+
+void SDCardEmulator::queueData(const uint8_t *data, uint16_t size)
+{
+	_output.push_back(static_cast<char>(0xff));
+	_output.push_back(static_cast<char>(0xfe));
+	_output.append(reinterpret_cast<const char*>(data), size);
+	const uint16_t crc = crc16(data, size);
+	_output.push_back(static_cast<char>(crc >> 8));
+	_output.push_back(static_cast<char>(crc));
+}
+
+
+void SDCardEmulator::queueBlock(uint32_t block)
+{
+	uint8_t data[512];
+	if (static_cast<size_t>(block + 1) * 512 <= _imageSize) {
+		memcpy(data, _image + static_cast<size_t>(block) * 512, 512);
+	} else {
+		memset(data, 0, 512);
+	}
+	uint16_t crc = crc16(data, 512);
+	if (_corruptBlock == static_cast<int64_t>(block)) {
+		crc ^= 0x0101;
+		_corruptBlock = -1;
+	}
+	_output.push_back(static_cast<char>(0xfe));
+	_output.append(reinterpret_cast<const char*>(data), 512);
+	_output.push_back(static_cast<char>(crc >> 8));
+	_output.push_back(static_cast<char>(crc));
+	_dataBlockEnd = _output.size();
+	++_counters.blocksStarted;
+}
+
+
+void SDCardEmulator::finishWrittenBlock(uint64_t now)
+{
+	if (static_cast<size_t>(_writeBlock + 1) * 512 <= _imageSize) {
+		memcpy(_image + static_cast<size_t>(_writeBlock) * 512, _writeBuffer, 512);
+	}
+	++_writeBlock;
+	++_counters.blocksWritten;
+	if (_powerCutBlockCount > 0) {
+		--_powerCutBlockCount;
+	}
+	uint32_t busyMicros = _latency.writeBusyMicros;
+	if (_latency.writeSpikeInterval > 0 && (_counters.blocksWritten % _latency.writeSpikeInterval) == 0) {
+		busyMicros = _latency.writeSpikeMicros;
+	}
+	_output.assign(1, static_cast<char>(0xe5)); // The data was accepted.
+	_outputPosition = 0;
+	_busyUntilCycle = now + busyMicros * cyclesPerMicrosecond;
+	_writeState = _isMultiWrite ? WriteWaitToken : WriteNone;
+	blockTransferred(now);
+}
+
+
+void SDCardEmulator::blockTransferred(uint64_t now)
+{
+	if (_failBlockCount > 0 && --_failBlockCount == 0) {
+		_failBlockCount = -1;
+		stopResponding(now, _failDurationMicros);
+	}
+}
+
+
+void SDCardEmulator::stopResponding(uint64_t now, uint32_t durationMicros)
+{
+	_isResponding = false;
+	_respondAgainCycle = (durationMicros > 0) ? (now + durationMicros * cyclesPerMicrosecond) : 0;
+}
+
+
+void SDCardEmulator::resetState()
+{
+	_isIdle = true;
+	_isApplicationCommand = false;
+	_initRounds = 0;
+	_commandLength = 0;
+	_output.clear();
+	_outputPosition = 0;
+	_dataBlockEnd = noDataBlock;
+	_readBlock = 0;
+	_readBlocksLeft = 0;
+	_isMultiRead = false;
+	_nextBlockCycle = 0;
+	_busyUntilCycle = 0;
+	_writeState = WriteNone;
+	_isMultiWrite = false;
+	_writeBlock = 0;
+	_writeCount = 0;
+}
+
+
+uint8_t SDCardEmulator::r1() const
+{
+	return _isIdle ? 0x01 : 0x00;
+}
+
+
+}
+
+
@@ -0,0 +1,220 @@
+#pragma once
+//
+// SDCardEmulator
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// An emulated SDHC card in SPI mode, on the SPI bus of the emulated MCU.
+// The card reads and writes a disk image, like the ones created by the
+// CreateDiskImage.pl and CreateFatImage.pl scripts. The image is kept in
+// shared memory, so written blocks survive a reboot with runBoot().
+//
+// All delays of the card run on the virtual clock of the MCU. A read
+// returns 0xff bytes until the data token is ready, and a busy card returns
+// 0x00 bytes, so the number of polls depends on the SPI clock like with a
+// real card.
+//
+
+
+#include "Mcu.h"
+
+#include <string>
+
+
+namespace host {
+
+
+/// The emulated SD card.
+///
+class SDCardEmulator : public SpiDevice
+{
+public:
+	/// The delays of a card.
+	///
+	struct Latency {
+		uint32_t readMicros; ///< The delay from a read command to the first data token.
+		uint32_t blockGapMicros; ///< The delay between the blocks of a multi block read.
+		uint32_t stopBusyMicros; ///< The busy time after a stop transmission command.
+		uint32_t stopResponseDelay; ///< The number of additional 0xff bytes before the response to a stop command.
+		uint32_t writeBusyMicros; ///< The busy time after each written block.
+		uint32_t writeSpikeInterval; ///< Every n-th written block takes writeSpikeMicros, 0 = never.
+		uint32_t writeSpikeMicros; ///< The busy time of a write spike.
+	};
+
+	/// A fast card: short delays and no write spikes.
+	///
+	static const Latency fastCard;
+
+	/// A slow card: long delays, and a long busy time every 32 written blocks,
+	/// like a card which erases a new allocation unit.
+	///
+	static const Latency slowCard;
+
+	/// The counters of the card.
+	///
+	struct Counters {
+		uint32_t commands[64]; ///< The number of each received command.
+		uint32_t blocksStarted; ///< The number of data blocks with a sent start token.
+		uint32_t blocksRead; ///< The number of completely sent data blocks, including the CRC.
+		uint32_t blocksWritten; ///< The number of written blocks.
+		uint32_t bitErrors; ///< The number of bytes with a flipped bit.
+		uint32_t unexpectedStops; ///< The number of stop commands without an active read.
+		uint32_t busyCommands; ///< The number of commands received while the card was busy.
+	};
+
+public:
+	/// Create a card without image.
+	///
+	SDCardEmulator();
+
+public:
+	/// Load a disk image into shared memory.
+	///
+	/// @param path The path of the image file.
+	/// @param size The size of the card in bytes, or 0 for the size of the image file.
+	/// @return true on success.
+	///
+	bool loadImage(const std::string &path, size_t size = 0);
+
+	/// Get the image data.
+	///
+	uint8_t* image() const { return _image; }
+
+	/// Get the size of the image in bytes.
+	///
+	size_t imageSize() const { return _imageSize; }
+
+	/// Set the pin of the chip select, PORTB bit 2 by default.
+	///
+	void setChipSelect(Register8 &port, uint8_t bit);
+
+	/// Set the delays of the card.
+	///
+	void setLatency(const Latency &latency);
+
+	/// Set the product serial number in the CID register.
+	///
+	void setSerialNumber(uint32_t serialNumber);
+
+	/// Set the highest SPI clock which the card reads without errors.
+	///
+	/// Above this clock, some of the sent bytes have a flipped bit. 0 = no limit.
+	///
+	void setMaximumClock(uint32_t clock);
+
+	/// Set if the card supports the high speed mode.
+	///
+	void setHighSpeedSupport(bool supported);
+
+	/// Send a wrong CRC the next time the given block is read.
+	///
+	void corruptBlockCrc(uint32_t block);
+
+	/// Stop responding after the given number of transferred blocks.
+	///
+	/// After the given time, the card responds again in the idle state, like
+	/// after a short power loss. With a duration of 0, the card responds
+	/// after the next powerCycle().
+	///
+	void failAfterBlocks(uint32_t blockCount, uint32_t durationMicros);
+
+	/// Cut the power while a block is written.
+	///
+	/// Only the given number of bytes of the block reach the image, the card
+	/// stops responding until the next powerCycle().
+	///
+	/// @param blockCount The number of blocks written before the affected block.
+	/// @param byteCount The number of bytes of the affected block which are written.
+	///
+	void cutPowerWhileWriting(uint32_t blockCount, uint16_t byteCount);
+
+	/// Power the card off and on, it responds in the idle state.
+	///
+	void powerCycle();
+
+	/// Get the counters.
+	///
+	Counters& counters() { return _counters; }
+
+	/// Reset the counters.
+	///
+	void resetCounters();
+
+	/// Get the number of received commands with the given index.
+	///
+	uint32_t commandCount(uint8_t index) const { return _counters.commands[index & 0x3f]; }
+
+public: // SpiDevice
+	bool isSelected() override;
+	uint8_t transfer(uint8_t data, uint32_t clock) override;
+
+private:
+	enum WriteState : uint8_t {
+		WriteNone, ///< No write active.
+		WriteWaitToken, ///< Waiting for the data token.
+		WriteData, ///< Receiving the data of a block.
+	};
+
+private:
+	uint8_t nextOutput(uint64_t now);
+	void receive(uint8_t data, uint64_t now);
+	void executeCommand(uint64_t now);
+	void queueData(const uint8_t *data, uint16_t size);
+	void queueBlock(uint32_t block);
+	void finishWrittenBlock(uint64_t now);
+	void blockTransferred(uint64_t now);
+	void stopResponding(uint64_t now, uint32_t durationMicros);
+	void resetState();
+	uint8_t r1() const;
+
+private:
+	uint8_t *_image;
+	size_t _imageSize;
+	Register8 *_chipSelectPort;
+	uint8_t _chipSelectMask;
+	Latency _latency;
+	uint8_t _cid[16];
+	uint8_t _csd[16];
+	uint32_t _maximumClock;
+	bool _highSpeedSupport;
+	uint32_t _random;
+	int64_t _corruptBlock;
+	int64_t _failBlockCount;
+	uint32_t _failDurationMicros;
+	int64_t _powerCutBlockCount;
+	uint16_t _powerCutByteCount;
+	Counters _counters;
+
+	// The state of the card.
+	bool _isResponding;
+	uint64_t _respondAgainCycle;
+	bool _isIdle;
+	bool _isApplicationCommand;
+	uint8_t _initRounds;
+	uint8_t _command[6];
+	uint8_t _commandLength;
+	std::string _output;
+	size_t _outputPosition;
+	size_t _dataBlockEnd;
+	uint32_t _readBlock;
+	uint32_t _readBlocksLeft;
+	bool _isMultiRead;
+	uint64_t _nextBlockCycle;
+	uint64_t _busyUntilCycle;
+	WriteState _writeState;
+	bool _isMultiWrite;
+	uint32_t _writeBlock;
+	uint16_t _writeCount;
+	uint8_t _writeBuffer[514];
+};
+
+
+/// The global instance of the card, connected to the SPI bus.
+///
+extern SDCardEmulator sdCardEmulator;
+
+
+}
+
+
@@ -0,0 +1,95 @@
+//
+// SensorReplay
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "SensorReplay.h"
+
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+
+namespace host {
+
+
+/// The interval of the samples of SensorTrace in ms.
+///
+static const uint32_t traceSampleInterval = 50;
+
+
+size_t SensorReplay::parse(const std::string &text)
+{
+	std::istringstream input(text);
+	std::string line;
+	size_t lineCount = 0;
+	bool hasStart = false;
+	uint32_t startTime = 0;
+	while (std::getline(input, line)) {
+		std::istringstream fields(line);
+		unsigned long time, value, count;
+		std::string rest;
+		if (!(fields >> time >> value >> count) || (fields >> rest) || value > 1023 || count == 0) {
+			continue;
+		}
+		if (!hasStart) {
+			startTime = time;
+			hasStart = true;
+		}
+		add(static_cast<uint32_t>(time - startTime), static_cast<uint16_t>(value));
+		_endTime = std::max<uint32_t>(_endTime, time - startTime + count * traceSampleInterval);
+		++lineCount;
+	}
+	return lineCount;
+}
+
+
+size_t SensorReplay::load(const std::string &path)
+{
+	std::ifstream file(path);
+	if (!file) {
+		return 0;
+	}
+	std::stringstream text;
+	text << file.rdbuf();
+	return parse(text.str());
+}
+
+
+void SensorReplay::add(uint32_t time, uint16_t value)
+{
+	// A chunk may start before the end of the previous one, the newer values replace the older.
+	while (!_samples.empty() && _samples.back().time >= time) {
+		_samples.pop_back();
+	}
+	_samples.push_back(Sample{time, value});
+	_endTime = std::max(_endTime, time);
+}
+
+
+uint16_t SensorReplay::valueAt(uint32_t time) const
+{
+	if (_samples.empty()) {
+		return 0;
+	}
+	auto next = std::upper_bound(_samples.begin(), _samples.end(), time,
+		[](uint32_t t, const Sample &sample) { return t < sample.time; });
+	return (next == _samples.begin()) ? next->value : (next - 1)->value;
+}
+
+
+void SensorReplay::connect(uint8_t channel, uint64_t startCycle) const
+{
+	auto trace = std::make_shared<SensorReplay>(*this);
+	setAnalogInput(channel, [trace, startCycle](uint64_t cycle) -> uint16_t {
+		const uint64_t time = (cycle > startCycle) ? (cycle - startCycle) / (cyclesPerMicrosecond * 1000) : 0;
+		return trace->valueAt(static_cast<uint32_t>(std::min<uint64_t>(time, 0xffffffffULL)));
+	});
+}
+
+
+}
+
+
@@ -0,0 +1,100 @@
+#pragma once
+//
+// SensorReplay
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Replays a recorded trace of a motion sensor as the voltage on an analog
+// input of the emulated MCU. The trace is read in the format which
+// SensorTrace::print() writes, so the dump of a unit from the serial
+// monitor can be replayed through the sketch on the virtual clock.
+//
+
+
+#include "Mcu.h"
+
+#include <string>
+#include <vector>
+
+
+namespace host {
+
+
+/// A trace of a sensor for the replay.
+///
+class SensorReplay
+{
+public:
+	/// One value of the trace.
+	///
+	struct Sample {
+		uint32_t time; ///< The time of the value in ms, from the start of the trace.
+		uint16_t value; ///< The 10 bit value.
+	};
+
+public:
+	/// Create an empty trace.
+	///
+	SensorReplay() : _endTime(0) {}
+
+public:
+	/// Read the lines of a trace.
+	///
+	/// Each line contains the time in ms, the value and the number of samples
+	/// with this value, like the lines of SensorTrace::print(). All other
+	/// lines are ignored, so a whole serial log can be read. The times are
+	/// moved to start at 0.
+	///
+	/// @return The number of read lines.
+	///
+	size_t parse(const std::string &text);
+
+	/// Read the lines of a trace from a file.
+	///
+	/// @return The number of read lines, or 0 if the file can not be read.
+	///
+	size_t load(const std::string &path);
+
+	/// Add a value at the end of the trace.
+	///
+	/// @param time The time in ms, from the start of the trace.
+	/// @param value The 10 bit value.
+	///
+	void add(uint32_t time, uint16_t value);
+
+	/// Remove all values.
+	///
+	void clear() { _samples.clear(); _endTime = 0; }
+
+	/// Get the values of the trace.
+	///
+	const std::vector<Sample>& samples() const { return _samples; }
+
+	/// Get the time after the last value in ms.
+	///
+	uint32_t endTime() const { return _endTime; }
+
+	/// Get the value of the trace at a time.
+	///
+	/// @param time The time in ms, from the start of the trace.
+	/// @return The last value before the time, the first value for the times before it.
+	///
+	uint16_t valueAt(uint32_t time) const;
+
+	/// Connect a copy of the trace to an analog input.
+	///
+	/// @param channel The analog input.
+	/// @param startCycle The cycle of the start of the trace.
+	///
+	void connect(uint8_t channel, uint64_t startCycle) const;
+
+private:
+	std::vector<Sample> _samples;
+	uint32_t _endTime;
+};
+
+
+}
+
+
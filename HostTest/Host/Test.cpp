@@ -0,0 +1,120 @@
+//
+// Test
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+#include "Test.h"
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+namespace host {
+
+
+namespace {
+
+/// The counters of the checks, shared with the boots in runBoot().
+///
+struct Counters {
+	int checkCount;
+	int failedCheckCount;
+};
+
+Counters *allocateCounters()
+{
+	Counters *counters = static_cast<Counters*>(allocateShared(sizeof(Counters)));
+	counters->checkCount = 0;
+	counters->failedCheckCount = 0;
+	return counters;
+}
+
+Counters &counters = *allocateCounters();
+
+}
+
+
+void section(const char *name)
+{
+	printf("-- %s\n", name);
+}
+
+
+bool check(bool condition, const char *text, const char *file, int line)
+{
+	++counters.checkCount;
+	if (!condition) {
+		++counters.failedCheckCount;
+		printf("FAILED %s:%d: %s\n", file, line, text);
+	}
+	return condition;
+}
+
+
+bool checkEqual(long long actual, long long expected, const char *actualText,
+	const char *expectedText, const char *file, int line)
+{
+	++counters.checkCount;
+	if (actual != expected) {
+		++counters.failedCheckCount;
+		printf("FAILED %s:%d: %s == %s (%lld != %lld)\n", file, line, actualText, expectedText,
+			actual, expected);
+		return false;
+	}
+	return true;
+}
+
+
+int failureCount()
+{
+	return counters.failedCheckCount;
+}
+
+
+int testResult()
+{
+	printf("%d checks, %d failed.\n", counters.checkCount, counters.failedCheckCount);
+	return (counters.failedCheckCount > 0) ? 1 : 0;
+}
+
+
+std::string dataPath(const std::string &fileName)
+{
+	const char *directory = getenv("HOST_DATA");
+	return std::string((directory != nullptr) ? directory : "_build/Data") + "/" + fileName;
+}
+
+
+bool runBoot(const std::function<void()> &boot)
+{
+	fflush(stdout);
+	fflush(stderr);
+	const int failedBefore = counters.failedCheckCount;
+	const pid_t pid = fork();
+	if (pid < 0) {
+		fatal("Could not fork the process for a boot.");
+	}
+	if (pid == 0) {
+		reset();
+		initArduino();
+		boot();
+		fflush(stdout);
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		++counters.checkCount;
+		++counters.failedCheckCount;
+		printf("FAILED boot with status %d.\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	}
+	return counters.failedCheckCount == failedBefore;
+}
+
+
+}
+
+
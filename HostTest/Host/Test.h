@@ -0,0 +1,79 @@
+#pragma once
+//
+// Test
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The checks for the host tests. Each test is a program, which returns
+// a non zero exit code if any check failed.
+//
+
+
+#include "Mcu.h"
+
+#include <functional>
+#include <string>
+
+
+/// Check a condition, and report it if it is false.
+///
+#define CHECK(condition) host::check((condition), #condition, __FILE__, __LINE__)
+
+/// Check if two integer values are equal, and report both values if not.
+///
+#define CHECK_EQUAL(actual, expected) host::checkEqual(static_cast<long long>(actual), \
+	static_cast<long long>(expected), #actual, #expected, __FILE__, __LINE__)
+
+
+namespace host {
+
+
+/// Start a new section of checks, which is printed as heading.
+///
+void section(const char *name);
+
+/// Check a condition.
+///
+/// @return The condition.
+///
+bool check(bool condition, const char *text, const char *file, int line);
+
+/// Check if two values are equal.
+///
+/// @return True if the values are equal.
+///
+bool checkEqual(long long actual, long long expected, const char *actualText,
+	const char *expectedText, const char *file, int line);
+
+/// Get the number of failed checks.
+///
+int failureCount();
+
+/// Print the result, and get the exit code for the test program.
+///
+int testResult();
+
+/// Get the path of a file in the directory with the generated test data.
+///
+/// The directory is set with the environment variable HOST_DATA, or
+/// "_build/Data" if it is not set.
+///
+std::string dataPath(const std::string &fileName);
+
+/// Run one boot of the MCU in a forked process.
+///
+/// The process starts with the static objects as they were before the first
+/// boot, so the code under test starts like after a reset. Only the memory
+/// from allocateShared(), like the EEPROM and the card images, is kept
+/// between the boots. The MCU is reset and initialized with initArduino().
+/// The checks of the boot are counted for this process.
+///
+/// @return True if the boot ended without failed checks.
+///
+bool runBoot(const std::function<void()> &boot);
+
+
+}
+
+
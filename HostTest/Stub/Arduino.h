@@ -0,0 +1,152 @@
+#pragma once
+//
+// Host Stub for the Arduino Core
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The subset of the Arduino core used by the CatProtect sketch, running
+// on the emulated MCU in Mcu.cpp. The time functions work like the
+// originals with the timer 0 overflow interrupt.
+//
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+
+#define F_CPU 16000000UL
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+
+template<class A, class B>
+inline auto min(A a, B b) -> typename std::decay<decltype(a < b ? a : b)>::type { return a < b ? a : b; }
+template<class A, class B>
+inline auto max(A a, B b) -> typename std::decay<decltype(a < b ? a : b)>::type { return a > b ? a : b; }
+
+
+class __FlashStringHelper;
+#define F(string) (reinterpret_cast<const __FlashStringHelper*>(string))
+
+
+/// A minimal dynamic string.
+///
+class String
+{
+public:
+	String(const char *text = "") : _text(text) {}
+	String(const __FlashStringHelper *text) : _text(reinterpret_cast<const char*>(text)) {}
+	String(int value, unsigned char base = 10) : _text(format(value, base)) {}
+	String(unsigned int value, unsigned char base = 10) : _text(format(value, base)) {}
+	String(long value, unsigned char base = 10) : _text(format(value, base)) {}
+	String(unsigned long value, unsigned char base = 10) : _text(format(value, base)) {}
+	String(unsigned char value, unsigned char base = 10) : _text(format(value, base)) {}
+	String operator+(const String &other) const { String result(*this); result._text += other._text; return result; }
+	const char* c_str() const { return _text.c_str(); }
+	unsigned int length() const { return static_cast<unsigned int>(_text.length()); }
+
+private:
+	static std::string format(long long value, unsigned char base);
+	std::string _text;
+};
+
+
+/// The base class for all text output.
+///
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t value) = 0;
+	size_t write(const char *text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+	virtual size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const __FlashStringHelper *text) { return write(reinterpret_cast<const char*>(text)); }
+	size_t print(const String &text) { return write(text.c_str()); }
+	size_t print(const char *text) { return write(text); }
+	size_t print(char value) { return write(static_cast<uint8_t>(value)); }
+	size_t print(unsigned char value, int base = DEC) { return printNumber(value, base); }
+	size_t print(int value, int base = DEC) { return printSigned(value, base); }
+	size_t print(unsigned int value, int base = DEC) { return printNumber(value, base); }
+	size_t print(long value, int base = DEC) { return printSigned(value, base); }
+	size_t print(unsigned long value, int base = DEC) { return printNumber(value, base); }
+	size_t print(double value, int digits = 2);
+
+	size_t println() { return write("\r\n"); }
+	template<typename T> size_t println(T value) { const size_t n = print(value); return n + println(); }
+	template<typename T> size_t println(T value, int format) { const size_t n = print(value, format); return n + println(); }
+
+private:
+	size_t printSigned(long value, int base);
+	size_t printNumber(unsigned long value, int base);
+};
+
+
+/// A stream with input.
+///
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+
+/// The serial port, connected to the console of the emulated MCU.
+///
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baudRate);
+	void end() {}
+	int available() override;
+	int read() override;
+	int peek() override;
+	void flush();
+	size_t write(uint8_t value) override;
+	using Print::write;
+	operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+
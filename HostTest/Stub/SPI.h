@@ -0,0 +1,81 @@
+#pragma once
+//
+// Host Stub for the Arduino SPI Library
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The bytes are routed to the emulated devices whose chip select is low.
+// Each transfer is charged with 8 SPI clocks plus the loop overhead.
+//
+
+
+#include <Arduino.h>
+
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+#define SPI_MODE_MASK 0x0C
+#define SPI_CLOCK_MASK 0x03
+#define SPI_2XCLOCK_MASK 0x01
+
+
+/// The settings for a transaction, with the same layout as the original.
+///
+class SPISettings
+{
+public:
+	SPISettings() { init(4000000, MSBFIRST, SPI_MODE0); }
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) { init(clock, bitOrder, dataMode); }
+
+private:
+	void init(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+		uint8_t clockDiv;
+		if (clock >= F_CPU / 2) {
+			clockDiv = 0;
+		} else if (clock >= F_CPU / 4) {
+			clockDiv = 1;
+		} else if (clock >= F_CPU / 8) {
+			clockDiv = 2;
+		} else if (clock >= F_CPU / 16) {
+			clockDiv = 3;
+		} else if (clock >= F_CPU / 32) {
+			clockDiv = 4;
+		} else if (clock >= F_CPU / 64) {
+			clockDiv = 5;
+		} else {
+			clockDiv = 6;
+		}
+		if (clockDiv == 6) {
+			clockDiv = 7;
+		}
+		clockDiv ^= 0x1;
+		spcr = _BV(SPE) | _BV(MSTR) | ((bitOrder == LSBFIRST) ? _BV(DORD) : 0) |
+			(dataMode & SPI_MODE_MASK) | ((clockDiv >> 1) & SPI_CLOCK_MASK);
+		spsr = clockDiv & SPI_2XCLOCK_MASK;
+	}
+
+	uint8_t spcr;
+	uint8_t spsr;
+	friend class SPIClass;
+};
+
+
+/// The SPI interface.
+///
+class SPIClass
+{
+public:
+	static void begin();
+	static void end();
+	static void beginTransaction(SPISettings settings);
+	static void endTransaction();
+	static uint8_t transfer(uint8_t data);
+	static void usingInterrupt(uint8_t interruptNumber) { (void)interruptNumber; }
+};
+
+extern SPIClass SPI;
+
+
@@ -0,0 +1,18 @@
+#pragma once
+//
+// Host Stub for <avr/eeprom.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+void eeprom_read_block(void *destination, const void *source, size_t size);
+void eeprom_update_block(const void *source, void *destination, size_t size);
+uint8_t eeprom_read_byte(const uint8_t *address);
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+
+
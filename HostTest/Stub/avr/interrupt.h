@@ -0,0 +1,24 @@
+#pragma once
+//
+// Host Stub for <avr/interrupt.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <avr/io.h>
+
+
+/// The interrupt vectors are plain functions, which the emulated MCU calls.
+///
+#define ISR(vector) extern "C" void vector(void); extern "C" void vector(void)
+
+/// Disable the interrupts (1 cycle).
+///
+inline void cli() { SREG &= ~0x80; }
+
+/// Enable the interrupts (1 cycle).
+///
+inline void sei() { SREG |= 0x80; }
+
+
@@ -0,0 +1,284 @@
+#pragma once
+//
+// Host Stub for <avr/io.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// The registers of the ATmega328 are objects, which forward each access
+// to the emulated MCU in Mcu.cpp. Each access is charged with the cycles
+// of the instruction avr-gcc uses for it, and may deliver interrupts.
+//
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define _BV(bit) (1 << (bit))
+
+
+namespace host {
+
+
+/// The address space of a register, which defines the instructions used to access it.
+///
+enum RegisterSpace : uint8_t {
+	SpaceBit = 0, ///< I/O 0x00-0x1f: in/out (1 cycle), sbi/cbi (2 cycles).
+	SpaceIo = 1, ///< I/O 0x20-0x3f: in/out (1 cycle).
+	SpaceMemory = 2, ///< Extended I/O: lds/sts (2 cycles).
+};
+
+
+/// The identifiers of the emulated registers.
+///
+enum RegisterId : uint8_t {
+	RegPINB, RegDDRB, RegPORTB, RegPINC, RegDDRC, RegPORTC, RegPIND, RegDDRD, RegPORTD,
+	RegTIFR0, RegTIFR1, RegTIFR2, RegEIFR, RegGPIOR0,
+	RegTCCR0A, RegTCCR0B, RegTCNT0, RegOCR0A, RegOCR0B, RegSPCR, RegSPSR, RegSPDR,
+	RegSMCR, RegMCUCR, RegSREG,
+	RegPRR, RegTIMSK0, RegTIMSK1, RegTIMSK2, RegADCL, RegADCH, RegADCSRA, RegADCSRB,
+	RegADMUX, RegDIDR0, RegTCCR1A, RegTCCR1B, RegTCCR2A, RegTCCR2B, RegTCNT2, RegOCR2A, RegOCR2B,
+	RegTCNT1, RegICR1, RegOCR1A, RegOCR1B, RegADC,
+	RegCount
+};
+
+
+class Register8;
+class Register16;
+
+void onRead(Register8 &reg);
+void onWrite(Register8 &reg, uint8_t value, uint8_t mask);
+void onRead(Register16 &reg);
+void onWrite(Register16 &reg, uint16_t value);
+void charge(uint32_t cycleCount);
+
+
+/// An emulated 8 bit register.
+///
+/// All reads go through the single conversion operator, which updates
+/// the value and charges the read. A pointer to the register accesses
+/// the plain value without emulation, like the chip select in SPIBus.
+///
+class Register8
+{
+public:
+	Register8(RegisterId id, RegisterSpace space) : id(id), space(space), value(0) {}
+	Register8(const Register8&) = delete;
+
+	operator volatile uint8_t&() {
+		onRead(*this);
+		charge(space == SpaceMemory ? 2 : 1);
+		return value;
+	}
+	volatile uint8_t* operator&() {
+		return &value;
+	}
+	Register8& operator=(int newValue) {
+		charge(space == SpaceMemory ? 2 : 1);
+		onWrite(*this, static_cast<uint8_t>(newValue), 0xff);
+		return *this;
+	}
+	Register8& operator|=(int bits) {
+		if (space == SpaceBit && isSingleBit(bits)) {
+			charge(2); // sbi
+			onWrite(*this, static_cast<uint8_t>(bits), static_cast<uint8_t>(bits));
+		} else {
+			readModifyWrite(static_cast<uint8_t>(readValue() | bits));
+		}
+		return *this;
+	}
+	Register8& operator&=(int bits) {
+		if (space == SpaceBit && isSingleBit(~bits & 0xff)) {
+			charge(2); // cbi
+			onWrite(*this, 0, static_cast<uint8_t>(~bits));
+		} else {
+			readModifyWrite(static_cast<uint8_t>(readValue() & bits));
+		}
+		return *this;
+	}
+	Register8& operator^=(int bits) {
+		readModifyWrite(static_cast<uint8_t>(readValue() ^ bits));
+		return *this;
+	}
+
+public:
+	const RegisterId id; ///< The identifier of the register.
+	const RegisterSpace space; ///< The address space of the register.
+	volatile uint8_t value; ///< The current value.
+
+private:
+	static bool isSingleBit(int bits) {
+		return bits != 0 && (bits & (bits - 1)) == 0 && bits < 0x100;
+	}
+	uint8_t readValue() {
+		onRead(*this);
+		return value;
+	}
+	void readModifyWrite(uint8_t newValue) {
+		charge(space == SpaceMemory ? 5 : 3);
+		onWrite(*this, newValue, 0xff);
+	}
+};
+
+
+/// An emulated 16 bit register in the extended I/O space.
+///
+class Register16
+{
+public:
+	Register16(RegisterId id) : id(id), value(0) {}
+	Register16(const Register16&) = delete;
+
+	operator volatile uint16_t&() {
+		onRead(*this);
+		charge(4);
+		return value;
+	}
+	Register16& operator=(int newValue) {
+		charge(4);
+		onWrite(*this, static_cast<uint16_t>(newValue));
+		return *this;
+	}
+
+public:
+	const RegisterId id; ///< The identifier of the register.
+	volatile uint16_t value; ///< The current value.
+};
+
+
+}
+
+
+#define HOST_REGISTER8(name, space) extern host::Register8 name;
+#define HOST_REGISTER16(name) extern host::Register16 name;
+#include "../../Host/Registers.h"
+#undef HOST_REGISTER8
+#undef HOST_REGISTER16
+
+#define ADCW ADC
+
+
+// Port pins
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTD6 6
+#define PORTD7 7
+#define DDD6 6
+#define DDD7 7
+
+// Timer 0
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+
+// Timer 1
+#define WGM10 0
+#define WGM11 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+
+// Timer 2
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+// ADC
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+
+// SPI
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define SPIF 7
+
+// Sleep and power
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+
+#define E2END 0x3FF
+#define RAMEND 0x8FF
+
+
@@ -0,0 +1,34 @@
+#pragma once
+//
+// Host Stub for <avr/pgmspace.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <stdint.h>
+#include <string.h>
+
+
+namespace host {
+void charge(uint32_t cycleCount);
+
+/// Read a value from flash, charged with the cycles of lpm.
+///
+template<typename T>
+inline T readProgramMemory(const T *address) {
+	charge(3 * sizeof(T));
+	return *address;
+}
+}
+
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) host::readProgramMemory(reinterpret_cast<const uint8_t*>(address))
+#define pgm_read_word(address) host::readProgramMemory(address)
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+
+
@@ -0,0 +1,17 @@
+#pragma once
+//
+// Host Stub for <avr/power.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <avr/io.h>
+
+
+#define power_adc_disable() (PRR |= _BV(PRADC))
+#define power_adc_enable() (PRR &= ~_BV(PRADC))
+#define power_twi_disable() (PRR |= _BV(PRTWI))
+#define power_twi_enable() (PRR &= ~_BV(PRTWI))
+
+
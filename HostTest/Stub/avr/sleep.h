@@ -0,0 +1,25 @@
+#pragma once
+//
+// Host Stub for <avr/sleep.h>
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <avr/io.h>
+
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN _BV(SM1)
+#define SLEEP_MODE_PWR_SAVE (_BV(SM0)|_BV(SM1))
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~(_BV(SM0)|_BV(SM1)|_BV(SM2))) | (mode))
+#define sleep_enable() (SMCR |= _BV(SE))
+#define sleep_disable() (SMCR &= ~_BV(SE))
+
+/// Sleep until the next interrupt. The emulated MCU skips the time.
+///
+void sleep_cpu();
+
+
@@ -0,0 +1,199 @@
+//
+// AudioPlayerTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Plays the generated sound files with the audio player, and checks the
+// samples at the emulated DAC. The test is built with the DAC on its own
+// pins, and with DACPORT_USE_SPI as AudioPlayerSpiTest.
+//
+#include "DacEmulator.h"
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "AudioPlayer.h"
+#include "SDCard.h"
+
+#include <string>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// Get a little endian 32 bit value from the image.
+///
+uint32_t imageUInt32(size_t offset)
+{
+	const uint8_t *data = sdCardEmulator.image() + offset;
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+
+}
+
+
+int main()
+{
+	section("Play a sound file");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		dacEmulator.clear();
+		CHECK(audioPlayer.play("v0.snd"));
+		const std::vector<DacEmulator::Sample> &samples = dacEmulator.samples();
+		uint32_t rampCount = 0;
+		for (size_t i = 0; i + 1 < samples.size(); ++i) {
+			if (samples[i].enabled && samples[i + 1].value == samples[i].value + 1) {
+				++rampCount;
+			}
+		}
+		CHECK(rampCount >= 2490);
+		CHECK_EQUAL(dacEmulator.errorCount(), 0);
+	});
+
+	section("The DAC shares the session of the SD-Card");
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		const uint32_t transactionCount = statistics().spiTransactionCount;
+		dacEmulator.clear();
+		CHECK(audioPlayer.play("v5.snd"));
+		CHECK(dacEmulator.commandCount() > 20000);
+		// The directory read, the start of the read and the shutdown of the DAC.
+		CHECK(statistics().spiTransactionCount - transactionCount < 10);
+		CHECK_EQUAL(statistics().spiContentionCount, 0);
+		CHECK_EQUAL(dacEmulator.errorCount(), 0);
+		CHECK_EQUAL(sdCardEmulator.counters().bitErrors, 0);
+	});
+
+	section("Reject sample rates the timer can not produce");
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v0.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		dacEmulator.clear();
+		CHECK(!audioPlayer.play(entry->startBlock, 100, AudioPlayer::minimumSampleRate - 1));
+		CHECK(!audioPlayer.play(entry->startBlock, 100, 100));
+		CHECK(!audioPlayer.play(entry->startBlock, 100, AudioPlayer::maximumSampleRate + 1));
+		CHECK(!audioPlayer.play(entry->startBlock, 100, 0));
+		CHECK_EQUAL(dacEmulator.commandCount(), 0);
+		CHECK(audioPlayer.play(entry->startBlock, 100, AudioPlayer::minimumSampleRate));
+		CHECK(dacEmulator.commandCount() >= 100);
+	});
+
+	section("Sample rate and gain of the version 2 directory");
+	sdCardEmulator.loadImage(dataPath("hcdi2gain.img"));
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		dacEmulator.clear();
+		CHECK(audioPlayer.play("v0.snd"));
+		// The ramp starts after the fade in, scaled to half around the center of the output.
+		const std::vector<DacEmulator::Sample> &samples = dacEmulator.samples();
+		size_t first = 0;
+		while (first < samples.size() && samples[first].value != 0x7f0) {
+			++first;
+		}
+		while (first < samples.size() && samples[first].value != 0x400) {
+			++first;
+		}
+		if (!CHECK(first + 2400 < samples.size())) {
+			return;
+		}
+		uint32_t scaledCount = 0;
+		for (size_t i = 0; i < 2400; ++i) {
+			if (samples[first + i].value == 0x400 + i / 2) {
+				++scaledCount;
+			}
+		}
+		CHECK_EQUAL(scaledCount, 2400);
+		// The samples are played at 11025Hz, the timer counts up and down for each one.
+		const uint64_t cycles = samples[first + 2000].cycle - samples[first].cycle;
+		CHECK_EQUAL(cycles / 2000, 2 * (F_CPU / 2 / 11025));
+	});
+
+	section("Prepared reads");
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v0.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		const uint32_t startBlock = entry->startBlock;
+		const uint32_t sampleCount = entry->fileSize / 2;
+		// A prepared read continues in the play of the same file, and starts it faster.
+		CHECK(audioPlayer.play(startBlock, sampleCount, 22050));
+		CHECK(audioPlayer.prepare(startBlock));
+		CHECK(audioPlayer.play(startBlock, sampleCount, 22050));
+		CHECK_EQUAL(audioPlayer.usedPrepareCount(), 1);
+		CHECK(audioPlayer.startLatency(true) < audioPlayer.startLatency(false));
+		// A play by name reads the index of the directory, the prepared read is stopped first.
+		sdCardEmulator.resetCounters();
+		CHECK(audioPlayer.prepare(startBlock));
+		CHECK(audioPlayer.play("v1.snd"));
+		CHECK_EQUAL(audioPlayer.cancelledPrepareCount(), 1);
+		CHECK(audioPlayer.wastedPrepareTime() > 0);
+		// One stop for the prepared read, and one after the play.
+		CHECK_EQUAL(sdCardEmulator.commandCount(12), 2);
+		CHECK_EQUAL(sdCardEmulator.counters().unexpectedStops, 0);
+		// The card is initialized again without an open read.
+		CHECK(audioPlayer.prepare(startBlock));
+		CHECK(audioPlayer.initialize());
+		CHECK_EQUAL(audioPlayer.cancelledPrepareCount(), 2);
+		CHECK(!audioPlayer.isPrepared());
+		CHECK(audioPlayer.play("v0.snd"));
+	});
+
+	section("Corrupt version 2 directory");
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		// Only the header is read, each lookup reads one index block and one record block.
+		sdCardEmulator.resetCounters();
+		CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCardEmulator.counters().blocksRead, 1);
+		CHECK(sdCard.findFile("v0.snd") != 0);
+		CHECK_EQUAL(sdCardEmulator.counters().blocksRead, 3);
+	});
+	const uint32_t indexStartBlock = imageUInt32(12);
+	const uint32_t recordStartBlock = imageUInt32(16);
+	const std::string firstName(reinterpret_cast<const char*>(sdCardEmulator.image() + recordStartBlock * 512 + 16), 6);
+	const std::string secondName(reinterpret_cast<const char*>(sdCardEmulator.image() + recordStartBlock * 512 + 48), 6);
+	// Change the sample rate in the first record.
+	sdCardEmulator.image()[recordStartBlock * 512 + 8] ^= 0x01;
+	runBoot([firstName, secondName]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+		CHECK(sdCard.findFile(firstName.c_str()) == 0);
+		CHECK_EQUAL(sdCard.error(), SDCard::Error_DirectoryCorrupt);
+		CHECK(sdCard.findFile(secondName.c_str()) != 0);
+	});
+	sdCardEmulator.image()[recordStartBlock * 512 + 8] ^= 0x01;
+	// Change the hash of the last unused slot in the index.
+	sdCardEmulator.image()[indexStartBlock * 512 + 62 * 8] ^= 0x01;
+	runBoot([secondName]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+		CHECK(sdCard.findFile(secondName.c_str()) == 0);
+		CHECK_EQUAL(sdCard.error(), SDCard::Error_DirectoryCorrupt);
+	});
+	sdCardEmulator.image()[indexStartBlock * 512 + 62 * 8] ^= 0x01;
+	// Change the number of records in the header.
+	sdCardEmulator.image()[20] ^= 0x01;
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCard.eventLogRegion().blockCount, 0);
+		CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusError);
+		CHECK_EQUAL(sdCard.error(), SDCard::Error_DirectoryCorrupt);
+		CHECK(sdCard.findFile("v0.snd") == 0);
+	});
+	sdCardEmulator.image()[20] ^= 0x01;
+	return testResult();
+}
+
+
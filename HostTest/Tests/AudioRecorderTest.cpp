@@ -0,0 +1,122 @@
+//
+// AudioRecorderTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Records a ramp from an analog input into the capture region of the
+// emulated card, and checks the samples and the dropped samples.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "AudioRecorder.h"
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The analog channel of the recordings.
+///
+const uint8_t channel = 1;
+
+
+/// Get a little endian 32 bit value from the image.
+///
+uint32_t imageUInt32(size_t offset)
+{
+	const uint8_t *data = sdCardEmulator.image() + offset;
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+
+/// Let the input rise by one 8 bit step with each sample at the given rate.
+///
+void setRampInput(uint16_t sampleRate)
+{
+	const uint64_t cyclesPerSample = F_CPU / sampleRate;
+	setAnalogInput(channel, [cyclesPerSample](uint64_t cycle) -> uint16_t {
+		return ((cycle / cyclesPerSample) * 4) & 0x3ff;
+	});
+}
+
+
+/// Count the recorded samples in the capture region which do not follow the ramp.
+///
+uint32_t countRampErrors(uint32_t sampleCount)
+{
+	const uint8_t *samples = sdCardEmulator.image() + (imageUInt32(34) + 1) * 512;
+	uint32_t errorCount = 0;
+	for (uint32_t i = 1; i < sampleCount; ++i) {
+		if (static_cast<uint8_t>(samples[i] - samples[i - 1]) != 1) {
+			++errorCount;
+		}
+	}
+	return errorCount;
+}
+
+
+/// Record and check the header in the capture region.
+///
+void record(uint16_t sampleRate, uint32_t sampleCount)
+{
+	if (!CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady)) {
+		return;
+	}
+	CHECK(audioRecorder.record(channel, sampleRate, sampleCount));
+	const uint32_t expectedCount = (sampleCount + 511) / 512 * 512;
+	CHECK_EQUAL(audioRecorder.recordedSampleCount(), expectedCount);
+	const AudioRecorder::CaptureHeader *header = reinterpret_cast<const AudioRecorder::CaptureHeader*>(
+		sdCardEmulator.image() + imageUInt32(34) * 512);
+	CHECK(memcmp(header->magic, "LRCP", 4) == 0);
+	CHECK_EQUAL(header->sampleCount, expectedCount);
+	CHECK_EQUAL(header->droppedSampleCount, audioRecorder.droppedSampleCount());
+	CHECK_EQUAL(header->sampleRate, sampleRate);
+	CHECK_EQUAL(header->channel, channel);
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+
+	section("Record at 8kHz");
+	setRampInput(8000);
+	runBoot([]{
+		record(8000, 8000);
+		CHECK_EQUAL(audioRecorder.droppedSampleCount(), 0);
+		CHECK_EQUAL(countRampErrors(audioRecorder.recordedSampleCount()), 0);
+	});
+
+	section("Record at 22.05kHz");
+	setRampInput(22050);
+	runBoot([]{
+		record(22050, 22050);
+		CHECK_EQUAL(audioRecorder.droppedSampleCount(), 0);
+		CHECK_EQUAL(countRampErrors(audioRecorder.recordedSampleCount()), 0);
+	});
+
+	section("Busy times of a slow card");
+	sdCardEmulator.setLatency(SDCardEmulator::slowCard);
+	setRampInput(8000);
+	runBoot([]{
+		// The usual busy time is bridged by the buffer, only the spikes drop samples.
+		record(8000, 40 * 512);
+		CHECK(audioRecorder.droppedSampleCount() > 0);
+		// The busy time of the spike is measured from the next chunk, 4ms after the block.
+		CHECK(audioRecorder.longestBusyTime() >= 140);
+		CHECK_EQUAL(countRampErrors(audioRecorder.recordedSampleCount()), 1);
+	});
+	sdCardEmulator.setLatency(SDCardEmulator::fastCard);
+	return testResult();
+}
+
+
@@ -0,0 +1,139 @@
+//
+// CrcTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Reads blocks with a wrong CRC from the emulated card, with the CRC
+// verification of SDCARD_VERIFY_CRC.
+//
+#include "DacEmulator.h"
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "AudioPlayer.h"
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// Read a number of blocks with readFast4().
+///
+/// @return The status at the end of the read.
+///
+SDCard::Status readBlocks(uint32_t startBlock, uint32_t blockCount)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	SDCard::Status status;
+	while ((status = sdCard.startMultiRead(startBlock)) == SDCard::StatusWait) {
+	}
+	if (status != SDCard::StatusReady) {
+		return status;
+	}
+	sdCard.startFastRead();
+	uint8_t buffer[4];
+	uint32_t readCount = 0;
+	while (readCount < blockCount * 128) {
+		status = sdCard.readFast4(buffer);
+		if (status == SDCard::StatusReady) {
+			++readCount;
+		} else if (status == SDCard::StatusError) {
+			break;
+		}
+	}
+	sdCard.stopRead();
+	return status;
+}
+
+
+/// Read one block with readData().
+///
+SDCard::Status readBlock(uint32_t block)
+{
+	SPISession session(SPIBus::SDCardDevice);
+	SDCard::Status status;
+	while ((status = sdCard.startRead(block)) == SDCard::StatusWait) {
+	}
+	if (status != SDCard::StatusReady) {
+		return status;
+	}
+	uint8_t buffer[100];
+	do {
+		uint16_t byteCount = sizeof(buffer);
+		status = sdCard.readData(buffer, &byteCount);
+	} while (status == SDCard::StatusReady || status == SDCard::StatusWait);
+	sdCard.stopRead();
+	return status;
+}
+
+
+}
+
+
+int main()
+{
+	section("Read blocks with correct CRC");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v2.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		CHECK_EQUAL(readBlocks(entry->startBlock, 100), SDCard::StatusReady);
+		CHECK_EQUAL(readBlock(entry->startBlock), SDCard::StatusEndOfBlock);
+		CHECK_EQUAL(sdCard.crcErrorCount(), 0);
+	});
+
+	section("Streamed read of a block with a wrong CRC");
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v2.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		sdCardEmulator.corruptBlockCrc(entry->startBlock + 50);
+		CHECK_EQUAL(readBlocks(entry->startBlock, 100), SDCard::StatusError);
+		CHECK_EQUAL(sdCard.error(), SDCard::Error_CrcMismatch);
+		CHECK_EQUAL(sdCard.crcErrorCount(), 1);
+		// The error is only counted once, the next read of the block succeeds.
+		CHECK_EQUAL(readBlocks(entry->startBlock, 100), SDCard::StatusReady);
+		CHECK_EQUAL(sdCard.crcErrorCount(), 1);
+	});
+
+	section("Single block read with a wrong CRC");
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v0.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		sdCardEmulator.corruptBlockCrc(entry->startBlock);
+		CHECK_EQUAL(readBlock(entry->startBlock), SDCard::StatusError);
+		CHECK_EQUAL(sdCard.error(), SDCard::Error_CrcMismatch);
+		CHECK_EQUAL(sdCard.crcErrorCount(), 1);
+	});
+
+	section("Playback stops at a block with a wrong CRC");
+	runBoot([]{
+		CHECK(audioPlayer.initialize());
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v5.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		sdCardEmulator.corruptBlockCrc(entry->startBlock + 10);
+		dacEmulator.clear();
+		CHECK(!audioPlayer.play("v5.snd"));
+		CHECK_EQUAL(sdCard.crcErrorCount(), 1);
+		// About ten blocks of samples are played, not the whole file.
+		CHECK(dacEmulator.commandCount() < 20 * 256);
+	});
+	return testResult();
+}
+
+
@@ -0,0 +1,171 @@
+//
+// EventLogTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Writes the event log to the emulated card, and recovers it after a power
+// loss while a block is written.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "EventLog.h"
+#include "SDCard.h"
+
+#include <string>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// An output which collects the text in a string.
+///
+class StringPrint : public Print
+{
+public:
+	size_t write(uint8_t value) override { text.push_back(static_cast<char>(value)); return 1; }
+	using Print::write;
+
+public:
+	std::string text;
+};
+
+
+/// Get a little endian 32 bit value from the image.
+///
+uint32_t imageUInt32(size_t offset)
+{
+	const uint8_t *data = sdCardEmulator.image() + offset;
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+
+/// Get the sequence number of a block in the event log region, 0 for a block without magic.
+///
+uint32_t blockSequence(uint32_t blockIndex)
+{
+	const size_t offset = (imageUInt32(26) + blockIndex) * 512;
+	if (memcmp(sdCardEmulator.image() + offset, "LRLG", 4) != 0) {
+		return 0;
+	}
+	return imageUInt32(offset + 4);
+}
+
+
+/// Count the lines in the text which contain the given string.
+///
+int countLines(const std::string &text, const std::string &part)
+{
+	int count = 0;
+	for (size_t position = text.find(part); position != std::string::npos; position = text.find(part, position + 1)) {
+		++count;
+	}
+	return count;
+}
+
+
+/// Initialize the card and the event log.
+///
+bool initializeLog()
+{
+	return sdCard.initialize() == SDCard::StatusReady && eventLog.initialize();
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	const uint32_t regionBlockCount = imageUInt32(30);
+	CHECK_EQUAL(regionBlockCount, 16);
+
+	section("Write events");
+	runBoot([]{
+		if (!CHECK(initializeLog())) {
+			return;
+		}
+		eventLog.add(EventLog::Boot, 0, 10);
+		eventLog.add(EventLog::Alarm, 2, 20);
+		CHECK(!eventLog.isFlushPending());
+		eventLog.requestFlush();
+		CHECK(eventLog.isFlushPending());
+		CHECK(eventLog.flush());
+		CHECK(!eventLog.isFlushPending());
+	});
+	CHECK_EQUAL(blockSequence(0), 1);
+	CHECK_EQUAL(blockSequence(1), 0);
+
+	section("Power loss while a block is written");
+	runBoot([]{
+		if (!CHECK(initializeLog())) {
+			return;
+		}
+		for (uint16_t i = 0; i < 4; ++i) {
+			eventLog.add(EventLog::Error, 100 + i, 30 + i);
+		}
+		// The header and a part of the first event reach the card.
+		sdCardEmulator.cutPowerWhileWriting(0, 16);
+		eventLog.requestFlush();
+		CHECK(!eventLog.flush());
+		CHECK(eventLog.isFlushPending());
+	});
+	CHECK(memcmp(sdCardEmulator.image() + (imageUInt32(26) + 1) * 512, "LRLG", 4) == 0);
+
+	section("Recover after the power loss");
+	runBoot([]{
+		if (!CHECK(initializeLog())) {
+			return;
+		}
+		StringPrint output;
+		eventLog.printEvents(output);
+		CHECK_EQUAL(countLines(output.text, " Boot "), 1);
+		CHECK_EQUAL(countLines(output.text, " Alarm "), 1);
+		CHECK_EQUAL(countLines(output.text, " Error "), 0);
+		// The partial block is overwritten with the next sequence number.
+		eventLog.add(EventLog::Boot, 0, 10);
+		eventLog.requestFlush();
+		CHECK(eventLog.flush());
+	});
+	CHECK_EQUAL(blockSequence(1), 2);
+
+	section("Continue after the last block in the ring");
+	for (uint32_t round = 0; round < 2; ++round) {
+		runBoot([]{
+			if (!CHECK(initializeLog())) {
+				return;
+			}
+			for (uint8_t i = 0; i < 10; ++i) {
+				eventLog.add(EventLog::AlarmEnd, i, 1000 + i);
+				eventLog.requestFlush();
+				CHECK(eventLog.flush());
+			}
+		});
+	}
+	// 22 blocks were written into 16 blocks.
+	for (uint32_t i = 0; i < regionBlockCount; ++i) {
+		CHECK_EQUAL(blockSequence(i), (i < 6) ? 17 + i : 1 + i);
+	}
+	runBoot([regionBlockCount]{
+		if (!CHECK(initializeLog())) {
+			return;
+		}
+		StringPrint output;
+		sdCardEmulator.resetCounters();
+		eventLog.printEvents(output);
+		// Each block is read once.
+		CHECK_EQUAL(sdCardEmulator.counters().blocksRead, regionBlockCount);
+		CHECK_EQUAL(countLines(output.text, " AlarmEnd "), 16);
+		// The oldest block is printed first, it has the fifth event of the first round.
+		CHECK(output.text.compare(0, 16, "1004 AlarmEnd 4\r") == 0);
+	});
+	return testResult();
+}
+
+
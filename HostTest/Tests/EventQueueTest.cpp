@@ -0,0 +1,133 @@
+//
+// EventQueueTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Pushes events from the ADC interrupt of the emulated MCU, and pops them
+// in a loop which never disables the interrupts. The loop waits a random
+// time between the calls, so the interrupts arrive at any point between
+// them. Checks that no event is lost or reordered, and that a full queue
+// only drops the new events.
+//
+#include "Test.h"
+
+#include "AnalogSampler.h"
+#include "EventQueue.h"
+
+#include <random>
+#include <vector>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The time in ms of one period of the input in the fault test.
+///
+const uint32_t faultPeriod = 1000;
+
+/// The time in ms the input reads 0 at the start of each period.
+///
+const uint32_t faultLength = 300;
+
+/// The number of periods of the fault test.
+///
+const uint32_t faultPeriodCount = 10;
+
+/// The number of events pushed by the conversion handler.
+///
+volatile uint32_t pushCount = 0;
+
+
+/// A conversion handler, which pushes one event with a sequence number for each conversion.
+///
+void pushConversion()
+{
+	eventQueue.push(EventQueue::PlaybackDone, 0, 0, pushCount);
+	++pushCount;
+}
+
+
+}
+
+
+int main()
+{
+	section("Input faults from the ADC interrupt");
+	setAnalogInput(0, [](uint64_t cycle) -> uint16_t {
+		const uint64_t ms = cycle / (F_CPU / 1000);
+		return ((ms % faultPeriod) < faultLength) ? 0 : 100;
+	});
+	runBoot([]{
+		std::mt19937 random(1);
+		std::uniform_int_distribution<uint32_t> waitCycles(0, 3 * F_CPU / 1000);
+		analogSampler.begin(_BV(0));
+		std::vector<EventQueue::Event> events;
+		while (millis() < faultPeriod * faultPeriodCount) {
+			EventQueue::Event event;
+			while (eventQueue.pop(event)) {
+				events.push_back(event);
+			}
+			wait(waitCycles(random));
+		}
+		// The first fault starts with the start of the MCU.
+		CHECK_EQUAL(events.size(), 2 * faultPeriodCount);
+		CHECK_EQUAL(eventQueue.overflowCount(), 0);
+		bool isInOrder = true;
+		for (size_t i = 0; i < events.size(); ++i) {
+			const EventQueue::Event &event = events[i];
+			const uint32_t periodStart = (i / 2) * faultPeriod;
+			const bool isFault = (i % 2) == 0;
+			// A fault after faultSampleCount samples, one each 1.024ms, the end with the next sample.
+			const uint32_t expectedTime = periodStart + (isFault ? AnalogSampler::faultSampleCount : faultLength);
+			if (event.type != EventQueue::InputFault || event.value != 0 || event.parameter != (isFault ? 1 : 0) ||
+				event.time + 2 < expectedTime || event.time > expectedTime + 5) {
+				isInOrder = false;
+			}
+		}
+		CHECK(isInOrder);
+	});
+
+	section("A slow loop with an event at each conversion");
+	runBoot([]{
+		std::mt19937 random(2);
+		std::uniform_int_distribution<uint32_t> waitCycles(0, 15 * F_CPU / 1000);
+		analogSampler.begin(_BV(0));
+		analogSampler.setConversionHandler(&pushConversion);
+		std::vector<unsigned long> sequence;
+		while (millis() < 5000) {
+			wait(waitCycles(random));
+			EventQueue::Event event;
+			while (eventQueue.pop(event)) {
+				sequence.push_back(event.time);
+			}
+		}
+		analogSampler.setConversionHandler(0);
+		// The indexes wrap around a few times.
+		CHECK(pushCount > 1000);
+		CHECK(eventQueue.overflowCount() > 0);
+		CHECK_EQUAL(sequence.size() + eventQueue.overflowCount() + eventQueue.depth(), pushCount);
+		CHECK_EQUAL(eventQueue.maximumDepth(), EventQueue::size);
+		bool isIncreasing = true;
+		for (size_t i = 1; i < sequence.size(); ++i) {
+			if (sequence[i] <= sequence[i - 1]) {
+				isIncreasing = false;
+			}
+		}
+		CHECK(isIncreasing);
+		// A full queue keeps the oldest events, the first ones are never dropped.
+		bool isStartComplete = sequence.size() >= EventQueue::size;
+		for (uint8_t i = 0; isStartComplete && i < EventQueue::size; ++i) {
+			isStartComplete = (sequence[i] == i);
+		}
+		CHECK(isStartComplete);
+	});
+	return testResult();
+}
+
+
+
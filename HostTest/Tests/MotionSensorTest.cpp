@@ -0,0 +1,88 @@
+//
+// MotionSensorTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Runs the motion sensor with a constant input, which steps up and down by
+// a few ADC steps below the threshold. After each step, the baseline has to
+// settle within half a step of the input and stay there, from below and
+// from above.
+//
+#include "Test.h"
+
+#include "MotionSensor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The interval of the loop calls in ms, like in the sketch.
+///
+const uint16_t loopInterval = 10;
+
+/// The time in ms of each constant input.
+///
+const uint32_t stepLength = 120000;
+
+/// The time in ms until the baseline settled after a step.
+///
+const uint32_t settleTime = 100000;
+
+/// The constant inputs, one after the other.
+///
+const uint16_t inputs[] = {100, 110, 95};
+
+/// The number of inputs.
+///
+const uint8_t inputCount = sizeof(inputs) / sizeof(inputs[0]);
+
+
+/// Call the loop of the sensor until the given time.
+///
+void runUntil(MotionSensor &motionSensor, uint32_t endTime)
+{
+	while (millis() < endTime) {
+		wait(static_cast<uint64_t>(loopInterval) * F_CPU / 1000);
+		motionSensor.loop(millis());
+	}
+}
+
+
+}
+
+
+int main()
+{
+	setAnalogInput(0, [](uint64_t cycle) -> uint16_t {
+		const uint64_t ms = cycle / (F_CPU / 1000);
+		return inputs[std::min<uint64_t>(ms / stepLength, inputCount - 1)];
+	});
+
+	section("The baseline settles on a constant input");
+	runBoot([]{
+		MotionSensor motionSensor;
+		CHECK(motionSensor.addSensor(0, 200, 0));
+		motionSensor.setup();
+		for (uint8_t i = 0; i < inputCount; ++i) {
+			runUntil(motionSensor, i * stepLength + settleTime);
+			const uint16_t baseline = motionSensor.baseline(0);
+			const int32_t error = static_cast<int32_t>(baseline) - (static_cast<int32_t>(inputs[i]) << MotionSensor::baselineFraction);
+			CHECK(std::abs(error) <= (1 << (MotionSensor::baselineFraction - 1)));
+			runUntil(motionSensor, (i + 1) * stepLength);
+			CHECK_EQUAL(motionSensor.baseline(0), baseline);
+			CHECK_EQUAL(motionSensor.status(), MotionSensor::Idle);
+		}
+	});
+	return testResult();
+}
+
+
+
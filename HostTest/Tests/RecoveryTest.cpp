@@ -0,0 +1,127 @@
+//
+// RecoveryTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Runs the sketch on the virtual clock, and swaps the card while the unit
+// is idle. The next alarm fails on the new card, which is recovered with
+// its own directory, voices and event log. The alarms after the recovery
+// play again. A voice which is not on the card is skipped, without an
+// error of the card.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "EventLog.h"
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+void setup();
+void loop();
+
+extern uint8_t nextVoiceInZone[];
+
+
+namespace {
+
+
+/// The time in ms until the sensor is idle, at most.
+///
+const uint32_t idleTimeout = 30000;
+
+/// The start of the periods of motion in ms.
+///
+const uint32_t motionStarts[] = {40000, 80000, 120000};
+
+/// The length of a period of motion in ms.
+///
+const uint32_t motionLength = 3000;
+
+/// The time in ms when the test ends.
+///
+const uint32_t endTime = 160000;
+
+
+/// Count the lines of the serial output which start with the given text.
+///
+uint32_t countLines(const std::string &start)
+{
+	const std::string &output = serialOutput();
+	uint32_t count = 0;
+	for (size_t position = output.find(start); position != std::string::npos; position = output.find(start, position + 1)) {
+		if (position == 0 || output[position - 1] == '\n') {
+			++count;
+		}
+	}
+	return count;
+}
+
+
+}
+
+
+int main()
+{
+	section("Swap the card while the unit is idle");
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	sdCardEmulator.setSerialNumber(0x1234);
+	setAnalogInput(0, [](uint64_t cycle) -> uint16_t {
+		const uint64_t ms = cycle / (F_CPU / 1000);
+		for (uint32_t start : motionStarts) {
+			if (ms >= start && ms < start + motionLength) {
+				return 500;
+			}
+		}
+		return 100;
+	});
+	runBoot([]{
+		setup();
+		while (countLines("Sensor is in idle state.") == 0 && millis() < idleTimeout) {
+			loop();
+		}
+		CHECK(millis() < motionStarts[0]);
+		// Another card with a playlist and without an event log.
+		sdCardEmulator.loadImage(dataPath("hcdi2list.img"));
+		sdCardEmulator.setSerialNumber(0x9abc);
+		sdCardEmulator.powerCycle();
+		while (millis() < endTime) {
+			loop();
+		}
+		CHECK_EQUAL(countLines("Error on play."), 1);
+		CHECK_EQUAL(countLines("Another card was inserted."), 1);
+		CHECK_EQUAL(countLines("Voices from playlist: 3"), 1);
+		CHECK_EQUAL(countLines("Recovered from the error."), 1);
+		CHECK_EQUAL(countLines("Recovery failed."), 0);
+		// Only an idle unit plays the alarm.
+		CHECK_EQUAL(countLines("Sensor alarm in zone 0"), 3);
+		CHECK(sdCard.isCardChanged());
+		// The region of the previous card must not be written on the new card.
+		CHECK(!eventLog.isAvailable());
+	});
+
+	section("Skip a voice which is not on the card");
+	// The third voice has too many fragments, it is not in the directory.
+	sdCardEmulator.loadImage(dataPath("fat.img"));
+	runBoot([]{
+		setup();
+		while (millis() < endTime) {
+			loop();
+		}
+		CHECK_EQUAL(countLines("Voice not found: v2.snd"), 1);
+		CHECK_EQUAL(countLines("Voice not found"), 1);
+		CHECK_EQUAL(countLines("Sensor alarm in zone 0"), 3);
+		CHECK_EQUAL(countLines("Error on play."), 0);
+		CHECK_EQUAL(countLines("No voice for the alarm."), 0);
+		// The voices 0, 1 and 3 were played.
+		CHECK_EQUAL(nextVoiceInZone[0], 4);
+	});
+	return testResult();
+}
+
+
+
@@ -0,0 +1,155 @@
+//
+// ReplayTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Reads the dump of a sensor trace, and replays a trace through the motion
+// sensor and the logic of the sketch on the virtual clock. With HOST_TRACE
+// set to the file of a dump, this trace is replayed too ("make replay").
+//
+#include "SDCardEmulator.h"
+#include "SensorReplay.h"
+#include "Test.h"
+
+#include "SensorTrace.h"
+
+#include <chrono>
+#include <cstdlib>
+
+
+using namespace host;
+using namespace lr;
+
+
+void setup();
+void loop();
+
+
+namespace {
+
+
+/// The length of the replayed trace in seconds.
+///
+const uint32_t replaySeconds = 3600;
+
+/// The start of the periods of motion in the replayed trace, in seconds.
+///
+const uint32_t motionStarts[] = {60, 200, 1000, 1010, 2400};
+
+/// The length of a period of motion in seconds.
+///
+const uint32_t motionSeconds = 3;
+
+
+/// Collects printed text in a string.
+///
+class StringPrint : public Print
+{
+public:
+	size_t write(uint8_t value) override { text += static_cast<char>(value); return 1; }
+
+	std::string text;
+};
+
+
+/// Count the lines of the serial output which start with the given text.
+///
+uint32_t countLines(const std::string &start)
+{
+	const std::string &output = serialOutput();
+	uint32_t count = 0;
+	for (size_t position = output.find(start); position != std::string::npos; position = output.find(start, position + 1)) {
+		if (position == 0 || output[position - 1] == '\n') {
+			++count;
+		}
+	}
+	return count;
+}
+
+
+}
+
+
+int main()
+{
+	section("Read the dump of a trace");
+	{
+		SensorTrace trace;
+		std::vector<uint16_t> values;
+		for (uint16_t i = 0; i < 120; ++i) {
+			// Runs, small steps and large jumps.
+			const uint16_t value = (i % 20 == 10) ? 900 : (100 + (i / 4) * 3);
+			values.push_back(value);
+			trace.add(5000 + i * SensorTrace::sampleInterval, value);
+		}
+		StringPrint dump;
+		dump.println("> t");
+		trace.print(dump);
+		dump.println("Sensor is in idle state.");
+		SensorReplay replay;
+		CHECK(replay.parse(dump.text) > 0);
+		// The ring may have dropped the oldest samples, the others are the last ones.
+		const uint32_t sampleCount = replay.endTime() / SensorTrace::sampleInterval;
+		CHECK(sampleCount > 60);
+		CHECK(sampleCount <= values.size());
+		bool isEqual = true;
+		for (uint32_t i = 0; i < sampleCount; ++i) {
+			const size_t index = values.size() - sampleCount + i;
+			if (replay.valueAt(i * SensorTrace::sampleInterval) != values[index]) {
+				isEqual = false;
+			}
+		}
+		CHECK(isEqual);
+	}
+
+	section("Replay a trace through the sketch");
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	runBoot([]{
+		SensorReplay replay;
+		for (uint32_t time = 0; time < replaySeconds * 1000; time += SensorTrace::sampleInterval) {
+			// The idle output wanders by a few steps.
+			uint16_t value = 100 + (time / 7000) % 5;
+			for (uint32_t start : motionStarts) {
+				if (time >= start * 1000 && time < (start + motionSeconds) * 1000) {
+					value += 400;
+				}
+			}
+			replay.add(time, value);
+		}
+		replay.connect(0, cycle());
+		const auto startTime = std::chrono::steady_clock::now();
+		setup();
+		while (millis() < replay.endTime()) {
+			loop();
+		}
+		const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startTime;
+		printf("   Replayed %u s in %.2f s.\n", replaySeconds, duration.count());
+		// The motion 10s after another one is in the idle time of the sensor.
+		CHECK_EQUAL(countLines("Sensor alarm in zone 0"), 4);
+		CHECK_EQUAL(countLines("Error"), 0);
+		// The end of each alarm is written to the event log after the alarm.
+		CHECK(sdCardEmulator.counters().blocksWritten >= 4);
+	});
+
+	const char *tracePath = getenv("HOST_TRACE");
+	if (tracePath != 0) {
+		section("Replay the dumped trace");
+		SensorReplay replay;
+		if (CHECK(replay.load(tracePath) > 0)) {
+			runBoot([&replay]{
+				replay.connect(0, cycle());
+				setSerialEcho(true);
+				setup();
+				while (millis() < replay.endTime()) {
+					loop();
+				}
+				printf("   Replayed %u s, %u alarms.\n", replay.endTime() / 1000, countLines("Sensor alarm in zone"));
+			});
+		}
+	}
+	return testResult();
+}
+
+
+
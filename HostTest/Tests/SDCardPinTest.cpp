@@ -0,0 +1,37 @@
+//
+// SDCardPinTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Uses the SD-Card library with the chip select on pin 9, defined with
+// SDCARD_CSPINNUM, SDCARD_CSPORT and SDCARD_CSPIN.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "SDCard.h"
+
+
+using namespace host;
+using namespace lr;
+
+
+int main()
+{
+	section("Chip select on pin 9");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	sdCardEmulator.setChipSelect(PORTB, PINB1);
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK(sdCard.findFile("v0.snd") != 0);
+		CHECK((DDRB.value & _BV(PINB1)) != 0);
+	});
+
+	section("No response on the default pin");
+	sdCardEmulator.setChipSelect(PORTB, PINB2);
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusError);
+	});
+	return testResult();
+}
@@ -0,0 +1,324 @@
+//
+// SDCardTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Reads the generated disk images with the SD-Card library from the
+// emulated card, with the delays of a fast and of a slow card.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "SDCard.h"
+
+#include <vector>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// Check if the data is the ramp of a generated sound file.
+///
+bool isRamp(const std::vector<uint8_t> &data)
+{
+	for (size_t i = 0; i < data.size(); ++i) {
+		const uint16_t sample = static_cast<uint16_t>((i / 2) * 16);
+		if (data[i] != static_cast<uint8_t>((i & 1) ? (sample >> 8) : sample)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/// Read a whole file with readFast4(), following its extents.
+///
+std::vector<uint8_t> readFile(const SDCard::DirectoryEntry *entry)
+{
+	std::vector<uint8_t> data;
+	SPISession session(SPIBus::SDCardDevice);
+	SDCard::Extent extent = {entry->startBlock, (entry->fileSize + 511) / 512};
+	const SDCard::Extent *extents = (entry->extentCount > 0) ? entry->extents : &extent;
+	SDCard::Status status;
+	const uint16_t extentCount = (entry->extentCount > 0) ? entry->extentCount : 1;
+	while ((status = sdCard.startMultiRead(extents, extentCount)) == SDCard::StatusWait) {
+	}
+	if (status != SDCard::StatusReady) {
+		return data;
+	}
+	sdCard.startFastRead();
+	uint8_t buffer[4];
+	while (data.size() < entry->fileSize) {
+		status = sdCard.readFast4(buffer);
+		if (status == SDCard::StatusReady) {
+			data.insert(data.end(), buffer, buffer + 4);
+		} else if (status == SDCard::StatusError) {
+			break;
+		}
+	}
+	sdCard.stopRead();
+	data.resize(std::min<size_t>(data.size(), entry->fileSize));
+	return data;
+}
+
+
+/// Check all sound files of the image on the initialized card.
+///
+void checkFiles()
+{
+	CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+	const uint32_t expectedSizes[] = {5000, 7000, 153618, 2000, 3000, 40000};
+	char name[] = "v0.snd";
+	for (uint8_t i = 0; i < 6; ++i) {
+		name[1] = '0' + i;
+		const SDCard::DirectoryEntry *entry = sdCard.findFile(name);
+		if (!CHECK(entry != 0)) {
+			continue;
+		}
+		CHECK_EQUAL(entry->fileSize, expectedSizes[i]);
+		const std::vector<uint8_t> data = readFile(entry);
+		CHECK_EQUAL(data.size(), expectedSizes[i]);
+		CHECK(isRamp(data));
+	}
+	CHECK(sdCard.findFile("x.snd") == 0);
+	CHECK_EQUAL(sdCardEmulator.counters().unexpectedStops, 0);
+	CHECK_EQUAL(sdCardEmulator.counters().bitErrors, 0);
+}
+
+
+/// Initialize the card, and check all sound files of the image.
+///
+void checkSoundFiles()
+{
+	CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+	checkFiles();
+}
+
+
+}
+
+
+int main()
+{
+	section("Initialize the card");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK(sdCard.isHighSpeed());
+		CHECK_EQUAL(sdCard.clockSpeed(), 8000000);
+		CHECK(sdCard.cardIdentity() != 0);
+		CHECK_EQUAL(sdCardEmulator.commandCount(0), 1);
+		CHECK_EQUAL(sdCardEmulator.commandCount(41), 3);
+	});
+
+	section("Card without high speed mode");
+	sdCardEmulator.setHighSpeedSupport(false);
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK(!sdCard.isHighSpeed());
+	});
+	sdCardEmulator.setHighSpeedSupport(true);
+
+	section("Version 1 directory");
+	runBoot([]{
+		checkSoundFiles();
+		CHECK(sdCard.findFile("a1.txt") != 0);
+	});
+
+	section("Read a single block with readData()");
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v0.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		SDCard::Status status;
+		while ((status = sdCard.startRead(entry->startBlock)) == SDCard::StatusWait) {
+		}
+		CHECK_EQUAL(status, SDCard::StatusReady);
+		std::vector<uint8_t> data;
+		uint8_t buffer[100];
+		do {
+			uint16_t byteCount = sizeof(buffer);
+			status = sdCard.readData(buffer, &byteCount);
+			if (status == SDCard::StatusReady || status == SDCard::StatusEndOfBlock) {
+				data.insert(data.end(), buffer, buffer + byteCount);
+			}
+		} while (status == SDCard::StatusReady || status == SDCard::StatusWait);
+		CHECK_EQUAL(status, SDCard::StatusEndOfBlock);
+		CHECK_EQUAL(data.size(), 512);
+		CHECK(isRamp(data));
+		CHECK_EQUAL(sdCard.stopRead(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCardEmulator.counters().unexpectedStops, 0);
+	});
+
+	section("Reinitialize after a fault");
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v2.snd");
+		if (!CHECK(entry != 0)) {
+			return;
+		}
+		// Without an active read, no stop command is sent.
+		checkFiles();
+		sdCardEmulator.resetCounters();
+		const uint32_t transactionCount = statistics().spiTransactionCount;
+		CHECK_EQUAL(sdCard.reinitialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCardEmulator.commandCount(12), 0);
+		CHECK_EQUAL(sdCardEmulator.commandCount(0), 0);
+		CHECK_EQUAL(statistics().spiTransactionCount - transactionCount, 1);
+		CHECK_EQUAL(spiBus.owner(), SPIBus::NoDevice);
+		// An interrupted multi block read is stopped, and the card stays initialized.
+		{
+			SPISession session(SPIBus::SDCardDevice);
+			SDCard::Status status;
+			while ((status = sdCard.startMultiRead(entry->startBlock)) == SDCard::StatusWait) {
+			}
+			CHECK_EQUAL(status, SDCard::StatusReady);
+			sdCard.startFastRead();
+			uint8_t buffer[4];
+			for (uint16_t i = 0; i < 300; ) {
+				if (sdCard.readFast4(buffer) == SDCard::StatusReady) {
+					++i;
+				}
+			}
+			CHECK_EQUAL(sdCard.reinitialize(), SDCard::StatusReady);
+			CHECK_EQUAL(spiBus.owner(), SPIBus::SDCardDevice);
+		}
+		CHECK_EQUAL(sdCardEmulator.commandCount(12), 1);
+		CHECK_EQUAL(sdCardEmulator.commandCount(0), 0);
+		CHECK_EQUAL(sdCardEmulator.counters().unexpectedStops, 0);
+		checkFiles();
+		// A card which stops responding in a read is initialized again.
+		sdCardEmulator.resetCounters();
+		sdCardEmulator.failAfterBlocks(2, 5000);
+		{
+			SPISession session(SPIBus::SDCardDevice);
+			SDCard::Status status;
+			while ((status = sdCard.startMultiRead(entry->startBlock)) == SDCard::StatusWait) {
+			}
+			CHECK_EQUAL(status, SDCard::StatusReady);
+			sdCard.startFastRead();
+			uint8_t buffer[4];
+			uint32_t readCount = 0;
+			for (const unsigned long startTime = millis(); millis() - startTime < 20; ) {
+				if (sdCard.readFast4(buffer) == SDCard::StatusReady) {
+					++readCount;
+				}
+			}
+			CHECK_EQUAL(readCount, 2 * 128);
+		}
+		CHECK_EQUAL(sdCard.reinitialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCardEmulator.commandCount(0), 1);
+		sdCardEmulator.resetCounters();
+		checkFiles();
+	});
+
+	section("Version 2 directory");
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	runBoot([]{
+		checkSoundFiles();
+	});
+
+	section("FAT32 file system with a partition");
+	sdCardEmulator.loadImage(dataPath("fatmbr.img"));
+	runBoot([]{
+		checkSoundFiles();
+	});
+
+	section("FAT32 file system with fragmented, truncated and empty files");
+	sdCardEmulator.loadImage(dataPath("fat.img"));
+	runBoot([]{
+		CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+		CHECK_EQUAL(sdCard.readDirectory(), SDCard::StatusReady);
+		// Each cluster of the fragmented file is an extent.
+		const SDCard::DirectoryEntry *entry = sdCard.findFile("v1.snd");
+		if (CHECK(entry != 0)) {
+			CHECK_EQUAL(entry->extentCount, 14);
+			const std::vector<uint8_t> data = readFile(entry);
+			CHECK_EQUAL(data.size(), 7000);
+			CHECK(isRamp(data));
+		}
+		// Stop right after the first extent, while the response to its stop command is pending.
+		sdCardEmulator.setLatency(SDCardEmulator::slowCard);
+		if (CHECK(entry != 0)) {
+			SPISession session(SPIBus::SDCardDevice);
+			while (sdCard.startMultiRead(entry->extents, entry->extentCount) == SDCard::StatusWait) {
+			}
+			sdCard.startFastRead();
+			uint8_t buffer[4];
+			for (uint8_t i = 0; i < 128;) {
+				if (sdCard.readFast4(buffer) == SDCard::StatusReady) {
+					++i;
+				}
+			}
+			CHECK_EQUAL(sdCard.readFast4(buffer), SDCard::StatusWait);
+			CHECK_EQUAL(sdCard.stopRead(), SDCard::StatusReady);
+			// The next command must not reach the card while it is busy with the stop.
+			SDCard::Status status;
+			while ((status = sdCard.startRead(0)) == SDCard::StatusWait) {
+			}
+			CHECK_EQUAL(status, SDCard::StatusReady);
+			CHECK_EQUAL(sdCard.stopRead(), SDCard::StatusReady);
+			CHECK_EQUAL(sdCardEmulator.counters().busyCommands, 0);
+		}
+		sdCardEmulator.setLatency(SDCardEmulator::fastCard);
+		// The 301 extents of this file are more than the limit, and more than 255.
+		CHECK(sdCard.findFile("v2.snd") == 0);
+		// The chain ends after two of the four clusters, the size is limited to the chain.
+		entry = sdCard.findFile("v3.snd");
+		if (CHECK(entry != 0)) {
+			CHECK_EQUAL(entry->fileSize, 1024);
+			CHECK_EQUAL(entry->extentCount, 0);
+			const std::vector<uint8_t> data = readFile(entry);
+			CHECK_EQUAL(data.size(), 1024);
+			CHECK(isRamp(data));
+		}
+		// An empty file has no clusters.
+		CHECK(sdCard.findFile("e.snd") == 0);
+		entry = sdCard.findFile("v5.snd");
+		if (CHECK(entry != 0)) {
+			CHECK_EQUAL(entry->fileSize, 40000);
+			CHECK(isRamp(readFile(entry)));
+		}
+		CHECK_EQUAL(sdCardEmulator.counters().unexpectedStops, 0);
+	});
+
+	section("Slow card");
+	sdCardEmulator.loadImage(dataPath("hcdi1.img"));
+	sdCardEmulator.setLatency(SDCardEmulator::slowCard);
+	runBoot([]{
+		checkSoundFiles();
+		// Each block start of the slow card needs more polls than on the fast card.
+		uint32_t slowStarts = 0;
+		for (uint8_t bucket = 4; bucket < SDCard::latencyBucketCount; ++bucket) {
+			slowStarts += sdCard.latencyCount(SDCard::LatencyBlockStart, bucket);
+		}
+		CHECK(slowStarts > 0);
+		CHECK(sdCard.latencyCount(SDCard::LatencyStopRead, 0) < sdCardEmulator.commandCount(12));
+	});
+	sdCardEmulator.setLatency(SDCardEmulator::fastCard);
+
+	section("Calibrate the clock of cards which fail above a limit");
+	const uint32_t maximumClocks[] = {4000000, 2000000, 1000000, 500000};
+	const uint32_t expectedClocks[] = {4000000, 2000000, 1000000, 250000};
+	for (uint8_t i = 0; i < 4; ++i) {
+		sdCardEmulator.setMaximumClock(maximumClocks[i]);
+		const uint32_t expectedClock = expectedClocks[i];
+		runBoot([expectedClock]{
+			CHECK_EQUAL(sdCard.initialize(), SDCard::StatusReady);
+			CHECK_EQUAL(sdCard.clockSpeed(), expectedClock);
+			// The calibration reads with bit errors, but the files are read without.
+			CHECK(sdCardEmulator.counters().bitErrors > 0);
+			sdCardEmulator.resetCounters();
+			checkFiles();
+		});
+	}
+	sdCardEmulator.setMaximumClock(0);
+	return testResult();
+}
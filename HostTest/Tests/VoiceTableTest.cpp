@@ -0,0 +1,270 @@
+//
+// VoiceTableTest
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+//
+// Resolves the voices on the emulated card, and loads them from the cache
+// in the EEPROM at the next boot. A warm boot must not read the directory,
+// and a swapped card must not use the cache or the regions of the old card.
+// An edited playlist must not use the cache either, and the skipped names
+// of a playlist are reported. Missing voices are reported and not available.
+//
+#include "SDCardEmulator.h"
+#include "Test.h"
+
+#include "AudioPlayer.h"
+#include "Crc16.h"
+#include "EventLog.h"
+#include "SDCard.h"
+#include "VoiceTable.h"
+
+#include <cstring>
+#include <string>
+
+
+using namespace host;
+using namespace lr;
+
+
+namespace {
+
+
+/// The default voices of the test.
+///
+const char* const voiceFileNames[] = {"v0.snd", "v1.snd", "v3.snd", "v4.snd"};
+
+/// The number of default voices.
+///
+const uint8_t voiceCount = sizeof(voiceFileNames) / sizeof(const char*);
+
+
+/// Collects printed text in a string.
+///
+class StringPrint : public Print
+{
+public:
+	size_t write(uint8_t value) override { text += static_cast<char>(value); return 1; }
+
+	std::string text;
+};
+
+
+/// Set a little endian 32 bit value in the header of the image, and update the CRC16 of the header.
+///
+void setHeaderUInt32(size_t offset, uint32_t value)
+{
+	uint8_t *data = sdCardEmulator.image();
+	for (uint8_t i = 0; i < 4; ++i) {
+		data[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+	}
+	const uint16_t crc = crc16Update(0, data, 42);
+	data[42] = static_cast<uint8_t>(crc);
+	data[43] = static_cast<uint8_t>(crc >> 8);
+}
+
+
+/// Replace the playlist in the image, padded with line breaks to the size of the old one.
+///
+/// Call this in a boot, the image is kept for the next boots.
+///
+void writePlaylist(const std::string &text)
+{
+	if (!CHECK(sdCard.initialize() == SDCard::StatusReady)) {
+		return;
+	}
+	const SDCard::DirectoryEntry *entry = sdCard.findFile("voices.txt");
+	if (!CHECK(entry != 0) || !CHECK(text.size() <= entry->fileSize)) {
+		return;
+	}
+	uint8_t *data = sdCardEmulator.image() + entry->startBlock * 512;
+	memset(data, '\n', entry->fileSize);
+	memcpy(data, text.data(), text.size());
+}
+
+
+/// Initialize the card and the voice table from the playlist.
+///
+/// @param isFromCache If the table is expected from the cache.
+/// @param count The expected number of voices.
+/// @param issues The expected problems of the playlist.
+///
+void initializePlaylist(bool isFromCache, uint8_t count, uint8_t issues)
+{
+	if (!CHECK(sdCard.initialize() == SDCard::StatusReady)) {
+		return;
+	}
+	CHECK(voiceTable.initialize(voiceFileNames, voiceCount));
+	CHECK_EQUAL(voiceTable.isFromCache(), isFromCache);
+	CHECK(voiceTable.isFromPlaylist());
+	CHECK_EQUAL(voiceTable.voiceCount(), count);
+	CHECK_EQUAL(voiceTable.playlistIssues(), issues);
+}
+
+
+/// Initialize the card and the voice table.
+///
+/// @param isFromCache If the table is expected from the cache.
+///
+void initializeVoices(bool isFromCache)
+{
+	if (!CHECK(sdCard.initialize() == SDCard::StatusReady)) {
+		return;
+	}
+	CHECK(voiceTable.initialize(voiceFileNames, voiceCount));
+	CHECK_EQUAL(voiceTable.isFromCache(), isFromCache);
+	CHECK(!voiceTable.isFromPlaylist());
+	CHECK_EQUAL(voiceTable.voiceCount(), voiceCount);
+}
+
+
+}
+
+
+int main()
+{
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	sdCardEmulator.setSerialNumber(0x1234);
+
+	section("Resolve the voices at the first boot");
+	runBoot([]{
+		initializeVoices(false);
+	});
+
+	section("Warm boot without reading the directory");
+	runBoot([]{
+		initializeVoices(true);
+		// Only block 0 for the checksum, block 0 for the regions and the log blocks are read.
+		sdCardEmulator.resetCounters();
+		CHECK(voiceTable.initialize(voiceFileNames, voiceCount));
+		CHECK(voiceTable.isFromCache());
+		CHECK(eventLog.initialize());
+		CHECK_EQUAL(sdCard.eventLogRegion().blockCount, 16);
+		CHECK_EQUAL(sdCard.captureRegion().blockCount, 512);
+		CHECK_EQUAL(sdCardEmulator.counters().blocksRead, 2 + 16);
+		CHECK_EQUAL(sdCardEmulator.commandCount(18), 0);
+		CHECK(voiceTable.play(0));
+	});
+
+	section("Another card with the same directory");
+	sdCardEmulator.setSerialNumber(0x5678);
+	runBoot([]{
+		initializeVoices(false);
+	});
+	runBoot([]{
+		initializeVoices(true);
+	});
+
+	section("Swap the card while running");
+	const uint32_t logCount = sdCardEmulator.image()[30];
+	runBoot([logCount]{
+		initializeVoices(true);
+		CHECK_EQUAL(sdCard.eventLogRegion().blockCount, logCount);
+		// The new card has a smaller event log, which changes block 0.
+		sdCardEmulator.setSerialNumber(0x9abc);
+		setHeaderUInt32(30, logCount / 2);
+		sdCardEmulator.powerCycle();
+		CHECK(sdCard.reinitialize() == SDCard::StatusReady);
+		CHECK(sdCard.isCardChanged());
+		CHECK_EQUAL(sdCard.eventLogRegion().blockCount, logCount / 2);
+		// The voices are resolved again for the new card.
+		CHECK(voiceTable.initialize(voiceFileNames, voiceCount));
+		CHECK(!voiceTable.isFromCache());
+		CHECK(voiceTable.play(0));
+		CHECK(sdCard.reinitialize() == SDCard::StatusReady);
+		CHECK(!sdCard.isCardChanged());
+	});
+	runBoot([logCount]{
+		initializeVoices(false);
+		CHECK_EQUAL(sdCard.eventLogRegion().blockCount, logCount / 2);
+	});
+
+	section("Voices from the playlist");
+	sdCardEmulator.loadImage(dataPath("hcdi2list.img"));
+	runBoot([]{
+		initializePlaylist(false, 3, 0);
+	});
+	runBoot([]{
+		initializePlaylist(true, 3, 0);
+	});
+
+	section("Edit the playlist without changing its size");
+	runBoot([]{
+		writePlaylist("v3.snd\nv4.snd\n");
+	});
+	runBoot([]{
+		initializePlaylist(false, 2, 0);
+	});
+	runBoot([]{
+		initializePlaylist(true, 2, 0);
+	});
+
+	section("Edit the playlist after its first block");
+	runBoot([]{
+		writePlaylist(std::string(600, '#') + "\nv5.snd\n");
+	});
+	runBoot([]{
+		initializePlaylist(false, 1, 0);
+	});
+	runBoot([]{
+		writePlaylist(std::string(600, '#') + "\nv4.snd\nv3.snd\n");
+	});
+	runBoot([]{
+		initializePlaylist(false, 2, 0);
+	});
+	runBoot([]{
+		initializePlaylist(true, 2, 0);
+	});
+
+	section("Report the skipped names of the playlist");
+	runBoot([]{
+		writePlaylist("v0.snd\n  v1.snd \t\nv0.snd-is-too-long.snd\nv 0.snd\n"
+			"v2.snd\nv3.snd\nv4.snd\nv5.snd\nv0.snd\nv1.snd");
+	});
+	runBoot([]{
+		const uint8_t issues = VoiceTable::PlaylistNameTooLong | VoiceTable::PlaylistTooManyNames |
+			VoiceTable::PlaylistNameNotFound;
+		// The name with a blank inside is not on the card, and removed from the table.
+		initializePlaylist(false, VoiceTable::maximumVoiceCount - 1, issues);
+		StringPrint output;
+		voiceTable.printMissingVoices(output);
+		CHECK(output.text == "Voice not found: v 0.snd\r\n");
+		// The blanks around a name are removed.
+		bool isAvailable = true;
+		for (uint8_t i = 0; i < voiceTable.voiceCount(); ++i) {
+			isAvailable = isAvailable && voiceTable.isAvailable(i);
+		}
+		CHECK(isAvailable);
+		CHECK(voiceTable.prepare(1));
+		audioPlayer.cancel();
+	});
+	runBoot([]{
+		const uint8_t issues = VoiceTable::PlaylistNameTooLong | VoiceTable::PlaylistTooManyNames |
+			VoiceTable::PlaylistNameNotFound;
+		initializePlaylist(true, VoiceTable::maximumVoiceCount - 1, issues);
+		StringPrint output;
+		voiceTable.printMissingVoices(output);
+		CHECK(output.text == "Voice not found: v 0.snd\r\n");
+	});
+
+	section("Keep the index of a missing default voice");
+	sdCardEmulator.loadImage(dataPath("hcdi2.img"));
+	runBoot([]{
+		const char* const fileNames[] = {"v0.snd", "x.snd", "v1.snd"};
+		CHECK(sdCard.initialize() == SDCard::StatusReady);
+		CHECK(voiceTable.initialize(fileNames, 3));
+		CHECK_EQUAL(voiceTable.voiceCount(), 3);
+		CHECK(voiceTable.isAvailable(0));
+		CHECK(!voiceTable.isAvailable(1));
+		CHECK(voiceTable.isAvailable(2));
+		// Playing the missing voice fails without an error of the card.
+		CHECK(!voiceTable.play(1));
+		CHECK_EQUAL(sdCard.error(), SDCard::NoError);
+		StringPrint output;
+		voiceTable.printMissingVoices(output);
+		CHECK(output.text == "Voice not found: x.snd\r\n");
+	});
+	return testResult();
+}
+
+
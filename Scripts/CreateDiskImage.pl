@@ -40,6 +40,17 @@ use File::Spec;
 #
 #   CreateDiskImage.pl -i example -o example_image.bin
 #
+# For large sound banks use the hashed directory (version 2), which has no
+# size limit and is never loaded into the RAM of the microcontroller:
+#
+#   CreateDiskImage.pl -i example -o example_image.bin --hashed
+#
+# The sample rate and gain stored for each file in the hashed directory can
+# be set with the --sample-rate and --gain options. To reserve blocks for
+# the event log of the device, use the --log-blocks option, for example
+# --log-blocks 128 to reserve 64kB. To reserve blocks for audio recordings
+# of the device, use the --capture-blocks option, for example
+# --capture-blocks 2048 to reserve 1MB.
 # It will convert the directory with all the files into the disk image 
 # called "example_image.bin". 
 #
@@ -75,23 +86,123 @@ use File::Spec;
 #   Rest of block filled with 0x00 bytes.
 # Block 1... - Files. Last Block always filled with 0x00 bytes.
 #
+# Format Version 2 (--hashed)
+# ---------------------------------------------------------------------------
+#
+# Block 0 - Header:
+#   4 Bytes Identifier: 0x48, 0x43, 0x44, 0x49 = "HCDI"
+#   4 Bytes 0x00 = Empty version 1 directory.
+#   2 Bytes version = 2 Little-Endian.
+#   2 Bytes number of index blocks Little-Endian.
+#   4 Bytes first index block Little-Endian.
+#   4 Bytes first record block Little-Endian.
+#   4 Bytes number of records Little-Endian.
+#   2 Bytes CRC16-CCITT of all index and record blocks Little-Endian.
+#     This identifies the directory, the device does not verify it.
+#   4 Bytes first event log block Little-Endian.
+#   4 Bytes number of event log blocks Little-Endian. 0 = No event log.
+#   4 Bytes first capture block Little-Endian.
+#   4 Bytes number of capture blocks Little-Endian. 0 = No capture region.
+#   2 Bytes CRC16-CCITT of the header bytes before it Little-Endian.
+#   Rest of block filled with 0x00 bytes.
+# Index Blocks - 63 slots per block:
+#   4 Bytes FNV-1a hash of the file name Little-Endian.
+#   4 Bytes record number Little-Endian. 0xffffffff = Unused slot.
+#   The index block for a name is: first index block + (hash % index blocks)
+#   Unused slots are always at the end of the block.
+#   2 Bytes CRC16-CCITT of the slots Little-Endian, after the last slot.
+#   6 Bytes 0x00.
+# Record Blocks - 16 records per block:
+#   4 Bytes start block Little-Endian.
+#   4 Bytes file size in bytes Little-Endian.
+#   2 Bytes sample rate in Hz Little-Endian.
+#   2 Bytes CRC16-CCITT of the file data Little-Endian.
+#   1 Byte format. 0 = 16bit unsigned Little-Endian mono.
+#   1 Byte gain in 1/16 steps. 16 = 1.0
+#   2 Bytes CRC16-CCITT of the other 30 bytes of the record Little-Endian.
+#   16 Bytes file name in ASCII format, padded with 0x00 bytes.
+#   The device only verifies the index block and the record of each lookup.
+# Event Log Blocks - Filled with 0x00 bytes, written by the device.
+# Capture Blocks - Filled with 0x00 bytes, written by the device.
+# Blocks... - Files. Last Block always filled with 0x00 bytes.
+#
 
 # Configuration
 # ---------------------------------------------------------------------------
 my $confMagic = "HCDI";
 my $confBlockSize = 512;
+my $confSlotsPerIndexBlock = 63;
+my $confRecordsPerBlock = 16;
+my $confMaximumNameLength = 16;
 
 # Options
 # ---------------------------------------------------------------------------
 my $optInputDirectory;
 my $optOutput;
+my $optHashed = 0;
+my $optSampleRate = 22050;
+my $optGain = 16;
+my $optLogBlocks = 0;
+my $optCaptureBlocks = 0;
+
+# Functions
+# ---------------------------------------------------------------------------
+
+# The table for the CRC16-CCITT (polynomial 0x1021, initial value 0x0000)
+my @crcTable = ();
+for my $i (0..255) {
+	my $crc = $i << 8;
+	for (1..8) {
+		$crc = ($crc & 0x8000) ? (($crc << 1) ^ 0x1021) : ($crc << 1);
+	}
+	push(@crcTable, $crc & 0xffff);
+}
+
+# Update a CRC16-CCITT with the given data.
+sub crc16 {
+	my ($crc, $data) = @_;
+	foreach my $byte (unpack("C*", $data)) {
+		$crc = (($crc << 8) & 0xffff) ^ $crcTable[(($crc >> 8) ^ $byte) & 0xff];
+	}
+	return $crc;
+}
+
+# Calculate the FNV-1a hash for a file name.
+sub fileNameHash {
+	my ($name) = @_;
+	my $hash = 2166136261;
+	foreach my $byte (unpack("C*", $name)) {
+		$hash ^= $byte;
+		$hash = ($hash * 16777619) & 0xffffffff;
+	}
+	return $hash;
+}
 
 # Main
 # ---------------------------------------------------------------------------
 GetOptions( "input|i=s" => \$optInputDirectory,
-			"output|o=s" => \$optOutput,)
+			"output|o=s" => \$optOutput,
+			"hashed" => \$optHashed,
+			"sample-rate=i" => \$optSampleRate,
+			"gain=i" => \$optGain,
+			"log-blocks=i" => \$optLogBlocks,
+			"capture-blocks=i" => \$optCaptureBlocks,)
 	or die( "Error reading commands line parameters.");
 
+# The limits of the timer and the play loop in the audio player.
+if ($optSampleRate < 245 || $optSampleRate > 22050) {
+	die("The sample rate has to be between 245 and 22050 Hz.");
+}
+if ($optGain < 0 || $optGain > 255) {
+	die("The gain has to be between 0 and 255.");
+}
+if ($optLogBlocks > 0 && !$optHashed) {
+	die("The event log requires the hashed directory (--hashed).");
+}
+if ($optCaptureBlocks > 0 && !$optHashed) {
+	die("The capture region requires the hashed directory (--hashed).");
+}
+
 print "  Create Disk Image\n";
 print "-" x 78 . "\n";
 
@@ -102,7 +213,6 @@ my $inputDirectory = IO::Dir->new($optInputDirectory)
 # Read all files from it.
 my $file;
 my @files = ();
-my $nextBlock = 1;
 while (defined($file = $inputDirectory->read)) {
 	next if $file =~ /^\.{1,2}$/; # Skip . and ..
 	my $filePath = File::Spec->catfile($optInputDirectory, $file);
@@ -112,11 +222,10 @@ while (defined($file = $inputDirectory->read)) {
 	if ($fileSize < 1) {
 		die("Found file with size < 1 byte.");
 	}
-	my $fileStartBlock = $nextBlock;
-	print "File \"$file\" size=$fileSize bytes startBlock=$fileStartBlock\n";
-	push(@files, {"name"=>$file, "size"=>$fileSize, "startBlock"=>$fileStartBlock});
-	# Search for the next block.
-	$nextBlock += ($fileSize / 512) + 1;
+	if ($optHashed && length($file) > $confMaximumNameLength) {
+		die("The file name \"$file\" is longer than $confMaximumNameLength bytes.");
+	}
+	push(@files, {"name"=>$file, "size"=>$fileSize});
 }
 undef $inputDirectory;
 
@@ -125,6 +234,63 @@ if (@files < 1) {
 	die("There are no files to write into the image.");
 }
 
+# Build the hash index for the version 2 directory.
+my @indexBlocks = ();
+my $indexBlockCount = 0;
+my $recordBlockCount = 0;
+if ($optHashed) {
+	# Start with a fill rate of 50% and increase the number of index blocks
+	# until every hash fits into its block. This guarantees a lookup never
+	# needs more than one index block read.
+	$indexBlockCount = int((@files * 2 + $confSlotsPerIndexBlock - 1) / $confSlotsPerIndexBlock);
+	$indexBlockCount = 1 if $indexBlockCount < 1;
+	for (;;) {
+		die("Too many files for the hash index.") if $indexBlockCount > 0xffff;
+		@indexBlocks = map { [] } (1..$indexBlockCount);
+		my $fits = 1;
+		for my $recordIndex (0..$#files) {
+			my $hash = fileNameHash($files[$recordIndex]->{"name"});
+			my $slots = $indexBlocks[$hash % $indexBlockCount];
+			if (@$slots >= $confSlotsPerIndexBlock) {
+				$fits = 0;
+				last;
+			}
+			push(@$slots, [$hash, $recordIndex]);
+		}
+		last if $fits;
+		++$indexBlockCount;
+	}
+	$recordBlockCount = int((@files + $confRecordsPerBlock - 1) / $confRecordsPerBlock);
+	my $maximumFill = 0;
+	my $usedBlocks = 0;
+	foreach my $slots (@indexBlocks) {
+		$maximumFill = @$slots if @$slots > $maximumFill;
+		++$usedBlocks if @$slots > 0;
+	}
+	print "Hash index: $indexBlockCount index blocks, $recordBlockCount record blocks.\n";
+	printf("Hash index fill: maximum %d/%d slots, average %.1f slots per used block.\n",
+		$maximumFill, $confSlotsPerIndexBlock, @files / ($usedBlocks || 1));
+	print "Every lookup needs one index block read and one record block read.\n";
+}
+
+# Assign the start blocks.
+my $logStartBlock = 1 + $indexBlockCount + $recordBlockCount;
+my $captureStartBlock = $logStartBlock + $optLogBlocks;
+my $nextBlock = $captureStartBlock + $optCaptureBlocks;
+if ($optLogBlocks > 0) {
+	print "Event log: $optLogBlocks blocks, startBlock=$logStartBlock\n";
+}
+if ($optCaptureBlocks > 0) {
+	print "Capture region: $optCaptureBlocks blocks, startBlock=$captureStartBlock\n";
+}
+foreach my $fileEntry (@files) {
+	my $fileSize = $fileEntry->{"size"};
+	$fileEntry->{"startBlock"} = $nextBlock;
+	print "File \"" . $fileEntry->{"name"} . "\" size=$fileSize bytes startBlock=$nextBlock\n";
+	# Search for the next block.
+	$nextBlock += int($fileSize / 512) + 1;
+}
+
 # Build the image
 print "Writing disk image...\n";
 my $outFile = IO::File->new($optOutput, ">:raw") or 
@@ -132,19 +298,63 @@ my $outFile = IO::File->new($optOutput, ">:raw") or
 
 # Start with the magic.
 $outFile->print($confMagic);
-# write all file entries.
-foreach my $fileEntry (@files) {
-	my $fileName = $fileEntry->{"name"};
-	my $fileSize = $fileEntry->{"size"};
-	my $startBlock = $fileEntry->{"startBlock"};
-	$outFile->print(pack("VVCA*", $startBlock, $fileSize, length($fileName), $fileName));
-}
-# Add at least 4 zero bytes.
-$outFile->print(pack("V", 0));
+if ($optHashed) {
+	# Create the index and record blocks.
+	my $tables = "";
+	foreach my $slots (@indexBlocks) {
+		my $block = "";
+		foreach my $slot (@$slots) {
+			$block .= pack("VV", $slot->[0], $slot->[1]);
+		}
+		while (length($block) < $confSlotsPerIndexBlock * 8) {
+			$block .= pack("VV", 0, 0xffffffff);
+		}
+		$tables .= $block . pack("vx6", crc16(0, $block));
+	}
+	my $records = "";
+	foreach my $fileEntry (@files) {
+		my $filePath = File::Spec->catfile($optInputDirectory, $fileEntry->{"name"});
+		my $inFile = IO::File->new($filePath, "<:raw")
+			or die("Could not open input file " . $fileEntry->{"name"} . " for reading.");
+		my $crc = 0;
+		my $buffer;
+		while ($inFile->read($buffer, 4096) > 0) {
+			$crc = crc16($crc, $buffer);
+		}
+		$inFile->close();
+		my $record = pack("VVvvCC", $fileEntry->{"startBlock"}, $fileEntry->{"size"},
+			$optSampleRate, $crc, 0, $optGain);
+		my $name = pack("a16", $fileEntry->{"name"});
+		$records .= $record . pack("v", crc16(0, $record . $name)) . $name;
+	}
+	while ((length($records) % $confBlockSize) != 0) {
+		$records .= pack("x");
+	}
+	$tables .= $records;
+	# Write the header, starting with an empty version 1 directory.
+	my $header = $confMagic . pack("VvvVVVvVVVV", 0, 2, $indexBlockCount, 1, 1 + $indexBlockCount,
+		scalar(@files), crc16(0, $tables), ($optLogBlocks > 0 ? $logStartBlock : 0), $optLogBlocks,
+		($optCaptureBlocks > 0 ? $captureStartBlock : 0), $optCaptureBlocks);
+	$outFile->print(substr($header, 4) . pack("v", crc16(0, $header)));
+	while (($outFile->tell % $confBlockSize) != 0) {
+		$outFile->print(pack("x"));
+	}
+	$outFile->print($tables);
+} else {
+	# write all file entries.
+	foreach my $fileEntry (@files) {
+		my $fileName = $fileEntry->{"name"};
+		my $fileSize = $fileEntry->{"size"};
+		my $startBlock = $fileEntry->{"startBlock"};
+		$outFile->print(pack("VVCA*", $startBlock, $fileSize, length($fileName), $fileName));
+	}
+	# Add at least 4 zero bytes.
+	$outFile->print(pack("V", 0));
 
-# Check the size of the header.
-if ($outFile->tell > $confBlockSize) {
-	die("Header is too large. Header is " . $outFile->getpos . ", but block size is " . $confBlockSize);
+	# Check the size of the header.
+	if ($outFile->tell > $confBlockSize) {
+		die("Header is too large. Header is " . $outFile->tell . ", but block size is " . $confBlockSize);
+	}
 }
 
 # Copy all files.
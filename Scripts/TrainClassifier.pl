@@ -0,0 +1,161 @@
+#!/usr/bin/perl
+#
+# Train the Alarm Classifier
+# ===========================================================================
+# (c)2014 by Lucky Resistor. http://luckyresistor.me
+# Licensed under the MIT license. See file LICENSE for details.
+#
+
+use strict;
+use warnings;
+
+# Small perl script to train the weights of the alarm classifier in the
+# MotionSensor class, from alarms recorded with the serial console.
+#
+# Enable MOTIONSENSOR_CLASSIFIER, and copy the "class" lines printed for
+# each alarm into a text file. Append the label "cat" or "other" to each
+# line, e.g.:
+#
+#   class 52 18 140 1 0 cat
+#   class 31 4 37 5 0 other
+#
+# All other lines are ignored. The script trains a logistic regression and
+# writes the weights as header file. Cats are weighted higher than other
+# alarms, because a missed cat is worse than a false alarm.
+#
+# Usage:
+#   TrainClassifier.pl Alarms.txt ClassifierWeights.h [cat weight]
+#
+
+my ($inputFile, $outputFile, $catWeight) = @ARGV;
+
+if (!defined $inputFile || !defined $outputFile) {
+	die( "Usage: TrainClassifier.pl <input file> <output file> [cat weight]\n" );
+}
+$catWeight = 4 if (!defined $catWeight);
+
+my $featureCount = 4;
+my $iterations = 20000;
+my $learningRate = 0.1;
+
+# Read the labeled samples.
+my @samples;
+open(my $in, '<', $inputFile) or die( "Could not open \"$inputFile\"." );
+while (my $line = <$in>) {
+	next if ($line !~ /^class\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)\s+-?\d+\s+(cat|other)\s*$/);
+	push(@samples, { features => [$1, $2, $3, $4], isCat => ($5 eq 'cat') ? 1 : 0 });
+}
+close($in);
+if (!@samples) {
+	die( "No labeled samples found in \"$inputFile\"." );
+}
+
+# Scale the features to 0-1 for the training.
+my @scale = (1) x $featureCount;
+foreach my $sample (@samples) {
+	for my $f (0..$featureCount-1) {
+		$scale[$f] = $sample->{features}[$f] if ($sample->{features}[$f] > $scale[$f]);
+	}
+}
+
+# Train with gradient descent.
+my @weights = (0) x ($featureCount + 1);
+my $totalWeight = 0;
+foreach my $sample (@samples) {
+	$totalWeight += $sample->{isCat} ? $catWeight : 1;
+}
+for (my $iteration = 0; $iteration < $iterations; ++$iteration) {
+	my @gradient = (0) x ($featureCount + 1);
+	foreach my $sample (@samples) {
+		my $error = (probability(\@weights, $sample) - $sample->{isCat}) * ($sample->{isCat} ? $catWeight : 1);
+		$gradient[0] += $error;
+		for my $f (0..$featureCount-1) {
+			$gradient[$f+1] += $error * $sample->{features}[$f] / $scale[$f];
+		}
+	}
+	for my $i (0..$featureCount) {
+		$weights[$i] -= $learningRate * $gradient[$i] / $totalWeight;
+	}
+}
+
+# Convert the weights for the unscaled features. Only the sign of the score
+# matters, so the weights are scaled to use the full range of 16 bit.
+my @rawWeights = ($weights[0]);
+for my $f (0..$featureCount-1) {
+	push(@rawWeights, $weights[$f+1] / $scale[$f]);
+}
+my $maximum = 0;
+foreach my $weight (@rawWeights) {
+	$maximum = abs($weight) if (abs($weight) > $maximum);
+}
+my $factor = ($maximum > 0) ? 32767 / $maximum : 0;
+my @intWeights = map { int($_ * $factor + ($_ < 0 ? -0.5 : 0.5)) } @rawWeights;
+
+# Report the result with the integer weights, like on the board.
+my ($catsAccepted, $catsSuppressed, $otherAccepted, $otherSuppressed) = (0, 0, 0, 0);
+foreach my $sample (@samples) {
+	my $score = $intWeights[0];
+	for my $f (0..$featureCount-1) {
+		$score += $intWeights[$f+1] * $sample->{features}[$f];
+	}
+	if ($sample->{isCat}) {
+		($score >= 0) ? ++$catsAccepted : ++$catsSuppressed;
+	} else {
+		($score >= 0) ? ++$otherAccepted : ++$otherSuppressed;
+	}
+}
+print "Samples: " . scalar(@samples) . "\n";
+print "Cats accepted: $catsAccepted suppressed: $catsSuppressed\n";
+print "Others accepted: $otherAccepted suppressed: $otherSuppressed\n";
+print "Weights: " . join(', ', @intWeights) . "\n";
+
+# Write the header file.
+open(my $out, '>', $outputFile) or die( "Could not create \"$outputFile\"." );
+print $out <<"END_HEADER";
+#pragma once
+//
+// ClassifierWeights
+// (c)2014 by Lucky Resistor. http://luckyresistor.me
+// Licensed under the MIT license. See file LICENSE for details.
+//
+
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+
+namespace lr {
+
+
+/// The weights of the alarm classifier in MotionSensor.
+///
+/// The first value is the bias, followed by one weight for each feature,
+/// in the order of MotionSensor::Features. An alarm is reported if the bias
+/// plus the weighted sum of the features is not negative.
+///
+/// Created by TrainClassifier.pl from $catsAccepted/@{[$catsAccepted + $catsSuppressed]} accepted cats
+/// and $otherSuppressed/@{[$otherAccepted + $otherSuppressed]} suppressed other alarms.
+///
+const int16_t classifierWeights[@{[$featureCount + 1]}] PROGMEM = {
+	@{[join(', ', @intWeights)]} };
+
+
+}
+
+
+END_HEADER
+close($out);
+
+# Calculate the probability of a cat for a sample.
+sub probability {
+	my ($weights, $sample) = @_;
+	my $sum = $weights->[0];
+	for my $f (0..$featureCount-1) {
+		$sum += $weights->[$f+1] * $sample->{features}[$f] / $scale[$f];
+	}
+	return 1 / (1 + exp(-$sum));
+}
+
+# ===========================================================================
+# END
+#